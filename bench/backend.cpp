@@ -0,0 +1,318 @@
+/*********************************************************************************
+ * File Name: backend.cpp
+ * Description: 基准测试用的本地服务端：echo模式原样返回收到的数据，sink模式丢弃
+ *              收到的数据，source模式每收到一个固定长度的请求返回固定长度的应答。
+ *              每个线程独立监听(SO_REUSEPORT)并运行自己的事件循环
+ * History:
+ *********************************************************************************/
+
+#include <netinet/tcp.h>
+#include <libgen.h>
+#include <string>
+#include "../src/global.h"
+
+enum MODE
+{
+    MODE_ECHO = 0,
+    MODE_SINK,
+    MODE_SOURCE
+};
+
+static const int BUF_SIZE = 65536;
+
+// 命令行配置
+struct Cconfig
+{
+    Cconfig() : port(2001), threads(1), mode(MODE_ECHO), req_bytes(64), rsp_bytes(64) {}
+
+    char addr[64];
+    int port;
+    int threads;
+    MODE mode;
+    long long req_bytes;            // source模式下每个请求的长度
+    long long rsp_bytes;            // source模式下每个应答的长度
+};
+
+// 一个客户端连接的待发送数据：echo模式为收到的数据，source模式只记录待发送的字节数
+struct Cclient
+{
+    Cclient() : out_off(0), out_left(0), req_seen(0), want_out(false) {}
+
+    std::string out;
+    size_t out_off;
+    long long out_left;
+    long long req_seen;             // source模式下当前请求已经收到的字节数
+    bool want_out;
+};
+
+static Cconfig g_cfg;
+static char g_zero[BUF_SIZE];
+
+static int create_listen()
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+
+    struct sockaddr_in addr;
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(g_cfg.port);
+    inet_pton(AF_INET, g_cfg.addr, &addr.sin_addr);
+    if ((bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) || (listen(fd, SOMAXCONN) < 0))
+    {
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static void set_out(int epollfd, int fd, Cclient* clt, bool want)
+{
+    if (clt->want_out == want)
+    {
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.data.fd = fd;
+    ev.events = want ? EPOLLOUT : EPOLLIN;
+    epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev);
+    clt->want_out = want;
+}
+
+// 发送待发送的数据，连接出错时返回false
+static bool flush_out(int epollfd, int fd, Cclient* clt)
+{
+    while ((clt->out_off < clt->out.size()) || (clt->out_left > 0))
+    {
+        ssize_t n = 0;
+        if (g_cfg.mode == MODE_ECHO)
+        {
+            n = send(fd, clt->out.data() + clt->out_off, clt->out.size() - clt->out_off, 0);
+        }
+        else
+        {
+            n = send(fd, g_zero, (clt->out_left < BUF_SIZE) ? clt->out_left : BUF_SIZE, 0);
+        }
+
+        if (n < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                set_out(epollfd, fd, clt, true);
+                return true;
+            }
+
+            return false;
+        }
+
+        if (g_cfg.mode == MODE_ECHO)
+        {
+            clt->out_off += n;
+        }
+        else
+        {
+            clt->out_left -= n;
+        }
+    }
+
+    clt->out.clear();
+    clt->out_off = 0;
+    set_out(epollfd, fd, clt, false);
+    return true;
+}
+
+/**************************************************************
+ * 函数名称：on_read
+ * 函数功能：读取客户端数据并按模式生成应答。应答发不出去时
+ *          停止读取，只等待写事件，发送完毕后再继续读取
+ * 输入参数：epollfd    事件表
+ *           fd         客户端描述符
+ *           clt        连接状态
+ * 输出参数：无
+ * 返 回 值：连接关闭或出错时返回false
+ **************************************************************/
+static bool on_read(int epollfd, int fd, Cclient* clt)
+{
+    char buf[BUF_SIZE];
+    while (!clt->want_out)
+    {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0)
+        {
+            return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+        }
+        else if (n == 0)
+        {
+            return false;
+        }
+
+        if (g_cfg.mode == MODE_ECHO)
+        {
+            clt->out.append(buf, n);
+            if (!flush_out(epollfd, fd, clt))
+            {
+                return false;
+            }
+        }
+        else if (g_cfg.mode == MODE_SOURCE)
+        {
+            clt->req_seen += n;
+            clt->out_left += clt->req_seen / g_cfg.req_bytes * g_cfg.rsp_bytes;
+            clt->req_seen %= g_cfg.req_bytes;
+            if (!flush_out(epollfd, fd, clt))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void* worker(void*)
+{
+    int listenfd = create_listen();
+    if (listenfd < 0)
+    {
+        printf("listen on %s:%d failed: %s\n", g_cfg.addr, g_cfg.port, strerror(errno));
+        exit(1);
+    }
+
+    int epollfd = epoll_create(1024);
+    struct epoll_event ev;
+    ev.data.fd = listenfd;
+    ev.events = EPOLLIN;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, listenfd, &ev);
+
+    map<int, Cclient*> clients;
+    struct epoll_event events[1024];
+    while (true)
+    {
+        int n = epoll_wait(epollfd, events, 1024, -1);
+        for (int i = 0; i < n; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == listenfd)
+            {
+                int connfd = -1;
+                while ((connfd = accept(listenfd, NULL, NULL)) >= 0)
+                {
+                    fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL) | O_NONBLOCK);
+                    int on = 1;
+                    setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                    ev.data.fd = connfd;
+                    ev.events = EPOLLIN;
+                    epoll_ctl(epollfd, EPOLL_CTL_ADD, connfd, &ev);
+                    clients[connfd] = new Cclient;
+                }
+
+                continue;
+            }
+
+            Cclient* clt = clients[fd];
+            bool ok = true;
+            if (events[i].events & EPOLLOUT)
+            {
+                ok = flush_out(epollfd, fd, clt);
+            }
+
+            if (ok && !clt->want_out && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+            {
+                ok = on_read(epollfd, fd, clt);
+            }
+
+            if (!ok)
+            {
+                close(fd);
+                clients.erase(fd);
+                delete clt;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void usage(const char* prog)
+{
+    printf("usage: %s [-a addr] [-p port] [-t threads] [-m echo|sink|source] [-q req_bytes] [-r rsp_bytes]\n", prog);
+    printf("  -a/-p  listen address and port (default 127.0.0.1:2001)\n");
+    printf("  -t     event loop threads, each with its own SO_REUSEPORT listener (default 1)\n");
+    printf("  -m     echo: send back what is received (default); sink: discard; source: answer requests\n");
+    printf("  -q/-r  source mode: every req_bytes received are answered with rsp_bytes (default 64/64)\n");
+}
+
+int main(int argc, char * argv [ ])
+{
+    strcpy(g_cfg.addr, "127.0.0.1");
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "a:p:t:m:q:r:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'a': snprintf(g_cfg.addr, sizeof(g_cfg.addr), "%s", optarg); break;
+            case 'p': g_cfg.port = atoi(optarg); break;
+            case 't': g_cfg.threads = atoi(optarg); break;
+            case 'q': g_cfg.req_bytes = atoll(optarg); break;
+            case 'r': g_cfg.rsp_bytes = atoll(optarg); break;
+            case 'm':
+            {
+                if (strcmp(optarg, "echo") == 0)
+                {
+                    g_cfg.mode = MODE_ECHO;
+                }
+                else if (strcmp(optarg, "sink") == 0)
+                {
+                    g_cfg.mode = MODE_SINK;
+                }
+                else if (strcmp(optarg, "source") == 0)
+                {
+                    g_cfg.mode = MODE_SOURCE;
+                }
+                else
+                {
+                    printf("bad mode: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+
+            case 'h':
+            default:
+            {
+                usage(basename(argv[0]));
+                return (opt == 'h') ? 0 : 1;
+            }
+        }
+    }
+
+    if ((g_cfg.threads <= 0) || (g_cfg.req_bytes <= 0) || (g_cfg.rsp_bytes < 0))
+    {
+        printf("invalid arguments\n");
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    vector<pthread_t> tids(g_cfg.threads);
+    for (int i = 0; i < g_cfg.threads; i++)
+    {
+        pthread_create(&tids[i], NULL, worker, NULL);
+    }
+
+    for (int i = 0; i < g_cfg.threads; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+
+    return 0;
+}
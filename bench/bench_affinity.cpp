@@ -0,0 +1,256 @@
+/*********************************************************************************
+ * File Name: bench_affinity.cpp
+ * Description: CPU亲和性基准测试。多个转发进程在socketpair之间经由2KB缓冲区
+ *              搬运数据(模拟Conn的转发路径)，在有干扰进程的情况下分别测量
+ *              不绑定CPU和绑定CPU(及本地NUMA内存)时的吞吐量、缓存未命中数
+ *              和CPU迁移次数
+ * History: 
+ *********************************************************************************/
+
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "../src/global.h"
+#include "../src/affinity.h"
+
+// 每个转发进程的测量结果
+struct result
+{
+    long long bytes;                // 转发的字节数
+    long long cache_misses;         // 缓存未命中数，-1表示无法测量
+    long long migrations;           // CPU迁移次数，-1表示无法测量
+};
+
+// 打开当前进程的性能计数器，失败返回-1(例如perf_event_paranoid禁止访问)
+static int open_counter(unsigned int type, unsigned long long config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long read_counter(int fd)
+{
+    long long value = -1;
+    if ((fd < 0) || (read(fd, &value, sizeof(value)) != sizeof(value)))
+    {
+        return -1;
+    }
+
+    return value;
+}
+
+/**************************************************************
+ * 函数名称：relay
+ * 函数功能：转发进程主循环。向"客户端"socketpair写入数据，读到转发缓冲区，
+ *          再写入"服务端"socketpair并读出，直到测试时间结束
+ * 输入参数：int idx            进程编号
+ *          bool pin           是否绑定CPU和本地内存
+ *          int buf_size       转发缓冲区大小
+ *          int seconds        测试时长
+ *          int resfd          写回测量结果的管道
+ * 输出参数：无
+ * 返 回 值：无
+ **************************************************************/
+static void relay(int idx, bool pin, int buf_size, int seconds, int resfd)
+{
+    if (pin)
+    {
+        int cpu = bind_cpu(idx);
+        if (cpu >= 0)
+        {
+            bind_local_mem(cpu);
+        }
+    }
+
+    // 绑定之后再分配缓冲区，使其位于本地节点
+    int clt[2];
+    int srv[2];
+    assert(socketpair(PF_UNIX, SOCK_STREAM, 0, clt) == 0);
+    assert(socketpair(PF_UNIX, SOCK_STREAM, 0, srv) == 0);
+    char* payload = new char[buf_size];
+    char* buf = new char[buf_size];
+    char* sink = new char[buf_size];
+    memset(payload, 'x', buf_size);
+
+    int misses = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    int migrations = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS);
+    if (misses >= 0)
+    {
+        ioctl(misses, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    if (migrations >= 0)
+    {
+        ioctl(migrations, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    struct result res;
+    res.bytes = 0;
+    time_t end = time(NULL) + seconds;
+    while (time(NULL) < end)
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            int n = send(clt[0], payload, buf_size, 0);
+            n = recv(clt[1], buf, n, MSG_WAITALL);
+            n = send(srv[0], buf, n, 0);
+            n = recv(srv[1], sink, n, MSG_WAITALL);
+            res.bytes += n;
+        }
+    }
+
+    res.cache_misses = read_counter(misses);
+    res.migrations = read_counter(migrations);
+    write(resfd, &res, sizeof(res));
+    _exit(0);
+}
+
+// 干扰进程：空转占用CPU，促使调度器迁移未绑定的转发进程
+static void noise()
+{
+    volatile unsigned long counter = 0;
+    while (true)
+    {
+        counter++;
+    }
+}
+
+// 运行一轮测试并打印结果
+static void run_round(const char* name, bool pin, int workers, int noises, int buf_size, int seconds)
+{
+    int pipefd[2];
+    assert(pipe(pipefd) == 0);
+
+    vector<pid_t> noise_pids;
+    for (int i = 0; i < noises; i++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            noise();
+        }
+        noise_pids.push_back(pid);
+    }
+
+    for (int i = 0; i < workers; i++)
+    {
+        if (fork() == 0)
+        {
+            close(pipefd[0]);
+            relay(i, pin, buf_size, seconds, pipefd[1]);
+        }
+    }
+
+    close(pipefd[1]);
+    struct result total;
+    memset(&total, 0, sizeof(total));
+    bool have_misses = true;
+    bool have_migrations = true;
+    struct result res;
+    for (int i = 0; i < workers; i++)
+    {
+        if (read(pipefd[0], &res, sizeof(res)) != sizeof(res))
+        {
+            break;
+        }
+
+        total.bytes += res.bytes;
+        have_misses = have_misses && (res.cache_misses >= 0);
+        have_migrations = have_migrations && (res.migrations >= 0);
+        total.cache_misses += res.cache_misses;
+        total.migrations += res.migrations;
+    }
+    close(pipefd[0]);
+
+    for (size_t i = 0; i < noise_pids.size(); i++)
+    {
+        kill(noise_pids[i], SIGKILL);
+    }
+    while (wait(NULL) > 0)
+    {
+    }
+
+    double mb = total.bytes / (1024.0 * 1024.0);
+    printf("%-10s %10.1f MB/s", name, mb / seconds);
+    if (have_misses && (mb > 0))
+    {
+        printf(" %14.1f misses/MB", total.cache_misses / mb);
+    }
+    else 
+    {
+        printf(" %14s misses/MB", "n/a");
+    }
+
+    if (have_migrations)
+    {
+        printf(" %10lld migrations\n", total.migrations);
+    }
+    else 
+    {
+        printf(" %10s migrations\n", "n/a");
+    }
+}
+
+int main(int argc, char * argv [ ])
+{
+    int workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int noises = workers;
+    int buf_size = 2048;
+    int seconds = 5;
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "w:n:b:s:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'w':
+            {
+                workers = atoi(optarg);
+                break;
+            }
+
+            case 'n':
+            {
+                noises = atoi(optarg);
+                break;
+            }
+
+            case 'b':
+            {
+                buf_size = atoi(optarg);
+                break;
+            }
+
+            case 's':
+            {
+                seconds = atoi(optarg);
+                break;
+            }
+
+            case 'h':
+            default:
+            {
+                printf("usage: %s [-w workers] [-n noise_procs] [-b buf_size] [-s seconds]\n", basename(argv[0]));
+                return (opt == 'h') ? 0 : 1;
+            }
+        }
+    }
+
+    if ((workers <= 0) || (buf_size <= 0) || (seconds <= 0))
+    {
+        printf("invalid arguments\n");
+        return 1;
+    }
+
+    printf("%d relay workers, %d noise procs, %d byte buffer, %ds per round\n", workers, noises, buf_size, seconds);
+    run_round("unpinned", false, workers, noises, buf_size, seconds);
+    run_round("pinned", true, workers, noises, buf_size, seconds);
+    return 0;
+}
+
@@ -0,0 +1,1027 @@
+/*********************************************************************************
+ * File Name: bench_micro.cpp
+ * Description: 热点路径的微基准测试，不需要网络。Conn的读写用socketpair，
+ *              Cmgr到服务端的连接指向本进程内的回环监听套接字；定时器覆盖
+ *              demo中的升序链表、时间轮和时间堆，以及公共定时器接口的四叉堆和
+ *              分层时间轮；另有事件循环读时钟的几种方式。每项测试按google-benchmark
+ *              的方式自动增加迭代次数，直到运行时间超过下限
+ * History:
+ *********************************************************************************/
+
+#include <libgen.h>
+#include <string>
+#include "../src/global.h"
+#include "../src/affinity.h"
+#include "../src/conn.h"
+#include "../src/mgr.h"
+#include "../src/timer.h"
+#include "../src/clock.h"
+
+// demo中的三种定时器都定义了自己的client_data，分别放在各自的名字空间中。
+// global.h和clock.h已经由上面包含，定时器头文件里的#include不会再展开
+namespace lst
+{
+#include "../demo/lst_timer.h"
+}
+
+namespace wheel
+{
+#include "../demo/time_wheel_timer.h"
+}
+
+namespace heap
+{
+#include "../demo/time_heap_timer.h"
+}
+
+static const int BATCH = 64;                // 需要暂停计时的测试每批操作的次数
+static const long long MAX_ITERS = 1LL << 24;
+
+// 一次运行的状态：被测函数执行iters次操作，可以暂停计时来做准备或清理工作
+class Cstate
+{
+public:
+    Cstate(long long arg, long long iters) : m_arg(arg), m_iters(iters), m_bytes(0), m_elapsed(0), m_start(0) {}
+
+public:
+    static long long now_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+    void start() { m_start = now_ns(); }
+    void pause() { m_elapsed += now_ns() - m_start; }
+    void resume() { m_start = now_ns(); }
+    void stop() { pause(); }
+
+public:
+    long long m_arg;                // 测试参数：缓冲区大小、会话数或者定时器数量
+    long long m_iters;
+    long long m_bytes;              // 处理的字节数，不为0时输出吞吐量
+    long long m_elapsed;
+    long long m_start;
+};
+
+typedef void (*BENCH_FUNC)(Cstate& state);
+
+struct Cbench
+{
+    const char* name;
+    BENCH_FUNC func;
+    long long args[8];              // 以0结尾
+};
+
+// 简单的xorshift随机数，避免rand()的锁
+static unsigned long long g_seed = 88172645463325252ULL;
+static unsigned long long next_rand()
+{
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 7;
+    g_seed ^= g_seed << 17;
+    return g_seed;
+}
+
+// 读完描述符中的数据
+static void drain_fd(int fd)
+{
+    char buf[65536];
+    while (recv(fd, buf, sizeof(buf), 0) > 0)
+    {
+    }
+}
+
+/**************************************************************
+ * 函数名称：bench_conn_relay
+ * 函数功能：Conn把客户端数据转发给服务端的吞吐量。每次操作向客户端
+ *          套接字写入arg字节，反复调用read_clt/write_srv直到全部转发，
+ *          大于缓冲区(BUFF_SIZE)的数据分多轮转发
+ **************************************************************/
+static void bench_conn_relay(Cstate& state)
+{
+    int clt[2];
+    int srv[2];
+    socketpair(PF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, clt);
+    socketpair(PF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, srv);
+
+    Conn conn;
+    struct sockaddr_in addr;
+    bzero(&addr, sizeof(addr));
+    conn.init_srv(srv[0], addr);
+    conn.init_clt(clt[0], addr);
+
+    vector<char> data(state.m_arg, 'x');
+    state.start();
+    for (long long i = 0; i < state.m_iters; i++)
+    {
+        long long sent = 0;
+        while (sent < state.m_arg)
+        {
+            ssize_t n = send(clt[1], &data[sent], state.m_arg - sent, 0);
+            sent += (n > 0) ? n : 0;
+            conn.read_clt();
+            conn.write_srv();
+            drain_fd(srv[1]);
+        }
+
+        while (conn.read_clt() == OK)
+        {
+            conn.write_srv();
+            drain_fd(srv[1]);
+        }
+    }
+
+    state.stop();
+    state.m_bytes = state.m_iters * state.m_arg;
+    close(clt[0]);
+    close(clt[1]);
+    close(srv[0]);
+    close(srv[1]);
+}
+
+// 本进程内的回环监听套接字，充当Cmgr的服务端
+class Cloopback
+{
+public:
+    Cloopback()
+    {
+        m_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        struct sockaddr_in addr;
+        bzero(&addr, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        bind(m_fd, (struct sockaddr*)&addr, sizeof(addr));
+        listen(m_fd, SOMAXCONN);
+        socklen_t len = sizeof(addr);
+        getsockname(m_fd, (struct sockaddr*)&addr, &len);
+        m_port = ntohs(addr.sin_port);
+    }
+
+    ~Cloopback()
+    {
+        for (size_t i = 0; i < m_peers.size(); i++)
+        {
+            close(m_peers[i]);
+        }
+
+        close(m_fd);
+    }
+
+    Chost host(int conns) const
+    {
+        Chost srv;
+        strcpy(srv.m_hostname, "127.0.0.1");
+        srv.m_port = m_port;
+        srv.m_conncnt = conns;
+        srv.m_proxy_send = PROXY_NONE;
+        srv.m_proxy_accept = false;
+        return srv;
+    }
+
+    // 接受积压的连接，keep为false时立即关闭
+    void accept_all(bool keep)
+    {
+        int fd = -1;
+        while ((fd = accept4(m_fd, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+        {
+            if (keep)
+            {
+                m_peers.push_back(fd);
+            }
+            else
+            {
+                close(fd);
+            }
+        }
+    }
+
+    void drain_peers()
+    {
+        for (size_t i = 0; i < m_peers.size(); i++)
+        {
+            drain_fd(m_peers[i]);
+        }
+    }
+
+private:
+    int m_fd;
+    int m_port;
+    vector<int> m_peers;
+};
+
+// 建立arg个会话：客户端为socketpair，服务端连接由Cmgr预先连到回环监听套接字
+static void open_sessions(Cmgr& mgr, Cloopback& loop, int count, vector<int>& clts, vector<int>& writers)
+{
+    loop.accept_all(true);
+    struct sockaddr_in addr;
+    bzero(&addr, sizeof(addr));
+    for (int i = 0; i < count; i++)
+    {
+        int pair[2];
+        socketpair(PF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair);
+        Conn* conn = mgr.pick_conn(pair[0]);
+        conn->init_clt(pair[0], addr);
+        clts.push_back(pair[0]);
+        writers.push_back(pair[1]);
+    }
+}
+
+// Cmgr::process的分发和转发开销：arg个会话轮流收到64字节的请求
+static void bench_mgr_process(Cstate& state)
+{
+    Cloopback loop;
+    int epollfd = epoll_create(1024);
+    vector<int> clts;
+    vector<int> writers;
+    {
+        Cmgr mgr(epollfd, loop.host(state.m_arg));
+        open_sessions(mgr, loop, state.m_arg, clts, writers);
+
+        char req[64];
+        memset(req, 'x', sizeof(req));
+        state.start();
+        for (long long i = 0; i < state.m_iters; i++)
+        {
+            int idx = i % state.m_arg;
+            send(writers[idx], req, sizeof(req), 0);
+            mgr.process(clts[idx], READ);
+            mgr.flush_events();
+            if ((idx == state.m_arg - 1) || ((i & 1023) == 1023))
+            {
+                state.pause();
+                loop.drain_peers();
+                state.resume();
+            }
+        }
+
+        state.stop();
+        state.m_bytes = state.m_iters * sizeof(req);
+    }
+
+    for (size_t i = 0; i < writers.size(); i++)
+    {
+        close(writers[i]);
+    }
+
+    close(epollfd);
+}
+
+// 没有数据可读时Cmgr::process的开销：查找会话和一次返回EAGAIN的recv
+static void bench_mgr_process_empty(Cstate& state)
+{
+    Cloopback loop;
+    int epollfd = epoll_create(1024);
+    vector<int> clts;
+    vector<int> writers;
+    {
+        Cmgr mgr(epollfd, loop.host(state.m_arg));
+        open_sessions(mgr, loop, state.m_arg, clts, writers);
+
+        state.start();
+        for (long long i = 0; i < state.m_iters; i++)
+        {
+            mgr.process(clts[i % state.m_arg], READ);
+        }
+
+        state.stop();
+    }
+
+    for (size_t i = 0; i < writers.size(); i++)
+    {
+        close(writers[i]);
+    }
+
+    close(epollfd);
+}
+
+// 会话建立和结束：pick_conn、init_clt、free_conn，以及下一次pick_conn时重建服务端连接
+static void bench_mgr_churn(Cstate& state)
+{
+    Cloopback loop;
+    int epollfd = epoll_create(1024);
+    {
+        Cmgr mgr(epollfd, loop.host(1));
+        struct sockaddr_in addr;
+        bzero(&addr, sizeof(addr));
+
+        state.start();
+        for (long long i = 0; i < state.m_iters; i++)
+        {
+            state.pause();
+            int pair[2];
+            socketpair(PF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair);
+            loop.accept_all(false);
+            state.resume();
+
+            Conn* conn = mgr.pick_conn(pair[0]);
+            conn->init_clt(pair[0], addr);
+            mgr.free_conn(conn);
+
+            state.pause();
+            close(pair[1]);
+            state.resume();
+        }
+
+        state.stop();
+    }
+
+    close(epollfd);
+}
+
+static void lst_noop(lst::client_data*) {}
+static void wheel_noop(wheel::client_data*) {}
+static void heap_noop(heap::client_data*) {}
+static void queue_noop(void*, void*) {}
+
+static const int FAR = 1000000;             // 预先放入的定时器在这么多毫秒之后才到期
+
+static lst::util_timer* new_lst_timer(long long expire)
+{
+    lst::util_timer* timer = new lst::util_timer;
+    timer->expire = expire;
+    timer->cb_func = lst_noop;
+    timer->user_data = NULL;
+    return timer;
+}
+
+// 链表按到期时间从晚到早插入时每次都插在头部，预先放入n个定时器只需要O(n)
+static void fill_lst(lst::sort_timer_lst& timers, vector<lst::util_timer*>& live, long long n, long long base)
+{
+    for (long long i = 0; i < n; i++)
+    {
+        lst::util_timer* timer = new_lst_timer(base + n - i);
+        timers.add_timer(timer);
+        live.push_back(timer);
+    }
+}
+
+// 从live中随机取出一个定时器
+template<typename T>
+static T take_random(vector<T>& live)
+{
+    size_t idx = next_rand() % live.size();
+    T timer = live[idx];
+    live[idx] = live.back();
+    live.pop_back();
+    return timer;
+}
+
+static void bench_lst_add(Cstate& state)
+{
+    lst::sort_timer_lst timers;
+    vector<lst::util_timer*> live;
+    long long base = monotonic_ms() + FAR;
+    fill_lst(timers, live, state.m_arg, base);
+
+    lst::util_timer* added[BATCH];
+    state.start();
+    for (long long i = 0; i < state.m_iters; i += BATCH)
+    {
+        int n = (state.m_iters - i < BATCH) ? (int)(state.m_iters - i) : BATCH;
+        for (int j = 0; j < n; j++)
+        {
+            added[j] = new_lst_timer(base + next_rand() % state.m_arg);
+            timers.add_timer(added[j]);
+        }
+
+        state.pause();
+        for (int j = 0; j < n; j++)
+        {
+            timers.del_timer(added[j]);
+        }
+        state.resume();
+    }
+
+    state.stop();
+}
+
+static void bench_lst_del(Cstate& state)
+{
+    lst::sort_timer_lst timers;
+    vector<lst::util_timer*> live;
+    long long base = monotonic_ms() + FAR;
+    fill_lst(timers, live, state.m_arg, base);
+
+    long long low = base;              // 补充的定时器比所有定时器都早，插在头部
+    state.start();
+    for (long long i = 0; i < state.m_iters; i += BATCH)
+    {
+        int n = (state.m_iters - i < BATCH) ? (int)(state.m_iters - i) : BATCH;
+        for (int j = 0; j < n; j++)
+        {
+            timers.del_timer(take_random(live));
+        }
+
+        state.pause();
+        for (int j = 0; j < n; j++)
+        {
+            lst::util_timer* timer = new_lst_timer(--low);
+            timers.add_timer(timer);
+            live.push_back(timer);
+        }
+        state.resume();
+    }
+
+    state.stop();
+}
+
+// 延长一个随机定时器的到期时间并调整其位置
+static void bench_lst_adjust(Cstate& state)
+{
+    lst::sort_timer_lst timers;
+    vector<lst::util_timer*> live;
+    fill_lst(timers, live, state.m_arg, monotonic_ms() + FAR);
+
+    state.start();
+    for (long long i = 0; i < state.m_iters; i++)
+    {
+        lst::util_timer* timer = live[next_rand() % live.size()];
+        timer->expire += 1 + next_rand() % state.m_arg;
+        timers.adjust_timer(timer);
+    }
+
+    state.stop();
+}
+
+// tick处理已经到期的定时器，每次操作为一个到期的定时器
+static void bench_lst_tick(Cstate& state)
+{
+    lst::sort_timer_lst timers;
+    vector<lst::util_timer*> live;
+    fill_lst(timers, live, state.m_arg, monotonic_ms() + FAR);
+
+    state.start();
+    for (long long i = 0; i < state.m_iters; i += BATCH)
+    {
+        int n = (state.m_iters - i < BATCH) ? (int)(state.m_iters - i) : BATCH;
+        state.pause();
+        long long expired = monotonic_ms() - 1;
+        for (int j = 0; j < n; j++)
+        {
+            timers.add_timer(new_lst_timer(expired));
+        }
+        state.resume();
+
+        timers.tick();
+    }
+
+    state.stop();
+}
+
+static wheel::tw_timer* add_wheel_timer(wheel::time_wheel& timers, int timeout)
+{
+    wheel::tw_timer* timer = timers.add_timer(timeout);
+    timer->cb_func = wheel_noop;
+    timer->user_data = NULL;
+    return timer;
+}
+
+static void fill_wheel(wheel::time_wheel& timers, vector<wheel::tw_timer*>& live, long long n)
+{
+    for (long long i = 0; i < n; i++)
+    {
+        live.push_back(add_wheel_timer(timers, FAR + next_rand() % FAR));
+    }
+}
+
+static void bench_wheel_add(Cstate& state)
+{
+    wheel::time_wheel timers;
+    vector<wheel::tw_timer*> live;
+    fill_wheel(timers, live, state.m_arg);
+
+    wheel::tw_timer* added[BATCH];
+    state.start();
+    for (long long i = 0; i < state.m_iters; i += BATCH)
+    {
+        int n = (state.m_iters - i < BATCH) ? (int)(state.m_iters - i) : BATCH;
+        for (int j = 0; j < n; j++)
+        {
+            added[j] = add_wheel_timer(timers, FAR + next_rand() % FAR);
+        }
+
+        state.pause();
+        for (int j = 0; j < n; j++)
+        {
+            timers.del_timer(added[j]);
+        }
+        state.resume();
+    }
+
+    state.stop();
+}
+
+static void bench_wheel_del(Cstate& state)
+{
+    wheel::time_wheel timers;
+    vector<wheel::tw_timer*> live;
+    fill_wheel(timers, live, state.m_arg);
+
+    state.start();
+    for (long long i = 0; i < state.m_iters; i += BATCH)
+    {
+        int n = (state.m_iters - i < BATCH) ? (int)(state.m_iters - i) : BATCH;
+        for (int j = 0; j < n; j++)
+        {
+            timers.del_timer(take_random(live));
+        }
+
+        state.pause();
+        for (int j = 0; j < n; j++)
+        {
+            live.push_back(add_wheel_timer(timers, FAR + next_rand() % FAR));
+        }
+        state.resume();
+    }
+
+    state.stop();
+}
+
+// 时间轮没有调整操作，用删除加重新添加代替
+static void bench_wheel_adjust(Cstate& state)
+{
+    wheel::time_wheel timers;
+    vector<wheel::tw_timer*> live;
+    fill_wheel(timers, live, state.m_arg);
+
+    state.start();
+    for (long long i = 0; i < state.m_iters; i++)
+    {
+        size_t idx = next_rand() % live.size();
+        timers.del_timer(live[idx]);
+        live[idx] = add_wheel_timer(timers, FAR + next_rand() % FAR);
+    }
+
+    state.stop();
+}
+
+// 一次ticks处理下一个槽：其中新加入的定时器到期，预先放入的定时器只减少圈数
+static void bench_wheel_tick(Cstate& state)
+{
+    wheel::time_wheel timers;
+    vector<wheel::tw_timer*> live;
+    fill_wheel(timers, live, state.m_arg);
+
+    state.start();
+    for (long long i = 0; i < state.m_iters; i += BATCH)
+    {
+        int n = (state.m_iters - i < BATCH) ? (int)(state.m_iters - i) : BATCH;
+        state.pause();
+        for (int j = 0; j < n; j++)
+        {
+            add_wheel_timer(timers, 1);
+        }
+
+        timers.ticks();
+        state.resume();
+
+        timers.ticks();
+    }
+
+    state.stop();
+}
+
+static heap::heap_timer* new_heap_timer(heap::time_heap& timers, int delay)
+{
+    heap::heap_timer* timer = timers.create_timer(delay);
+    timer->cb_func = heap_noop;
+    timer->user_data = NULL;
+    return timer;
+}
+
+static void fill_heap(heap::time_heap& timers, vector<heap::heap_timer*>& live, long long n)
+{
+    for (long long i = 0; i < n; i++)
+    {
+        heap::heap_timer* timer = new_heap_timer(timers, FAR + next_rand() % FAR);
+        timers.add_timer(timer);
+        live.push_back(timer);
+    }
+}
+
+static void bench_heap_add(Cstate& state)
+{
+    heap::time_heap timers(16);
+    vector<heap::heap_timer*> live;
+    fill_heap(timers, live, state.m_arg);
+
+    heap::heap_timer* added[BATCH];
+    state.start();
+    for (long long i = 0; i < state.m_iters; i += BATCH)
+    {
+        int n = (state.m_iters - i < BATCH) ? (int)(state.m_iters - i) : BATCH;
+        for (int j = 0; j < n; j++)
+        {
+            added[j] = new_heap_timer(timers, FAR + next_rand() % FAR);
+            timers.add_timer(added[j]);
+        }
+
+        state.pause();
+        for (int j = 0; j < n; j++)
+        {
+            timers.del_timer(added[j]);
+        }
+        state.resume();
+    }
+
+    state.stop();
+}
+
+static void bench_heap_del(Cstate& state)
+{
+    heap::time_heap timers(16);
+    vector<heap::heap_timer*> live;
+    fill_heap(timers, live, state.m_arg);
+
+    state.start();
+    for (long long i = 0; i < state.m_iters; i += BATCH)
+    {
+        int n = (state.m_iters - i < BATCH) ? (int)(state.m_iters - i) : BATCH;
+        for (int j = 0; j < n; j++)
+        {
+            timers.del_timer(take_random(live));
+        }
+
+        state.pause();
+        for (int j = 0; j < n; j++)
+        {
+            heap::heap_timer* timer = new_heap_timer(timers, FAR + next_rand() % FAR);
+            timers.add_timer(timer);
+            live.push_back(timer);
+        }
+        state.resume();
+    }
+
+    state.stop();
+}
+
+static void bench_heap_adjust(Cstate& state)
+{
+    heap::time_heap timers(16);
+    vector<heap::heap_timer*> live;
+    fill_heap(timers, live, state.m_arg);
+
+    state.start();
+    for (long long i = 0; i < state.m_iters; i++)
+    {
+        timers.adjust_timer(live[next_rand() % live.size()], FAR + next_rand() % FAR);
+    }
+
+    state.stop();
+}
+
+static void bench_heap_tick(Cstate& state)
+{
+    heap::time_heap timers(16);
+    vector<heap::heap_timer*> live;
+    fill_heap(timers, live, state.m_arg);
+
+    state.start();
+    for (long long i = 0; i < state.m_iters; i += BATCH)
+    {
+        int n = (state.m_iters - i < BATCH) ? (int)(state.m_iters - i) : BATCH;
+        state.pause();
+        for (int j = 0; j < n; j++)
+        {
+            timers.add_timer(new_heap_timer(timers, -1));
+        }
+        state.resume();
+
+        timers.tick();
+    }
+
+    state.stop();
+}
+
+// 公共定时器接口的容器：定时器预先分配，到期时间为毫秒，预先放入的定时器在FAR毫秒之后才到期
+static void fill_queue(Ctimer_queue* timers, vector<Ctimer>& pool, long long n, long long now)
+{
+    pool.resize(n + BATCH);
+    for (size_t i = 0; i < pool.size(); i++)
+    {
+        pool[i].init(queue_noop, NULL, NULL);
+    }
+
+    for (long long i = 0; i < n; i++)
+    {
+        timers->add(&pool[i], now + FAR + next_rand() % FAR);
+    }
+}
+
+template<TIMER_TYPE TYPE>
+static void bench_queue_add(Cstate& state)
+{
+    long long now = FAR;
+    Ctimer_queue* timers = Ctimer_queue::create(TYPE, now);
+    vector<Ctimer> pool;
+    fill_queue(timers, pool, state.m_arg, now);
+
+    state.start();
+    for (long long i = 0; i < state.m_iters; i += BATCH)
+    {
+        int n = (state.m_iters - i < BATCH) ? (int)(state.m_iters - i) : BATCH;
+        for (int j = 0; j < n; j++)
+        {
+            timers->add(&pool[state.m_arg + j], now + FAR + next_rand() % FAR);
+        }
+
+        state.pause();
+        for (int j = 0; j < n; j++)
+        {
+            timers->cancel(&pool[state.m_arg + j]);
+        }
+        state.resume();
+    }
+
+    state.stop();
+    delete timers;
+}
+
+template<TIMER_TYPE TYPE>
+static void bench_queue_cancel(Cstate& state)
+{
+    long long now = FAR;
+    Ctimer_queue* timers = Ctimer_queue::create(TYPE, now);
+    vector<Ctimer> pool;
+    fill_queue(timers, pool, state.m_arg, now);
+
+    Ctimer* removed[BATCH];
+    state.start();
+    for (long long i = 0; i < state.m_iters; i += BATCH)
+    {
+        int n = (state.m_iters - i < BATCH) ? (int)(state.m_iters - i) : BATCH;
+        for (int j = 0; j < n; j++)
+        {
+            removed[j] = &pool[next_rand() % state.m_arg];
+            timers->cancel(removed[j]);
+        }
+
+        state.pause();
+        for (int j = 0; j < n; j++)
+        {
+            timers->add(removed[j], now + FAR + next_rand() % FAR);
+        }
+        state.resume();
+    }
+
+    state.stop();
+    delete timers;
+}
+
+// 推迟一个随机定时器，即空闲超时的刷新
+template<TIMER_TYPE TYPE>
+static void bench_queue_adjust(Cstate& state)
+{
+    long long now = FAR;
+    Ctimer_queue* timers = Ctimer_queue::create(TYPE, now);
+    vector<Ctimer> pool;
+    fill_queue(timers, pool, state.m_arg, now);
+
+    state.start();
+    for (long long i = 0; i < state.m_iters; i++)
+    {
+        timers->adjust(&pool[next_rand() % state.m_arg], now + FAR + next_rand() % FAR);
+    }
+
+    state.stop();
+    delete timers;
+}
+
+// 每次操作为一个到期的定时器，时间每批前进1毫秒，时间轮的层间搬移也计入
+template<TIMER_TYPE TYPE>
+static void bench_queue_expire(Cstate& state)
+{
+    long long now = FAR;
+    Ctimer_queue* timers = Ctimer_queue::create(TYPE, now);
+    vector<Ctimer> pool;
+    fill_queue(timers, pool, state.m_arg, now);
+
+    state.start();
+    for (long long i = 0; i < state.m_iters; i += BATCH)
+    {
+        int n = (state.m_iters - i < BATCH) ? (int)(state.m_iters - i) : BATCH;
+        state.pause();
+        for (int j = 0; j < n; j++)
+        {
+            timers->add(&pool[state.m_arg + j], now);
+        }
+        state.resume();
+
+        timers->expire(now);
+        now++;
+    }
+
+    state.stop();
+    delete timers;
+}
+
+// 事件循环读时钟的开销：直接调用clock_gettime，更新缓存时钟(clock_gettime或TSC)，读取缓存
+static void bench_clock_gettime(Cstate& state)
+{
+    long long sum = 0;
+    state.start();
+    for (long long i = 0; i < state.m_iters; i++)
+    {
+        sum += monotonic_ms();
+    }
+
+    state.stop();
+    g_seed += sum & 1;
+}
+
+static void bench_clock_update(Cstate& state, bool use_tsc)
+{
+    Cclock::init(use_tsc);
+    long long sum = 0;
+    state.start();
+    for (long long i = 0; i < state.m_iters; i++)
+    {
+        sum += Cclock::update();
+    }
+
+    state.stop();
+    g_seed += sum & 1;
+}
+
+static void bench_clock_update_sys(Cstate& state)
+{
+    bench_clock_update(state, false);
+}
+
+// TSC不可用时与clock_update_sys相同
+static void bench_clock_update_tsc(Cstate& state)
+{
+    bench_clock_update(state, true);
+}
+
+static void bench_clock_cached(Cstate& state)
+{
+    Cclock::update();
+    long long sum = 0;
+    state.start();
+    for (long long i = 0; i < state.m_iters; i++)
+    {
+        sum += Cclock::now_ms();
+    }
+
+    state.stop();
+    g_seed += sum & 1;
+}
+
+#define TIMER_SIZES {1000, 10000, 100000, 1000000, 0}
+
+static const Cbench g_benches[] =
+{
+    {"conn_relay", bench_conn_relay, {64, 512, 2048, 16384, 65536, 0}},
+    {"mgr_process", bench_mgr_process, {1, 64, 1024, 0}},
+    {"mgr_process_empty", bench_mgr_process_empty, {1, 64, 1024, 0}},
+    {"mgr_churn", bench_mgr_churn, {1, 0}},
+    {"lst_add", bench_lst_add, TIMER_SIZES},
+    {"lst_del", bench_lst_del, TIMER_SIZES},
+    {"lst_adjust", bench_lst_adjust, TIMER_SIZES},
+    {"lst_tick", bench_lst_tick, TIMER_SIZES},
+    {"wheel_add", bench_wheel_add, TIMER_SIZES},
+    {"wheel_del", bench_wheel_del, TIMER_SIZES},
+    {"wheel_adjust", bench_wheel_adjust, TIMER_SIZES},
+    {"wheel_tick", bench_wheel_tick, TIMER_SIZES},
+    {"heap_add", bench_heap_add, TIMER_SIZES},
+    {"heap_del", bench_heap_del, TIMER_SIZES},
+    {"heap_adjust", bench_heap_adjust, TIMER_SIZES},
+    {"heap_tick", bench_heap_tick, TIMER_SIZES},
+    {"heap4_add", bench_queue_add<TIMER_HEAP>, TIMER_SIZES},
+    {"heap4_cancel", bench_queue_cancel<TIMER_HEAP>, TIMER_SIZES},
+    {"heap4_adjust", bench_queue_adjust<TIMER_HEAP>, TIMER_SIZES},
+    {"heap4_expire", bench_queue_expire<TIMER_HEAP>, TIMER_SIZES},
+    {"hwheel_add", bench_queue_add<TIMER_WHEEL>, TIMER_SIZES},
+    {"hwheel_cancel", bench_queue_cancel<TIMER_WHEEL>, TIMER_SIZES},
+    {"hwheel_adjust", bench_queue_adjust<TIMER_WHEEL>, TIMER_SIZES},
+    {"hwheel_expire", bench_queue_expire<TIMER_WHEEL>, TIMER_SIZES},
+    {"clock_gettime", bench_clock_gettime, {1, 0}},
+    {"clock_update_sys", bench_clock_update_sys, {1, 0}},
+    {"clock_update_tsc", bench_clock_update_tsc, {1, 0}},
+    {"clock_cached", bench_clock_cached, {1, 0}}
+};
+
+/**************************************************************
+ * 函数名称：run_bench
+ * 函数功能：运行一项测试。迭代次数从1开始，按上一次的耗时估计达到
+ *          最短运行时间所需的次数(每次最多增加到10倍)，直到运行时间
+ *          超过下限或者达到迭代次数上限
+ * 输入参数：bench      测试
+ *           arg        测试参数
+ *           min_ns     最短运行时间
+ * 输出参数：无
+ * 返 回 值：最后一次运行的状态
+ **************************************************************/
+static Cstate run_bench(const Cbench& bench, long long arg, long long min_ns)
+{
+    long long iters = 1;
+    while (true)
+    {
+        Cstate state(arg, iters);
+        bench.func(state);
+        if ((state.m_elapsed >= min_ns) || (iters >= MAX_ITERS))
+        {
+            return state;
+        }
+
+        double scale = (state.m_elapsed > 0) ? (1.4 * min_ns / state.m_elapsed) : 10.0;
+        scale = (scale > 10.0) ? 10.0 : ((scale < 2.0) ? 2.0 : scale);
+        iters = (long long)(iters * scale);
+        iters = (iters > MAX_ITERS) ? MAX_ITERS : iters;
+    }
+}
+
+int main(int argc, char * argv [ ])
+{
+    long long min_ms = 200;
+    int cpu = 0;
+    const char* filter = NULL;
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "m:c:f:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+            {
+                min_ms = atoll(optarg);
+                break;
+            }
+
+            case 'c':
+            {
+                cpu = atoi(optarg);
+                break;
+            }
+
+            case 'f':
+            {
+                filter = optarg;
+                break;
+            }
+
+            case 'h':
+            default:
+            {
+                printf("usage: %s [-m min_ms] [-c cpu] [-f filter]\n", basename(argv[0]));
+                printf("  -m  minimum run time of each benchmark in milliseconds (default 200)\n");
+                printf("  -c  pin to this cpu, -1 to not pin (default 0)\n");
+                printf("  -f  only run benchmarks whose name contains this string\n");
+                return (opt == 'h') ? 0 : 1;
+            }
+        }
+    }
+
+    if (min_ms <= 0)
+    {
+        printf("invalid arguments\n");
+        return 1;
+    }
+
+    if (cpu >= 0)
+    {
+        cpu = bind_cpu(cpu);
+    }
+
+    // 被测代码会打印调试信息，测试期间标准输出指向/dev/null，结果写到原来的标准输出
+    signal(SIGPIPE, SIG_IGN);
+    FILE* out = fdopen(dup(STDOUT_FILENO), "w");
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+
+    fprintf(out, "cpu %d, min time %lld ms\n", cpu, min_ms);
+    fprintf(out, "%-28s %12s %12s %12s\n", "benchmark", "iterations", "ns/op", "MB/s");
+    fflush(out);
+    for (size_t i = 0; i < sizeof(g_benches) / sizeof(g_benches[0]); i++)
+    {
+        const Cbench& bench = g_benches[i];
+        if (filter && !strstr(bench.name, filter))
+        {
+            continue;
+        }
+
+        for (int j = 0; bench.args[j] != 0; j++)
+        {
+            Cstate state = run_bench(bench, bench.args[j], min_ms * 1000000);
+            fflush(stdout);
+
+            char name[64];
+            snprintf(name, sizeof(name), "%s/%lld", bench.name, bench.args[j]);
+            fprintf(out, "%-28s %12lld %12.1f", name, state.m_iters, (double)state.m_elapsed / state.m_iters);
+            if (state.m_bytes > 0)
+            {
+                fprintf(out, " %12.1f", state.m_bytes * 1e3 / state.m_elapsed);
+            }
+
+            fprintf(out, "\n");
+            fflush(out);
+        }
+    }
+
+    fclose(out);
+    return 0;
+}
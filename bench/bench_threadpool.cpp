@@ -0,0 +1,215 @@
+/*********************************************************************************
+ * File Name: bench_threadpool.cpp
+ * Description: demo线程池请求队列的基准测试。同样数量的生产者线程向线程池提交
+ *              空任务(或者做少量计算的任务)，分别测量互斥锁链表locked_queue、
+ *              无锁环形队列mpmc_queue和工作窃取调度steal_queue在1到64个工作
+ *              线程时每秒完成的任务数
+ * History:
+ *********************************************************************************/
+
+#include <libgen.h>
+#include <sched.h>
+#include <atomic>
+#include <vector>
+#include "../demo/threadpool.h"
+
+static const int MAX_SLOTS = 128;
+static const int THREAD_COUNTS[] = {1, 2, 4, 8, 16, 32, 64};
+
+// 每个工作线程完成的任务数，各占一条缓存行，避免计数本身成为竞争点
+struct Cslot
+{
+    alignas(64) std::atomic<long long> done;
+};
+
+static Cslot g_slots[MAX_SLOTS];
+static std::atomic<int> g_next_slot(0);
+static __thread int t_slot = -1;
+static int g_work = 0;
+
+// 测试任务：做g_work轮简单计算，完成后在本线程的计数上加1
+class Ctask
+{
+public:
+    Ctask() : m_value(1) {}
+
+public:
+    void process()
+    {
+        unsigned long long x = m_value;
+        for (int i = 0; i < g_work; i++)
+        {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        }
+
+        m_value = x;
+        if (t_slot < 0)
+        {
+            t_slot = g_next_slot.fetch_add(1) % MAX_SLOTS;
+        }
+
+        g_slots[t_slot].done.fetch_add(1, std::memory_order_relaxed);
+    }
+
+public:
+    unsigned long long m_value;
+};
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long long total_done()
+{
+    long long total = 0;
+    for (int i = 0; i < MAX_SLOTS; i++)
+    {
+        total += g_slots[i].done.load(std::memory_order_relaxed);
+    }
+
+    return total;
+}
+
+// 一个生产者线程负责提交的任务，队列满时让出CPU后重试
+template<typename Q>
+struct Cproducer
+{
+    threadpool<Ctask, Q>* pool;
+    Ctask* tasks;
+    long long cnt;
+};
+
+template<typename Q>
+static void* produce(void* arg)
+{
+    Cproducer<Q>* producer = (Cproducer<Q>*)arg;
+    for (long long i = 0; i < producer->cnt; i++)
+    {
+        while (!producer->pool->append(&producer->tasks[i]))
+        {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+/**************************************************************
+ * 函数名称：run_pool
+ * 函数功能：创建threads个工作线程的线程池，由producers个线程共提交
+ *          cnt个任务，从开始提交计时到所有任务执行完毕
+ * 输入参数：threads        工作线程数
+ *           producers      生产者线程数
+ *           queue_size     请求队列的容量
+ *           tasks          任务数组
+ *           cnt            任务数
+ * 输出参数：无
+ * 返 回 值：每秒完成的任务数
+ **************************************************************/
+template<typename Q>
+static double run_pool(int threads, int producers, int queue_size, Ctask* tasks, long long cnt)
+{
+    threadpool<Ctask, Q>* pool = new threadpool<Ctask, Q>(threads, queue_size);
+    std::vector<Cproducer<Q> > args(producers);
+    std::vector<pthread_t> tids(producers);
+    long long before = total_done();
+    long long start = now_ns();
+    for (int i = 0; i < producers; i++)
+    {
+        long long from = cnt * i / producers;
+        args[i].pool = pool;
+        args[i].tasks = tasks + from;
+        args[i].cnt = cnt * (i + 1) / producers - from;
+        pthread_create(&tids[i], NULL, produce<Q>, &args[i]);
+    }
+
+    for (int i = 0; i < producers; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+
+    while (total_done() - before < cnt)
+    {
+        sched_yield();
+    }
+
+    long long elapsed = now_ns() - start;
+    delete pool;
+    return cnt * 1e9 / elapsed;
+}
+
+static void usage(const char* prog)
+{
+    printf("usage: %s [-n tasks] [-p producers] [-w work] [-q queue_size] [-t max_threads]\n", prog);
+    printf("  -n  tasks submitted for each measurement (default 1000000)\n");
+    printf("  -p  producer threads submitting tasks, like the reactor thread of demo19 (default 1)\n");
+    printf("  -w  rounds of arithmetic in each task, 0 = empty tasks that only measure the queue (default 0)\n");
+    printf("  -q  request queue capacity (default 10000, the threadpool default)\n");
+    printf("  -t  largest worker thread count, counts are 1 2 4 ... 64 (default 64)\n");
+}
+
+int main(int argc, char * argv [ ])
+{
+    long long cnt = 1000000;
+    int producers = 1;
+    int queue_size = 10000;
+    int max_threads = 64;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "n:p:w:q:t:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': cnt = atoll(optarg); break;
+            case 'p': producers = atoi(optarg); break;
+            case 'w': g_work = atoi(optarg); break;
+            case 'q': queue_size = atoi(optarg); break;
+            case 't': max_threads = atoi(optarg); break;
+            case 'h':
+            default:
+            {
+                usage(basename(argv[0]));
+                return (opt == 'h') ? 0 : 1;
+            }
+        }
+    }
+
+    if ((cnt <= 0) || (producers <= 0) || (g_work < 0) || (queue_size <= 0))
+    {
+        printf("invalid arguments\n");
+        return 1;
+    }
+
+    // 线程池创建线程时会打印信息，测试期间标准输出指向/dev/null，结果写到原来的标准输出
+    FILE* out = fdopen(dup(STDOUT_FILENO), "w");
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+
+    Ctask* tasks = new Ctask[cnt];
+    fprintf(out, "%lld tasks, %d producers, work %d, queue %d, %ld cpus\n", cnt, producers, g_work, queue_size,
+            sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(out, "%8s %16s %16s %16s %8s %8s\n", "threads", "locked tasks/s", "mpmc tasks/s", "steal tasks/s",
+            "mpmc", "steal");
+    for (size_t i = 0; i < sizeof(THREAD_COUNTS) / sizeof(THREAD_COUNTS[0]); i++)
+    {
+        int threads = THREAD_COUNTS[i];
+        if (threads > max_threads)
+        {
+            break;
+        }
+
+        double locked = run_pool<locked_queue<Ctask> >(threads, producers, queue_size, tasks, cnt);
+        double mpmc = run_pool<mpmc_queue<Ctask> >(threads, producers, queue_size, tasks, cnt);
+        double steal = run_pool<steal_queue<Ctask> >(threads, producers, queue_size, tasks, cnt);
+        fprintf(out, "%8d %16.0f %16.0f %16.0f %7.2fx %7.2fx\n", threads, locked, mpmc, steal, mpmc / locked,
+                steal / locked);
+        fflush(out);
+    }
+
+    delete [] tasks;
+    fclose(out);
+    return 0;
+}
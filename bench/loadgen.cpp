@@ -0,0 +1,1151 @@
+/*********************************************************************************
+ * File Name: loadgen.cpp
+ * Description: 多线程负载生成器，取代demo/stress_test。按给定速率发送请求(开环)，
+ *              延迟从请求按计划应当发出的时间算起，服务端变慢时积压的请求也计入
+ *              延迟(修正协调遗漏)；速率可以分阶段阶跃或线性变化。输出吞吐量和
+ *              对数线性直方图(HDR)统计的延迟百分位，格式为文本或JSON
+ * History:
+ *********************************************************************************/
+
+#include <netinet/tcp.h>
+#include <libgen.h>
+#include <deque>
+#include <queue>
+#include <string>
+#include "../src/global.h"
+
+static const int MAX_STAGES = 16;
+static const int MAX_BATCH = 64;            // 一次writev最多合并的请求数
+static const int READ_BUF_SIZE = 65536;
+static const int MAX_LINE = 256;            // 解析应答头部时保留的行长度，更长的行只判断是否为空行
+
+// 速率阶段：在seconds秒内从from线性变化到to(相等时为阶跃)
+struct Cstage
+{
+    double from;
+    double to;
+    double seconds;
+};
+
+// 命令行配置
+struct Cconfig
+{
+    Cconfig() : port(1234), conns(1), idle(0), threads(1), seconds(10), rate(0), stage_cnt(0), depth(1),
+                churn(0), http(true), expect(-1), json(false), verbose(false), drain(2) {}
+
+    char addr[64];
+    int port;
+    int conns;                      // 发送请求的连接数
+    int idle;                       // 只建立、不发送请求的连接数
+    int threads;
+    double seconds;
+    double rate;                    // 总速率(请求/秒)，0表示闭环：收到应答立即发送下一个请求
+    Cstage stages[MAX_STAGES];
+    int stage_cnt;
+    int depth;                      // 每个连接最多未完成的请求数(流水线深度)
+    int churn;                      // 每个连接完成这么多请求后重建连接，0表示不重建
+    bool http;                      // 按HTTP/1.1解析应答，否则每个应答为固定的expect字节
+    long long expect;               // 原始模式下每个应答的字节数，0表示不等待应答
+    bool json;
+    bool verbose;                   // 每秒打印一次进度
+    double drain;                   // 停止发送后等待未完成应答的秒数
+    std::string payload;
+};
+
+// 对数线性直方图：小于2^SUB_BITS的值精确记录，更大的值每个2的幂区间分成2^(SUB_BITS-1)
+// 个等宽的桶，相对误差不超过2^-(SUB_BITS-1)。记录的是纳秒
+class Chist
+{
+public:
+    static const int SUB_BITS = 8;
+    static const int HALF = 1 << (SUB_BITS - 1);
+    static const int BUCKETS = (1 << SUB_BITS) + (64 - SUB_BITS) * HALF;
+
+public:
+    Chist() { reset(); }
+
+public:
+    void reset()
+    {
+        memset(m_counts, 0, sizeof(m_counts));
+        m_total = 0;
+        m_max = 0;
+        m_sum = 0;
+    }
+
+    void record(long long v)
+    {
+        v = (v < 0) ? 0 : v;
+        m_counts[index(v)]++;
+        m_total++;
+        m_sum += v;
+        m_max = (v > m_max) ? v : m_max;
+    }
+
+    void merge(const Chist& other)
+    {
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            m_counts[i] += other.m_counts[i];
+        }
+
+        m_total += other.m_total;
+        m_sum += other.m_sum;
+        m_max = (other.m_max > m_max) ? other.m_max : m_max;
+    }
+
+    // 第p百分位所在桶的上界，不超过最大值
+    long long percentile(double p) const
+    {
+        if (m_total == 0)
+        {
+            return 0;
+        }
+
+        long long rank = (long long)(p / 100.0 * m_total + 0.5);
+        rank = (rank < 1) ? 1 : rank;
+        long long seen = 0;
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            seen += m_counts[i];
+            if (seen >= rank)
+            {
+                long long upper = upper_bound(i);
+                return (upper < m_max) ? upper : m_max;
+            }
+        }
+
+        return m_max;
+    }
+
+    double mean() const { return (m_total > 0) ? (m_sum / m_total) : 0.0; }
+
+private:
+    static int index(long long v)
+    {
+        if (v < (1LL << SUB_BITS))
+        {
+            return v;
+        }
+
+        int msb = 63 - __builtin_clzll(v);
+        int shift = msb - (SUB_BITS - 1);
+        return (1 << SUB_BITS) + (shift - 1) * HALF + (int)((v >> shift) - HALF);
+    }
+
+    static long long upper_bound(int idx)
+    {
+        if (idx < (1 << SUB_BITS))
+        {
+            return idx;
+        }
+
+        int shift = (idx - (1 << SUB_BITS)) / HALF + 1;
+        long long sub = (idx - (1 << SUB_BITS)) % HALF + HALF;
+        return ((sub + 1) << shift) - 1;
+    }
+
+public:
+    long long m_counts[BUCKETS];
+    long long m_total;
+    long long m_max;
+    double m_sum;
+};
+
+// 一个连接
+struct Cconn
+{
+    int fd;
+    bool active;                    // 空闲连接只占用描述符，不发送请求
+    bool connecting;
+    bool dead;                      // 重建失败，不再使用
+    bool in_heap;                   // 是否在发送时间堆中
+    bool want_out;                  // 是否注册了EPOLLOUT
+    int queued;                     // 还没有写完的请求数
+    long long write_off;            // 第一个没有写完的请求已经写出的字节数
+    std::deque<long long> inflight; // 已经排队但还没有收到应答的请求的计划发送时间
+    long long next_ns;              // 下一个请求的计划发送时间
+    int done_on_conn;               // 本连接已经完成的请求数
+
+    // 应答解析状态
+    bool in_body;
+    bool first_line;
+    char line[MAX_LINE];
+    int line_len;
+    int status;
+    long long content_length;
+    bool chunked;
+    long long body_left;
+};
+
+// 一个工作线程的统计
+struct Cstats
+{
+    Cstats() : requests(0), responses(0), errors(0), connect_errors(0), reconnects(0), non_2xx(0),
+               unanswered(0), unsent(0), bytes_in(0), bytes_out(0) {}
+
+    long long requests;
+    long long responses;
+    long long errors;               // 应答格式错误或者连接被服务端关闭时丢失的请求
+    long long connect_errors;
+    long long reconnects;
+    long long non_2xx;
+    long long unanswered;           // 等待结束时仍没有应答的请求
+    long long unsent;               // 开环时因为流水线深度用满，到结束时仍没有发出的请求
+    long long bytes_in;
+    long long bytes_out;
+    Chist hist[MAX_STAGES];         // 按计划发送时间所在的阶段分别统计
+};
+
+struct Cworker
+{
+    int idx;
+    int first_conn;                 // 本线程第一个活动连接的全局编号，用于错开发送时间
+    int active;
+    int idle;
+    Cstats stats;
+    volatile long long progress;    // 已完成的请求数，供主线程打印进度
+    pthread_t tid;
+};
+
+static Cconfig g_cfg;
+static struct sockaddr_in g_addr;
+static long long g_start_ns;
+static long long g_end_ns;          // 停止发送的时间
+static pthread_barrier_t g_ready;
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// 相对开始时间t秒时的总速率
+static double rate_at(double t)
+{
+    if (g_cfg.stage_cnt == 0)
+    {
+        return g_cfg.rate;
+    }
+
+    for (int i = 0; i < g_cfg.stage_cnt; i++)
+    {
+        const Cstage& st = g_cfg.stages[i];
+        if (t < st.seconds)
+        {
+            return st.from + (st.to - st.from) * (t / st.seconds);
+        }
+
+        t -= st.seconds;
+    }
+
+    return g_cfg.stages[g_cfg.stage_cnt - 1].to;
+}
+
+static int stage_of(long long ns)
+{
+    double t = (ns - g_start_ns) / 1e9;
+    for (int i = 0; i < g_cfg.stage_cnt; i++)
+    {
+        if (t < g_cfg.stages[i].seconds)
+        {
+            return i;
+        }
+
+        t -= g_cfg.stages[i].seconds;
+    }
+
+    return (g_cfg.stage_cnt > 0) ? (g_cfg.stage_cnt - 1) : 0;
+}
+
+// 解析阶段列表：rate[-rate]:seconds[,...]
+static bool parse_stages(const char* spec)
+{
+    g_cfg.stage_cnt = 0;
+    g_cfg.seconds = 0;
+    const char* p = spec;
+    while (*p)
+    {
+        if (g_cfg.stage_cnt >= MAX_STAGES)
+        {
+            return false;
+        }
+
+        Cstage& st = g_cfg.stages[g_cfg.stage_cnt];
+        char* end = NULL;
+        st.from = strtod(p, &end);
+        st.to = st.from;
+        if (*end == '-')
+        {
+            st.to = strtod(end + 1, &end);
+        }
+
+        if (*end != ':')
+        {
+            return false;
+        }
+
+        st.seconds = strtod(end + 1, &end);
+        if ((st.from <= 0) || (st.to <= 0) || (st.seconds <= 0) || ((*end != ',') && (*end != '\0')))
+        {
+            return false;
+        }
+
+        g_cfg.seconds += st.seconds;
+        g_cfg.stage_cnt++;
+        p = (*end == ',') ? (end + 1) : end;
+    }
+
+    return g_cfg.stage_cnt > 0;
+}
+
+// 命令行中的请求内容，支持\r、\n、\t和\\转义
+static std::string unescape(const char* s)
+{
+    std::string out;
+    for (; *s; s++)
+    {
+        if ((*s == '\\') && s[1])
+        {
+            s++;
+            out += (*s == 'r') ? '\r' : (*s == 'n') ? '\n' : (*s == 't') ? '\t' : *s;
+        }
+        else
+        {
+            out += *s;
+        }
+    }
+
+    return out;
+}
+
+static bool read_file(const char* path, std::string& out)
+{
+    FILE* fp = fopen(path, "rb");
+    if (!fp)
+    {
+        return false;
+    }
+
+    char buf[65536];
+    size_t n = 0;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    {
+        out.append(buf, n);
+    }
+
+    fclose(fp);
+    return true;
+}
+
+static void reset_parser(Cconn& c)
+{
+    c.in_body = false;
+    c.first_line = true;
+    c.line_len = 0;
+    c.status = 0;
+    c.content_length = -1;
+    c.chunked = false;
+    c.body_left = g_cfg.http ? 0 : g_cfg.expect;
+    c.in_body = !g_cfg.http;
+}
+
+// 发起非阻塞连接，结果在可写时确认
+static bool open_conn(Cconn& c)
+{
+    c.fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c.fd < 0)
+    {
+        return false;
+    }
+
+    fcntl(c.fd, F_SETFL, fcntl(c.fd, F_GETFL) | O_NONBLOCK);
+    int on = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    int ret = connect(c.fd, (struct sockaddr*)&g_addr, sizeof(g_addr));
+    if ((ret != 0) && (errno != EINPROGRESS))
+    {
+        close(c.fd);
+        c.fd = -1;
+        return false;
+    }
+
+    c.connecting = (ret != 0);
+    c.want_out = c.connecting;
+    c.queued = 0;
+    c.write_off = 0;
+    c.done_on_conn = 0;
+    reset_parser(c);
+    return true;
+}
+
+/**************************************************************
+ * 函数名称：Cgen
+ * 函数功能：一个工作线程的事件循环。活动连接的下一个计划发送时间放在
+ *          小顶堆中，到期时把请求排入连接(未完成的请求数不超过流水线
+ *          深度)；深度用满时连接离开堆，收到应答后把积压的请求立即发出，
+ *          这些请求的延迟仍从各自的计划发送时间算起
+ **************************************************************/
+class Cgen
+{
+public:
+    Cgen(Cworker* w) : m_w(w), m_epollfd(-1) {}
+
+public:
+    void run();
+
+private:
+    typedef std::pair<long long, int> Cdue;
+
+private:
+    bool connect_all();
+    void schedule(int idx, long long now);
+    void flush(int idx, long long now);
+    void on_read(int idx, long long now);
+    void on_write(int idx, long long now);
+    bool feed(Cconn& c, const char* data, int len, long long now);
+    void complete(Cconn& c, long long now);
+    void reconnect(int idx, long long now);
+    void set_out(Cconn& c, bool want);
+    bool sending(long long now) const { return now < g_end_ns; }
+
+private:
+    Cworker* m_w;
+    int m_epollfd;
+    vector<Cconn> m_conns;
+    std::priority_queue<Cdue, vector<Cdue>, std::greater<Cdue> > m_due;
+    char m_buf[READ_BUF_SIZE];
+};
+
+// 建立本线程的所有连接，等待连接完成(最多3秒)
+bool Cgen::connect_all()
+{
+    m_conns.resize(m_w->active + m_w->idle);
+    for (size_t i = 0; i < m_conns.size(); i++)
+    {
+        Cconn& c = m_conns[i];
+        c.active = ((int)i < m_w->active);
+        c.dead = false;
+        c.in_heap = false;
+        c.next_ns = 0;
+        if (!open_conn(c))
+        {
+            c.dead = true;
+            m_w->stats.connect_errors++;
+            continue;
+        }
+
+        struct epoll_event ev;
+        ev.data.u32 = i;
+        ev.events = EPOLLIN | (c.connecting ? (int)EPOLLOUT : 0);
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, c.fd, &ev);
+    }
+
+    long long deadline = now_ns() + 3000000000LL;
+    struct epoll_event events[256];
+    while (now_ns() < deadline)
+    {
+        int pending = 0;
+        for (size_t i = 0; i < m_conns.size(); i++)
+        {
+            pending += (!m_conns[i].dead && m_conns[i].connecting) ? 1 : 0;
+        }
+
+        if (pending == 0)
+        {
+            return true;
+        }
+
+        int n = epoll_wait(m_epollfd, events, 256, 100);
+        for (int i = 0; i < n; i++)
+        {
+            on_write(events[i].data.u32, 0);
+        }
+    }
+
+    for (size_t i = 0; i < m_conns.size(); i++)
+    {
+        if (!m_conns[i].dead && m_conns[i].connecting)
+        {
+            close(m_conns[i].fd);
+            m_conns[i].dead = true;
+            m_w->stats.connect_errors++;
+        }
+    }
+
+    return true;
+}
+
+void Cgen::set_out(Cconn & c, bool want)
+{
+    if (c.want_out == want)
+    {
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.data.u32 = &c - &m_conns[0];
+    ev.events = EPOLLIN | (want ? (int)EPOLLOUT : 0);
+    epoll_ctl(m_epollfd, EPOLL_CTL_MOD, c.fd, &ev);
+    c.want_out = want;
+}
+
+// 把到期的请求排入连接并发送；开环时连接还能继续排队则重新放入堆中
+void Cgen::schedule(int idx, long long now)
+{
+    Cconn& c = m_conns[idx];
+    if (c.dead || !c.active)
+    {
+        return;
+    }
+
+    bool closed_loop = (g_cfg.stage_cnt == 0) && (g_cfg.rate <= 0);
+    while (((int)c.inflight.size() < g_cfg.depth) && (closed_loop ? sending(now) : (c.next_ns <= now))
+           && (c.next_ns < g_end_ns))
+    {
+        c.inflight.push_back(closed_loop ? now : c.next_ns);
+        c.queued++;
+        m_w->stats.requests++;
+        if (!closed_loop)
+        {
+            // 每个连接分担总速率的1/conns
+            double rate = rate_at((c.next_ns - g_start_ns) / 1e9);
+            c.next_ns += (long long)(1e9 * g_cfg.conns / rate);
+        }
+    }
+
+    flush(idx, now);
+    if (!closed_loop && !c.in_heap && !c.dead && ((int)c.inflight.size() < g_cfg.depth) && (c.next_ns < g_end_ns))
+    {
+        m_due.push(Cdue(c.next_ns, idx));
+        c.in_heap = true;
+    }
+}
+
+// 发送排队的请求，多个请求合并为一次writev。不等待应答时写完即完成
+void Cgen::flush(int idx, long long now)
+{
+    Cconn& c = m_conns[idx];
+    const char* data = g_cfg.payload.data();
+    long long len = g_cfg.payload.size();
+    if (c.connecting || c.dead)
+    {
+        return;
+    }
+
+    while (c.queued > 0)
+    {
+        struct iovec iov[MAX_BATCH];
+        int cnt = (c.queued < MAX_BATCH) ? c.queued : MAX_BATCH;
+        for (int i = 0; i < cnt; i++)
+        {
+            iov[i].iov_base = (void*)(data + ((i == 0) ? c.write_off : 0));
+            iov[i].iov_len = len - ((i == 0) ? c.write_off : 0);
+        }
+
+        ssize_t n = writev(c.fd, iov, cnt);
+        if (n < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                set_out(c, true);
+                return;
+            }
+
+            reconnect(idx, now);
+            return;
+        }
+
+        m_w->stats.bytes_out += n;
+        n += c.write_off;
+        c.write_off = n % len;
+        int done = n / len;
+        c.queued -= done;
+        if (g_cfg.expect == 0)
+        {
+            for (int i = 0; i < done; i++)
+            {
+                complete(c, now);
+            }
+        }
+    }
+
+    set_out(c, false);
+}
+
+// 一个请求完成，按计划发送时间记录延迟
+void Cgen::complete(Cconn & c, long long now)
+{
+    long long intended = c.inflight.front();
+    c.inflight.pop_front();
+    m_w->stats.hist[stage_of(intended)].record(now - intended);
+    m_w->stats.responses++;
+    m_w->progress = m_w->stats.responses;
+    c.done_on_conn++;
+}
+
+/**************************************************************
+ * 函数名称：Cgen::feed
+ * 函数功能：逐段解析应答。HTTP模式下逐行扫描头部，取出状态码、
+ *          Content-Length和Transfer-Encoding，消息体只计数不保存；
+ *          原始模式下每个应答为固定字节数
+ * 输入参数：c      连接
+ *           data   新读到的数据
+ *           len    数据长度
+ *           now    当前时间
+ * 输出参数：无
+ * 返 回 值：应答格式错误或者不支持时返回false
+ **************************************************************/
+bool Cgen::feed(Cconn & c, const char* data, int len, long long now)
+{
+    if (!g_cfg.http && (g_cfg.expect == 0))
+    {
+        // 请求写完即完成，收到的数据直接丢弃
+        return true;
+    }
+
+    int pos = 0;
+    while (pos < len)
+    {
+        if (c.in_body)
+        {
+            long long n = (c.body_left < len - pos) ? c.body_left : (len - pos);
+            c.body_left -= n;
+            pos += n;
+            if (c.body_left > 0)
+            {
+                return true;
+            }
+
+            if (c.inflight.empty())
+            {
+                return false;
+            }
+
+            complete(c, now);
+            reset_parser(c);
+            continue;
+        }
+
+        const char* nl = (const char*)memchr(data + pos, '\n', len - pos);
+        int end = nl ? (nl - data) : len;
+        int n = end - pos;
+        int keep = (c.line_len + n < MAX_LINE) ? n : (MAX_LINE - 1 - c.line_len);
+        keep = (keep < 0) ? 0 : keep;
+        memcpy(c.line + c.line_len, data + pos, keep);
+        c.line_len += keep;
+        pos = nl ? (end + 1) : len;
+        if (!nl)
+        {
+            return true;
+        }
+
+        int line_len = c.line_len;
+        if ((line_len > 0) && (c.line[line_len - 1] == '\r'))
+        {
+            line_len--;
+        }
+
+        c.line[line_len] = '\0';
+        c.line_len = 0;
+        if (c.first_line)
+        {
+            if ((strncmp(c.line, "HTTP/1.", 7) != 0) || (line_len < 12))
+            {
+                return false;
+            }
+
+            c.status = atoi(c.line + 9);
+            c.first_line = false;
+        }
+        else if (line_len > 0)
+        {
+            if (strncasecmp(c.line, "Content-Length:", 15) == 0)
+            {
+                c.content_length = atoll(c.line + 15);
+            }
+            else if (strncasecmp(c.line, "Transfer-Encoding:", 18) == 0)
+            {
+                c.chunked = true;
+            }
+        }
+        else if ((c.status >= 100) && (c.status < 200))
+        {
+            // 临时应答，继续解析最终应答
+            reset_parser(c);
+        }
+        else
+        {
+            if (c.chunked || ((c.content_length < 0) && (c.status != 204) && (c.status != 304)))
+            {
+                return false;
+            }
+
+            m_w->stats.non_2xx += ((c.status < 200) || (c.status >= 300)) ? 1 : 0;
+            c.in_body = true;
+            c.body_left = (c.content_length > 0) ? c.content_length : 0;
+            if (c.body_left == 0)
+            {
+                if (c.inflight.empty())
+                {
+                    return false;
+                }
+
+                complete(c, now);
+                reset_parser(c);
+            }
+        }
+    }
+
+    return true;
+}
+
+void Cgen::on_read(int idx, long long now)
+{
+    Cconn& c = m_conns[idx];
+    while (!c.dead)
+    {
+        int n = recv(c.fd, m_buf, sizeof(m_buf), 0);
+        if (n < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                break;
+            }
+
+            reconnect(idx, now);
+            return;
+        }
+        else if (n == 0)
+        {
+            reconnect(idx, now);
+            return;
+        }
+
+        m_w->stats.bytes_in += n;
+        if (!feed(c, m_buf, n, now))
+        {
+            reconnect(idx, now);
+            return;
+        }
+    }
+
+    if (c.active && (g_cfg.churn > 0) && (c.done_on_conn >= g_cfg.churn) && c.inflight.empty())
+    {
+        reconnect(idx, now);
+        return;
+    }
+
+    schedule(idx, now);
+}
+
+void Cgen::on_write(int idx, long long now)
+{
+    Cconn& c = m_conns[idx];
+    if (c.dead)
+    {
+        return;
+    }
+
+    if (c.connecting)
+    {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if ((getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) || (error != 0))
+        {
+            close(c.fd);
+            c.dead = true;
+            m_w->stats.connect_errors++;
+            return;
+        }
+
+        c.connecting = false;
+    }
+
+    if (now > 0)
+    {
+        schedule(idx, now);
+    }
+    else
+    {
+        set_out(c, false);
+    }
+}
+
+// 连接被关闭、出错或者按-k重建：未完成的请求记为错误，发送阶段内重新连接
+void Cgen::reconnect(int idx, long long now)
+{
+    Cconn& c = m_conns[idx];
+    m_w->stats.errors += c.inflight.size();
+    c.inflight.clear();
+    close(c.fd);
+    c.fd = -1;
+    if (!c.active || !sending(now))
+    {
+        c.dead = true;
+        return;
+    }
+
+    m_w->stats.reconnects++;
+    if (!open_conn(c))
+    {
+        c.dead = true;
+        m_w->stats.connect_errors++;
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.data.u32 = idx;
+    ev.events = EPOLLIN | (c.connecting ? (int)EPOLLOUT : 0);
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, c.fd, &ev);
+    schedule(idx, now);
+}
+
+void Cgen::run()
+{
+    m_epollfd = epoll_create(1024);
+    connect_all();
+
+    // 所有线程连接完毕后由主线程设定开始时间
+    pthread_barrier_wait(&g_ready);
+    pthread_barrier_wait(&g_ready);
+
+    // 各连接的第一个请求在一个发送间隔内均匀错开
+    long long now = now_ns();
+    for (int i = 0; i < m_w->active; i++)
+    {
+        double rate = rate_at(0);
+        m_conns[i].next_ns = g_start_ns + ((rate > 0) ? (long long)(1e9 * (m_w->first_conn + i) / rate) : 0);
+        schedule(i, now);
+    }
+
+    long long drain_end = g_end_ns + (long long)(g_cfg.drain * 1e9);
+    struct epoll_event events[1024];
+    while (true)
+    {
+        now = now_ns();
+        int outstanding = 0;
+        if (!sending(now))
+        {
+            for (size_t i = 0; i < m_conns.size(); i++)
+            {
+                outstanding += m_conns[i].dead ? 0 : m_conns[i].inflight.size();
+            }
+
+            if ((outstanding == 0) || (now >= drain_end))
+            {
+                break;
+            }
+        }
+
+        int timeout = sending(now) ? (int)((g_end_ns - now) / 1000000) : (int)((drain_end - now) / 1000000);
+        if (!m_due.empty())
+        {
+            long long wait = (m_due.top().first - now) / 1000000;
+            timeout = (wait < timeout) ? (int)wait : timeout;
+        }
+
+        int n = epoll_wait(m_epollfd, events, 1024, (timeout > 0) ? timeout : 0);
+        now = now_ns();
+        for (int i = 0; i < n; i++)
+        {
+            int idx = events[i].data.u32;
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            {
+                on_read(idx, now);
+            }
+
+            if (events[i].events & EPOLLOUT)
+            {
+                on_write(idx, now);
+            }
+        }
+
+        while (!m_due.empty() && (m_due.top().first <= now))
+        {
+            int idx = m_due.top().second;
+            m_due.pop();
+            m_conns[idx].in_heap = false;
+            schedule(idx, now);
+        }
+    }
+
+    bool closed_loop = (g_cfg.stage_cnt == 0) && (g_cfg.rate <= 0);
+    for (size_t i = 0; i < m_conns.size(); i++)
+    {
+        Cconn& c = m_conns[i];
+        if (!c.dead)
+        {
+            m_w->stats.unanswered += c.inflight.size();
+            close(c.fd);
+        }
+
+        while (c.active && !closed_loop && (c.next_ns < g_end_ns))
+        {
+            m_w->stats.unsent++;
+            c.next_ns += (long long)(1e9 * g_cfg.conns / rate_at((c.next_ns - g_start_ns) / 1e9));
+        }
+    }
+
+    close(m_epollfd);
+}
+
+static void* worker(void* arg)
+{
+    Cgen* gen = new Cgen((Cworker*)arg);
+    gen->run();
+    delete gen;
+    return NULL;
+}
+
+// 打印一组延迟统计，单位为微秒
+static void print_latency(const Chist& h, bool json)
+{
+    static const double pcts[] = {50, 90, 99, 99.9, 99.99};
+    if (json)
+    {
+        printf("{\"mean\": %.1f", h.mean() / 1000.0);
+        for (int i = 0; i < (int)(sizeof(pcts) / sizeof(pcts[0])); i++)
+        {
+            printf(", \"p%g\": %.1f", pcts[i], h.percentile(pcts[i]) / 1000.0);
+        }
+
+        printf(", \"max\": %.1f}", h.m_max / 1000.0);
+        return;
+    }
+
+    printf("  latency(us)  mean %.1f", h.mean() / 1000.0);
+    for (int i = 0; i < (int)(sizeof(pcts) / sizeof(pcts[0])); i++)
+    {
+        printf("  p%g %.1f", pcts[i], h.percentile(pcts[i]) / 1000.0);
+    }
+
+    printf("  max %.1f\n", h.m_max / 1000.0);
+}
+
+static void usage(const char* prog)
+{
+    printf("usage: %s [-a addr] [-p port] [-c conns] [-i idle_conns] [-t threads] [-d seconds] [-r rate] [-R stages]\n"
+           "       [-q depth] [-k reqs_per_conn] [-u path | -s payload | -f file | -b bytes] [-e rsp_bytes] [-w drain] [-j] [-v]\n", prog);
+    printf("  -a/-p  target address and port (default 127.0.0.1:1234)\n");
+    printf("  -c     connections sending requests, -i extra connections that stay idle\n");
+    printf("  -t     threads, connections are spread evenly\n");
+    printf("  -d     seconds to send (default 10)\n");
+    printf("  -r     total requests per second, open loop; 0 = closed loop, next request when a response arrives (default)\n");
+    printf("  -R     rate stages rate[-rate]:seconds[,...], a range ramps linearly; overrides -r and -d\n");
+    printf("  -q     max outstanding (pipelined) requests per connection (default 1)\n");
+    printf("  -k     reconnect after this many requests on a connection (default 0 = never)\n");
+    printf("  -u     send HTTP/1.1 GET requests for path (default /index.html)\n");
+    printf("  -s/-f  send this raw payload (\\r \\n \\t escapes) or file content, -b n sends n bytes of 'x'\n");
+    printf("  -e     raw payloads: response bytes per request, 0 = none, default = payload size (echo)\n");
+    printf("  -w     seconds to wait for outstanding responses after sending stops (default 2)\n");
+    printf("  -j     print results as JSON\n");
+    printf("  -v     print throughput every second to stderr\n");
+}
+
+int main(int argc, char * argv [ ])
+{
+    strcpy(g_cfg.addr, "127.0.0.1");
+    const char* path = "/index.html";
+    const char* stages = NULL;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "a:p:c:i:t:d:r:R:q:k:u:s:f:b:e:w:jvh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'a': snprintf(g_cfg.addr, sizeof(g_cfg.addr), "%s", optarg); break;
+            case 'p': g_cfg.port = atoi(optarg); break;
+            case 'c': g_cfg.conns = atoi(optarg); break;
+            case 'i': g_cfg.idle = atoi(optarg); break;
+            case 't': g_cfg.threads = atoi(optarg); break;
+            case 'd': g_cfg.seconds = atof(optarg); break;
+            case 'r': g_cfg.rate = atof(optarg); break;
+            case 'R': stages = optarg; break;
+            case 'q': g_cfg.depth = atoi(optarg); break;
+            case 'k': g_cfg.churn = atoi(optarg); break;
+            case 'u': path = optarg; break;
+            case 's': g_cfg.http = false; g_cfg.payload = unescape(optarg); break;
+            case 'b': g_cfg.http = false; g_cfg.payload.assign(atoi(optarg), 'x'); break;
+            case 'e': g_cfg.expect = atoll(optarg); break;
+            case 'w': g_cfg.drain = atof(optarg); break;
+            case 'j': g_cfg.json = true; break;
+            case 'v': g_cfg.verbose = true; break;
+            case 'f':
+            {
+                g_cfg.http = false;
+                if (!read_file(optarg, g_cfg.payload))
+                {
+                    printf("cannot read %s\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+
+            case 'h':
+            default:
+            {
+                usage(basename(argv[0]));
+                return (opt == 'h') ? 0 : 1;
+            }
+        }
+    }
+
+    if (stages && !parse_stages(stages))
+    {
+        printf("bad stages: %s\n", stages);
+        return 1;
+    }
+
+    if (g_cfg.http)
+    {
+        char req[1024];
+        snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: %s:%d\r\n\r\n", path, g_cfg.addr, g_cfg.port);
+        g_cfg.payload = req;
+    }
+    else if (g_cfg.expect < 0)
+    {
+        g_cfg.expect = g_cfg.payload.size();
+    }
+
+    if ((g_cfg.conns <= 0) || (g_cfg.idle < 0) || (g_cfg.threads <= 0) || (g_cfg.seconds <= 0) || (g_cfg.rate < 0)
+        || (g_cfg.depth <= 0) || (g_cfg.churn < 0) || g_cfg.payload.empty() || (g_cfg.threads > g_cfg.conns))
+    {
+        printf("invalid arguments\n");
+        return 1;
+    }
+
+    bzero(&g_addr, sizeof(g_addr));
+    g_addr.sin_family = AF_INET;
+    g_addr.sin_port = htons(g_cfg.port);
+    if (inet_pton(AF_INET, g_cfg.addr, &g_addr.sin_addr) != 1)
+    {
+        printf("bad address: %s\n", g_cfg.addr);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    vector<Cworker*> workers(g_cfg.threads);
+    pthread_barrier_init(&g_ready, NULL, g_cfg.threads + 1);
+    int first = 0;
+    for (int i = 0; i < g_cfg.threads; i++)
+    {
+        Cworker* w = new Cworker;
+        w->idx = i;
+        w->first_conn = first;
+        w->active = g_cfg.conns / g_cfg.threads + ((i < g_cfg.conns % g_cfg.threads) ? 1 : 0);
+        w->idle = g_cfg.idle / g_cfg.threads + ((i < g_cfg.idle % g_cfg.threads) ? 1 : 0);
+        w->progress = 0;
+        first += w->active;
+        workers[i] = w;
+        pthread_create(&w->tid, NULL, worker, w);
+    }
+
+    pthread_barrier_wait(&g_ready);
+    g_start_ns = now_ns();
+    g_end_ns = g_start_ns + (long long)(g_cfg.seconds * 1e9);
+    pthread_barrier_wait(&g_ready);
+
+    // 每秒打印一次吞吐量
+    long long last = 0;
+    while (g_cfg.verbose && (now_ns() < g_end_ns))
+    {
+        sleep(1);
+        long long done = 0;
+        for (int i = 0; i < g_cfg.threads; i++)
+        {
+            done += workers[i]->progress;
+        }
+
+        fprintf(stderr, "%6.1fs %10lld req/s  target %.0f req/s\n", (now_ns() - g_start_ns) / 1e9, done - last,
+                rate_at((now_ns() - g_start_ns) / 1e9));
+        last = done;
+    }
+
+    Cstats total;
+    for (int i = 0; i < g_cfg.threads; i++)
+    {
+        pthread_join(workers[i]->tid, NULL);
+        Cstats& s = workers[i]->stats;
+        total.requests += s.requests;
+        total.responses += s.responses;
+        total.errors += s.errors;
+        total.connect_errors += s.connect_errors;
+        total.reconnects += s.reconnects;
+        total.non_2xx += s.non_2xx;
+        total.unanswered += s.unanswered;
+        total.unsent += s.unsent;
+        total.bytes_in += s.bytes_in;
+        total.bytes_out += s.bytes_out;
+        for (int j = 0; j < MAX_STAGES; j++)
+        {
+            total.hist[j].merge(s.hist[j]);
+        }
+
+        delete workers[i];
+    }
+
+    Chist all;
+    for (int j = 0; j < MAX_STAGES; j++)
+    {
+        all.merge(total.hist[j]);
+    }
+
+    const char* mode = (g_cfg.stage_cnt > 0) ? "stages" : ((g_cfg.rate > 0) ? "open-loop" : "closed-loop");
+    double secs = g_cfg.seconds;
+    if (g_cfg.json)
+    {
+        printf("{\"target\": \"%s:%d\", \"threads\": %d, \"connections\": %d, \"idle_connections\": %d, "
+               "\"depth\": %d, \"reqs_per_conn\": %d, \"mode\": \"%s\", \"rate\": %.0f, \"seconds\": %.1f, "
+               "\"payload_bytes\": %d,\n",
+               g_cfg.addr, g_cfg.port, g_cfg.threads, g_cfg.conns, g_cfg.idle, g_cfg.depth, g_cfg.churn, mode,
+               g_cfg.rate, secs, (int)g_cfg.payload.size());
+        printf(" \"requests\": %lld, \"responses\": %lld, \"errors\": %lld, \"connect_errors\": %lld, "
+               "\"reconnects\": %lld, \"non_2xx\": %lld, \"unanswered\": %lld, \"unsent\": %lld,\n",
+               total.requests, total.responses, total.errors, total.connect_errors, total.reconnects,
+               total.non_2xx, total.unanswered, total.unsent);
+        printf(" \"throughput_rps\": %.1f, \"bytes_in\": %lld, \"bytes_out\": %lld, \"gbps_in\": %.3f, "
+               "\"gbps_out\": %.3f,\n",
+               total.responses / secs, total.bytes_in, total.bytes_out, total.bytes_in * 8 / secs / 1e9,
+               total.bytes_out * 8 / secs / 1e9);
+        printf(" \"latency_us\": ");
+        print_latency(all, true);
+        printf(",\n \"stages\": [");
+        for (int j = 0; j < g_cfg.stage_cnt; j++)
+        {
+            const Cstage& st = g_cfg.stages[j];
+            printf("%s\n  {\"from\": %.0f, \"to\": %.0f, \"seconds\": %.1f, \"responses\": %lld, "
+                   "\"throughput_rps\": %.1f, \"latency_us\": ",
+                   (j > 0) ? "," : "", st.from, st.to, st.seconds, total.hist[j].m_total, total.hist[j].m_total / st.seconds);
+            print_latency(total.hist[j], true);
+            printf("}");
+        }
+
+        printf("]}\n");
+        return 0;
+    }
+
+    printf("target %s:%d, %d threads, %d connections (%d idle), depth %d, %s", g_cfg.addr, g_cfg.port, g_cfg.threads,
+           g_cfg.conns, g_cfg.idle, g_cfg.depth, mode);
+    if (g_cfg.stage_cnt == 0 && g_cfg.rate > 0)
+    {
+        printf(" %.0f req/s", g_cfg.rate);
+    }
+
+    printf(", %.1fs, %d byte requests\n", secs, (int)g_cfg.payload.size());
+    printf("  requests %lld  responses %lld  errors %lld  connect errors %lld  reconnects %lld  non-2xx %lld  unanswered %lld  unsent %lld\n",
+           total.requests, total.responses, total.errors, total.connect_errors, total.reconnects, total.non_2xx,
+           total.unanswered, total.unsent);
+    printf("  throughput %.1f req/s  in %.3f Gbit/s  out %.3f Gbit/s\n", total.responses / secs,
+           total.bytes_in * 8 / secs / 1e9, total.bytes_out * 8 / secs / 1e9);
+    print_latency(all, false);
+    for (int j = 0; j < g_cfg.stage_cnt; j++)
+    {
+        const Cstage& st = g_cfg.stages[j];
+        printf("stage %d: %.0f-%.0f req/s for %.1fs, %.1f req/s\n", j, st.from, st.to, st.seconds,
+               total.hist[j].m_total / st.seconds);
+        print_latency(total.hist[j], false);
+    }
+
+    return 0;
+}
@@ -0,0 +1,160 @@
+#!/bin/bash
+#*********************************************************************************
+# File Name: run_bench.sh
+# Description: springsnail端到端基准测试。每个场景启动本地服务端(backend)和位于其前面
+#              的springsnail，用loadgen施加负载，记录吞吐量、延迟和springsnail每个请求
+#              消耗的CPU时间。结果每行一个指标，不同提交的结果可以直接diff或用-b对比
+# History:
+#*********************************************************************************
+
+SECONDS_PER_RUN=10
+WORKERS=1
+THREADS=1
+OUT=""
+BASELINE=""
+SS_PORT=${SS_PORT:-17000}
+BE_PORT=${BE_PORT:-17001}
+IDLE=${IDLE:-10000}
+ACTIVE=${ACTIVE:-1000}
+ALL_SCENARIOS="rpc bulk churn idle"
+
+usage()
+{
+    echo "usage: $0 [-d seconds] [-n workers] [-t loadgen_threads] [-o result_file] [-b baseline_file] [scenario...]"
+    echo "  scenarios: $ALL_SCENARIOS (default all)"
+    echo "    rpc    64 byte echo ping-pong on 64 connections, closed loop"
+    echo "    bulk   1 MB responses streamed to 8 connections"
+    echo "    churn  a new connection for every 64 byte request on 32 connections, measures conn_per_sec"
+    echo "    idle   \$IDLE idle connections plus \$ACTIVE active ones at 20000 req/s (default 10000 + 1000)"
+    echo "  -o  also write the results to this file, one 'scenario.metric value' per line"
+    echo "  -b  print each metric next to the same metric in an earlier result file"
+}
+
+while getopts "d:n:t:o:b:h" opt
+do
+    case $opt in
+        d) SECONDS_PER_RUN=$OPTARG ;;
+        n) WORKERS=$OPTARG ;;
+        t) THREADS=$OPTARG ;;
+        o) OUT=$OPTARG ;;
+        b) BASELINE=$OPTARG ;;
+        *) usage; exit 1 ;;
+    esac
+done
+
+shift $((OPTIND - 1))
+SCENARIOS=${*:-$ALL_SCENARIOS}
+[ -n "$OUT" ] && OUT=$(realpath -m "$OUT")
+[ -n "$BASELINE" ] && BASELINE=$(realpath -m "$BASELINE")
+cd "$(dirname "$0")"
+
+make -s -C ../src springsnail > /dev/null && make -s backend loadgen > /dev/null || exit 1
+
+# 空闲连接场景每个进程需要两万多个描述符
+ulimit -n 65536 2> /dev/null || ulimit -n "$(ulimit -Hn)"
+
+TMP=$(mktemp -d)
+BE_PID=""
+SS_PID=""
+trap 'stop_all; rm -rf "$TMP"' EXIT
+
+stop_all()
+{
+    [ -n "$SS_PID" ] && kill "$SS_PID" 2> /dev/null && wait "$SS_PID" 2> /dev/null
+    [ -n "$BE_PID" ] && kill "$BE_PID" 2> /dev/null && wait "$BE_PID" 2> /dev/null
+    SS_PID=""
+    BE_PID=""
+}
+
+# springsnail主进程和工作进程累计的CPU时间(时钟滴答)
+cpu_ticks()
+{
+    local total=0
+    for pid in $SS_PID $(pgrep -P "$SS_PID")
+    do
+        total=$((total + $(awk '{print $14 + $15}' "/proc/$pid/stat" 2> /dev/null || echo 0)))
+    done
+
+    echo $total
+}
+
+# 等待springsnail的所有工作进程建立到服务端的连接
+wait_ready()
+{
+    local want=$1
+    for i in $(seq 1 300)
+    do
+        local have=$(ss -Htn state established "( sport = :$BE_PORT )" | wc -l)
+        [ "$have" -ge "$want" ] && return 0
+        sleep 0.1
+    done
+
+    echo "springsnail opened $have of $want server connections" >&2
+    return 0
+}
+
+# 从loadgen的JSON结果中取出字段
+field()
+{
+    grep -o "\"$1\": [-0-9.]*" "$TMP/result.json" | head -1 | awk '{print $2}'
+}
+
+# 运行一个场景：$1场景名，$2服务端参数，$3每个事件循环到服务端的连接数，其余为loadgen参数
+run_scenario()
+{
+    local name=$1 backend_args=$2 conns=$3
+    shift 3
+
+    ./backend -p "$BE_PORT" $backend_args > /dev/null &
+    BE_PID=$!
+    sleep 0.2
+    ../src/springsnail -l "127.0.0.1:$SS_PORT" -s "127.0.0.1:$BE_PORT" -c "$conns" -n "$WORKERS" -d 0 > "$TMP/springsnail.log" &
+    SS_PID=$!
+    wait_ready $((conns * WORKERS))
+
+    local before=$(cpu_ticks)
+    ./loadgen -p "$SS_PORT" -t "$THREADS" -d "$SECONDS_PER_RUN" -j "$@" > "$TMP/result.json"
+    local after=$(cpu_ticks)
+    stop_all
+
+    local responses=$(field responses)
+    local hz=$(getconf CLK_TCK)
+    {
+        echo "$name.req_per_sec $(field throughput_rps)"
+        echo "$name.conn_per_sec $(awk -v n="$(field reconnects)" -v d="$SECONDS_PER_RUN" 'BEGIN {printf "%.1f", n / d}')"
+        echo "$name.gbps_in $(field gbps_in)"
+        echo "$name.gbps_out $(field gbps_out)"
+        echo "$name.p50_us $(field p50)"
+        echo "$name.p99_us $(field p99)"
+        echo "$name.p99.9_us $(field p99.9)"
+        echo "$name.cpu_us_per_req $(awk -v t=$((after - before)) -v hz="$hz" -v n="$responses" \
+                                        'BEGIN {printf "%.2f", (n > 0) ? t * 1e6 / hz / n : 0}')"
+        echo "$name.errors $(( $(field errors) + $(field connect_errors) + $(field unanswered) ))"
+    } >> "$TMP/results"
+}
+
+echo "# commit $(git rev-parse --short HEAD 2> /dev/null) $(date '+%Y-%m-%d %H:%M:%S') ${SECONDS_PER_RUN}s $WORKERS workers $(nproc) cpus" > "$TMP/results"
+for scenario in $SCENARIOS
+do
+    case $scenario in
+        rpc)   run_scenario rpc "-m echo" 64 -c 64 -b 64 ;;
+        bulk)  run_scenario bulk "-m source -q 64 -r 1048576" 8 -c 8 -b 64 -e 1048576 ;;
+        churn) run_scenario churn "-m echo" 256 -c 32 -b 64 -k 1 ;;
+        idle)  run_scenario idle "-m echo" $((IDLE + ACTIVE)) -c "$ACTIVE" -i "$IDLE" -b 64 -r 20000 ;;
+        *)     echo "unknown scenario: $scenario" >&2; exit 1 ;;
+    esac
+done
+
+if [ -n "$BASELINE" ]
+then
+    # 对比基线：指标 基线值 本次值 变化百分比
+    awk 'NR == FNR { if ($1 !~ /^#/) base[$1] = $2; next }
+         $1 ~ /^#/ { print; next }
+         { b = base[$1]; d = (b != "" && b != 0) ? sprintf("%+.1f%%", ($2 - b) * 100 / b) : "-";
+           printf "%-24s %14s %14s %9s\n", $1, (b != "") ? b : "-", $2, d }' "$BASELINE" "$TMP/results"
+else
+    cat "$TMP/results"
+fi
+
+[ -n "$OUT" ] && cp "$TMP/results" "$OUT"
+exit 0
@@ -1,20 +1,38 @@
 /*********************************************************************************
  * File Name: demo11_server.cpp
- * Description: 基于升序链表的定时器处理非活动连接(模拟socket选项KEEPALIVE)
+ * Description: 用定时器处理非活动连接(模拟socket选项KEEPALIVE)。定时器容器使用
+ *              ../src/timer.h的公共接口，启动参数wheel选择分层时间轮，默认为四叉堆，
+ *              第二个参数为空闲超时的毫秒数。到期时间为单调时钟的毫秒数，由timerfd
+ *              按最早到期时间唤醒事件循环，不再用SIGALRM定期经信号管道通知
  * Author: jinglong
  * Date: 2020年4月29日 09:29
  * History: 
  *********************************************************************************/
 
-#include "lst_timer.h"
+#include <sys/timerfd.h>
+#include "global.h"
+#include "../src/timer.h"
+#include "../src/clock.h"
 
 #define         FD_LIMIT                65535
 #define         MAX_EVENT_NUMBER        1024
-#define         TIMESLOT                5
+#define         IDLE_TIMEOUT            15000       // 默认的空闲超时(毫秒)
+#define         BUFFER_SIZE             64
+
+// 用户数据结构
+struct client_data
+{
+    sockaddr_in addr;               // 客户端socket地址
+    int sockfd;                     // 连接socket描述符
+    char buf[BUFFER_SIZE];          // 读缓存
+    Ctimer timer;                   // 定时器
+};
 
 static int pipefd[2];
 static int epollfd = 0;
-static sort_timer_lst timer_lst;
+static int timerfd = -1;
+static long long armed = -1;            // timerfd当前设置的到期时间，-1表示没有设置
+static Ctimer_queue* timers = NULL;
 
 /**********************************************************
  * 函数名称：setnonblocking
@@ -83,18 +101,49 @@ void addsig(int sig)
     assert(sigaction(sig, &sa, NULL) != -1);
 }
 
-// 定时器处理函数
+// 定时器处理函数：timerfd到期后已经停止，执行到期的定时器后由arm_timerfd重新设置
 void timer_handler()
 {
-    timer_lst.tick();
-    alarm(TIMESLOT);
+    armed = -1;
+    timers->expire(monotonic_ms());
+}
+
+/*************************************************************************
+ * 函数名称：arm_timerfd
+ * 函数功能：按定时器容器的最早到期时间设置timerfd，到期时间是单调时钟的
+ *           绝对时间，已经过去时timerfd立即可读。没有定时器时停止timerfd。
+ *           最早到期时间没有变化时不调用timerfd_settime
+ * 输入参数：无
+ * 输出参数：无
+ * 返 回 值：无
+ *************************************************************************/
+void arm_timerfd()
+{
+    long long next = timers->next_expire();
+    if (next == armed)
+    {
+        return;
+    }
+
+    // it_value全为0表示停止timerfd
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (next >= 0)
+    {
+        its.it_value.tv_sec = next / 1000;
+        its.it_value.tv_nsec = (next % 1000) * 1000000;
+    }
+
+    timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+    armed = next;
 }
 
 // 定时器回调函数: 删除非活动连接socket上的注册事件，并关闭连接
-void cb_func(client_data* user_data)
+void cb_func(void*, void* data)
 {
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
+    client_data* user_data = (client_data*)data;
     assert(user_data);
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     close(user_data->sockfd);
     printf("close fd %d\n", user_data->sockfd);
 }
@@ -117,12 +166,22 @@ int main(int argc, char * argv [ ])
     assert(ret != -1);
 
     struct epoll_event events[MAX_EVENT_NUMBER];
-    int epollfd = epoll_create(5);
+    epollfd = epoll_create(5);
     assert(epollfd != -1);
 
+    bool use_wheel = (argc > 1) && (strcmp(argv[1], "wheel") == 0);
+    int idle_timeout = (argc > 2) ? atoi(argv[2]) : IDLE_TIMEOUT;
+    timers = Ctimer_queue::create(use_wheel ? TIMER_WHEEL : TIMER_HEAP, monotonic_ms());
+    printf("timer container: %s, idle timeout %d ms\n", use_wheel ? "wheel" : "heap", idle_timeout);
+
     // 注册监听描述符的事件
     addfd(epollfd, listenfd);
 
+    // 定时器到期由timerfd通知，和其他描述符一样通过epoll_wait返回
+    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    assert(timerfd != -1);
+    addfd(epollfd, timerfd);
+
     // 创建双向管道
     ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
     assert(ret != -1);
@@ -132,13 +191,11 @@ int main(int argc, char * argv [ ])
     addfd(epollfd, pipefd[0]);
 
     // 设置信号处理函数
-    addsig(SIGALRM);
     addsig(SIGTERM);
     bool stop_server = false;
 
     client_data* users = new client_data[FD_LIMIT];
     bool timeout = false;
-    alarm(TIMESLOT);
 
     while (!stop_server)
     {
@@ -164,14 +221,20 @@ int main(int argc, char * argv [ ])
                 // 创建用户信息
                 users[connfd].addr = clnt_addr;
                 users[connfd].sockfd = connfd;
-                // 创建定时器，并设置超时时间和回调函数
-                util_timer* timer = new util_timer;
-                timer->user_data = &users[connfd];
-                timer->cb_func = cb_func;
-                time_t cur = time(NULL);
-                timer->expire = cur + 3 * TIMESLOT;
-                users[connfd].timer = timer;        // 将用户和定时器绑定
-                timer_lst.add_timer(timer);         // 将定时器添加到定时器链表中
+                // 设置定时器的回调函数和超时时间，并将其添加到定时器容器中
+                users[connfd].timer.init(cb_func, NULL, &users[connfd]);
+                timers->add(&users[connfd].timer, monotonic_ms() + idle_timeout);
+            }
+            // 用timeout标记有定时任务需要处理，但不会立即处理定时任务
+            // 因为定时任务的优先级并不高，优先处理其他重要任务
+            else if ((sockfd == timerfd) && (events[i].events & EPOLLIN))
+            {
+                uint64_t expirations = 0;
+                while (read(timerfd, &expirations, sizeof(expirations)) > 0)
+                {
+                }
+
+                timeout = true;
             }
             // 处理信号
             else if ((sockfd == pipefd[0]) && (events[i].events & EPOLLIN))
@@ -193,14 +256,6 @@ int main(int argc, char * argv [ ])
                     {
                         switch (signals[i])
                         {
-                            // 用timeout标记有定时任务需要处理，但不会立即处理定时任务
-                            // 因为定时任务的优先级并不高，优先处理其他重要任务
-                            case SIGALRM:
-                            {
-                                timeout = true;
-                                break;
-                            }
-
                             case SIGTERM:
                             {
                                 stop_server = true;
@@ -216,39 +271,28 @@ int main(int argc, char * argv [ ])
                 ret = recv(sockfd, users[sockfd].buf, sizeof(users[sockfd].buf) - 1, 0);
                 printf("got %d bytes of client data %s from %d\n", ret, users[sockfd].buf, sockfd);
 
-                util_timer* timer = users[sockfd].timer;
+                Ctimer* timer = &users[sockfd].timer;
                 if (ret < 0)
                 {
                     // 如果发生错误，则关闭连接，并移除对应的定时器
                     if (errno != EAGAIN)
                     {
-                        cb_func(&users[sockfd]);
-                        if (timer)
-                        {
-                            timer_lst.del_timer(timer);
-                        }
+                        cb_func(NULL, &users[sockfd]);
+                        timers->cancel(timer);
                     }
                 }
                 else if (ret == 0)
                 {
                     // 如果对方已经关闭连接，那我们也关闭连接，并移除相应的定时器
-                    cb_func(&users[sockfd]);
-                    if (timer)
-                    {
-                        timer_lst.del_timer(timer);
-                    }
+                    cb_func(NULL, &users[sockfd]);
+                    timers->cancel(timer);
                 }
                 else 
                 {
                     // 如果某个客户连接上有数据可读，则我们需要调整该连接对应的定时器，以延迟
-                    // 该连接被关闭的时间
-                    if (timer)
-                    {
-                        time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        printf("adjust time once\n");
-                        timer_lst.adjust_timer(timer);
-                    }
+                    // 该连接被关闭的时间。堆和时间轮都可以直接调整，不需要重新查找位置
+                    printf("adjust time once\n");
+                    timers->adjust(timer, monotonic_ms() + idle_timeout);
                 }
             }
         }
@@ -258,12 +302,17 @@ int main(int argc, char * argv [ ])
             timer_handler();
             timeout = false;
         }
+
+        // 本轮添加、调整或执行的定时器可能改变了最早到期时间
+        arm_timerfd();
     }
 
     close(listenfd);
+    close(timerfd);
     close(pipefd[1]);
     close(pipefd[0]);
     delete [] users;
+    delete timers;
     return 0;
 }
 
@@ -15,6 +15,8 @@
 
 extern int addfd(int epollfd, int fd, bool one_shot);
 
+static volatile sig_atomic_t g_print_stats = 0;     // 收到SIGUSR1时打印缓存统计
+
 void addsig(int sig, void(*sig_handler)(int), bool restart = true)
 {
     struct sigaction sa;
@@ -30,6 +32,11 @@ void addsig(int sig, void(*sig_handler)(int), bool restart = true)
     assert(sigaction(sig, &sa, NULL) != -1);
 }
 
+void stats_handler(int)
+{
+    g_print_stats = 1;
+}
+
 void show_error(int connfd, const char* info)
 {
     printf("%s\n", info);
@@ -41,12 +48,13 @@ int main(int argc, char * argv [ ])
 {
     // 忽略SIGPIPE信号
     addsig(SIGPIPE, SIG_IGN);
+    addsig(SIGUSR1, stats_handler);
 
-    // 创建线程池
-    threadpool<http_conn>* pool = NULL;
+    // 创建线程池，每个工作线程一个请求队列，空闲的线程从其他线程的队列中窃取请求
+    threadpool<http_conn, steal_queue<http_conn> >* pool = NULL;
     try
     {
-        pool = new threadpool<http_conn>;
+        pool = new threadpool<http_conn, steal_queue<http_conn> >;
     }
     catch (...)
     {
@@ -92,6 +100,12 @@ int main(int argc, char * argv [ ])
             break;
         }
 
+        if (g_print_stats)
+        {
+            g_print_stats = 0;
+            http_conn::print_stats();
+        }
+
         for (int i = 0; i < number; i++)
         {
             int sockfd = events[i].data.fd;
@@ -125,7 +139,8 @@ int main(int argc, char * argv [ ])
                 // 根据读的结果，决定是将任务添加到线程池还是关闭连接
                 if (users[sockfd].read())
                 {
-                    pool->append(users + sockfd);
+                    // 同一个连接的请求交给同一个工作线程，连接的缓冲区留在它的缓存中
+                    pool->append(users + sockfd, sockfd);
                 }
                 else 
                 {
@@ -138,6 +153,11 @@ int main(int argc, char * argv [ ])
                 {
                     users[sockfd].close_conn();
                 }
+                else if (users[sockfd].has_pending())
+                {
+                    // 读缓冲区中还有流水线请求没有处理，继续交给线程池
+                    pool->append(users + sockfd, sockfd);
+                }
             }
             else 
             {
@@ -0,0 +1,216 @@
+#ifndef __FILE_CACHE_H_
+#define __FILE_CACHE_H_
+
+// 静态文件的描述符和元数据缓存：按路径缓存打开的文件描述符和stat结果，按LRU淘汰。
+// 热点文件不再每个请求都stat/open/close，每隔一段时间重新stat一次路径，
+// 文件被修改或替换(mtime、大小、inode变化)时重新打开
+#include "global.h"
+#include "locker.h"
+
+// 缓存的文件
+struct file_entry
+{
+    std::string path;
+    int fd;
+    struct stat st;
+    long long checked_ms;                       // 上次核对文件状态的时间
+    int refs;                                   // 正在使用该描述符的应答数
+    bool evicted;                               // 已经移出缓存，最后一个使用者释放时关闭
+    std::list<file_entry*>::iterator lru;       // 在LRU链表中的位置
+};
+
+class file_cache
+{
+public:
+    file_cache(int capacity = 1024, int revalidate_ms = 1000)
+        : m_capacity(capacity), m_revalidate_ms(revalidate_ms) {}
+    ~file_cache();
+
+public:
+    file_entry* acquire(const char* path, int& err);
+    void release(file_entry* entry);
+
+private:
+    static long long now_ms();
+    static file_entry* open_entry(const char* path, int& err);
+    static bool same_file(const struct stat& a, const struct stat& b);
+    void drop(file_entry* entry);
+    void unref(file_entry* entry);
+
+private:
+    int m_capacity;                                     // 最多缓存的文件数
+    int m_revalidate_ms;                                // 重新核对文件状态的间隔
+    std::map<std::string, file_entry*> m_entries;
+    std::list<file_entry*> m_lru;                       // 表头为最近使用的文件
+    CLocker m_locker;                                   // 工作线程共享缓存
+};
+
+inline file_cache::~file_cache()
+{
+    std::map<std::string, file_entry*>::iterator it = m_entries.begin();
+    for (; it != m_entries.end(); ++it)
+    {
+        close(it->second->fd);
+        delete it->second;
+    }
+}
+
+inline long long file_cache::now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// 打开文件并检查权限，失败时err为ENOENT、EACCES或EISDIR
+inline file_entry* file_cache::open_entry(const char* path, int& err)
+{
+    struct stat st;
+    if (stat(path, &st) < 0)
+    {
+        err = ENOENT;
+        return NULL;
+    }
+
+    if (!(st.st_mode & S_IROTH))
+    {
+        err = EACCES;
+        return NULL;
+    }
+
+    if (S_ISDIR(st.st_mode))
+    {
+        err = EISDIR;
+        return NULL;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if ((fd < 0) || (fstat(fd, &st) < 0))
+    {
+        err = (fd < 0) ? errno : EACCES;
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+
+        return NULL;
+    }
+
+    file_entry* entry = new file_entry;
+    entry->path = path;
+    entry->fd = fd;
+    entry->st = st;
+    entry->checked_ms = now_ms();
+    entry->refs = 0;
+    entry->evicted = false;
+    return entry;
+}
+
+inline bool file_cache::same_file(const struct stat& a, const struct stat& b)
+{
+    return (a.st_ino == b.st_ino) && (a.st_dev == b.st_dev) && (a.st_size == b.st_size)
+        && (a.st_mtim.tv_sec == b.st_mtim.tv_sec) && (a.st_mtim.tv_nsec == b.st_mtim.tv_nsec)
+        && (a.st_mode == b.st_mode);
+}
+
+// 移出缓存，仍在使用时由最后一个使用者关闭
+inline void file_cache::drop(file_entry* entry)
+{
+    m_entries.erase(entry->path);
+    m_lru.erase(entry->lru);
+    entry->evicted = true;
+    if (entry->refs == 0)
+    {
+        close(entry->fd);
+        delete entry;
+    }
+}
+
+inline void file_cache::unref(file_entry* entry)
+{
+    if ((--entry->refs == 0) && entry->evicted)
+    {
+        close(entry->fd);
+        delete entry;
+    }
+}
+
+/*************************************************************************
+ * 函数名称：file_cache::acquire
+ * 函数功能：获取文件的描述符和状态，使用完之后必须调用release。命中且未到核对
+ *          时间时不做任何系统调用；未命中时在锁外打开文件，避免阻塞其他线程
+ * 输入参数：const char* path   文件的完整路径
+ * 输出参数：int& err           失败原因：ENOENT、EACCES或EISDIR
+ * 返 回 值：缓存的文件，失败返回NULL
+ *************************************************************************/
+inline file_entry* file_cache::acquire(const char* path, int& err)
+{
+    long long now = now_ms();
+    std::string key(path);
+
+    m_locker.lock();
+    std::map<std::string, file_entry*>::iterator it = m_entries.find(key);
+    if (it != m_entries.end())
+    {
+        file_entry* entry = it->second;
+        bool valid = true;
+        if (now - entry->checked_ms >= m_revalidate_ms)
+        {
+            struct stat st;
+            valid = (stat(path, &st) == 0) && same_file(st, entry->st);
+            entry->checked_ms = now;
+        }
+
+        if (valid)
+        {
+            entry->refs++;
+            m_lru.splice(m_lru.begin(), m_lru, entry->lru);
+            m_locker.unlock();
+            return entry;
+        }
+
+        // 文件已经改变，重新打开
+        drop(entry);
+    }
+    m_locker.unlock();
+
+    file_entry* entry = open_entry(path, err);
+    if (!entry)
+    {
+        return NULL;
+    }
+
+    m_locker.lock();
+    // 其他线程可能已经同时打开了同一个文件
+    it = m_entries.find(key);
+    if (it != m_entries.end())
+    {
+        close(entry->fd);
+        delete entry;
+        entry = it->second;
+        m_lru.splice(m_lru.begin(), m_lru, entry->lru);
+    }
+    else
+    {
+        m_lru.push_front(entry);
+        entry->lru = m_lru.begin();
+        m_entries[key] = entry;
+        while ((int)m_entries.size() > m_capacity)
+        {
+            drop(m_lru.back());
+        }
+    }
+
+    entry->refs++;
+    m_locker.unlock();
+    return entry;
+}
+
+inline void file_cache::release(file_entry* entry)
+{
+    m_locker.lock();
+    unref(entry);
+    m_locker.unlock();
+}
+
+#endif
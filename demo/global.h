@@ -22,9 +22,13 @@
 #include <sys/wait.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <exception>
 #include <semaphore.h>
 #include <list>
+#include <map>
+#include <string>
 #include <cstdio>
 #include <stdarg.h>
 
@@ -7,6 +7,7 @@
  *****************************************************************/
 
 #include "http_conn.h"
+#include "../src/httpscan.h"
 
 // 定义HTTP的一些状态信息
 const char* ok_200_title = "OK";
@@ -91,12 +92,15 @@ void modfd(int epollfd, int fd, int ev)
 
 int http_conn::m_user_count = 0;
 int http_conn::m_epollfd = -1;
+file_cache http_conn::m_file_cache;
+object_cache http_conn::m_object_cache;
 
 // 关闭一个HTTP连接
 void http_conn::close_conn(bool real_close)
 {
     if (real_close && (m_sockfd != -1))
     {
+        release_files();
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
         m_user_count--;
@@ -129,6 +133,25 @@ void http_conn::init(int sockfd, const sockaddr_in & addr)
 
 // 初始化连接
 void http_conn::init()
+{
+    m_checked_idx = 0;
+    m_read_idx = 0;
+    m_write_idx = 0;
+    m_part_count = 0;
+    m_part_idx = 0;
+    m_bytes_to_send = 0;
+    m_file = 0;
+    m_object = 0;
+    m_close_after = false;
+    m_more = false;
+    memset(m_read_buf, '\0', sizeof(m_read_buf));
+    memset(m_write_buf, '\0', sizeof(m_write_buf));
+    memset(m_real_file, '\0', sizeof(m_real_file));
+    init_request();
+}
+
+// 开始解析下一个请求，读缓冲区中已经读入的数据(流水线请求)保留
+void http_conn::init_request()
 {
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
@@ -137,17 +160,47 @@ void http_conn::init()
     m_version = 0;
     m_content_length = 0;
     m_host = 0;
-    m_start_line = 0;
-    m_checked_idx = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
-    memset(m_read_buf, '\0', sizeof(m_read_buf));
-    memset(m_write_buf, '\0', sizeof(m_write_buf));
-    memset(m_real_file, '\0', sizeof(m_real_file));
+    m_start_line = m_checked_idx;
+    m_req_start = m_checked_idx;
+}
+
+// 把还没有处理完的请求移到读缓冲区开头，给后续数据腾出空间
+void http_conn::compact_read_buf()
+{
+    int shift = m_req_start;
+    if (shift == 0)
+    {
+        return;
+    }
+
+    memmove(m_read_buf, m_read_buf + shift, m_read_idx - shift);
+    m_read_idx -= shift;
+    m_checked_idx -= shift;
+    m_start_line -= shift;
+    m_req_start = 0;
+
+    // 已经解析出的字段指向读缓冲区，随数据一起移动
+    if (m_url)
+    {
+        m_url -= shift;
+    }
+
+    if (m_version)
+    {
+        m_version -= shift;
+    }
+
+    if (m_host)
+    {
+        m_host -= shift;
+    }
 }
 
 LINE_STATUS http_conn::parse_line()
 {
+    // 一次比较多个字节，直接跳到下一个CR或LF
+    m_checked_idx = scan_any(m_read_buf, m_checked_idx, m_read_idx, "\r\n", 2);
+
     char temp;
     for (; m_checked_idx < m_read_idx; m_checked_idx++)
     {
@@ -183,7 +236,8 @@ LINE_STATUS http_conn::parse_line()
     return LINE_OPEN;
 }
 
-// 循环读取客户数据，直到无数据可读或者对方关闭连接
+// 循环读取客户数据，直到无数据可读、读缓冲区已满或者对方关闭连接。读缓冲区满时
+// 先处理已读入的请求，剩下的数据在重新注册EPOLLIN事件时会再次触发
 bool http_conn::read()
 {
     if (m_read_idx >= READ_BUFFER_SIZE)
@@ -192,7 +246,7 @@ bool http_conn::read()
     }
 
     int bytes_read = 0;
-    while (true)
+    while (m_read_idx < READ_BUFFER_SIZE)
     {
         bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
 
@@ -216,19 +270,44 @@ bool http_conn::read()
     return true;
 }
 
-// 解析HTTP请求行，获取请求方法，目标URL，以及HTTP版本号
-HTTP_CODE http_conn::parse_request_line(char * text)
+// 跳过text中[pos, end)开头的空格和制表符，返回第一个非空白字符的位置
+static int skip_blank(const char* text, int pos, int end)
 {
-    m_url = strpbrk(text, " \t");
-    if (!m_url)
+    while ((pos < end) && ((text[pos] == ' ') || (text[pos] == '\t')))
+    {
+        pos++;
+    }
+
+    return pos;
+}
+
+// 长度为len的字段是否等于token(不区分大小写)。先比较长度，不需要扫描到字符串结尾
+static bool token_eq(const char* text, int len, const char* token, int token_len)
+{
+    return (len == token_len) && (strncasecmp(text, token, token_len) == 0);
+}
+
+/**************************************************************
+ * 函数名称：http_conn::parse_request_line
+ * 函数功能：解析HTTP请求行，获取请求方法，目标URL，以及HTTP版本号。
+ *          行的长度已知，分隔的空白用scan_any一次比较多个字节查找，
+ *          方法和版本按长度比较
+ * 输入参数：text       请求行，CRLF已经被替换为'\0'
+ *           len        请求行的长度
+ * 输出参数：无
+ * 返 回 值：NO_REQUEST表示继续解析头部，BAD_REQUEST表示请求行有误
+ **************************************************************/
+HTTP_CODE http_conn::parse_request_line(char * text, int len)
+{
+    int method_end = scan_any(text, 0, len, " \t", 2);
+    if (method_end == len)
     {
         return BAD_REQUEST;
     }
-    *m_url++ = '\0';
+    text[method_end] = '\0';
 
-    char* method = text;
     // 仅支持GET方法
-    if (strcasecmp(method, "GET") == 0)
+    if (token_eq(text, method_end, "GET", 3))
     {
         m_method = GET;
     }
@@ -237,17 +316,19 @@ HTTP_CODE http_conn::parse_request_line(char * text)
         return BAD_REQUEST;
     }
 
-    m_url += strspn(m_url, " \t");
-    m_version = strpbrk(m_url, " \t");
-    if (!m_version)
+    int url = skip_blank(text, method_end + 1, len);
+    int url_end = scan_any(text, url, len, " \t", 2);
+    if (url_end == len)
     {
         return BAD_REQUEST;
     }
 
-    *m_version++ = '\0';
-    m_version += strspn(m_version, " \t");
+    text[url_end] = '\0';
+    m_url = text + url;
+    int version = skip_blank(text, url_end + 1, len);
+    m_version = text + version;
     // 仅支持HTTP/1.1方法
-    if (strcasecmp(m_version, "HTTP/1.1") != 0)
+    if (!token_eq(m_version, len - version, "HTTP/1.1", 8))
     {
         return BAD_REQUEST;
     }
@@ -255,8 +336,8 @@ HTTP_CODE http_conn::parse_request_line(char * text)
     // 检查URL是否合法
     if (strncasecmp(m_url, "http://", 7) == 0)
     {
-        m_url += 7;
-        m_url = strchr(m_url, '/');
+        int path = scan_char(text, url + 7, url_end, '/');
+        m_url = (path < url_end) ? text + path : NULL;
     }
 
     if (!m_url || m_url[0] != '/')
@@ -268,11 +349,20 @@ HTTP_CODE http_conn::parse_request_line(char * text)
     return NO_REQUEST;
 }
 
-// 解析HTTP的一个头部信息
-HTTP_CODE http_conn::parse_headers(char * text)
+/**************************************************************
+ * 函数名称：http_conn::parse_headers
+ * 函数功能：解析HTTP的一个头部信息。用scan_char查找冒号，按字段名
+ *          的长度比较，只有长度相同时才比较字符
+ * 输入参数：text       头部行，CRLF已经被替换为'\0'
+ *           len        头部行的长度
+ * 输出参数：无
+ * 返 回 值：GET_REQUEST表示头部解析完毕，CHECK_STATE_CONTENT状态下
+ *          返回NO_REQUEST继续读取消息体，BAD_REQUEST表示头部有误
+ **************************************************************/
+HTTP_CODE http_conn::parse_headers(char * text, int len)
 {
     // 遇到空行，说明头部字段解析完毕
-    if (text[0] == '\0')
+    if (len == 0)
     {
         // 如果HTTP请求有消息体，则还需要读取m_content_length字节的消息体，状态机转移到CHECK_STATE_CONTENT状态
         if (m_content_length != 0)
@@ -283,69 +373,91 @@ HTTP_CODE http_conn::parse_headers(char * text)
 
         return GET_REQUEST;
     }
+
+    int colon = scan_char(text, 0, len, ':');
+    if (colon == len)
+    {
+        return NO_REQUEST;
+    }
+
+    int value = skip_blank(text, colon + 1, len);
     // 处理connection头部字段
-    else if (strncasecmp(text, "Connection:", 11) == 0)
+    if (token_eq(text, colon, "Connection", 10))
     {
-        text += 11;
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0)
+        if (token_eq(text + value, len - value, "keep-alive", 10))
         {
             m_linger = true;
         }
     }
     // 处理Content-Length头部字段
-    else if (strncasecmp(text, "Content-Length:", 15) == 0)
+    else if (token_eq(text, colon, "Content-Length", 14))
     {
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
+        m_content_length = atol(text + value);
+        if (m_content_length < 0)
+        {
+            return BAD_REQUEST;
+        }
     }
     // 处理Host头部字段
-    else if (strncasecmp(text, "Host:", 5) == 0)
-    {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
-    }
-    else 
+    else if (token_eq(text, colon, "Host", 4))
     {
-        printf("oop! unknow header %s\n", text);
+        m_host = text + value;
     }
 
     return NO_REQUEST;
 }
 
-// 我们没有真正解析HTTP请求的消息体，只是判断它是否被完整的读入了
-HTTP_CODE http_conn::parse_content(char * text)
+// 我们没有真正解析HTTP请求的消息体，只是判断它是否被完整的读入了。
+// 消息体之后的数据属于下一个流水线请求，不能改动
+HTTP_CODE http_conn::parse_content(char*)
 {
     if (m_read_idx >= (m_content_length + m_checked_idx))
     {
-        text[m_content_length] = '\0';
+        m_checked_idx += m_content_length;
+        m_start_line = m_checked_idx;
         return GET_REQUEST;
     }
 
     return NO_REQUEST;
 }
 
-// 主状态机
+// 主状态机：解析读缓冲区中的下一个请求
 HTTP_CODE http_conn::process_read()
 {
     LINE_STATUS line_status = LINE_OK;
     HTTP_CODE ret = NO_REQUEST;
     char* text = 0;
+    int len = 0;
 
-    while (((m_check_state == CHECK_STATE_CONTENT) && (line_status == LINE_OK)) 
-        || ((line_status = parse_line()) == LINE_OK))
+    while (true)
     {
+        // 消息体不按行解析
+        if (m_check_state == CHECK_STATE_CONTENT)
+        {
+            ret = parse_content(m_read_buf + m_checked_idx);
+            return (ret == GET_REQUEST) ? do_request() : NO_REQUEST;
+        }
+
+        line_status = parse_line();
+        if (line_status == LINE_BAD)
+        {
+            return BAD_REQUEST;
+        }
+        else if (line_status == LINE_OPEN)
+        {
+            return NO_REQUEST;
+        }
+
+        // parse_line把行尾的CRLF替换成了两个'\0'
         text = get_line();
+        len = m_checked_idx - 2 - m_start_line;
         m_start_line = m_checked_idx;
-        printf("got 1 http line: %s\n", text);
 
         switch (m_check_state)
         {
             case CHECK_STATE_REQUESTLINE:
             {
-                ret = parse_request_line(text);
+                ret = parse_request_line(text, len);
                 if (ret == BAD_REQUEST)
                 {
                     return BAD_REQUEST;
@@ -356,7 +468,7 @@ HTTP_CODE http_conn::process_read()
 
             case CHECK_STATE_HEADER:
             {
-                ret = parse_headers(text);
+                ret = parse_headers(text, len);
                 if (ret == BAD_REQUEST)
                 {
                     return BAD_REQUEST;
@@ -369,18 +481,6 @@ HTTP_CODE http_conn::process_read()
                 break;
             }
 
-            case CHECK_STATE_CONTENT:
-            {
-                ret = parse_content(text);
-                if (ret == GET_REQUEST)
-                {
-                    return do_request();
-                }
-
-                line_status = LINE_OPEN;
-                break;
-            }
-
             default:
             {
                 return INTERNAL_ERROR;
@@ -392,60 +492,165 @@ HTTP_CODE http_conn::process_read()
 }
 
 // 当遇到一个完整的、正确的HTTP请求时，我们就分析目标文件的属性。如果目标文件存在，对所有用户可读，
-// 且不是目录，则使用mmap将其映射到内存地址m_file_address处，并告诉调用者获取文件成功
+// 且不是目录，则从文件缓存中取得它打开的描述符，并告诉调用者获取文件成功。文件内容之后用sendfile发送
 HTTP_CODE http_conn::do_request()
 {
     strcpy(m_real_file, doc_root);
     int len = strlen(doc_root);
     strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
-    if (stat(m_real_file, &m_file_stat) < 0)
+
+    // 先查热点对象缓存，命中时直接发送缓存的完整应答。缓存的应答带有keep-alive头部，
+    // 只用于保持连接的请求
+    if (m_linger)
     {
-        return NO_RESOURCE;
+        m_object = m_object_cache.acquire(m_real_file);
+        if (m_object)
+        {
+            return FILE_REQUEST;
+        }
+    }
+
+    int err = 0;
+    m_file = m_file_cache.acquire(m_real_file, err);
+    if (!m_file)
+    {
+        if (err == EACCES)
+        {
+            return FORBIDDEN_REQUEST;
+        }
+
+        return (err == EISDIR) ? BAD_REQUEST : NO_RESOURCE;
     }
 
-    if (!(m_file_stat.st_mode & S_IROTH))
+    return FILE_REQUEST;
+}
+
+// 释放这一批应答引用的文件
+void http_conn::release_files()
+{
+    if (m_file)
     {
-        return FORBIDDEN_REQUEST;
+        m_file_cache.release(m_file);
+        m_file = 0;
     }
 
-    if (S_ISDIR(m_file_stat.st_mode))
+    if (m_object)
     {
-        return BAD_REQUEST;
+        m_object_cache.release(m_object);
+        m_object = 0;
     }
 
-    int fd = open(m_real_file, O_RDONLY);
-    m_file_address = (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
-    return FILE_REQUEST;
+    for (int i = 0; i < m_part_count; i++)
+    {
+        if (m_parts[i].file)
+        {
+            m_file_cache.release(m_parts[i].file);
+            m_parts[i].file = 0;
+        }
+
+        if (m_parts[i].object)
+        {
+            m_object_cache.release(m_parts[i].object);
+            m_parts[i].object = 0;
+        }
+    }
 }
 
-// 对内存映射执行munmap操作
-void http_conn::unmap()
+// 追加一段写缓冲区中的数据，与上一段相邻时合并
+void http_conn::add_part(char* base, int len)
 {
-    if (m_file_address)
+    out_part* last = (m_part_count > 0) ? &m_parts[m_part_count - 1] : 0;
+    if (last && !last->file && !last->object && (last->base + last->len == base))
+    {
+        last->len += len;
+    }
+    else
     {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+        m_parts[m_part_count].base = base;
+        m_parts[m_part_count].object = 0;
+        m_parts[m_part_count].file = 0;
+        m_parts[m_part_count].offset = 0;
+        m_parts[m_part_count].len = len;
+        m_part_count++;
     }
+
+    m_bytes_to_send += len;
 }
 
-// 写HTTP响应
-bool http_conn::write()
+// 追加一个文件的全部内容，分段持有文件的引用直到发送完毕
+void http_conn::add_file_part(file_entry* file)
+{
+    m_parts[m_part_count].base = 0;
+    m_parts[m_part_count].object = 0;
+    m_parts[m_part_count].file = file;
+    m_parts[m_part_count].offset = 0;
+    m_parts[m_part_count].len = file->st.st_size;
+    m_part_count++;
+    m_bytes_to_send += file->st.st_size;
+}
+
+// 追加一个缓存的完整应答，与其他内存分段一起用一次sendmsg发送
+void http_conn::add_object_part(cached_object* object)
 {
-    int temp = 0;
-    int bytes_have_send = 0;
-    int bytes_to_send = m_write_idx;
+    m_parts[m_part_count].base = object->data;
+    m_parts[m_part_count].object = object;
+    m_parts[m_part_count].file = 0;
+    m_parts[m_part_count].offset = 0;
+    m_parts[m_part_count].len = object->len;
+    m_part_count++;
+    m_bytes_to_send += object->len;
+}
 
-    if (bytes_to_send == 0)
+/*************************************************************************
+ * 函数名称：write
+ * 函数功能：发送这一批应答。相邻的内存分段用一次sendmsg发送，文件分段用sendfile
+ *          直接从页缓存发送；只发送了一部分时记下进度，等待下一个EPOLLOUT事件继续
+ * 输入参数：无
+ * 输出参数：无
+ * 返 回 值：false表示需要关闭连接
+ *************************************************************************/
+bool http_conn::write()
+{
+    if (m_bytes_to_send == 0)
     {
         modfd(m_epollfd, m_sockfd, EPOLLIN);
-        init();
         return true;
     }
 
-    while (1)
+    while (m_part_idx < m_part_count)
     {
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        out_part& part = m_parts[m_part_idx];
+        ssize_t temp = 0;
+        if (part.file)
+        {
+            temp = sendfile(m_sockfd, part.file->fd, &part.offset, part.len);
+            // 文件在发送过程中被截短
+            if (temp == 0)
+            {
+                release_files();
+                return false;
+            }
+        }
+        else
+        {
+            struct iovec iv[MAX_PARTS];
+            int count = 0;
+            for (int i = m_part_idx; (i < m_part_count) && !m_parts[i].file; i++)
+            {
+                iv[count].iov_base = m_parts[i].base;
+                iv[count].iov_len = m_parts[i].len;
+                count++;
+            }
+
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iv;
+            msg.msg_iovlen = count;
+            // 后面紧跟文件内容时，让头部和文件的开头合并到同一个TCP段中
+            int flags = (m_part_idx + count < m_part_count) ? MSG_MORE : 0;
+            temp = sendmsg(m_sockfd, &msg, flags);
+        }
+
         if (temp <= -1)
         {
             // 如果TCP写缓存没有空间，则等待一下轮的EPOLLOUT事件
@@ -455,28 +660,48 @@ bool http_conn::write()
                 return true;
             }
 
-            unmap();
+            release_files();
             return false;
         }
 
-        bytes_to_send -= temp;
-        bytes_have_send += temp;
-        if (bytes_to_send <= bytes_have_send)
+        m_bytes_to_send -= temp;
+        if (part.file)
         {
-            unmap();
-            if (m_linger)
-            {
-                init();
-                modfd(m_epollfd, m_sockfd, EPOLLIN);
-                return true;
-            }
-            else 
-            {
-                modfd(m_epollfd, m_sockfd, EPOLLIN);
-                return false;
-            }
+            part.len -= temp;
+            m_part_idx += (part.len == 0) ? 1 : 0;
+            continue;
         }
+
+        // 跳过已经发完的内存分段，调整发送了一部分的分段
+        while ((m_part_idx < m_part_count) && !m_parts[m_part_idx].file && (temp >= m_parts[m_part_idx].len))
+        {
+            temp -= m_parts[m_part_idx].len;
+            m_part_idx++;
+        }
+
+        if (temp > 0)
+        {
+            m_parts[m_part_idx].base += temp;
+            m_parts[m_part_idx].len -= temp;
+        }
+    }
+
+    release_files();
+    m_write_idx = 0;
+    m_part_count = 0;
+    m_part_idx = 0;
+    if (m_close_after)
+    {
+        return false;
     }
+
+    // 还有流水线请求没有处理时由调用者交给工作线程，此时不能注册事件
+    if (!m_more)
+    {
+        modfd(m_epollfd, m_sockfd, EPOLLIN);
+    }
+
+    return true;
 }
 
 // 往写缓冲区中写入待发送的数据
@@ -507,9 +732,7 @@ bool http_conn::add_status_line(int status, const char * title)
 
 bool http_conn::add_headers(int content_length)
 {
-    add_content_length(content_length);
-    add_Linger();
-    add_blank_line();
+    return add_content_length(content_length) && add_Linger() && add_blank_line();
 }
 
 bool http_conn::add_content_length(int content_length)
@@ -532,9 +755,10 @@ bool http_conn::add_content(const char * content)
     return add_response("%s", content);
 }
 
-// 根据服务器处理HTTP请求的结果，决定返回给客户端的内容
+// 根据服务器处理HTTP请求的结果，决定返回给客户端的内容。应答追加到这一批应答之后
 bool http_conn::process_write(HTTP_CODE ret)
 {
+    int head_start = m_write_idx;
     switch (ret)
     {
         case INTERNAL_ERROR:
@@ -587,19 +811,41 @@ bool http_conn::process_write(HTTP_CODE ret)
 
         case FILE_REQUEST:
         {
+            if (m_object)
+            {
+                add_object_part(m_object);
+                m_object = 0;
+                return true;
+            }
+
             add_status_line(200, ok_200_title);
-            if (m_file_stat.st_size != 0)
+            if (m_file->st.st_size != 0)
             {
-                add_headers(m_file_stat.st_size);
-                m_iv[0].iov_base = m_write_buf;
-                m_iv[0].iov_len = m_write_idx;
-                m_iv[1].iov_base = m_file_address;
-                m_iv[1].iov_len = m_file_stat.st_size;
-                m_iv_count = 2;
+                add_headers(m_file->st.st_size);
+                // 小文件生成完整的应答放入热点对象缓存，之后的请求不再需要sendfile
+                if (m_linger && (m_file->st.st_size <= m_object_cache.max_object()))
+                {
+                    cached_object* object = m_object_cache.insert(m_real_file, m_file->st, m_write_buf + head_start,
+                                                                  m_write_idx - head_start, m_file->fd);
+                    if (object)
+                    {
+                        m_write_idx = head_start;
+                        m_file_cache.release(m_file);
+                        m_file = 0;
+                        add_object_part(object);
+                        return true;
+                    }
+                }
+
+                add_part(m_write_buf + head_start, m_write_idx - head_start);
+                add_file_part(m_file);
+                m_file = 0;
                 return true;
             }
             else 
             {
+                m_file_cache.release(m_file);
+                m_file = 0;
                 const char* ok_string = "<html><body></body></html>";
                 add_headers( strlen( ok_string ) );
                 if ( ! add_content( ok_string ) )
@@ -607,6 +853,8 @@ bool http_conn::process_write(HTTP_CODE ret)
                     return false;
                 }
             }
+
+            break;
         }
         
         default:
@@ -615,29 +863,67 @@ bool http_conn::process_write(HTTP_CODE ret)
         }
     }
 
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
+    add_part(m_write_buf + head_start, m_write_idx - head_start);
     return true;
 }
 
-// 由线程池中的工作线程调用，是处理HTTP请求的入口函数
+// 打印热点对象缓存的统计信息
+void http_conn::print_stats()
+{
+    object_cache_stats stats;
+    m_object_cache.get_stats(stats);
+    long long lookups = stats.hits + stats.misses;
+    printf("object cache: %lld objects, %lld bytes, %lld hits, %lld misses (%.1f%% hit), %lld evictions, %lld invalidations\n",
+           stats.objects, stats.bytes, stats.hits, stats.misses, (lookups > 0) ? stats.hits * 100.0 / lookups : 0.0,
+           stats.evictions, stats.invalidations);
+}
+
+/*************************************************************************
+ * 函数名称：process
+ * 函数功能：由线程池中的工作线程调用，是处理HTTP请求的入口函数。依次处理读缓冲区
+ *          中所有完整的请求(流水线)，应答合并成一批，由一次writev发送
+ * 输入参数：无
+ * 输出参数：无
+ * 返 回 值：无
+ *************************************************************************/
 void http_conn::process()
 {
-    HTTP_CODE read_ret = process_read();
-    if (read_ret == NO_REQUEST)
+    m_more = false;
+    while (true)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        return;
-    }
+        // 这一批应答已满，剩下的请求等发送完之后再处理
+        if ((m_part_count + 2 > MAX_PARTS) || (m_write_idx + MAX_RESPONSE_HEAD > WRITE_BUFFER_SIZE))
+        {
+            m_more = true;
+            break;
+        }
 
-    bool write_ret = process_write(read_ret);
-    if (!write_ret)
-    {
-        close_conn();
-    }
+        HTTP_CODE read_ret = process_read();
+        if (read_ret == NO_REQUEST)
+        {
+            break;
+        }
 
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
-}
+        // 出错之后请求的边界无法确定，应答之后关闭连接
+        if ((read_ret == BAD_REQUEST) || (read_ret == INTERNAL_ERROR))
+        {
+            m_linger = false;
+        }
 
+        if (!process_write(read_ret))
+        {
+            close_conn();
+            return;
+        }
 
+        m_close_after = !m_linger;
+        init_request();
+        if (m_close_after)
+        {
+            break;
+        }
+    }
+
+    compact_read_buf();
+    modfd(m_epollfd, m_sockfd, (m_part_count > 0) ? EPOLLOUT : EPOLLIN);
+}
@@ -3,6 +3,8 @@
 
 #include "global.h"
 #include "locker.h"
+#include "file_cache.h"
+#include "object_cache.h"
 
 enum METHOD { GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT, PATCH };
 enum CHECK_STATE { CHECK_STATE_REQUESTLINE = 0, CHECK_STATE_HEADER, CHECK_STATE_CONTENT };
@@ -54,13 +56,26 @@ enum LINE_STATUS
 };
 #endif /* NEVER */
 
+// 待发送的一段应答：写缓冲区或热点对象缓存中的一段内存，或者用sendfile发送的一段文件内容
+struct out_part
+{
+    char* base;                 // 内存数据，file为NULL时有效
+    cached_object* object;      // base指向缓存的应答时，持有热点对象缓存中的一个引用
+    file_entry* file;           // 文件，持有文件缓存中的一个引用
+    off_t offset;               // 文件中下一个要发送的位置
+    long long len;              // 还没有发送的字节数
+};
+
 // HTTP管理类
 class http_conn
 {
 public:
     static const int FILENAME_LEN = 200;            // 文件名的最大长度
     static const int READ_BUFFER_SIZE = 2048;       // 读缓冲区的大小
-    static const int WRITE_BUFFER_SIZE = 1024;      // 写缓冲区的大小
+    static const int WRITE_BUFFER_SIZE = 4096;      // 写缓冲区的大小，可以容纳一批应答的头部
+    static const int MAX_PIPELINE = 16;             // 一批最多合并的应答数
+    static const int MAX_PARTS = MAX_PIPELINE * 2;  // 一批应答最多的分段数
+    static const int MAX_RESPONSE_HEAD = 512;       // 单个应答写入写缓冲区的最大长度(状态行、头部和错误页面)
 
 public:
     http_conn(){}
@@ -77,25 +92,36 @@ public:
     bool write();
     // 处理客户请求: 由工作线程调用
     void process();
+    // 应答批次已满时还有请求留在读缓冲区中，发送完之后需要再交给工作线程处理
+    bool has_pending() const { return m_more; }
+    // 打印热点对象缓存的统计信息
+    static void print_stats();
 
 private:
     // 初始化连接
     void init();
+    // 开始解析下一个请求
+    void init_request();
+    // 把未处理的数据移到读缓冲区开头
+    void compact_read_buf();
     // 解析HTTP请求
     HTTP_CODE process_read();
     // 填充HTTP应答
     bool process_write(HTTP_CODE ret);
 
     // 下面这一组函数被process_read调用以分析HTTP对象
-    HTTP_CODE parse_request_line(char *text);
-    HTTP_CODE parse_headers(char * text);
+    HTTP_CODE parse_request_line(char *text, int len);
+    HTTP_CODE parse_headers(char * text, int len);
     HTTP_CODE parse_content(char* text);
     HTTP_CODE do_request();
     char* get_line(){ return m_read_buf + m_start_line; }
     LINE_STATUS parse_line();
 
     // 下面这一组函数被process_write调用以填充HTTP应答
-    void unmap();
+    void release_files();
+    void add_part(char* base, int len);
+    void add_file_part(file_entry* file);
+    void add_object_part(cached_object* object);
     bool add_response( const char* format, ... );
     bool add_content( const char* content );
     bool add_status_line( int status, const char* title );
@@ -107,6 +133,8 @@ private:
 public:
     static int m_epollfd;               // 内核事件表描述符(所有的事件需要注册到该内核事件表中，所以定义为静态的)
     static int m_user_count;            // 用户数量
+    static file_cache m_file_cache;     // 所有连接共享的文件描述符缓存
+    static object_cache m_object_cache; // 所有连接共享的小文件应答缓存
 
 private:
     int m_sockfd;                               // 读取HTTP连接的socket
@@ -115,6 +143,7 @@ private:
     int m_read_idx;                             // 标识读缓冲区中已经读入的客户数据的最后一个字节的下一个位置
     int m_checked_idx;                          // 当前正在分析的字符在读缓冲区中的位置
     int m_start_line;                           // 当前正在解析的行的起始位置
+    int m_req_start;                            // 当前正在解析的请求的起始位置
     char m_write_buf[WRITE_BUFFER_SIZE];        // 写缓冲区
     int m_write_idx;                            // 写缓冲区中待发送的字节数
 
@@ -128,10 +157,14 @@ private:
     int m_content_length;                       // HTTP请求的消息体长度
     bool m_linger;                              // HTTP请求是否要保持连接
 
-    char* m_file_address;                       // 客户请求的目标文件被mmap到内存中的起始位置
-    struct stat m_file_stat;                    // 目标文件的状态. 可以用来判断目标文件是否存在、是否为目录、是否可读，并获取文件大小等信息
-    struct iovec m_iv[2];                       // 采用writev来执行写操作
-    int m_iv_count;                             // 表示被写内存块的数量
+    file_entry* m_file;                         // 客户请求的目标文件，包括打开的描述符和文件状态
+    cached_object* m_object;                    // 客户请求的目标文件在热点对象缓存中的完整应答
+    out_part m_parts[MAX_PARTS];                // 这一批应答的分段，内存分段用writev、文件分段用sendfile发送
+    int m_part_count;                           // 分段的数量
+    int m_part_idx;                             // 第一个还没有发送完的分段
+    long long m_bytes_to_send;                  // 这一批应答还没有发送的字节数
+    bool m_close_after;                         // 这一批应答发送完之后关闭连接
+    bool m_more;                                // 读缓冲区中还有没有处理的请求
 };
 
 #endif
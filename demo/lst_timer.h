@@ -1,8 +1,9 @@
 #ifndef __LST_TIMER_H_
 #define __LST_TIMER_H_
 
-// 升序链表定时器
+// 升序链表定时器：到期时间为单调时钟的毫秒数
 #include "global.h"
+#include "../src/clock.h"
 
 #define     BUFFER_SIZE     64
 
@@ -24,7 +25,7 @@ public:
     util_timer() : prev(NULL), next(NULL) {}
 
 public:
-    time_t expire;                       // 任务超时时间：绝对时间
+    long long expire;                    // 任务超时时间：单调时钟的绝对时间(毫秒)
     void (*cb_func)(client_data*);       // 任务回调函数
     client_data* user_data;              // 回调函数需要处理的用户数据
     util_timer* prev;                    // 指向前一个定时器
@@ -152,7 +153,19 @@ public:
         delete timer;
     }
 
-    // 心搏函数: SIGALRM信号每被触发一次就会在其信号处理函数中执行一次tick()函数
+    // 距离头结点到期还有多少毫秒，作为epoll_wait的超时值，没有定时器时返回-1
+    int next_timeout() const
+    {
+        if (!head)
+        {
+            return -1;
+        }
+
+        long long delta = head->expire - monotonic_ms();
+        return (delta > 0) ? (int)delta : 0;
+    }
+
+    // 心搏函数: epoll_wait超时返回(或者timerfd可读)后调用，处理所有已到期的定时器
     void tick()
     {
         if (!head)
@@ -161,7 +174,7 @@ public:
         }
 
         printf("timer tick\n");
-        time_t cur = time(NULL);            // 获取系统当前时间
+        long long cur = monotonic_ms();     // 获取单调时钟的当前时间
         util_timer* tmp = head;
 
         // 定时器的核心处理逻辑：从头到尾处理每一个定时器，直到遇到一个尚未到期的定时器
@@ -176,10 +189,14 @@ public:
             tmp->cb_func(tmp->user_data);
 
             head = tmp->next;
-            if (!head)
+            if (head)
             {
                 head->prev = NULL;
             }
+            else
+            {
+                tail = NULL;
+            }
 
             delete tmp;
             tmp = head;
@@ -212,7 +229,7 @@ private:
         if (!tmp)
         {
             prev->next = timer;
-            timer->next = prev;
+            timer->prev = prev;
             timer->next = NULL;
             tail = timer;
         }
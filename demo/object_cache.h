@@ -0,0 +1,277 @@
+#ifndef __OBJECT_CACHE_H_
+#define __OBJECT_CACHE_H_
+
+// 小文件的热点对象缓存：缓存预先生成的完整应答(状态行、头部和文件内容)，命中时
+// 直接把缓存的内存交给writev发送，不需要sendfile。按路径哈希分成多个分片，每个分片
+// 有自己的锁、LRU链表和内存上限，减少工作线程之间的锁竞争
+#include "global.h"
+#include "locker.h"
+
+// 缓存的应答
+struct cached_object
+{
+    std::string path;
+    char* data;                                 // 完整的应答
+    int len;
+    struct stat st;                             // 生成应答时文件的状态，用来发现文件被修改
+    long long checked_ms;                       // 上次核对文件状态的时间
+    int refs;                                   // 正在发送该应答的连接数
+    bool evicted;                               // 已经移出缓存，最后一个使用者释放时删除
+    int shard;
+    std::list<cached_object*>::iterator lru;    // 在所属分片LRU链表中的位置
+};
+
+// 缓存统计
+struct object_cache_stats
+{
+    long long hits;
+    long long misses;
+    long long evictions;                        // 因为内存上限被淘汰的对象数
+    long long invalidations;                    // 因为文件被修改而删除的对象数
+    long long bytes;                            // 缓存占用的内存
+    long long objects;
+};
+
+class object_cache
+{
+public:
+    static const int SHARDS = 16;
+
+public:
+    object_cache(long long mem_limit = 16 * 1024 * 1024, int max_object = 16 * 1024, int revalidate_ms = 1000)
+        : m_shard_limit(mem_limit / SHARDS), m_max_object(max_object), m_revalidate_ms(revalidate_ms) {}
+    ~object_cache();
+
+public:
+    int max_object() const { return m_max_object; }
+    cached_object* acquire(const char* path);
+    cached_object* insert(const char* path, const struct stat& st, const char* head, int head_len, int fd);
+    void release(cached_object* object);
+    void get_stats(object_cache_stats& stats);
+
+private:
+    // 一个分片
+    struct shard
+    {
+        shard() : bytes(0), hits(0), misses(0), evictions(0), invalidations(0) {}
+
+        CLocker locker;
+        std::map<std::string, cached_object*> objects;
+        std::list<cached_object*> lru;          // 表头为最近使用的对象
+        long long bytes;
+        long long hits;
+        long long misses;
+        long long evictions;
+        long long invalidations;
+    };
+
+private:
+    static long long now_ms();
+    static int shard_of(const char* path);
+    static long long cost(const cached_object* object) { return object->len + object->path.size() + sizeof(cached_object); }
+    void drop(shard& sh, cached_object* object);
+    void unref(cached_object* object);
+
+private:
+    shard m_shards[SHARDS];
+    long long m_shard_limit;                    // 每个分片的内存上限
+    int m_max_object;                           // 缓存的文件大小上限
+    int m_revalidate_ms;                        // 重新核对文件状态的间隔
+};
+
+inline object_cache::~object_cache()
+{
+    for (int i = 0; i < SHARDS; i++)
+    {
+        std::map<std::string, cached_object*>::iterator it = m_shards[i].objects.begin();
+        for (; it != m_shards[i].objects.end(); ++it)
+        {
+            delete [] it->second->data;
+            delete it->second;
+        }
+    }
+}
+
+inline long long object_cache::now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// FNV-1a哈希选择分片
+inline int object_cache::shard_of(const char* path)
+{
+    unsigned int hash = 2166136261u;
+    for (; *path; path++)
+    {
+        hash = (hash ^ (unsigned char)*path) * 16777619u;
+    }
+
+    return hash % SHARDS;
+}
+
+// 移出缓存，仍在发送时由最后一个使用者删除
+inline void object_cache::drop(shard& sh, cached_object* object)
+{
+    sh.objects.erase(object->path);
+    sh.lru.erase(object->lru);
+    sh.bytes -= cost(object);
+    object->evicted = true;
+    if (object->refs == 0)
+    {
+        delete [] object->data;
+        delete object;
+    }
+}
+
+inline void object_cache::unref(cached_object* object)
+{
+    if ((--object->refs == 0) && object->evicted)
+    {
+        delete [] object->data;
+        delete object;
+    }
+}
+
+/*************************************************************************
+ * 函数名称：object_cache::acquire
+ * 函数功能：查找路径对应的应答，命中时增加引用，发送完之后必须调用release。
+ *          到了核对时间时重新stat文件，文件被修改则删除对象并按未命中处理
+ * 输入参数：const char* path   文件的完整路径
+ * 输出参数：无
+ * 返 回 值：缓存的应答，未命中返回NULL
+ *************************************************************************/
+inline cached_object* object_cache::acquire(const char* path)
+{
+    shard& sh = m_shards[shard_of(path)];
+    long long now = now_ms();
+
+    sh.locker.lock();
+    std::map<std::string, cached_object*>::iterator it = sh.objects.find(path);
+    if (it == sh.objects.end())
+    {
+        sh.misses++;
+        sh.locker.unlock();
+        return NULL;
+    }
+
+    cached_object* object = it->second;
+    if (now - object->checked_ms >= m_revalidate_ms)
+    {
+        struct stat st;
+        if ((stat(path, &st) != 0) || (st.st_ino != object->st.st_ino) || (st.st_size != object->st.st_size)
+            || (st.st_mtim.tv_sec != object->st.st_mtim.tv_sec) || (st.st_mtim.tv_nsec != object->st.st_mtim.tv_nsec)
+            || (st.st_mode != object->st.st_mode))
+        {
+            drop(sh, object);
+            sh.invalidations++;
+            sh.misses++;
+            sh.locker.unlock();
+            return NULL;
+        }
+
+        object->checked_ms = now;
+    }
+
+    object->refs++;
+    sh.hits++;
+    sh.lru.splice(sh.lru.begin(), sh.lru, object->lru);
+    sh.locker.unlock();
+    return object;
+}
+
+/*************************************************************************
+ * 函数名称：object_cache::insert
+ * 函数功能：读出文件内容，与应答头部拼成完整的应答放入缓存，超过分片内存上限时
+ *          淘汰最久没有使用的对象。返回的对象已经增加了引用
+ * 输入参数：const char* path           文件的完整路径
+ *           const struct stat& st      打开文件时的状态
+ *           const char* head           应答头部(包括结束空行)
+ *           int head_len               头部长度
+ *           int fd                     打开的文件
+ * 输出参数：无
+ * 返 回 值：缓存的应答，文件太大或者读取失败时返回NULL
+ *************************************************************************/
+inline cached_object* object_cache::insert(const char* path, const struct stat& st, const char* head, int head_len, int fd)
+{
+    if ((st.st_size > m_max_object) || (head_len + st.st_size + (long long)sizeof(cached_object) > m_shard_limit))
+    {
+        return NULL;
+    }
+
+    // 在锁外读文件
+    int body_len = st.st_size;
+    char* data = new char[head_len + body_len];
+    memcpy(data, head, head_len);
+    int done = 0;
+    while (done < body_len)
+    {
+        int n = pread(fd, data + head_len + done, body_len - done, done);
+        if (n <= 0)
+        {
+            delete [] data;
+            return NULL;
+        }
+
+        done += n;
+    }
+
+    cached_object* object = new cached_object;
+    object->path = path;
+    object->data = data;
+    object->len = head_len + body_len;
+    object->st = st;
+    object->checked_ms = now_ms();
+    object->refs = 1;
+    object->evicted = false;
+    object->shard = shard_of(path);
+
+    shard& sh = m_shards[object->shard];
+    sh.locker.lock();
+    std::map<std::string, cached_object*>::iterator it = sh.objects.find(object->path);
+    if (it != sh.objects.end())
+    {
+        // 其他线程已经放入了同一个文件，替换旧的对象
+        drop(sh, it->second);
+    }
+
+    sh.lru.push_front(object);
+    object->lru = sh.lru.begin();
+    sh.objects[object->path] = object;
+    sh.bytes += cost(object);
+    while (sh.bytes > m_shard_limit)
+    {
+        drop(sh, sh.lru.back());
+        sh.evictions++;
+    }
+    sh.locker.unlock();
+    return object;
+}
+
+inline void object_cache::release(cached_object* object)
+{
+    shard& sh = m_shards[object->shard];
+    sh.locker.lock();
+    unref(object);
+    sh.locker.unlock();
+}
+
+inline void object_cache::get_stats(object_cache_stats& stats)
+{
+    memset(&stats, 0, sizeof(stats));
+    for (int i = 0; i < SHARDS; i++)
+    {
+        shard& sh = m_shards[i];
+        sh.locker.lock();
+        stats.hits += sh.hits;
+        stats.misses += sh.misses;
+        stats.evictions += sh.evictions;
+        stats.invalidations += sh.invalidations;
+        stats.bytes += sh.bytes;
+        stats.objects += sh.objects.size();
+        sh.locker.unlock();
+    }
+}
+
+#endif
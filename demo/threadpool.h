@@ -1,12 +1,14 @@
 #ifndef __THREADPOOL_H_
 #define __THREADPOOL_H_
 
-// 半同步/半反应堆线程池
+// 半同步/半反应堆线程池。请求队列默认为无锁环形队列mpmc_queue，也可以换成互斥锁
+// 保护的链表locked_queue或者每个工作线程一个队列的工作窃取调度steal_queue(见work_queue.h)
 #include "global.h"
 #include "locker.h"
+#include "work_queue.h"
 
 // 线程池类
-template<typename T>
+template<typename T, typename Q = mpmc_queue<T> >
 class threadpool
 {
 public:
@@ -15,6 +17,7 @@ public:
 
 public:
     bool append(T* request);
+    bool append(T* request, int worker);
 
 private:
     static void *worker(void *arg);
@@ -24,30 +27,28 @@ private:
     int m_thread_number;            // 线程池中的线程数
     int m_max_requests;             // 请求队列中允许的最大请求数
     pthread_t* m_threads;           // 描述线程组的数组，大小为m_thread_number
-    std::list<T*> m_workqueue;      // 请求队列
-    CLocker m_queuelocker;          // 保护请求队列的互斥锁
-    CSem m_queuestat;               // 是否有任务需要处理
-    bool m_stop;                    // 是否结束线程
+    Q m_workqueue;                  // 请求队列，关闭后工作线程取完剩余的请求就退出
 };
 
 /**************************************************************
- * 函数名称：threadpool<T>::threadpool
+ * 函数名称：threadpool<T, Q>::threadpool
  * 函数功能：线程池构造函数
  * 输入参数: int thread_number     线程池中线程的数量
  *           int max_requests      请求队列中最多允许等待的请求的数量
  * 输出参数：无
  * 返 回 值：无
  **************************************************************/
-template<typename T>
-threadpool<T>::threadpool(int thread_number, int max_requests) : 
-    m_thread_number(thread_number), m_max_requests(max_requests), m_stop(false), m_threads(NULL)
+template<typename T, typename Q>
+threadpool<T, Q>::threadpool(int thread_number, int max_requests) : 
+    m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL),
+    m_workqueue(max_requests, thread_number)
 {
     if ((thread_number <= 0) || (max_requests <= 0))
     {
         throw std::exception();
     }
 
-    // 创建m_thread_number个线程，并将它们都设置为脱离线程
+    // 创建m_thread_number个线程，析构时关闭请求队列并等待它们退出
     m_threads = new pthread_t[m_thread_number];
     if (!m_threads)
     {
@@ -59,69 +60,59 @@ threadpool<T>::threadpool(int thread_number, int max_requests) :
         printf("create the %dth thread\n", i);
         if (pthread_create(m_threads + i, NULL, worker, this) != 0)
         {
-            delete [] m_threads;
-            throw std::exception();
-        }
+            m_workqueue.close();
+            for (int j = 0; j < i; j++)
+            {
+                pthread_join(m_threads[j], NULL);
+            }
 
-        // 设置为脱离线程
-        if (pthread_detach(m_threads[i]))
-        {
             delete [] m_threads;
             throw std::exception();
         }
     }
 }
 
-template<typename T>
-threadpool<T>::~threadpool()
+template<typename T, typename Q>
+threadpool<T, Q>::~threadpool()
 {
+    m_workqueue.close();
+    for (int i = 0; i < m_thread_number; i++)
+    {
+        pthread_join(m_threads[i], NULL);
+    }
+
     delete [] m_threads;
-    m_stop = true;
 }
 
-// 往队列中添加任务
-template<typename T>
-bool threadpool<T>::append(T* request)
+// 往队列中添加任务，队列已满时返回false
+template<typename T, typename Q>
+bool threadpool<T, Q>::append(T* request)
 {
-    // 操作工作队列时需要加锁，因为它被所有的线程共享
-    m_queuelocker.lock();
-    if (m_workqueue.size() > m_max_requests)
-    {
-        m_queuelocker.unlock();
-        return false;
-    }
+    return m_workqueue.push(request);
+}
 
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
-    m_queuestat.post();
-    return true;
+// 把任务交给指定的工作线程，只有steal_queue支持。队列已满时返回false
+template<typename T, typename Q>
+bool threadpool<T, Q>::append(T* request, int worker)
+{
+    return m_workqueue.push(request, worker);
 }
 
 // 工作线程运行的函数，不断从工作队列中取出任务并执行
-template<typename T>
-void *threadpool<T>::worker(void *arg)
+template<typename T, typename Q>
+void *threadpool<T, Q>::worker(void *arg)
 {
     threadpool* pool = (threadpool*)arg;
     pool->run();
     return pool;
 }
 
-template<typename T>
-void threadpool<T>::run()
+template<typename T, typename Q>
+void threadpool<T, Q>::run()
 {
-    while (!m_stop)
+    T* request = NULL;
+    while (m_workqueue.pop(request))
     {
-        m_queuestat.wait();
-        m_queuelocker.lock();
-        if (m_workqueue.empty())
-        {
-            m_queuelocker.unlock();
-            continue;
-        }
-
-        T* request = m_workqueue.front();
-        m_workqueue.pop_front();
-        m_queuelocker.unlock();
         if (!request)
         {
             continue;
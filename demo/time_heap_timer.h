@@ -1,8 +1,13 @@
 #ifndef __TIMER_HEAP_H_
 #define __TIMER_HEAP_H_
 
-// 时间堆定时器
+// 时间堆定时器：四叉最小堆。堆数组中同时存放到期时间和定时器指针，每个结点16字节，
+// 数组按缓存行对齐并在开头空出三个结点，一个结点的四个子结点正好占满一条缓存行，
+// 比较时不需要访问定时器本身。每个定时器记录自己在堆中
+// 的下标，删除和调整都是O(log n)。定时器从时间堆自带的对象池中分配，到期时间为单调时钟的毫秒数
+#include <vector>
 #include "global.h"
+#include "../src/clock.h"
 
 #define     BUFFER_SIZE         64
 
@@ -20,84 +25,70 @@ struct client_data
 class heap_timer
 {
 public:
-    heap_timer(int delay)
-    {
-        expire = time(NULL) + delay;
-    }
+    heap_timer() : expire(0), cb_func(NULL), user_data(NULL), index(-1) {}
 
 public:
-    time_t expire;                          // 定时器生效的绝对时间
+    long long expire;                       // 定时器生效的绝对时间(单调时钟毫秒)
     void (*cb_func)(client_data*);          // 定时器回调函数
     client_data* user_data;                 // 用户数据
+    int index;                              // 在堆数组中的下标，-1表示不在堆中
 };
 
 // 时间堆类
 class time_heap
 {
 public:
-    // 构造函数一：初始化一个大小为cap的空堆
-    time_heap(int cap) throw(std::exception()) : capacity(cap), cur_size(0)
+    // 初始化一个大小为cap的空堆，容量不够时自动扩大
+    time_heap(int cap) : capacity(cap > 0 ? cap : 1), cur_size(0)
     {
-        array = new heap_timer*[capacity];
-        if (!array)
-        {
-            throw std::exception();
-        }
-
-        for (int i = 0; i < capacity; i++)
-        {
-            array[i] = NULL;
-        }
+        array = alloc_nodes(capacity);
     }
 
-    // 构造函数二：用已有数组来初始化堆
-    time_heap(heap_timer** init_array, int size, int capacity) throw(std::exception()) : cur_size(0), capacity(capacity)
+    ~time_heap()
     {
-        if (capacity < size)
+        for (size_t i = 0; i < chunks.size(); i++)
         {
-            throw std::exception();
+            delete [] chunks[i];
         }
 
-        array = new heap_timer* [capacity];
-        if (!array)
-        {
-            throw std::exception();
-        }
-
-        for (int i = 0; i < capacity; i++)
-        {
-            array[i] = NULL;
-        }
+        free_nodes(array);
+    }
 
-        if (size != 0)
+public:
+    // 从对象池中分配一个delay毫秒后到期的定时器，尚未加入堆中
+    heap_timer* create_timer(int delay)
+    {
+        if (free_timers.empty())
         {
-            for (int i = 0; i < size; i++)
-            {
-                array[i] = init_array[i];
-            }
-
-            for (int i = (cur_size - 1) / 2; i >= 0; i++)
+            heap_timer* chunk = new heap_timer[POOL_CHUNK];
+            chunks.push_back(chunk);
+            for (int i = POOL_CHUNK - 1; i >= 0; i--)
             {
-                percolate_down(i);
+                free_timers.push_back(&chunk[i]);
             }
         }
+
+        heap_timer* timer = free_timers.back();
+        free_timers.pop_back();
+        timer->expire = monotonic_ms() + delay;
+        timer->cb_func = NULL;
+        timer->user_data = NULL;
+        timer->index = -1;
+        return timer;
     }
 
-    ~time_heap()
+    // 将定时器加入堆中，已在堆中时按新的到期时间调整位置
+    void add_timer(heap_timer* timer)
     {
-        for (int i = 0; i < cur_size; i++)
+        if (!timer)
         {
-            delete array[i];
+            return;
         }
 
-        delete [] array;
-    }
-
-public:
-    void add_timer(heap_timer* timer) throw (std::exception())
-    {
-        if (!timer)
+        if (timer->index >= 0)
         {
+            array[timer->index].expire = timer->expire;
+            reposition(timer->index);
             return;
         }
 
@@ -107,31 +98,42 @@ public:
             resize();
         }
 
-        int hole = cur_size++;
-        int parent = 0;
-        for (; hole > 0; hole = parent)
-        {
-            parent = (hole - 1) / 2;
-            if (array[parent]->expire <= timer->expire)
-            {
-                break;
-            }
+        array[cur_size].expire = timer->expire;
+        array[cur_size].timer = timer;
+        timer->index = cur_size;
+        percolate_up(cur_size++);
+    }
 
-            array[hole] = array[parent];
+    // 删除定时器：用堆尾的结点填补它的位置，然后将定时器放回对象池
+    void del_timer(heap_timer* timer)
+    {
+        if (!timer || (timer->index < 0))
+        {
+            return;
         }
 
-        array[hole] = timer;
+        remove(timer->index);
+        free_timers.push_back(timer);
     }
 
-    // 删除定时器
-    void del_timer(heap_timer* timer)
+    // 调整定时器：到期时间改为delay毫秒之后，可以提前也可以推迟，直接在原位置上移或下移。
+    // 定时器已经到期出堆(例如在自己的回调函数中)时重新加入堆中
+    void adjust_timer(heap_timer* timer, int delay)
     {
         if (!timer)
         {
             return;
         }
-        // 仅仅将目标定时器的回调函数设置为NULL，即延迟销毁。这将节省真正删除该定时器造成的开销
-        timer->cb_func = NULL;
+
+        timer->expire = monotonic_ms() + delay;
+        if (timer->index < 0)
+        {
+            add_timer(timer);
+            return;
+        }
+
+        array[timer->index].expire = timer->expire;
+        reposition(timer->index);
     }
 
     // 获取堆顶部的定时器
@@ -141,48 +143,47 @@ public:
         {
             return NULL;
         }
-        return array[0];
+        return array[0].timer;
     }
 
     // 删除堆顶部的定时器
     void pop_timer()
     {
-        if (empty())
+        if (!empty())
         {
-            return ;
+            del_timer(array[0].timer);
         }
-        if (array[0])
+    }
+
+    // 距离堆顶的定时器到期还有多少毫秒，作为epoll_wait的超时值，堆为空时返回-1
+    int next_timeout() const
+    {
+        if (empty())
         {
-            delete array[0];
-            array[0] = array[--cur_size];
-            percolate_down(0);
+            return -1;
         }
+
+        long long delta = array[0].expire - monotonic_ms();
+        return (delta > 0) ? (int)delta : 0;
     }
 
-    // 心博函数
+    // 心博函数：定时器先出堆再执行回调，回调中可以用adjust_timer重新启动它，否则执行完后放回对象池
     void tick()
     {
-        heap_timer* tmp = array[0];
-        time_t cur = time(NULL);
-        while (!empty())
+        long long cur = monotonic_ms();
+        while (!empty() && (array[0].expire <= cur))
         {
-            if (!tmp)
-            {
-                break;
-            }
-
-            if (tmp->expire > cur)
+            heap_timer* timer = array[0].timer;
+            remove(0);
+            if (timer->cb_func)
             {
-                break;
+                timer->cb_func(timer->user_data);
             }
 
-            if (array[0]->cb_func)
+            if (timer->index < 0)
             {
-                array[0]->cb_func(array[0]->user_data);
+                free_timers.push_back(timer);
             }
-
-            pop_timer();
-            tmp = array[0];
         }
     }
 
@@ -191,63 +192,147 @@ public:
         return cur_size == 0;
     }
 
+    int size() const
+    {
+        return cur_size;
+    }
+
 private:
+    static const int ARITY = 4;             // 每个结点的子结点数
+    static const int POOL_CHUNK = 256;      // 对象池每次分配的定时器个数
+    static const int CACHE_LINE = 64;
+    static const int PAD = ARITY - 1;       // 数组开头空出的结点数，使下标1的结点从缓存行开头开始
+
+    // 堆数组的元素：到期时间的副本和定时器
+    struct heap_node
+    {
+        long long expire;
+        heap_timer* timer;
+    };
+
+private:
+    // 分配cap个结点的堆数组。第h个结点的子结点下标为4h+1~4h+4，数组开头空出PAD个结点后
+    // 它们的地址从(4h+4)*16字节开始，正好是一条缓存行
+    static heap_node* alloc_nodes(int cap)
+    {
+        void* mem = NULL;
+        if (posix_memalign(&mem, CACHE_LINE, (cap + PAD) * sizeof(heap_node)) != 0)
+        {
+            throw std::exception();
+        }
+
+        return (heap_node*)mem + PAD;
+    }
+
+    static void free_nodes(heap_node* nodes)
+    {
+        free(nodes - PAD);
+    }
+
+    // 将第hole个结点放到正确的位置：比父结点早到期时上滤，否则下滤
+    void reposition(int hole)
+    {
+        if ((hole > 0) && (array[hole].expire < array[(hole - 1) / ARITY].expire))
+        {
+            percolate_up(hole);
+        }
+        else
+        {
+            percolate_down(hole);
+        }
+    }
+
+    // 从堆中取出第hole个结点，定时器不放回对象池
+    void remove(int hole)
+    {
+        array[hole].timer->index = -1;
+        if (hole != --cur_size)
+        {
+            array[hole] = array[cur_size];
+            array[hole].timer->index = hole;
+            reposition(hole);
+        }
+    }
+
+    // 最小堆的上滤操作：父结点依次下移，直到找到第hole个结点的位置
+    void percolate_up(int hole)
+    {
+        heap_node temp = array[hole];
+        while (hole > 0)
+        {
+            int parent = (hole - 1) / ARITY;
+            if (array[parent].expire <= temp.expire)
+            {
+                break;
+            }
+
+            array[hole] = array[parent];
+            array[hole].timer->index = hole;
+            hole = parent;
+        }
+
+        array[hole] = temp;
+        temp.timer->index = hole;
+    }
+
     // 最小堆的下滤操作，它确保数组中以第hole个节点作为根的子树拥有最小堆性质
     void percolate_down(int hole)
     {
-        heap_timer* temp = array[hole];
-        int child = 0;
-        for (; (hole * 2 + 1) <= (cur_size - 1); hole = child)
+        heap_node temp = array[hole];
+        while (true)
         {
-            child = hole * 2 + 1;
-            if ((child < (cur_size - 1)) && (array[child + 1]->expire < array[child]->expire))
+            int first = hole * ARITY + 1;
+            if (first >= cur_size)
             {
-                ++child;
+                break;
             }
 
-            if (array[child]->expire < temp->expire)
+            // 在最多四个相邻的子结点中找出最早到期的一个
+            int last = (first + ARITY < cur_size) ? (first + ARITY) : cur_size;
+            int child = first;
+            for (int i = first + 1; i < last; i++)
             {
-                array[hole] = array[child];
+                if (array[i].expire < array[child].expire)
+                {
+                    child = i;
+                }
             }
-            else
+
+            if (array[child].expire >= temp.expire)
             {
                 break;
             }
+
+            array[hole] = array[child];
+            array[hole].timer->index = hole;
+            hole = child;
         }
 
         array[hole] = temp;
+        temp.timer->index = hole;
     }
 
     // 将数组容量扩大一倍
-    void resize() throw (std::exception())
+    void resize()
     {
-        heap_timer** temp = new heap_timer* [2 * capacity];
-        for (int i = 0; i < 2 * capacity; i++)
-        {
-            temp[i] = NULL;
-        }
-
-        if (!temp)
-        {
-            throw std::exception();
-        }
-
-        capacity = 2 * capacity;
+        heap_node* temp = alloc_nodes(2 * capacity);
         for (int i = 0; i < cur_size; i++)
         {
             temp[i] = array[i];
         }
 
-        delete [] array;
+        capacity = 2 * capacity;
+        free_nodes(array);
         array = temp;
     }
 
 private:
-    heap_timer** array;                 // 堆数组
-    int capacity;                       // 对数组的容量
-    int cur_size;                       // 对数组当前包含元素的个数
+    heap_node* array;                   // 堆数组
+    int capacity;                       // 堆数组的容量
+    int cur_size;                       // 堆数组当前包含元素的个数
+    std::vector<heap_timer*> free_timers;   // 对象池中空闲的定时器
+    std::vector<heap_timer*> chunks;        // 对象池分配的内存块，时间堆销毁时释放
 };
 
 
 #endif
-
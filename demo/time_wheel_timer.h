@@ -1,8 +1,9 @@
 #ifndef __DEMO12_SERVER_H_
 #define __DEMO12_SERVER_H_
 
-// 时间轮定时器
+// 时间轮定时器：超时值为毫秒，时间轮按单调时钟每SI毫秒转动一个槽
 #include "global.h"
+#include "../src/clock.h"
 
 #define         BUFFER_SIZE         64
 
@@ -36,7 +37,7 @@ public:
 class time_wheel
 {
 public:
-    time_wheel() : cur_slot(0)
+    time_wheel() : cur_slot(0), timer_cnt(0), next_tick(monotonic_ms() + SI)
     {
         // 初始化时间轮上每个槽的头结点
         for (int i = 0; i < N; i++)
@@ -60,7 +61,7 @@ public:
         }
     }
 
-    // 根据定时值timeout创建一个定时器，并把它插入合适的槽中
+    // 根据定时值timeout(毫秒)创建一个定时器，并把它插入合适的槽中
     tw_timer* add_timer(int timeout)
     {
         if (timeout < 0)
@@ -92,7 +93,6 @@ public:
         // 如果第ts个槽中尚无任何定时器，则把新建的定时器插入其中，并将该定时器设置为该槽的头结点
         if (!slots[ts])
         {
-            printf("add timer, rotation is %d, ts is %d, cur_slot is %d\n", rotation, ts, cur_slot);
             slots[ts] = timer;
         }
         else 
@@ -102,6 +102,7 @@ public:
             slots[ts] = timer;
         }
 
+        timer_cnt++;
         return timer;
     }
 
@@ -113,6 +114,7 @@ public:
             return ;
         }
 
+        timer_cnt--;
         int ts = timer->time_slot;
         if (timer == slots[ts])
         {
@@ -140,10 +142,8 @@ public:
     void ticks()
     {
         tw_timer* tmp = slots[cur_slot];
-        printf("current slot is %d\n", cur_slot);
         while (tmp)
         {
-            printf("tick the timer once\n");
             // 如果定时器的rotation值大于0，则它在这一轮不起作用
             if (tmp->rotation > 0)
             {
@@ -154,9 +154,9 @@ public:
             {
                 // 执行定时任务，并删除定时器
                 tmp->cb_func(tmp->user_data);
+                timer_cnt--;
                 if (tmp == slots[cur_slot])
                 {
-                    printf("delete header in cur_slot\n");
                     slots[cur_slot] = tmp->next;
                     delete tmp;
                     if (slots[cur_slot])
@@ -183,11 +183,42 @@ public:
         cur_slot = ++cur_slot % N;
     }
 
+    // 按单调时钟推进时间轮：上次转动之后每经过SI毫秒转动一个槽。时间轮为空时不必逐槽转动，
+    // 直接从当前时间重新计时
+    void advance()
+    {
+        long long now = monotonic_ms();
+        while ((timer_cnt > 0) && (now >= next_tick))
+        {
+            ticks();
+            next_tick += SI;
+        }
+
+        if ((timer_cnt == 0) && (now >= next_tick))
+        {
+            next_tick = now + SI;
+        }
+    }
+
+    // 距离下一次转动还有多少毫秒，作为epoll_wait的超时值，时间轮为空时返回-1
+    int next_timeout() const
+    {
+        if (timer_cnt == 0)
+        {
+            return -1;
+        }
+
+        long long delta = next_tick - monotonic_ms();
+        return (delta > 0) ? (int)delta : 0;
+    }
+
 private:
     static const int N = 60;            // 时间轮上的槽数目
-    static const int SI = 1;            // 槽时间间隔为1s，即每1秒时间轮转一次
+    static const int SI = 100;          // 槽时间间隔为100ms，即每100毫秒时间轮转一次，也是定时的精度
     tw_timer* slots[N];                 // 时间轮的槽，其中每个元素指向一个定时器链表，链表无序
     int cur_slot;                       // 时间轮的当前槽
+    int timer_cnt;                      // 时间轮中的定时器个数
+    long long next_tick;                // 下一次转动的时间(单调时钟毫秒)
 };
 
 #endif
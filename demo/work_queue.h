@@ -0,0 +1,706 @@
+#ifndef __WORK_QUEUE_H_
+#define __WORK_QUEUE_H_
+
+// 线程池的请求队列。三种实现的接口相同：构造时给出容量和工作线程数；push不阻塞，
+// 队列满时返回false；pop阻塞到取出一个请求，队列关闭并且已经取空时返回false；close
+// 唤醒所有等待的线程
+#include <atomic>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "global.h"
+#include "locker.h"
+
+// 互斥锁保护的链表，用信号量通知工作线程：每次入队和出队都要加锁、分配或释放
+// 链表结点，每个请求还有一次sem_post/sem_wait
+template<typename T>
+class locked_queue
+{
+public:
+    locked_queue(int capacity, int = 1) : m_capacity(capacity), m_closed(false) {}
+
+public:
+    bool push(T* item)
+    {
+        m_locker.lock();
+        if ((int)m_list.size() >= m_capacity)
+        {
+            m_locker.unlock();
+            return false;
+        }
+
+        m_list.push_back(item);
+        m_locker.unlock();
+        m_sem.post();
+        return true;
+    }
+
+    bool pop(T*& item)
+    {
+        while (true)
+        {
+            m_sem.wait();
+            m_locker.lock();
+            if (!m_list.empty())
+            {
+                item = m_list.front();
+                m_list.pop_front();
+                m_locker.unlock();
+                return true;
+            }
+
+            bool closed = m_closed;
+            m_locker.unlock();
+            if (closed)
+            {
+                // 把唤醒传给下一个等待的线程
+                m_sem.post();
+                return false;
+            }
+        }
+    }
+
+    void close()
+    {
+        m_locker.lock();
+        m_closed = true;
+        m_locker.unlock();
+        m_sem.post();
+    }
+
+private:
+    int m_capacity;
+    std::list<T*> m_list;
+    CLocker m_locker;
+    CSem m_sem;
+    bool m_closed;
+};
+
+// 忙等时让出流水线给同一核心上的另一个超线程
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// 有界无锁多生产者多消费者环形队列(Vyukov)。每个槽位带有序号：序号等于入队位置时槽位
+// 空闲，等于入队位置+1时槽位中有数据。生产者和消费者各自用CAS推进入队和出队位置，互不
+// 加锁，也不分配内存。队列为空时消费者先忙等SPIN_COUNT轮(单CPU时忙等只会占用生产者的时间，
+// 不忙等)，仍然取不到才在futex上睡眠；生产者只在有线程睡眠、并且没有线程正在忙等取请求时
+// 才调用futex唤醒一个，消费者取到请求后如果队列中还有请求，再把唤醒传给一个睡眠的线程
+template<typename T>
+class mpmc_queue
+{
+public:
+    mpmc_queue(int capacity, int workers = 1);
+    ~mpmc_queue();
+
+public:
+    bool push(T* item);
+    bool pop(T*& item);
+    bool try_pop(T*& item);
+    void close();
+
+private:
+    static const int SPIN_COUNT = 64;       // 多CPU时睡眠前忙等的轮数
+    static const int CACHE_LINE = 64;
+
+    struct cell
+    {
+        std::atomic<size_t> seq;
+        T* item;
+    };
+
+private:
+    void pass_wake();
+    void futex_wait(int expected);
+    void futex_wake(int cnt);
+
+private:
+    cell* m_cells;
+    size_t m_mask;                                          // 槽位数减1，槽位数为2的幂
+    alignas(CACHE_LINE) std::atomic<size_t> m_tail;         // 下一个入队位置
+    alignas(CACHE_LINE) std::atomic<size_t> m_head;         // 下一个出队位置
+    alignas(CACHE_LINE) std::atomic<int> m_epoch;           // futex字，每次唤醒加1
+    std::atomic<int> m_waiters;                             // 在futex上睡眠(或正准备睡眠)的线程数
+    std::atomic<int> m_spinners;                            // 在pop中正在取请求、没有睡眠的线程数
+    std::atomic<bool> m_closed;
+    int m_spin;                                             // 睡眠前忙等的轮数
+};
+
+// 槽位数取不小于capacity的2的幂，下标用位与代替取模
+template<typename T>
+mpmc_queue<T>::mpmc_queue(int capacity, int) : m_tail(0), m_head(0), m_epoch(0), m_waiters(0), m_spinners(0),
+    m_closed(false)
+{
+    m_spin = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? SPIN_COUNT : 0;
+
+    size_t size = 2;
+    while ((int)size < capacity)
+    {
+        size <<= 1;
+    }
+
+    m_cells = new cell[size];
+    for (size_t i = 0; i < size; i++)
+    {
+        m_cells[i].seq.store(i, std::memory_order_relaxed);
+        m_cells[i].item = NULL;
+    }
+
+    m_mask = size - 1;
+}
+
+template<typename T>
+mpmc_queue<T>::~mpmc_queue()
+{
+    delete [] m_cells;
+}
+
+template<typename T>
+void mpmc_queue<T>::futex_wait(int expected)
+{
+    syscall(SYS_futex, (int*)&m_epoch, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+template<typename T>
+void mpmc_queue<T>::futex_wake(int cnt)
+{
+    syscall(SYS_futex, (int*)&m_epoch, FUTEX_WAKE_PRIVATE, cnt, NULL, NULL, 0);
+}
+
+/**************************************************************
+ * 函数名称：mpmc_queue<T>::push
+ * 函数功能：入队。槽位序号等于入队位置时用CAS占下该位置，写入数据
+ *          后把序号加1发布给消费者；序号小于入队位置说明消费者还没有
+ *          取走上一圈的数据，队列已满。发布之后如果有消费者睡眠、并且
+ *          没有消费者正在取请求就唤醒一个。消费者睡眠前会先登记再检查
+ *          一次队列，不会错过这次入队
+ * 输入参数：item       请求
+ * 输出参数：无
+ * 返 回 值：队列已满时返回false
+ **************************************************************/
+template<typename T>
+bool mpmc_queue<T>::push(T* item)
+{
+    cell* c = NULL;
+    size_t pos = m_tail.load(std::memory_order_relaxed);
+    while (true)
+    {
+        c = &m_cells[pos & m_mask];
+        size_t seq = c->seq.load(std::memory_order_acquire);
+        long diff = (long)seq - (long)pos;
+        if (diff == 0)
+        {
+            if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    c->item = item;
+    c->seq.store(pos + 1, std::memory_order_release);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if ((m_waiters.load(std::memory_order_relaxed) > 0) && (m_spinners.load(std::memory_order_relaxed) == 0))
+    {
+        m_epoch.fetch_add(1, std::memory_order_release);
+        futex_wake(1);
+    }
+
+    return true;
+}
+
+// 出队，不阻塞：槽位序号等于出队位置+1时取走数据，并把序号设为下一圈的入队位置
+template<typename T>
+bool mpmc_queue<T>::try_pop(T*& item)
+{
+    cell* c = NULL;
+    size_t pos = m_head.load(std::memory_order_relaxed);
+    while (true)
+    {
+        c = &m_cells[pos & m_mask];
+        size_t seq = c->seq.load(std::memory_order_acquire);
+        long diff = (long)seq - (long)(pos + 1);
+        if (diff == 0)
+        {
+            if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = m_head.load(std::memory_order_relaxed);
+        }
+    }
+
+    item = c->item;
+    c->seq.store(pos + m_mask + 1, std::memory_order_release);
+    return true;
+}
+
+// 取到请求后队列中仍有请求、并且有线程睡眠时唤醒一个。生产者在有线程忙等时不唤醒，
+// 一批突发的请求到来时由取到请求的线程逐个唤醒其他线程，而不是全部由忙等的线程处理
+template<typename T>
+void mpmc_queue<T>::pass_wake()
+{
+    if ((m_waiters.load(std::memory_order_relaxed) > 0) &&
+        (m_head.load(std::memory_order_relaxed) != m_tail.load(std::memory_order_relaxed)))
+    {
+        m_epoch.fetch_add(1, std::memory_order_release);
+        futex_wake(1);
+    }
+}
+
+/**************************************************************
+ * 函数名称：mpmc_queue<T>::pop
+ * 函数功能：出队，队列为空时等待。先忙等m_spin轮，然后登记为
+ *          睡眠线程(不再算作正在取请求的线程)并再检查一次队列，仍然
+ *          为空才在futex上睡眠。登记之后入队的生产者一定看到登记并
+ *          修改futex字，睡眠会立即返回。取到请求后调用pass_wake
+ * 输入参数：无
+ * 输出参数：item       取出的请求
+ * 返 回 值：队列关闭并且已经取空时返回false
+ **************************************************************/
+template<typename T>
+bool mpmc_queue<T>::pop(T*& item)
+{
+    int spin = 0;
+    m_spinners.fetch_add(1, std::memory_order_relaxed);
+    while (true)
+    {
+        if (try_pop(item))
+        {
+            m_spinners.fetch_sub(1, std::memory_order_relaxed);
+            pass_wake();
+            return true;
+        }
+
+        if (m_closed.load(std::memory_order_acquire))
+        {
+            m_spinners.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        if (spin++ < m_spin)
+        {
+            cpu_relax();
+            continue;
+        }
+
+        int epoch = m_epoch.load(std::memory_order_acquire);
+        m_waiters.fetch_add(1, std::memory_order_relaxed);
+        m_spinners.fetch_sub(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!try_pop(item))
+        {
+            if (!m_closed.load(std::memory_order_acquire))
+            {
+                futex_wait(epoch);
+            }
+
+            m_spinners.fetch_add(1, std::memory_order_relaxed);
+            m_waiters.fetch_sub(1, std::memory_order_relaxed);
+            spin = 0;
+            continue;
+        }
+
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+        pass_wake();
+        return true;
+    }
+}
+
+template<typename T>
+void mpmc_queue<T>::close()
+{
+    m_closed.store(true, std::memory_order_release);
+    m_epoch.fetch_add(1, std::memory_order_release);
+    futex_wake(INT_MAX);
+}
+
+// 工作窃取队列中每个工作线程的双端队列(Chase-Lev)，容量固定。底端只有入队：同一时刻
+// 只有一个线程push(由调用者用lock_push保证)；顶端用CAS出队，所属的工作线程和来窃取
+// 的线程都从顶端取，请求按到达顺序处理。底端没有出队操作，原算法中为了和底端出队竞争
+// 最后一个元素而在steal里加的seq_cst栅栏可以省掉
+template<typename T>
+class ws_deque
+{
+public:
+    enum { STEAL_OK, STEAL_EMPTY, STEAL_ABORT };
+
+public:
+    ws_deque() : m_buf(NULL), m_mask(0), m_top(0), m_bottom(0), m_push_lock(false) {}
+    ~ws_deque() { delete [] m_buf; }
+
+public:
+    void init(int capacity);
+    bool push(T* item);
+    int steal(T*& item);
+    bool empty() const { return m_top.load(std::memory_order_relaxed) >= m_bottom.load(std::memory_order_relaxed); }
+
+    void lock_push()
+    {
+        while (m_push_lock.exchange(true, std::memory_order_acquire))
+        {
+            cpu_relax();
+        }
+    }
+
+    void unlock_push() { m_push_lock.store(false, std::memory_order_release); }
+
+private:
+    static const int CACHE_LINE = 64;
+
+private:
+    std::atomic<T*>* m_buf;
+    long m_mask;                                            // 槽位数减1，槽位数为2的幂
+    alignas(CACHE_LINE) std::atomic<long> m_top;            // 下一个出队位置，被出队的线程竞争
+    alignas(CACHE_LINE) std::atomic<long> m_bottom;         // 下一个入队位置，只有入队的线程修改
+    std::atomic<bool> m_push_lock;                          // 多个生产者时串行化底端的入队
+};
+
+// 槽位数取不小于capacity的2的幂
+template<typename T>
+void ws_deque<T>::init(int capacity)
+{
+    long size = 2;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+
+    m_buf = new std::atomic<T*>[size];
+    for (long i = 0; i < size; i++)
+    {
+        m_buf[i].store(NULL, std::memory_order_relaxed);
+    }
+
+    m_mask = size - 1;
+}
+
+// 从底端入队，队列已满时返回false。槽位只有在出队的线程把顶端推过它之后才会被覆盖
+template<typename T>
+bool ws_deque<T>::push(T* item)
+{
+    long b = m_bottom.load(std::memory_order_relaxed);
+    long t = m_top.load(std::memory_order_acquire);
+    if (b - t > m_mask)
+    {
+        return false;
+    }
+
+    m_buf[b & m_mask].store(item, std::memory_order_relaxed);
+    m_bottom.store(b + 1, std::memory_order_release);
+    return true;
+}
+
+/**************************************************************
+ * 函数名称：ws_deque<T>::steal
+ * 函数功能：从顶端出队。先读出顶端的元素，再用CAS把顶端加1，
+ *          CAS失败说明别的线程先取走了它(读到的元素也可能已经
+ *          被新入队的覆盖)，放弃这次读取
+ * 输入参数：无
+ * 输出参数：item       取出的请求
+ * 返 回 值：STEAL_OK取到请求，STEAL_EMPTY队列为空，STEAL_ABORT
+ *          与其他线程竞争失败，可以重试
+ **************************************************************/
+template<typename T>
+int ws_deque<T>::steal(T*& item)
+{
+    long t = m_top.load(std::memory_order_acquire);
+    long b = m_bottom.load(std::memory_order_acquire);
+    if (t >= b)
+    {
+        return STEAL_EMPTY;
+    }
+
+    T* x = m_buf[t & m_mask].load(std::memory_order_relaxed);
+    if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+    {
+        return STEAL_ABORT;
+    }
+
+    item = x;
+    return STEAL_OK;
+}
+
+// 工作窃取调度：每个工作线程一个ws_deque。反应堆线程把请求放进指定(或者轮流选择)的
+// 工作线程的队列，工作线程先取自己队列中的请求，取空后依次到其他线程的队列中窃取，
+// 请求固定交给同一个线程时它用到的数据大多还在该线程所在核心的缓存中。工作线程在第一次
+// pop时按顺序领取编号。所有队列都取空后的忙等、睡眠以及取到请求后传递唤醒与mpmc_queue相同
+template<typename T>
+class steal_queue
+{
+public:
+    steal_queue(int capacity, int workers);
+    ~steal_queue();
+
+public:
+    bool push(T* item);
+    bool push(T* item, int worker);
+    bool pop(T*& item);
+    void close();
+
+private:
+    static const int SPIN_COUNT = 64;       // 多CPU时睡眠前忙等的轮数
+    static const int CACHE_LINE = 64;
+
+private:
+    int self();
+    bool try_pop(int self, T*& item);
+    void notify();
+    void pass_wake();
+    void futex_wait(int expected);
+    void futex_wake(int cnt);
+
+private:
+    int m_workers;
+    ws_deque<T>* m_deques;                                  // 每个工作线程一个队列
+    std::atomic<unsigned> m_next_push;                      // 轮流选择工作线程
+    std::atomic<int> m_next_worker;                         // 下一个领取的工作线程编号
+    alignas(CACHE_LINE) std::atomic<int> m_epoch;           // futex字，每次唤醒加1
+    std::atomic<int> m_waiters;                             // 在futex上睡眠(或正准备睡眠)的线程数
+    std::atomic<int> m_spinners;                            // 在pop中正在取请求、没有睡眠的线程数
+    std::atomic<bool> m_closed;
+    int m_spin;                                             // 睡眠前忙等的轮数
+
+    static __thread int t_worker;                           // 本线程的工作线程编号，-1表示还没有领取
+};
+
+template<typename T>
+__thread int steal_queue<T>::t_worker = -1;
+
+// 每个队列的容量取capacity平均分给各个工作线程后的大小
+template<typename T>
+steal_queue<T>::steal_queue(int capacity, int workers) : m_workers(workers), m_next_push(0), m_next_worker(0),
+    m_epoch(0), m_waiters(0), m_spinners(0), m_closed(false)
+{
+    m_spin = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? SPIN_COUNT : 0;
+    if (m_workers <= 0)
+    {
+        m_workers = 1;
+    }
+
+    m_deques = new ws_deque<T>[m_workers];
+    for (int i = 0; i < m_workers; i++)
+    {
+        m_deques[i].init((capacity + m_workers - 1) / m_workers);
+    }
+}
+
+template<typename T>
+steal_queue<T>::~steal_queue()
+{
+    delete [] m_deques;
+}
+
+template<typename T>
+void steal_queue<T>::futex_wait(int expected)
+{
+    syscall(SYS_futex, (int*)&m_epoch, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+template<typename T>
+void steal_queue<T>::futex_wake(int cnt)
+{
+    syscall(SYS_futex, (int*)&m_epoch, FUTEX_WAKE_PRIVATE, cnt, NULL, NULL, 0);
+}
+
+// 本线程的工作线程编号，第一次调用时领取
+template<typename T>
+int steal_queue<T>::self()
+{
+    if (t_worker < 0)
+    {
+        t_worker = m_next_worker.fetch_add(1, std::memory_order_relaxed) % m_workers;
+    }
+
+    return t_worker;
+}
+
+// 轮流选择工作线程入队
+template<typename T>
+bool steal_queue<T>::push(T* item)
+{
+    return push(item, m_next_push.fetch_add(1, std::memory_order_relaxed) % m_workers);
+}
+
+/**************************************************************
+ * 函数名称：steal_queue<T>::push
+ * 函数功能：把请求放进worker号工作线程的队列，该队列已满时依次
+ *          放进后面的队列。入队之后和mpmc_queue一样，只在有线程
+ *          睡眠、并且没有线程正在取请求时唤醒一个，被唤醒的线程
+ *          不一定是worker，它会去窃取
+ * 输入参数：item       请求
+ *           worker     工作线程编号，超出范围时取模
+ * 输出参数：无
+ * 返 回 值：所有队列都已满时返回false
+ **************************************************************/
+template<typename T>
+bool steal_queue<T>::push(T* item, int worker)
+{
+    int idx = (worker < 0) ? 0 : worker % m_workers;
+    for (int i = 0; i < m_workers; i++)
+    {
+        ws_deque<T>& deque = m_deques[idx];
+        deque.lock_push();
+        bool ok = deque.push(item);
+        deque.unlock_push();
+        if (ok)
+        {
+            notify();
+            return true;
+        }
+
+        if (++idx == m_workers)
+        {
+            idx = 0;
+        }
+    }
+
+    return false;
+}
+
+template<typename T>
+void steal_queue<T>::notify()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if ((m_waiters.load(std::memory_order_relaxed) > 0) && (m_spinners.load(std::memory_order_relaxed) == 0))
+    {
+        m_epoch.fetch_add(1, std::memory_order_release);
+        futex_wake(1);
+    }
+}
+
+// 取到请求后还有线程睡眠时，只要任何一个队列中还有请求就唤醒一个。只有存在睡眠的
+// 线程时才扫描各个队列
+template<typename T>
+void steal_queue<T>::pass_wake()
+{
+    if (m_waiters.load(std::memory_order_relaxed) == 0)
+    {
+        return;
+    }
+
+    for (int i = 0; i < m_workers; i++)
+    {
+        if (!m_deques[i].empty())
+        {
+            m_epoch.fetch_add(1, std::memory_order_release);
+            futex_wake(1);
+            return;
+        }
+    }
+}
+
+// 先取自己队列中的请求，再从下一个线程开始依次窃取。有竞争失败的队列时再扫描一遍，
+// 所有队列都为空才返回false
+template<typename T>
+bool steal_queue<T>::try_pop(int self, T*& item)
+{
+    while (true)
+    {
+        bool aborted = false;
+        int idx = self;
+        for (int i = 0; i < m_workers; i++)
+        {
+            int ret = m_deques[idx].steal(item);
+            if (ret == ws_deque<T>::STEAL_OK)
+            {
+                return true;
+            }
+
+            if (ret == ws_deque<T>::STEAL_ABORT)
+            {
+                aborted = true;
+            }
+
+            if (++idx == m_workers)
+            {
+                idx = 0;
+            }
+        }
+
+        if (!aborted)
+        {
+            return false;
+        }
+    }
+}
+
+// 出队，所有队列都为空时等待，过程同mpmc_queue<T>::pop
+template<typename T>
+bool steal_queue<T>::pop(T*& item)
+{
+    int me = self();
+    int spin = 0;
+    m_spinners.fetch_add(1, std::memory_order_relaxed);
+    while (true)
+    {
+        if (try_pop(me, item))
+        {
+            m_spinners.fetch_sub(1, std::memory_order_relaxed);
+            pass_wake();
+            return true;
+        }
+
+        if (m_closed.load(std::memory_order_acquire))
+        {
+            m_spinners.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        if (spin++ < m_spin)
+        {
+            cpu_relax();
+            continue;
+        }
+
+        int epoch = m_epoch.load(std::memory_order_acquire);
+        m_waiters.fetch_add(1, std::memory_order_relaxed);
+        m_spinners.fetch_sub(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!try_pop(me, item))
+        {
+            if (!m_closed.load(std::memory_order_acquire))
+            {
+                futex_wait(epoch);
+            }
+
+            m_spinners.fetch_add(1, std::memory_order_relaxed);
+            m_waiters.fetch_sub(1, std::memory_order_relaxed);
+            spin = 0;
+            continue;
+        }
+
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+        pass_wake();
+        return true;
+    }
+}
+
+template<typename T>
+void steal_queue<T>::close()
+{
+    m_closed.store(true, std::memory_order_release);
+    m_epoch.fetch_add(1, std::memory_order_release);
+    futex_wake(INT_MAX);
+}
+
+#endif
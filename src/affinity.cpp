@@ -0,0 +1,123 @@
+/*********************************************************************************
+ * File Name: affinity.cpp
+ * Description: CPU亲和性及NUMA内存策略设置
+ * History: 
+ *********************************************************************************/
+
+#include <sched.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "affinity.h"
+
+/**************************************************************
+ * 函数名称：bind_cpu
+ * 函数功能：将当前进程绑定到允许运行的CPU集合中的第idx个CPU上(按CPU个数取模)，
+ *          使进程不再被调度器在多个核之间迁移
+ * 输入参数：int idx            进程编号
+ * 输出参数：无
+ * 返 回 值：绑定的CPU编号，失败返回-1
+ **************************************************************/
+int bind_cpu(int idx)
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        return -1;
+    }
+
+    int count = CPU_COUNT(&allowed);
+    if (count <= 0)
+    {
+        return -1;
+    }
+
+    int target = idx % count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &allowed))
+        {
+            continue;
+        }
+
+        if (target-- > 0)
+        {
+            continue;
+        }
+
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        CPU_SET(cpu, &mask);
+        if (sched_setaffinity(0, sizeof(mask), &mask) != 0)
+        {
+            return -1;
+        }
+
+        return cpu;
+    }
+
+    return -1;
+}
+
+// 获取CPU所在的NUMA节点，非NUMA系统返回0
+int cpu_node(int cpu)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR* dir = opendir(path);
+    if (!dir)
+    {
+        return 0;
+    }
+
+    int node = 0;
+    struct dirent* entry = NULL;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (sscanf(entry->d_name, "node%d", &node) == 1)
+        {
+            break;
+        }
+    }
+
+    closedir(dir);
+    return node;
+}
+
+/**************************************************************
+ * 函数名称：bind_local_mem
+ * 函数功能：让当前进程此后分配的内存优先来自cpu所在的NUMA节点。
+ *          使用MPOL_PREFERRED而不是MPOL_BIND，本地节点内存耗尽时
+ *          退回到其他节点分配，而不是触发OOM
+ * 输入参数：int cpu            进程绑定的CPU
+ * 输出参数：无
+ * 返 回 值：成功返回true，失败返回false
+ **************************************************************/
+bool bind_local_mem(int cpu)
+{
+    int node = cpu_node(cpu);
+    if ((node < 0) || (node >= (int)(sizeof(unsigned long) * 8)))
+    {
+        return false;
+    }
+
+    unsigned long mask = 1UL << node;
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8) == 0;
+}
+
+// 获取内核处理连接fd上数据包的CPU，不支持时返回-1
+int incoming_cpu(int fd)
+{
+#ifdef SO_INCOMING_CPU
+    int cpu = -1;
+    socklen_t len = sizeof(cpu);
+    if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0)
+    {
+        return cpu;
+    }
+#endif
+
+    return -1;
+}
+
@@ -0,0 +1,12 @@
+#ifndef __AFFINITY_H_
+#define __AFFINITY_H_
+
+#include "global.h"
+
+int bind_cpu(int idx);
+int cpu_node(int cpu);
+bool bind_local_mem(int cpu);
+int incoming_cpu(int fd);
+
+#endif
+
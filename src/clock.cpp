@@ -0,0 +1,142 @@
+/*********************************************************************************
+ * File Name: clock.cpp
+ * Description: 事件循环的缓存时钟，可选用TSC代替clock_gettime
+ * History:
+ *********************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "clock.h"
+
+__thread long long Cclock::t_now_ns = 0;
+__thread long long Cclock::t_base_ns = 0;
+__thread unsigned long long Cclock::t_base_tsc = 0;
+unsigned long long Cclock::s_mult = 0;
+unsigned long long Cclock::s_resync_tsc = 0;
+double Cclock::s_tsc_ghz = 0;
+
+static long long monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static unsigned long long read_tsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// TSC频率恒定(constant_tsc)且在深度睡眠状态下不停止(nonstop_tsc)时才能用来计时
+static bool tsc_invariant()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    FILE* fp = fopen("/proc/cpuinfo", "r");
+    if (!fp)
+    {
+        return false;
+    }
+
+    char line[4096];
+    bool ok = false;
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (strncmp(line, "flags", 5) == 0)
+        {
+            ok = strstr(line, " constant_tsc") && strstr(line, " nonstop_tsc");
+            break;
+        }
+    }
+
+    fclose(fp);
+    return ok;
+#else
+    return false;
+#endif
+}
+
+/**************************************************************
+ * 函数名称：Cclock::init
+ * 函数功能：选择时钟来源。启用TSC时在CALIBRATE_NS内同时读取
+ *          单调时钟和TSC，算出每个TSC周期的纳秒数。工作进程和
+ *          线程在这之后创建，直接使用标定的结果
+ * 输入参数：use_tsc    是否尝试使用TSC
+ * 输出参数：无
+ * 返 回 值：启用了TSC返回true，否则使用clock_gettime
+ **************************************************************/
+bool Cclock::init(bool use_tsc)
+{
+    s_mult = 0;
+    t_now_ns = 0;
+    if (!use_tsc || !tsc_invariant())
+    {
+        update();
+        return false;
+    }
+
+    long long t0 = monotonic_ns();
+    unsigned long long c0 = read_tsc();
+    long long t1 = t0;
+    unsigned long long c1 = c0;
+    while (t1 - t0 < CALIBRATE_NS)
+    {
+        t1 = monotonic_ns();
+        c1 = read_tsc();
+    }
+
+    if (c1 <= c0)
+    {
+        update();
+        return false;
+    }
+
+    s_mult = (unsigned long long)((long double)(t1 - t0) * (1ULL << SHIFT) / (c1 - c0));
+    s_resync_tsc = (unsigned long long)((long double)(c1 - c0) * RESYNC_NS / (t1 - t0));
+    s_tsc_ghz = (double)(c1 - c0) / (t1 - t0);
+    t_base_tsc = 0;
+    update();
+    return true;
+}
+
+/**************************************************************
+ * 函数名称：Cclock::update
+ * 函数功能：读时钟并更新本线程的缓存。启用TSC时按上次对齐以来
+ *          经过的TSC周期数推算时间，距上次对齐超过RESYNC_NS(或者
+ *          本线程还没有对齐过)时重新读取单调时钟对齐。TSC推算的
+ *          时间与单调时钟有微小偏差，对齐时不让时间倒退
+ * 输入参数：无
+ * 输出参数：无
+ * 返 回 值：当前时间(毫秒)
+ **************************************************************/
+long long Cclock::update()
+{
+    long long now = 0;
+    unsigned long long delta = (s_mult > 0) ? (read_tsc() - t_base_tsc) : 0;
+    if ((s_mult > 0) && (t_base_tsc != 0) && (delta < s_resync_tsc))
+    {
+        now = t_base_ns + (long long)((delta * s_mult) >> SHIFT);
+    }
+    else
+    {
+        now = monotonic_ns();
+        if (s_mult > 0)
+        {
+            t_base_tsc = read_tsc();
+            t_base_ns = now;
+        }
+    }
+
+    if (now > t_now_ns)
+    {
+        t_now_ns = now;
+    }
+
+    return t_now_ns / 1000000;
+}
@@ -0,0 +1,46 @@
+#ifndef __CLOCK_H_
+#define __CLOCK_H_
+
+// 单调时钟：不受系统时间调整的影响，定时器和各种超时都用它计时
+#include <time.h>
+
+// 获取单调时钟的当前时间(毫秒)
+static inline long long monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 事件循环的缓存时钟：每次epoll_wait返回后调用update读一次时钟，处理事件时定时器、
+// 统计和日志都读取缓存的时间，不再各自调用time或clock_gettime。缓存按线程保存，
+// 线程池的每个事件循环线程各自更新。启用TSC时update只读时间戳计数器，按启动时
+// 标定的频率换算成单调时钟的时间，每秒用clock_gettime重新对齐一次
+class Cclock
+{
+public:
+    // 启动时在主线程调用一次。use_tsc为true且TSC频率恒定时标定TSC，返回是否启用了TSC
+    static bool init(bool use_tsc);
+    // 读时钟并更新本线程的缓存，返回当前时间(毫秒)，不会比上次返回的时间早
+    static long long update();
+    // 本线程上次update的时间(毫秒)，还没有update过时读一次时钟
+    static long long now_ms() { return (t_now_ns > 0) ? t_now_ns / 1000000 : update(); }
+    static time_t now_sec() { return now_ms() / 1000; }
+    static bool tsc_enabled() { return s_mult > 0; }
+    static double tsc_ghz() { return s_tsc_ghz; }
+
+private:
+    static const int SHIFT = 32;                        // s_mult的定点小数位数
+    static const long long CALIBRATE_NS = 20000000;     // 标定TSC的时长
+    static const long long RESYNC_NS = 1000000000;      // 与clock_gettime对齐的间隔
+
+private:
+    static __thread long long t_now_ns;                 // 缓存的时间(纳秒)
+    static __thread long long t_base_ns;                // 上次对齐时的单调时钟时间
+    static __thread unsigned long long t_base_tsc;      // 上次对齐时的TSC
+    static unsigned long long s_mult;                   // 每个TSC周期的纳秒数乘以2^SHIFT，0表示不用TSC
+    static unsigned long long s_resync_tsc;             // RESYNC_NS对应的TSC周期数
+    static double s_tsc_ghz;
+};
+
+#endif
@@ -41,15 +41,78 @@ void Conn::reset()
     m_srv_read_idx = 0;
     m_srv_write_idx = 0;
     m_srv_closed = false;
+    m_srv_half_closed = false;
+    m_clt_events = 0;
+    m_clt_want = 0;
+    m_clt_stalled = false;
+    m_srv_events = 0;
+    m_srv_want = 0;
+    m_srv_stalled = false;
+    m_clt_pending = false;
+    m_srv_pending = false;
+    m_clt_ready = false;
+    m_srv_ready = false;
     m_cltfd = -1;
+    m_proxy_send = PROXY_NONE;
+    m_proxy_expect = false;
+    m_proxy_len = 0;
+    m_proxy_sent = 0;
     memset(m_clt_buf, '\0', sizeof(m_clt_buf));
     memset(m_srv_buf, '\0', sizeof(m_srv_buf));
 }
 
+// 初始化客户端连接。需要发送PROXY协议头部且客户端连接上没有待解析的头部时，
+// 用客户端地址和它连接的本地地址生成头部
 void Conn::init_clt(int sockfd, const sockaddr_in & clnt_addr)
 {
     m_cltfd = sockfd;
     m_clt_addr = clnt_addr;
+    if ((m_proxy_send != PROXY_NONE) && !m_proxy_expect)
+    {
+        struct sockaddr_in local;
+        socklen_t len = sizeof(local);
+        getsockname(sockfd, (struct sockaddr*)&local, &len);
+        m_proxy_len = proxy_build(m_proxy_send, m_clt_addr, local, m_proxy_hdr);
+    }
+}
+
+/**************************************************************
+ * 函数名称：Conn::strip_proxy
+ * 函数功能：解析客户端连接开头的PROXY协议头部并从缓冲区中跳过，
+ *          头部中的地址作为客户端地址。需要向服务端发送头部时
+ *          转发头部中原始连接的地址
+ * 输入参数：无
+ * 输出参数：无
+ * 返 回 值：头部长度，数据不完整返回0，格式错误返回-1
+ **************************************************************/
+int Conn::strip_proxy()
+{
+    struct sockaddr_in src;
+    struct sockaddr_in dst;
+    bool has_addr = false;
+    int n = proxy_parse(m_clt_buf + m_clt_write_idx, m_clt_read_idx - m_clt_write_idx, src, dst, has_addr);
+    if (n <= 0)
+    {
+        return n;
+    }
+
+    m_proxy_expect = false;
+    m_clt_write_idx += n;
+    if (!has_addr)
+    {
+        // 没有地址时把springsnail看作原始连接的两端
+        src = m_clt_addr;
+        socklen_t len = sizeof(dst);
+        getsockname(m_cltfd, (struct sockaddr*)&dst, &len);
+    }
+
+    m_clt_addr = src;
+    if (m_proxy_send != PROXY_NONE)
+    {
+        m_proxy_len = proxy_build(m_proxy_send, src, dst, m_proxy_hdr);
+    }
+
+    return n;
 }
 
 void Conn::init_srv(int sockfd, const sockaddr_in & srv_addr)
@@ -58,12 +121,20 @@ void Conn::init_srv(int sockfd, const sockaddr_in & srv_addr)
     m_srv_addr = srv_addr;
 }
 
-// 读取客户端数据
-RET_CODE Conn::read_clt()
+// 读取客户端数据。budget为本次最多读取的字节数，不大于0表示不限制
+RET_CODE Conn::read_clt(int budget)
 {
     int bytes_read = 0;
+    int total = 0;
+    m_clt_pending = false;
     while (true)
     {
+        if ((budget > 0) && (total >= budget))
+        {
+            m_clt_pending = true;
+            break;
+        }
+
         if (m_clt_read_idx >= BUFF_SIZE)
         {
             printf("the client read buffer is full, let server write\n");
@@ -86,17 +157,26 @@ RET_CODE Conn::read_clt()
         }
 
         m_clt_read_idx += bytes_read;
+        total += bytes_read;
     }
 
     return ((m_clt_read_idx - m_clt_write_idx) > 0) ? OK : NOTHING;
 }
 
-// 读取服务端数据
-RET_CODE Conn::read_srv()
+// 读取服务端数据。budget为本次最多读取的字节数，不大于0表示不限制
+RET_CODE Conn::read_srv(int budget)
 {
     int bytes_read = 0;
+    int total = 0;
+    m_srv_pending = false;
     while (true)
     {
+        if ((budget > 0) && (total >= budget))
+        {
+            m_srv_pending = true;
+            break;
+        }
+
         if (m_srv_read_idx >= BUFF_SIZE)
         {
             printf("the server read buffer is full, let client write\n");
@@ -120,6 +200,7 @@ RET_CODE Conn::read_srv()
         }
 
         m_srv_read_idx += bytes_read;
+        total += bytes_read;
     }
 
     return ((m_srv_read_idx - m_srv_write_idx) > 0) ? OK : NOTHING;
@@ -157,6 +238,7 @@ RET_CODE Conn::write_clt()
     }
 }
 
+// 发送客户端数据。PROXY协议头部还没有发完时与客户端数据合并为一次writev
 RET_CODE Conn::write_srv()
 {
     int bytes_write = 0;
@@ -169,7 +251,27 @@ RET_CODE Conn::write_srv()
             return BUFFER_EMPTY;
         }
 
-        bytes_write = send(m_srvfd, m_clt_buf + m_clt_write_idx, m_clt_read_idx - m_clt_write_idx, 0);
+        if (m_proxy_sent < m_proxy_len)
+        {
+            struct iovec iov[2];
+            iov[0].iov_base = m_proxy_hdr + m_proxy_sent;
+            iov[0].iov_len = m_proxy_len - m_proxy_sent;
+            iov[1].iov_base = m_clt_buf + m_clt_write_idx;
+            iov[1].iov_len = m_clt_read_idx - m_clt_write_idx;
+            bytes_write = writev(m_srvfd, iov, 2);
+            if (bytes_write > 0)
+            {
+                int hdr = (bytes_write < (int)iov[0].iov_len) ? bytes_write : (int)iov[0].iov_len;
+                m_proxy_sent += hdr;
+                m_clt_write_idx += bytes_write - hdr;
+                continue;
+            }
+        }
+        else
+        {
+            bytes_write = send(m_srvfd, m_clt_buf + m_clt_write_idx, m_clt_read_idx - m_clt_write_idx, 0);
+        }
+
         if (bytes_write == -1)
         {
             if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
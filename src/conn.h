@@ -2,6 +2,8 @@
 #define __CONN_H_
 
 #include "fdwrapper.h"
+#include "proxyproto.h"
+#include "timer.h"
 
 class Conn
 {
@@ -13,10 +15,11 @@ public:
     void init_clt(int sockfd, const sockaddr_in& clnt_addr);
     void init_srv(int sockfd, const sockaddr_in& srv_addr);
     void reset();
-    RET_CODE read_clt();
+    RET_CODE read_clt(int budget = 0);
     RET_CODE write_clt();
-    RET_CODE read_srv();
+    RET_CODE read_srv(int budget = 0);
     RET_CODE write_srv();
+    int strip_proxy();
 
 public:
     static const int BUFF_SIZE = 2048;
@@ -34,6 +37,30 @@ public:
     sockaddr_in m_srv_addr;
 
     bool m_srv_closed;
+    bool m_srv_half_closed;         // 排空阶段已对服务端执行半关闭(SHUT_WR)
+
+    // 内核事件表缓存：只有期望的事件与已注册的事件不同时才调用epoll_ctl
+    int m_clt_events;               // cltfd当前在内核事件表中注册的事件
+    int m_clt_want;                 // cltfd期望注册的事件，每轮事件循环结束时同步到内核事件表
+    bool m_clt_stalled;             // 客户端缓冲区满时停止了读取，缓冲区腾空后需要继续读取
+    int m_srv_events;
+    int m_srv_want;
+    bool m_srv_stalled;
+
+    // 读预算：一次事件最多读取的字节数用完时套接字中可能还有数据，由管理对象的就绪队列轮流继续读取
+    bool m_clt_pending;             // 客户端套接字因预算用完而停止读取
+    bool m_srv_pending;
+    bool m_clt_ready;               // cltfd是否已在就绪队列中
+    bool m_srv_ready;
+
+    // PROXY协议：客户端连接开头的头部先解析掉；发给服务端的头部与第一批客户端数据一起发送
+    PROXY_VERSION m_proxy_send;     // 发给服务端的头部版本，PROXY_NONE表示不发送
+    bool m_proxy_expect;            // 客户端连接开头还有待解析的头部
+    char m_proxy_hdr[PROXY_HDR_MAX];
+    int m_proxy_len;                // 发给服务端的头部长度
+    int m_proxy_sent;               // 头部已经发送的字节数
+
+    Ctimer m_idle_timer;            // 空闲超时，会话上每有一次读写就推迟
 };
 
 #endif
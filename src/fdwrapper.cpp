@@ -10,33 +10,35 @@
 #include "conn.h"
 #include "fdwrapper.h"
 
-// 将文件描述符设置为非阻塞的
+// 将文件描述符设置为非阻塞的，已经是非阻塞的描述符不再调用F_SETFL
 int setnonblocking(int fd)
 {
     int old_option = fcntl(fd, F_GETFL);
-    int new_option = old_option | O_NONBLOCK;
-    fcntl(fd, F_SETFL, new_option);
+    if (!(old_option & O_NONBLOCK))
+    {
+        fcntl(fd, F_SETFL, old_option | O_NONBLOCK);
+    }
+
     return old_option;
 }
 
-// 注册文件描述符fd的可读事件EPOLLIN
+// 注册文件描述符fd的可读事件EPOLLIN。边沿触发要求fd是非阻塞的，由创建者在创建时设置
+// (accept4/socket的SOCK_NONBLOCK或者setnonblocking)，这里不再为每次注册调用fcntl
 void add_read_fd(int epollfd, int fd)
 {
     struct epoll_event event;
     event.data.fd = fd;
     event.events = EPOLLIN | EPOLLET;
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    setnonblocking(fd);
 }
 
-// 注册文件描述符fd上的可写事件EPOLLOUT
+// 注册文件描述符fd上的可写事件EPOLLOUT，fd必须已经是非阻塞的
 void add_write_fd(int epollfd, int fd)
 {
     struct epoll_event event;
     event.data.fd = fd;
     event.events = EPOLLOUT | EPOLLET;
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    setnonblocking(fd);
 }
 
 // 删除文件描述符fd上注册的所有事件，并关闭文件描述符
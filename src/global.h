@@ -22,6 +22,7 @@
 #include <sys/wait.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <exception>
 #include <semaphore.h>
 #include <list>
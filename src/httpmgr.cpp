@@ -0,0 +1,1737 @@
+/*********************************************************************************
+ * File Name: httpmgr.cpp
+ * Description: 七层HTTP代理：请求路由与服务端连接池
+ * History: 
+ *********************************************************************************/
+
+#include <ctype.h>
+#include <new>
+#include "httpmgr.h"
+
+static const int DEFAULT_CONNS = 8;         // 路由规则中每个服务端默认的最大连接数
+static const char* CONN_KEEP_ALIVE = "Connection: keep-alive\r\n";
+
+// 逐跳头部只对一段连接有效，不转发给服务端
+static bool is_hop_header(const Chttphead& head, const char* buf, const Cheader& header)
+{
+    return head.span_equal(buf, header.m_name, "Connection")
+        || head.span_equal(buf, header.m_name, "Keep-Alive")
+        || head.span_equal(buf, header.m_name, "Proxy-Connection");
+}
+
+// 查找头部，返回在m_headers中的下标，没有时返回-1
+static int find_header(const Chttphead& head, const char* buf, const char* name)
+{
+    for (int i = 0; i < head.m_header_cnt; i++)
+    {
+        if (head.span_equal(buf, head.m_headers[i].m_name, name))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**************************************************************
+ * 函数名称：find_directive
+ * 函数功能：在Cache-Control(或Pragma)头部中查找指令，同名头部有
+ *          多个时依次查找，指令不区分大小写
+ * 输入参数：head       解析后的头部
+ *           buf        头部数据
+ *           header     头部名称
+ *           name       指令名称
+ * 输出参数：无
+ * 返 回 值：没有该指令时返回-1，指令带数值时返回数值，否则返回0
+ **************************************************************/
+static long find_directive(const Chttphead& head, const char* buf, const char* header, const char* name)
+{
+    int name_len = strlen(name);
+    for (int i = 0; i < head.m_header_cnt; i++)
+    {
+        if (!head.span_equal(buf, head.m_headers[i].m_name, header))
+        {
+            continue;
+        }
+
+        const char* p = buf + head.m_headers[i].m_value.m_off;
+        const char* end = p + head.m_headers[i].m_value.m_len;
+        while (p < end)
+        {
+            while ((p < end) && ((*p == ' ') || (*p == '\t') || (*p == ',')))
+            {
+                p++;
+            }
+
+            const char* tok = p;
+            while ((p < end) && (*p != ',') && (*p != '=') && (*p != ' ') && (*p != '\t'))
+            {
+                p++;
+            }
+
+            int tok_len = p - tok;
+            long num = 0;
+            while ((p < end) && ((*p == ' ') || (*p == '\t')))
+            {
+                p++;
+            }
+
+            if ((p < end) && (*p == '='))
+            {
+                p++;
+                bool quoted = (p < end) && (*p == '"');
+                p += quoted ? 1 : 0;
+                while ((p < end) && (*p >= '0') && (*p <= '9'))
+                {
+                    num = (num < 100000000) ? (num * 10 + (*p - '0')) : num;
+                    p++;
+                }
+
+                // 跳过指令值的其余部分，引号中可以有逗号
+                while ((p < end) && (quoted ? (*p != '"') : (*p != ',')))
+                {
+                    p++;
+                }
+
+                p += (quoted && (p < end)) ? 1 : 0;
+            }
+
+            if ((tok_len == name_len) && (strncasecmp(tok, name, name_len) == 0))
+            {
+                return num;
+            }
+        }
+    }
+
+    return -1;
+}
+
+/**************************************************************
+ * 函数名称：Chttpcfg::add_route
+ * 函数功能：添加一条路由规则，格式为[host]/prefix=ip:port[,ip:port...]，
+ *          每条规则对应一个上游服务器组
+ * 输入参数：spec   路由规则
+ * 输出参数：无
+ * 返 回 值：格式错误时返回false
+ **************************************************************/
+bool Chttpcfg::add_route(const char * spec)
+{
+    const char* eq = strchr(spec, '=');
+    if (!eq)
+    {
+        return false;
+    }
+
+    const char* slash = (const char*)memchr(spec, '/', eq - spec);
+    if (!slash || ((slash - spec) >= 256) || ((eq - slash) >= 256))
+    {
+        return false;
+    }
+
+    Croute route;
+    memcpy(route.m_host, spec, slash - spec);
+    route.m_host[slash - spec] = '\0';
+    memcpy(route.m_prefix, slash, eq - slash);
+    route.m_prefix[eq - slash] = '\0';
+
+    Cupstream upstream;
+    const char* p = eq + 1;
+    while (*p)
+    {
+        const char* end = strchr(p, ',');
+        if (!end)
+        {
+            end = p + strlen(p);
+        }
+
+        const char* colon = (const char*)memchr(p, ':', end - p);
+        if (!colon || ((colon - p) >= (int)sizeof(((Chost*)0)->m_hostname)))
+        {
+            return false;
+        }
+
+        Chost host;
+        memcpy(host.m_hostname, p, colon - p);
+        host.m_hostname[colon - p] = '\0';
+        host.m_port = atoi(colon + 1);
+        host.m_conncnt = DEFAULT_CONNS;
+        host.m_proxy_send = PROXY_NONE;
+        host.m_proxy_accept = false;
+        if (host.m_port <= 0)
+        {
+            return false;
+        }
+
+        upstream.m_servers.push_back(host);
+        p = (*end) ? (end + 1) : end;
+    }
+
+    if (upstream.m_servers.empty())
+    {
+        return false;
+    }
+
+    route.m_upstream = m_upstreams.size();
+    m_upstreams.push_back(upstream);
+    m_routes.push_back(route);
+    return true;
+}
+
+Cbackend::Cbackend()
+{
+    m_buf = new char[BUFF_SIZE];
+    if (!m_buf)
+    {
+        throw std::exception();
+    }
+
+    m_capture = NULL;
+    reset();
+}
+
+Cbackend::~Cbackend()
+{
+    delete [] m_buf;
+    delete [] m_capture;
+}
+
+void Cbackend::reset()
+{
+    m_fd = -1;
+    m_is_backend = true;
+    m_events = 0;
+    m_want = 0;
+    m_ready = false;
+    m_upstream = -1;
+    m_connecting = false;
+    m_read_idx = 0;
+    m_write_idx = 0;
+    m_msg_end = 0;
+    m_head.reset();
+    m_body.init(BODY_NONE, 0);
+    m_head_done = false;
+    m_done = false;
+    m_reusable = true;
+    m_stalled = false;
+    m_session = NULL;
+    delete [] m_capture;
+    m_capture = NULL;
+    m_capture_len = 0;
+    m_capture_head = 0;
+    m_ttl = 0;
+    m_age = 0;
+}
+
+Csession::Csession()
+{
+    m_buf = new char[BUFF_SIZE];
+    if (!m_buf)
+    {
+        throw std::exception();
+    }
+
+    m_reply = NULL;
+    reset();
+}
+
+Csession::~Csession()
+{
+    delete [] m_buf;
+    delete [] m_reply;
+}
+
+void Csession::init_clt(int sockfd, const sockaddr_in & clnt_addr)
+{
+    m_fd = sockfd;
+    m_clt_addr = clnt_addr;
+}
+
+void Csession::reset()
+{
+    m_fd = -1;
+    m_is_backend = false;
+    m_events = 0;
+    m_want = 0;
+    m_ready = false;
+    m_start = 0;
+    m_fwd_end = 0;
+    m_read_idx = 0;
+    m_head.reset();
+    m_body.init(BODY_NONE, 0);
+    m_state = SESSION_HEAD;
+    m_keep_alive = false;
+    m_is_head = false;
+    m_eof = false;
+    m_stalled = false;
+    m_proxy_expect = false;
+    m_upstream = -1;
+    m_backend = NULL;
+    m_cache_key_len = 0;
+    delete [] m_reply;
+    m_reply = NULL;
+    m_reply_len = 0;
+    m_reply_idx = 0;
+    m_iov_cnt = 0;
+    m_iov_idx = 0;
+}
+
+Chttpmgr::Chttpmgr(int epollfd, const Chttpcfg & cfg)
+    : m_epollfd(epollfd), m_cfg(cfg), m_session_cnt(0), m_draining(false), m_io_budget(IO_BUDGET),
+      m_epoll_ctl_cnt(0), m_request_cnt(0), m_connect_cnt(0), m_cache_hit_cnt(0), m_idle_timeout(0), m_now(0), m_timeout_cnt(0),
+      m_connect_timeout_cnt(0)
+{
+    m_timers = Ctimer_queue::create(TIMER_WHEEL, 0);
+
+    m_pools.resize(cfg.m_upstreams.size());
+    for (size_t i = 0; i < cfg.m_upstreams.size(); i++)
+    {
+        const vector<Chost>& servers = cfg.m_upstreams[i].m_servers;
+        for (size_t j = 0; j < servers.size(); j++)
+        {
+            printf("upstream %d srv host info: (%s, %d)\n", (int)i, servers[j].m_hostname, servers[j].m_port);
+            m_pools[i].m_max_conns += servers[j].m_conncnt;
+        }
+    }
+}
+
+Chttpmgr::~Chttpmgr()
+{
+    for (map<int, Cfdstate*>::iterator iter = m_fds.begin(); iter != m_fds.end(); iter++)
+    {
+        close(iter->first);
+        if (iter->second->m_is_backend)
+        {
+            delete static_cast<Cbackend*>(iter->second);
+        }
+        else
+        {
+            delete static_cast<Csession*>(iter->second);
+        }
+    }
+
+    for (size_t i = 0; i < m_free_sessions.size(); i++)
+    {
+        delete m_free_sessions[i];
+    }
+
+    for (size_t i = 0; i < m_free_backends.size(); i++)
+    {
+        delete m_free_backends[i];
+    }
+
+    delete m_timers;
+}
+
+// 为新客户端连接建立会话。与服务端连接不再一一绑定，只要内存允许就可以接受
+Csession* Chttpmgr::pick_conn(int cltfd)
+{
+    if (m_draining)
+    {
+        return NULL;
+    }
+
+    Csession* session = NULL;
+    if (!m_free_sessions.empty())
+    {
+        session = m_free_sessions.back();
+        m_free_sessions.pop_back();
+    }
+    else
+    {
+        try
+        {
+            session = new Csession;
+        }
+        catch (...)
+        {
+            return NULL;
+        }
+    }
+
+    session->m_fd = cltfd;
+    session->m_proxy_expect = m_cfg.m_proxy_accept;
+    add_fd(session, 0);
+    m_fds[cltfd] = session;
+    m_session_cnt++;
+    session->m_idle_timer.init(on_idle_timeout, this, session);
+    touch(session);
+    return session;
+}
+
+int Chttpmgr::get_used_conn_cnt()
+{
+    return m_session_cnt;
+}
+
+// 各上游服务器组中空闲的服务端连接数
+int Chttpmgr::get_idle_conn_cnt()
+{
+    int cnt = 0;
+    for (size_t i = 0; i < m_pools.size(); i++)
+    {
+        cnt += m_pools[i].m_idle.size();
+    }
+
+    return cnt;
+}
+
+// 服务端连接按需建立，失效的连接直接关闭，不需要像Cmgr那样定期重建
+void Chttpmgr::recycle_conns()
+{
+}
+
+/**************************************************************
+ * 函数名称：Chttpmgr::drain
+ * 函数功能：进入排空状态。空闲的客户端会话和服务端连接立即关闭，
+ *          正在处理请求的会话在当前应答发完后关闭
+ * 输入参数：无
+ * 输出参数：无
+ * 返 回 值：无
+ **************************************************************/
+void Chttpmgr::drain()
+{
+    m_draining = true;
+
+    vector<Cfdstate*> idle;
+    for (map<int, Cfdstate*>::iterator iter = m_fds.begin(); iter != m_fds.end(); iter++)
+    {
+        Cfdstate* state = iter->second;
+        if (state->m_is_backend)
+        {
+            if (!static_cast<Cbackend*>(state)->m_session)
+            {
+                idle.push_back(state);
+            }
+        }
+        else
+        {
+            Csession* session = static_cast<Csession*>(state);
+            if ((session->m_state == SESSION_HEAD) && (session->m_start == session->m_read_idx))
+            {
+                idle.push_back(state);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < idle.size(); i++)
+    {
+        if (idle[i]->m_is_backend)
+        {
+            close_backend(static_cast<Cbackend*>(idle[i]));
+        }
+        else
+        {
+            close_session(static_cast<Csession*>(idle[i]));
+        }
+    }
+}
+
+RET_CODE Chttpmgr::process(int fd, OP_TYPE type)
+{
+    map<int, Cfdstate*>::iterator iter = m_fds.find(fd);
+    if (iter == m_fds.end())
+    {
+        return NOTHING;
+    }
+
+    if (iter->second->m_is_backend)
+    {
+        Cbackend* backend = static_cast<Cbackend*>(iter->second);
+        if (backend->m_session)
+        {
+            touch(backend->m_session);
+        }
+
+        return (type == READ) ? on_srv_read(backend) : on_srv_write(backend);
+    }
+
+    Csession* session = static_cast<Csession*>(iter->second);
+    touch(session);
+    return (type == READ) ? on_clt_read(session) : on_clt_write(session);
+}
+
+// 读取客户端请求
+RET_CODE Chttpmgr::on_clt_read(Csession * session)
+{
+    RET_CODE res = read_fd(session, session->m_buf, session->m_read_idx, Csession::BUFF_SIZE);
+    if (res == IOERR)
+    {
+        close_session(session);
+        return CLOSED;
+    }
+
+    session->m_eof = session->m_eof || (res == CLOSED);
+    session->m_stalled = (res == BUFFER_FULL);
+    return advance(session);
+}
+
+// 客户端可写时继续发送服务端应答
+RET_CODE Chttpmgr::on_clt_write(Csession * session)
+{
+    Cbackend* backend = session->m_backend;
+    if (!backend)
+    {
+        if (session->m_state == SESSION_CACHED)
+        {
+            return advance(session);
+        }
+
+        set_interest(session, 0);
+        return OK;
+    }
+
+    RET_CODE res = forward_response(backend);
+    if (res == IOERR)
+    {
+        close_session(session);
+        return CLOSED;
+    }
+
+    return ((res == OK) && backend->m_done) ? advance(session) : OK;
+}
+
+// 读取服务端应答并转发给客户端
+RET_CODE Chttpmgr::on_srv_read(Cbackend * backend)
+{
+    Csession* session = backend->m_session;
+    if (!session)
+    {
+        // 空闲连接上不应该有数据，可读说明服务端关闭了连接或者违反了协议
+        close_backend(backend);
+        return OK;
+    }
+
+    if (backend->m_connecting)
+    {
+        return on_srv_write(backend);
+    }
+
+    RET_CODE res = read_fd(backend, backend->m_buf, backend->m_read_idx, Cbackend::BUFF_SIZE);
+    if (res == IOERR)
+    {
+        return backend_failed(backend);
+    }
+
+    backend->m_stalled = (res == BUFFER_FULL);
+    if (parse_response(backend) != OK)
+    {
+        return backend_failed(backend);
+    }
+
+    if (res == CLOSED)
+    {
+        // 没有长度的应答以连接关闭结束，其余情况说明应答不完整
+        if (backend->m_head_done && (backend->m_body.m_type == BODY_UNTIL_CLOSE))
+        {
+            backend->m_done = true;
+        }
+        else if (!backend->m_done)
+        {
+            return backend_failed(backend);
+        }
+
+        backend->m_reusable = false;
+    }
+
+    res = forward_response(backend);
+    if (res == IOERR)
+    {
+        close_session(session);
+        return CLOSED;
+    }
+
+    return ((res == OK) && backend->m_done) ? advance(session) : OK;
+}
+
+// 非阻塞connect完成，或者请求数据可以继续发送
+RET_CODE Chttpmgr::on_srv_write(Cbackend * backend)
+{
+    if (backend->m_connecting)
+    {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if ((getsockopt(backend->m_fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) || (error != 0))
+        {
+            printf("connect to upstream %d failed: %s\n", backend->m_upstream, strerror(error));
+            return backend_failed(backend);
+        }
+
+        backend->m_connecting = false;
+        m_timers->cancel(&backend->m_connect_timer);
+        set_interest(backend, 0);
+    }
+
+    return backend->m_session ? advance(backend->m_session) : OK;
+}
+
+/**************************************************************
+ * 函数名称：Chttpmgr::advance
+ * 函数功能：推进会话的状态机：解析请求头部、路由并取得服务端连接、
+ *          转发请求；请求和应答都完成后释放服务端连接，保持连接时
+ *          继续处理缓冲区中已经到达的下一个请求
+ * 输入参数：session    客户端会话
+ * 输出参数：无
+ * 返 回 值：CLOSED表示会话已经关闭
+ **************************************************************/
+RET_CODE Chttpmgr::advance(Csession * session)
+{
+    while (true)
+    {
+        if (session->m_state == SESSION_HEAD)
+        {
+            if (session->m_start == session->m_read_idx)
+            {
+                session->m_start = session->m_fwd_end = session->m_read_idx = 0;
+                if (session->m_eof || m_draining)
+                {
+                    close_session(session);
+                    return CLOSED;
+                }
+
+                return OK;
+            }
+
+            // 跳过连接开头的PROXY协议头部，头部中的地址作为客户端地址
+            if (session->m_proxy_expect)
+            {
+                struct sockaddr_in src;
+                struct sockaddr_in dst;
+                bool has_addr = false;
+                int n = proxy_parse(session->m_buf, session->m_read_idx, src, dst, has_addr);
+                if ((n < 0) || ((n == 0) && (session->m_eof || (session->m_read_idx >= Csession::BUFF_SIZE))))
+                {
+                    close_session(session);
+                    return CLOSED;
+                }
+                else if (n == 0)
+                {
+                    return OK;
+                }
+
+                session->m_proxy_expect = false;
+                session->m_clt_addr = has_addr ? src : session->m_clt_addr;
+                session->m_start = n;
+                continue;
+            }
+
+            // 上一个请求之后的数据移到缓冲区头部，头部解析结果中的偏移都相对于缓冲区起始位置
+            if (session->m_start > 0)
+            {
+                session->m_read_idx -= session->m_start;
+                memmove(session->m_buf, session->m_buf + session->m_start, session->m_read_idx);
+                session->m_start = session->m_fwd_end = 0;
+                if (session->m_stalled)
+                {
+                    session->m_stalled = false;
+                    mark_ready(session);
+                }
+            }
+
+            PARSE_CODE code = session->m_head.parse(session->m_buf, session->m_read_idx, true);
+            if (code == PARSE_ERROR)
+            {
+                return reply_error(session, 400);
+            }
+            else if (code == PARSE_AGAIN)
+            {
+                if (session->m_read_idx >= Csession::BUFF_SIZE)
+                {
+                    return reply_error(session, 431);
+                }
+                else if (session->m_eof)
+                {
+                    close_session(session);
+                    return CLOSED;
+                }
+
+                return OK;
+            }
+
+            if (start_request(session) == CLOSED)
+            {
+                return CLOSED;
+            }
+
+            continue;
+        }
+        else if (session->m_state == SESSION_WAIT)
+        {
+            return OK;
+        }
+        else if (session->m_state == SESSION_CACHED)
+        {
+            RET_CODE res = send_reply(session);
+            if (res == IOERR)
+            {
+                close_session(session);
+                return CLOSED;
+            }
+            else if (res == TRY_AGAIN)
+            {
+                return OK;
+            }
+
+            if (!session->m_keep_alive)
+            {
+                close_session(session);
+                return CLOSED;
+            }
+
+            // 可以缓存的请求没有请求体，下一个请求从头部之后开始
+            session->m_start = session->m_fwd_end;
+            if ((session->m_start == session->m_read_idx) && session->m_stalled)
+            {
+                session->m_stalled = false;
+                mark_ready(session);
+            }
+
+            session->m_state = SESSION_HEAD;
+            session->m_head.reset();
+            continue;
+        }
+
+        Cbackend* backend = session->m_backend;
+        if (!session->m_body.done())
+        {
+            int n = session->m_body.consume(session->m_buf + session->m_fwd_end, session->m_read_idx - session->m_fwd_end);
+            if (n < 0)
+            {
+                if (backend->m_head_done)
+                {
+                    close_session(session);
+                    return CLOSED;
+                }
+
+                return reply_error(session, 400);
+            }
+
+            session->m_fwd_end += n;
+        }
+
+        if (backend->m_connecting)
+        {
+            return OK;
+        }
+
+        if (forward_request(session) == IOERR)
+        {
+            return backend_failed(backend);
+        }
+
+        bool req_done = session->m_body.done() && (session->m_iov_cnt == 0) && (session->m_start == session->m_fwd_end);
+        bool rsp_done = backend->m_done && (backend->m_write_idx == backend->m_read_idx);
+        if (!rsp_done)
+        {
+            if (session->m_eof && !req_done)
+            {
+                close_session(session);
+                return CLOSED;
+            }
+
+            return OK;
+        }
+
+        // 服务端在请求发完之前就给出了应答，连接上还有请求的剩余数据，两端都不能再使用
+        if (!req_done)
+        {
+            close_session(session);
+            return CLOSED;
+        }
+
+        release_backend(backend);
+        if (!session->m_keep_alive)
+        {
+            close_session(session);
+            return CLOSED;
+        }
+
+        session->m_state = SESSION_HEAD;
+        session->m_head.reset();
+    }
+}
+
+// 请求头部解析完毕：确定请求体的定界方式，路由到上游服务器组并取得服务端连接
+RET_CODE Chttpmgr::start_request(Csession * session)
+{
+    m_request_cnt++;
+
+    const Chttphead& head = session->m_head;
+    if (head.m_has_te)
+    {
+        if (!head.m_chunked)
+        {
+            return reply_error(session, 501);
+        }
+
+        session->m_body.init(BODY_CHUNKED, 0);
+    }
+    else
+    {
+        session->m_body.init((head.m_content_length > 0) ? BODY_LENGTH : BODY_NONE, head.m_content_length);
+    }
+
+    session->m_keep_alive = http_keep_alive(head);
+    session->m_is_head = head.span_equal(session->m_buf, head.m_method, "HEAD");
+    session->m_fwd_end = head.m_head_len;
+
+    session->m_upstream = route(session);
+    if (session->m_upstream < 0)
+    {
+        return reply_error(session, 404);
+    }
+
+    // 缓存命中时不需要服务端连接
+    if (cache_lookup(session))
+    {
+        return OK;
+    }
+
+    build_head(session);
+
+    Cbackend* backend = acquire_backend(session);
+    if (backend)
+    {
+        attach(session, backend);
+    }
+    else if (session->m_state != SESSION_WAIT)
+    {
+        return reply_error(session, 502);
+    }
+
+    return OK;
+}
+
+/**************************************************************
+ * 函数名称：Chttpmgr::forward_request
+ * 函数功能：把请求发给服务端：先发送改写后的头部，再直接从缓冲区发送
+ *          已经确认属于本请求的请求体数据
+ * 输入参数：session    客户端会话
+ * 输出参数：无
+ * 返 回 值：TRY_AGAIN表示服务端暂时写不进去，IOERR表示服务端连接出错
+ **************************************************************/
+RET_CODE Chttpmgr::forward_request(Csession * session)
+{
+    Cbackend* backend = session->m_backend;
+    while (session->m_iov_idx < session->m_iov_cnt)
+    {
+        int n = writev(backend->m_fd, session->m_iov + session->m_iov_idx, session->m_iov_cnt - session->m_iov_idx);
+        if (n == -1)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                set_interest(backend, EPOLLOUT);
+                return TRY_AGAIN;
+            }
+
+            return IOERR;
+        }
+
+        while ((n > 0) && (session->m_iov_idx < session->m_iov_cnt))
+        {
+            struct iovec& iov = session->m_iov[session->m_iov_idx];
+            if (n >= (int)iov.iov_len)
+            {
+                n -= iov.iov_len;
+                session->m_iov_idx++;
+            }
+            else
+            {
+                iov.iov_base = (char*)iov.iov_base + n;
+                iov.iov_len -= n;
+                n = 0;
+            }
+        }
+    }
+
+    // 头部已经发完，之后从请求体开始转发
+    if (session->m_iov_cnt > 0)
+    {
+        session->m_iov_cnt = session->m_iov_idx = 0;
+        session->m_start = session->m_head.m_head_len;
+    }
+
+    while (session->m_start < session->m_fwd_end)
+    {
+        int n = send(backend->m_fd, session->m_buf + session->m_start, session->m_fwd_end - session->m_start, 0);
+        if (n == -1)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                set_interest(backend, EPOLLOUT);
+                return TRY_AGAIN;
+            }
+
+            return IOERR;
+        }
+
+        session->m_start += n;
+    }
+
+    set_interest(backend, 0);
+    if (session->m_start == session->m_read_idx)
+    {
+        session->m_start = session->m_fwd_end = session->m_read_idx = 0;
+        if (session->m_stalled)
+        {
+            session->m_stalled = false;
+            mark_ready(session);
+        }
+    }
+
+    return OK;
+}
+
+// 把已确认属于当前应答的数据发给客户端，发完后腾出缓冲区空间
+RET_CODE Chttpmgr::forward_response(Cbackend * backend)
+{
+    Csession* session = backend->m_session;
+    while (backend->m_write_idx < backend->m_msg_end)
+    {
+        int n = send(session->m_fd, backend->m_buf + backend->m_write_idx, backend->m_msg_end - backend->m_write_idx, 0);
+        if (n == -1)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                set_interest(session, EPOLLOUT);
+                return TRY_AGAIN;
+            }
+
+            return IOERR;
+        }
+
+        backend->m_write_idx += n;
+    }
+
+    set_interest(session, 0);
+    if (backend->m_write_idx > 0)
+    {
+        int left = backend->m_read_idx - backend->m_write_idx;
+        memmove(backend->m_buf, backend->m_buf + backend->m_write_idx, left);
+        backend->m_read_idx = left;
+        backend->m_msg_end -= backend->m_write_idx;
+        backend->m_write_idx = 0;
+    }
+
+    if (backend->m_stalled && (backend->m_read_idx < Cbackend::BUFF_SIZE))
+    {
+        backend->m_stalled = false;
+        mark_ready(backend);
+    }
+
+    return OK;
+}
+
+/**************************************************************
+ * 函数名称：Chttpmgr::parse_response
+ * 函数功能：解析新读入的应答数据，确定其中属于当前应答的部分(m_msg_end)。
+ *          1xx临时应答之后继续解析最终应答
+ * 输入参数：backend    服务端连接
+ * 输出参数：无
+ * 返 回 值：IOERR表示应答格式错误
+ **************************************************************/
+RET_CODE Chttpmgr::parse_response(Cbackend * backend)
+{
+    while (!backend->m_done)
+    {
+        if (!backend->m_head_done)
+        {
+            char* msg = backend->m_buf + backend->m_msg_end;
+            PARSE_CODE code = backend->m_head.parse(msg, backend->m_read_idx - backend->m_msg_end, false);
+            if (code == PARSE_ERROR)
+            {
+                return IOERR;
+            }
+            else if (code == PARSE_AGAIN)
+            {
+                return (backend->m_read_idx - backend->m_msg_end >= Cbackend::BUFF_SIZE) ? IOERR : OK;
+            }
+
+            const Chttphead& head = backend->m_head;
+            int status = head.m_status;
+            if (backend->m_session->m_is_head || ((status >= 100) && (status < 200) && (status != 101))
+                || (status == 204) || (status == 304))
+            {
+                backend->m_body.init(BODY_NONE, 0);
+            }
+            else if (head.m_has_te)
+            {
+                backend->m_body.init(head.m_chunked ? BODY_CHUNKED : BODY_UNTIL_CLOSE, 0);
+            }
+            else if (head.m_content_length >= 0)
+            {
+                backend->m_body.init(BODY_LENGTH, head.m_content_length);
+            }
+            else
+            {
+                backend->m_body.init(BODY_UNTIL_CLOSE, 0);
+            }
+
+            cache_begin(backend, msg);
+            backend->m_reusable = backend->m_reusable && http_keep_alive(head)
+                && (backend->m_body.m_type != BODY_UNTIL_CLOSE);
+            backend->m_head_done = true;
+            backend->m_msg_end += head.m_head_len;
+        }
+
+        int n = backend->m_body.consume(backend->m_buf + backend->m_msg_end, backend->m_read_idx - backend->m_msg_end);
+        if (n < 0)
+        {
+            return IOERR;
+        }
+
+        if (backend->m_capture)
+        {
+            memcpy(backend->m_capture + backend->m_capture_len, backend->m_buf + backend->m_msg_end, n);
+            backend->m_capture_len += n;
+        }
+
+        backend->m_msg_end += n;
+        if (!backend->m_body.done())
+        {
+            return OK;
+        }
+
+        // 1xx是临时应答，后面还有最终应答
+        int status = backend->m_head.m_status;
+        if ((status >= 100) && (status < 200) && (status != 101))
+        {
+            backend->m_head_done = false;
+            backend->m_head.reset();
+            continue;
+        }
+
+        backend->m_done = true;
+        cache_end(backend);
+    }
+
+    // 服务端在应答之后还发送了数据，连接的状态已经不可信
+    if (backend->m_msg_end < backend->m_read_idx)
+    {
+        backend->m_reusable = false;
+        backend->m_read_idx = backend->m_msg_end;
+    }
+
+    return OK;
+}
+
+// 服务端连接出错：应答还没有开始转发时给客户端返回502，否则只能关闭客户端连接
+RET_CODE Chttpmgr::backend_failed(Cbackend * backend)
+{
+    Csession* session = backend->m_session;
+    bool started = backend->m_head_done || (backend->m_msg_end > 0);
+    close_backend(backend);
+    if (!session)
+    {
+        return OK;
+    }
+
+    if (started)
+    {
+        close_session(session);
+        return CLOSED;
+    }
+
+    return reply_error(session, 502);
+}
+
+// 按Host和路径前缀选择路由规则：指定主机的规则优先于任意主机的规则，同类规则中前缀最长的优先
+int Chttpmgr::route(Csession * session)
+{
+    const Chttphead& head = session->m_head;
+    const char* path = session->m_buf + head.m_target.m_off;
+    int path_len = head.m_target.m_len;
+    const char* host = "";
+    int host_len = 0;
+
+    // 目标URL可以是绝对形式：http://host/path
+    if ((path_len > 7) && (strncasecmp(path, "http://", 7) == 0))
+    {
+        host = path + 7;
+        const char* slash = (const char*)memchr(host, '/', path_len - 7);
+        host_len = slash ? (slash - host) : (path_len - 7);
+        path_len = slash ? (path_len - 7 - host_len) : 1;
+        path = slash ? slash : "/";
+    }
+    else if (head.m_host >= 0)
+    {
+        host = session->m_buf + head.m_headers[head.m_host].m_value.m_off;
+        host_len = head.m_headers[head.m_host].m_value.m_len;
+    }
+
+    const char* colon = (const char*)memchr(host, ':', host_len);
+    if (colon)
+    {
+        host_len = colon - host;
+    }
+
+    int best = -1;
+    int best_score = -1;
+    for (size_t i = 0; i < m_cfg.m_routes.size(); i++)
+    {
+        const Croute& route = m_cfg.m_routes[i];
+        bool any_host = (route.m_host[0] == '\0');
+        if (!any_host && (((int)strlen(route.m_host) != host_len) || (strncasecmp(route.m_host, host, host_len) != 0)))
+        {
+            continue;
+        }
+
+        int prefix_len = strlen(route.m_prefix);
+        if ((path_len < prefix_len) || (strncmp(path, route.m_prefix, prefix_len) != 0))
+        {
+            continue;
+        }
+
+        int score = prefix_len + (any_host ? 0 : 65536);
+        if (score > best_score)
+        {
+            best = route.m_upstream;
+            best_score = score;
+        }
+    }
+
+    return best;
+}
+
+// 生成转发给服务端的请求头部：去掉逐跳头部并要求服务端保持连接。各段直接指向缓冲区，不拷贝数据
+void Chttpmgr::build_head(Csession * session)
+{
+    const Chttphead& head = session->m_head;
+    char* buf = session->m_buf;
+    int cnt = 0;
+    int pos = 0;
+    for (int i = 0; i < head.m_header_cnt; i++)
+    {
+        const Cheader& header = head.m_headers[i];
+        if (!is_hop_header(head, buf, header))
+        {
+            continue;
+        }
+
+        if (header.m_name.m_off > pos)
+        {
+            session->m_iov[cnt].iov_base = buf + pos;
+            session->m_iov[cnt].iov_len = header.m_name.m_off - pos;
+            cnt++;
+        }
+
+        pos = header.m_end;
+    }
+
+    if (head.m_blank > pos)
+    {
+        session->m_iov[cnt].iov_base = buf + pos;
+        session->m_iov[cnt].iov_len = head.m_blank - pos;
+        cnt++;
+    }
+
+    session->m_iov[cnt].iov_base = (void*)CONN_KEEP_ALIVE;
+    session->m_iov[cnt].iov_len = strlen(CONN_KEEP_ALIVE);
+    cnt++;
+    session->m_iov[cnt].iov_base = buf + head.m_blank;
+    session->m_iov[cnt].iov_len = head.m_head_len - head.m_blank;
+    cnt++;
+
+    session->m_iov_cnt = cnt;
+    session->m_iov_idx = 0;
+}
+
+// 把服务端连接交给会话使用
+void Chttpmgr::attach(Csession * session, Cbackend * backend)
+{
+    session->m_backend = backend;
+    session->m_state = SESSION_FORWARD;
+    backend->m_session = session;
+    backend->m_read_idx = 0;
+    backend->m_write_idx = 0;
+    backend->m_msg_end = 0;
+    backend->m_head.reset();
+    backend->m_body.init(BODY_NONE, 0);
+    backend->m_head_done = false;
+    backend->m_done = false;
+    backend->m_reusable = true;
+    backend->m_stalled = false;
+    delete [] backend->m_capture;
+    backend->m_capture = NULL;
+}
+
+// 从会话所属的服务器组取得服务端连接：优先使用空闲连接，未达上限时新建连接，否则排队等待
+Cbackend* Chttpmgr::acquire_backend(Csession * session)
+{
+    Cconnpool& pool = m_pools[session->m_upstream];
+    if (!pool.m_idle.empty())
+    {
+        Cbackend* backend = pool.m_idle.front();
+        pool.m_idle.pop_front();
+        return backend;
+    }
+
+    if (pool.m_conn_cnt < pool.m_max_conns)
+    {
+        Cbackend* backend = connect_backend(session->m_upstream);
+        if (backend || (pool.m_conn_cnt == 0))
+        {
+            return backend;
+        }
+    }
+
+    session->m_state = SESSION_WAIT;
+    pool.m_waiting.push_back(session);
+    return NULL;
+}
+
+/**************************************************************
+ * 函数名称：Chttpmgr::connect_backend
+ * 函数功能：在服务器组中轮流选择服务端发起非阻塞连接，连接结果在
+ *          服务端描述符可写时确认
+ * 输入参数：upstream   服务器组下标
+ * 输出参数：无
+ * 返 回 值：组内所有服务端都无法连接时返回NULL
+ **************************************************************/
+Cbackend* Chttpmgr::connect_backend(int upstream)
+{
+    Cconnpool& pool = m_pools[upstream];
+    const vector<Chost>& servers = m_cfg.m_upstreams[upstream].m_servers;
+    for (size_t i = 0; i < servers.size(); i++)
+    {
+        const Chost& srv = servers[pool.m_next];
+        pool.m_next = (pool.m_next + 1) % servers.size();
+
+        struct sockaddr_in addr;
+        bzero(&addr, sizeof(addr));
+        addr.sin_family = AF_INET;
+        inet_pton(AF_INET, srv.m_hostname, &addr.sin_addr);
+        addr.sin_port = htons(srv.m_port);
+
+        int sockfd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (sockfd < 0)
+        {
+            return NULL;
+        }
+
+        int ret = connect(sockfd, (struct sockaddr*)&addr, sizeof(addr));
+        if ((ret != 0) && (errno != EINPROGRESS))
+        {
+            printf("connect to (%s, %d) failed\n", srv.m_hostname, srv.m_port);
+            close(sockfd);
+            continue;
+        }
+
+        Cbackend* backend = NULL;
+        if (!m_free_backends.empty())
+        {
+            backend = m_free_backends.back();
+            m_free_backends.pop_back();
+        }
+        else
+        {
+            try
+            {
+                backend = new Cbackend;
+            }
+            catch (...)
+            {
+                close(sockfd);
+                return NULL;
+            }
+        }
+
+        backend->m_fd = sockfd;
+        backend->m_upstream = upstream;
+        backend->m_connecting = (ret != 0);
+        if (backend->m_connecting && (m_cfg.m_connect_timeout > 0))
+        {
+            backend->m_connect_timer.init(on_connect_timeout, this, backend);
+            m_timers->add(&backend->m_connect_timer, m_now + m_cfg.m_connect_timeout);
+        }
+
+        add_fd(backend, backend->m_connecting ? (int)EPOLLOUT : 0);
+        m_fds[sockfd] = backend;
+        pool.m_conn_cnt++;
+        m_connect_cnt++;
+        return backend;
+    }
+
+    return NULL;
+}
+
+// 应答结束后归还服务端连接：有会话在等待时直接交给它，否则放回连接池(排空阶段则关闭)
+void Chttpmgr::release_backend(Cbackend * backend)
+{
+    if (backend->m_session)
+    {
+        backend->m_session->m_backend = NULL;
+        backend->m_session = NULL;
+    }
+
+    if (!backend->m_reusable)
+    {
+        close_backend(backend);
+        return;
+    }
+
+    set_interest(backend, 0);
+    Cconnpool& pool = m_pools[backend->m_upstream];
+    if (!pool.m_waiting.empty())
+    {
+        Csession* session = pool.m_waiting.front();
+        pool.m_waiting.pop_front();
+        attach(session, backend);
+        advance(session);
+    }
+    else if (m_draining)
+    {
+        close_backend(backend);
+    }
+    else
+    {
+        pool.m_idle.push_back(backend);
+    }
+}
+
+// 关闭服务端连接。有会话在等待时为其新建连接，整个组都连不上时给等待的会话返回502
+void Chttpmgr::close_backend(Cbackend * backend)
+{
+    int upstream = backend->m_upstream;
+    Cconnpool& pool = m_pools[upstream];
+    if (backend->m_session)
+    {
+        backend->m_session->m_backend = NULL;
+    }
+
+    if (!backend->m_session && !backend->m_connecting)
+    {
+        pool.m_idle.remove(backend);
+    }
+
+    m_timers->cancel(&backend->m_connect_timer);
+    close(backend->m_fd);
+    m_fds.erase(backend->m_fd);
+    pool.m_conn_cnt--;
+    backend->reset();
+    m_free_backends.push_back(backend);
+
+    while (!pool.m_waiting.empty())
+    {
+        Cbackend* fresh = connect_backend(upstream);
+        Csession* session = pool.m_waiting.front();
+        pool.m_waiting.pop_front();
+        if (fresh)
+        {
+            attach(session, fresh);
+            advance(session);
+            break;
+        }
+
+        if (pool.m_conn_cnt > 0)
+        {
+            pool.m_waiting.push_front(session);
+            break;
+        }
+
+        session->m_state = SESSION_HEAD;
+        reply_error(session, 502);
+    }
+}
+
+// 关闭客户端会话。服务端连接上还有未完成的请求或应答，不能再复用，一并关闭
+void Chttpmgr::close_session(Csession * session)
+{
+    if (session->m_state == SESSION_WAIT)
+    {
+        m_pools[session->m_upstream].m_waiting.remove(session);
+    }
+
+    Cbackend* backend = session->m_backend;
+    m_timers->cancel(&session->m_idle_timer);
+    close(session->m_fd);
+    m_fds.erase(session->m_fd);
+    m_session_cnt--;
+    session->reset();
+    m_free_sessions.push_back(session);
+
+    if (backend)
+    {
+        backend->m_session = NULL;
+        close_backend(backend);
+    }
+}
+
+// 给客户端返回错误应答后关闭会话
+RET_CODE Chttpmgr::reply_error(Csession * session, int status)
+{
+    const char* title = "Bad Gateway";
+    switch (status)
+    {
+        case 400: title = "Bad Request"; break;
+        case 404: title = "Not Found"; break;
+        case 431: title = "Request Header Fields Too Large"; break;
+        case 501: title = "Not Implemented"; break;
+        default: break;
+    }
+
+    char buf[256];
+    int len = snprintf(buf, sizeof(buf), "HTTP/1.1 %d %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status, title);
+    send(session->m_fd, buf, len, 0);
+    close_session(session);
+    return CLOSED;
+}
+
+/**************************************************************
+ * 函数名称：Chttpmgr::cache_lookup
+ * 函数功能：确定请求的应答能否缓存并生成缓存键"GET 主机 目标URL"，
+ *          然后查找应答缓存。只缓存没有请求体、不带Authorization的GET
+ *          请求；请求带no-store时不缓存，带no-cache、max-age=0或者
+ *          Pragma: no-cache时不查找，但服务端的新应答仍然放入缓存
+ * 输入参数：session    客户端会话
+ * 输出参数：无
+ * 返 回 值：命中时返回true，会话转入发送缓存应答的状态
+ **************************************************************/
+bool Chttpmgr::cache_lookup(Csession * session)
+{
+    const Chttphead& head = session->m_head;
+    const char* buf = session->m_buf;
+    session->m_cache_key_len = 0;
+    if (!m_cfg.m_cache || !head.span_equal(buf, head.m_method, "GET") || (session->m_body.m_type != BODY_NONE)
+        || (find_header(head, buf, "Authorization") >= 0) || (find_directive(head, buf, "Cache-Control", "no-store") >= 0))
+    {
+        return false;
+    }
+
+    int host_len = (head.m_host >= 0) ? head.m_headers[head.m_host].m_value.m_len : 0;
+    int key_len = 4 + host_len + 1 + head.m_target.m_len;
+    if (key_len > Crespcache::MAX_KEY)
+    {
+        return false;
+    }
+
+    // 主机名不区分大小写
+    char* key = session->m_cache_key;
+    memcpy(key, "GET ", 4);
+    for (int i = 0; i < host_len; i++)
+    {
+        key[4 + i] = tolower(buf[head.m_headers[head.m_host].m_value.m_off + i]);
+    }
+
+    key[4 + host_len] = ' ';
+    memcpy(key + 5 + host_len, buf + head.m_target.m_off, head.m_target.m_len);
+    session->m_cache_key_len = key_len;
+
+    if ((find_directive(head, buf, "Cache-Control", "no-cache") >= 0) || (find_directive(head, buf, "Cache-Control", "max-age") == 0)
+        || (find_directive(head, buf, "Pragma", "no-cache") >= 0))
+    {
+        return false;
+    }
+
+    int len = 0;
+    char* reply = m_cfg.m_cache->lookup(key, key_len, session->m_keep_alive ? "keep-alive" : "close", len);
+    if (!reply)
+    {
+        return false;
+    }
+
+    session->m_reply = reply;
+    session->m_reply_len = len;
+    session->m_reply_idx = 0;
+    session->m_state = SESSION_CACHED;
+    m_cache_hit_cnt++;
+    return true;
+}
+
+// 把缓存中的应答发给客户端，发完后释放
+RET_CODE Chttpmgr::send_reply(Csession * session)
+{
+    while (session->m_reply_idx < session->m_reply_len)
+    {
+        int n = send(session->m_fd, session->m_reply + session->m_reply_idx, session->m_reply_len - session->m_reply_idx, 0);
+        if (n == -1)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                set_interest(session, EPOLLOUT);
+                return TRY_AGAIN;
+            }
+
+            return IOERR;
+        }
+
+        session->m_reply_idx += n;
+    }
+
+    set_interest(session, 0);
+    delete [] session->m_reply;
+    session->m_reply = NULL;
+    session->m_reply_len = session->m_reply_idx = 0;
+    return OK;
+}
+
+/**************************************************************
+ * 函数名称：Chttpmgr::cache_begin
+ * 函数功能：最终应答的头部解析完毕。应答可以缓存时复制去掉逐跳头部和
+ *          Age之后的头部，消息体在解析时随之复制。只缓存以Content-Length
+ *          定界、带正的s-maxage或max-age，且没有no-store、no-cache、
+ *          private、Set-Cookie和Vary的应答
+ * 输入参数：backend    服务端连接
+ *           msg        应答的起始位置，头部解析结果中的偏移相对于它
+ * 输出参数：无
+ * 返 回 值：无
+ **************************************************************/
+void Chttpmgr::cache_begin(Cbackend * backend, const char * msg)
+{
+    Csession* session = backend->m_session;
+    const Chttphead& head = backend->m_head;
+    int status = head.m_status;
+    if (!m_cfg.m_cache || (session->m_cache_key_len == 0) || (backend->m_body.m_type != BODY_LENGTH)
+        || ((status != 200) && (status != 203) && (status != 301) && (status != 404) && (status != 410))
+        || (head.m_blank + head.m_content_length > m_cfg.m_cache->max_object())
+        || (find_header(head, msg, "Set-Cookie") >= 0) || (find_header(head, msg, "Vary") >= 0)
+        || (find_directive(head, msg, "Cache-Control", "no-store") >= 0)
+        || (find_directive(head, msg, "Cache-Control", "no-cache") >= 0)
+        || (find_directive(head, msg, "Cache-Control", "private") >= 0))
+    {
+        return;
+    }
+
+    long ttl = find_directive(head, msg, "Cache-Control", "s-maxage");
+    if (ttl < 0)
+    {
+        ttl = find_directive(head, msg, "Cache-Control", "max-age");
+    }
+
+    int age = 0;
+    int age_idx = find_header(head, msg, "Age");
+    if (age_idx >= 0)
+    {
+        age = atoi(msg + head.m_headers[age_idx].m_value.m_off);
+    }
+
+    if (ttl - age <= 0)
+    {
+        return;
+    }
+
+    backend->m_capture = new (std::nothrow) char[head.m_blank + head.m_content_length];
+    if (!backend->m_capture)
+    {
+        return;
+    }
+
+    int len = 0;
+    int pos = 0;
+    for (int i = 0; i < head.m_header_cnt; i++)
+    {
+        const Cheader& header = head.m_headers[i];
+        if (is_hop_header(head, msg, header) || head.span_equal(msg, header.m_name, "Age"))
+        {
+            memcpy(backend->m_capture + len, msg + pos, header.m_name.m_off - pos);
+            len += header.m_name.m_off - pos;
+            pos = header.m_end;
+        }
+    }
+
+    memcpy(backend->m_capture + len, msg + pos, head.m_blank - pos);
+    len += head.m_blank - pos;
+    backend->m_capture_head = backend->m_capture_len = len;
+    backend->m_ttl = ttl - age;
+    backend->m_age = age;
+}
+
+// 应答完整读入后放入应答缓存
+void Chttpmgr::cache_end(Cbackend * backend)
+{
+    if (!backend->m_capture)
+    {
+        return;
+    }
+
+    Csession* session = backend->m_session;
+    m_cfg.m_cache->store(session->m_cache_key, session->m_cache_key_len, backend->m_capture, backend->m_capture_head,
+                         backend->m_capture + backend->m_capture_head, backend->m_capture_len - backend->m_capture_head,
+                         backend->m_ttl, backend->m_age);
+    delete [] backend->m_capture;
+    backend->m_capture = NULL;
+}
+
+// 读取数据直到EAGAIN、缓冲区满或者读预算用完，预算用完时放入就绪队列
+RET_CODE Chttpmgr::read_fd(Cfdstate * state, char * buf, int & read_idx, int size)
+{
+    int total = 0;
+    while (true)
+    {
+        if ((m_io_budget > 0) && (total >= m_io_budget))
+        {
+            mark_ready(state);
+            return OK;
+        }
+
+        if (read_idx >= size)
+        {
+            return BUFFER_FULL;
+        }
+
+        int n = recv(state->m_fd, buf + read_idx, size - read_idx, 0);
+        if (n == -1)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                return OK;
+            }
+
+            return IOERR;
+        }
+        else if (n == 0)
+        {
+            return CLOSED;
+        }
+
+        read_idx += n;
+        total += n;
+    }
+}
+
+// 注册描述符，ev之外总是关注EPOLLIN
+void Chttpmgr::add_fd(Cfdstate * state, int ev)
+{
+    struct epoll_event event;
+    event.data.fd = state->m_fd;
+    event.events = ev | EPOLLIN | EPOLLET;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, state->m_fd, &event);
+    m_epoll_ctl_cnt++;
+    state->m_events = state->m_want = ev | EPOLLIN;
+}
+
+// 记录描述符期望注册的事件，在flush_events中统一提交
+void Chttpmgr::set_interest(Cfdstate * state, int ev)
+{
+    state->m_want = ev | EPOLLIN;
+    m_changes.push_back(state->m_fd);
+}
+
+void Chttpmgr::mark_ready(Cfdstate * state)
+{
+    if (!state->m_ready)
+    {
+        state->m_ready = true;
+        m_ready.push_back(state->m_fd);
+    }
+}
+
+// 每轮事件循环结束时把事件变化提交到内核事件表，只有期望的事件与已注册的不同时才调用epoll_ctl
+void Chttpmgr::flush_events()
+{
+    for (size_t i = 0; i < m_changes.size(); i++)
+    {
+        map<int, Cfdstate*>::iterator iter = m_fds.find(m_changes[i]);
+        if (iter == m_fds.end())
+        {
+            continue;
+        }
+
+        Cfdstate* state = iter->second;
+        if (state->m_want != state->m_events)
+        {
+            modfd(m_epollfd, state->m_fd, state->m_want);
+            m_epoll_ctl_cnt++;
+            state->m_events = state->m_want;
+        }
+    }
+
+    m_changes.clear();
+}
+
+bool Chttpmgr::has_ready()
+{
+    return !m_ready.empty();
+}
+
+// 为就绪队列中的描述符各读取一个预算的数据，返回本轮中关闭的会话数
+int Chttpmgr::process_ready()
+{
+    int closed = 0;
+    size_t count = m_ready.size();
+    for (size_t i = 0; i < count; i++)
+    {
+        int fd = m_ready.front();
+        m_ready.pop_front();
+
+        map<int, Cfdstate*>::iterator iter = m_fds.find(fd);
+        if (iter == m_fds.end())
+        {
+            continue;
+        }
+
+        iter->second->m_ready = false;
+        if (process(fd, READ) == CLOSED)
+        {
+            closed++;
+        }
+    }
+
+    return closed;
+}
+
+// 会话上有读写时推迟空闲超时
+void Chttpmgr::touch(Csession * session)
+{
+    if (m_idle_timeout > 0)
+    {
+        m_timers->add(&session->m_idle_timer, m_now + m_idle_timeout);
+    }
+}
+
+// 空闲超时的回调：关闭会话，正在为其服务的服务端连接一并关闭
+void Chttpmgr::on_idle_timeout(void* owner, void* data)
+{
+    Chttpmgr* mgr = static_cast<Chttpmgr*>(owner);
+    mgr->m_timeout_cnt++;
+    mgr->close_session(static_cast<Csession*>(data));
+}
+
+// connect超时的回调：与connect失败一样处理，还没有发出请求的会话应答502
+void Chttpmgr::on_connect_timeout(void* owner, void* data)
+{
+    Chttpmgr* mgr = static_cast<Chttpmgr*>(owner);
+    Cbackend* backend = static_cast<Cbackend*>(data);
+    printf("connect to upstream %d timed out\n", backend->m_upstream);
+    mgr->m_connect_timeout_cnt++;
+    mgr->backend_failed(backend);
+}
+
+// 每轮事件循环开始时调用：记录本轮的时间，关闭空闲超时的会话和connect超时的服务端连接，返回关闭的个数
+int Chttpmgr::expire_timers(long long now)
+{
+    m_now = now;
+    return m_timers->expire(now);
+}
+
+// 距离下一个定时器到期的毫秒数，没有定时器时返回-1
+int Chttpmgr::next_timeout()
+{
+    long long next = m_timers->next_expire();
+    if (next < 0)
+    {
+        return -1;
+    }
+
+    return (next > m_now) ? (int)(next - m_now) : 0;
+}
+
+// 打印转发和连接复用的统计信息
+void Chttpmgr::print_stats(const char* name, int idx)
+{
+    double per_request = (m_request_cnt > 0) ? ((double)m_epoll_ctl_cnt / m_request_cnt) : 0.0;
+    double per_connect = (m_connect_cnt > 0) ? ((double)m_request_cnt / m_connect_cnt) : 0.0;
+    printf("%s %d stats: %lld requests, %lld epoll_ctl, %.2f epoll_ctl per request, "
+           "%lld upstream connects, %.2f requests per upstream connection, %lld idle timeouts, %lld connect timeouts\n",
+           name, idx, m_request_cnt, m_epoll_ctl_cnt, per_request, m_connect_cnt, per_connect, m_timeout_cnt,
+           m_connect_timeout_cnt);
+
+    if (m_cfg.m_cache)
+    {
+        Ccachestats stats;
+        m_cfg.m_cache->get_stats(stats);
+        printf("%s %d cache: %lld requests served from cache; shared: %lld hits, %lld misses, %lld stores, "
+               "%lld evictions, %lld expired, %d entries, %lld bytes\n",
+               name, idx, m_cache_hit_cnt, stats.m_hits, stats.m_misses, stats.m_stores,
+               stats.m_evictions, stats.m_expired, stats.m_entries, stats.m_used);
+    }
+}
@@ -0,0 +1,246 @@
+#ifndef __HTTPMGR_H_
+#define __HTTPMGR_H_
+
+// 七层HTTP代理：按Host和路径前缀把请求路由到上游服务器组，客户端的keep-alive请求
+// 逐个复用各组的服务端连接池，一个服务端连接先后为多个客户端服务，而不是与某个
+// 客户端会话绑定。对外接口与Cmgr相同，可以直接作为进程池/线程池的管理对象
+#include "global.h"
+#include "fdwrapper.h"
+#include "httpparser.h"
+#include "mgr.h"
+#include "respcache.h"
+#include "proxyproto.h"
+#include "timer.h"
+
+// 上游服务器组：一条路由规则转发到的一组服务端。新连接在组内轮流选择服务端，
+// 各服务端Chost::m_conncnt之和为每个事件循环到该组的最大连接数
+class Cupstream
+{
+public:
+    vector<Chost> m_servers;
+};
+
+// 路由规则：Host为空时匹配任意主机，路径按前缀匹配
+class Croute
+{
+public:
+    char m_host[256];
+    char m_prefix[256];
+    int m_upstream;                 // 在Chttpcfg::m_upstreams中的下标
+};
+
+class Chttpcfg
+{
+public:
+    Chttpcfg() : m_cache(NULL), m_proxy_accept(false), m_connect_timeout(0) {}
+
+public:
+    bool add_route(const char* spec);
+
+public:
+    vector<Croute> m_routes;
+    vector<Cupstream> m_upstreams;
+    Crespcache* m_cache;            // 所有工作进程共享的应答缓存，NULL表示不缓存
+    bool m_proxy_accept;            // 客户端连接开头带有PROXY协议头部
+    int m_connect_timeout;          // 连接上游服务端的超时(毫秒)，不大于0表示由内核决定
+};
+
+// 注册到内核事件表的描述符的公共状态
+class Cfdstate
+{
+public:
+    int m_fd;
+    bool m_is_backend;
+    int m_events;                   // 当前在内核事件表中注册的事件
+    int m_want;                     // 期望注册的事件，每轮事件循环结束时同步到内核事件表
+    bool m_ready;                   // 是否已在就绪队列中
+};
+
+class Csession;
+
+// 到上游服务端的连接，空闲时放在所属服务器组的连接池中
+class Cbackend : public Cfdstate
+{
+public:
+    Cbackend();
+    ~Cbackend();
+
+public:
+    void reset();
+
+public:
+    static const int BUFF_SIZE = 8192;
+
+    int m_upstream;
+    bool m_connecting;              // 非阻塞connect尚未完成
+    char* m_buf;                    // 服务端应答缓冲区
+    int m_read_idx;                 // 已经读入的字节数
+    int m_write_idx;                // 已经发给客户端的字节数
+    int m_msg_end;                  // 已确认属于当前应答的字节数
+    Chttphead m_head;
+    Chttpbody m_body;
+    bool m_head_done;
+    bool m_done;                    // 当前应答已经完整读入
+    bool m_reusable;                // 应答结束后连接是否可以放回连接池
+    bool m_stalled;                 // 缓冲区满时停止了读取
+    Csession* m_session;            // 正在为之服务的客户端会话
+
+    // 可以缓存的应答在转发的同时复制一份，完整之后放入应答缓存
+    char* m_capture;
+    int m_capture_len;
+    int m_capture_head;             // 复制的头部长度(去掉逐跳头部，不含结束空行)
+    int m_ttl;
+    int m_age;
+
+    Ctimer m_connect_timer;         // 非阻塞connect的超时，连接建立或关闭时取消
+};
+
+// 会话状态
+enum SESSION_STATE
+{
+    SESSION_HEAD = 0,               // 读取并解析请求头部
+    SESSION_WAIT,                   // 等待上游服务器组的空闲连接
+    SESSION_FORWARD,                // 转发请求和应答
+    SESSION_CACHED                  // 发送缓存中的应答
+};
+
+// 客户端会话
+class Csession : public Cfdstate
+{
+public:
+    Csession();
+    ~Csession();
+
+public:
+    void init_clt(int sockfd, const sockaddr_in& clnt_addr);
+    void reset();
+
+public:
+    static const int BUFF_SIZE = 8192;                  // 也是请求头部的最大长度
+    static const int MAX_IOV = Chttphead::MAX_HEADERS + 4;
+
+    sockaddr_in m_clt_addr;
+    char* m_buf;                    // 客户端请求缓冲区
+    int m_start;                    // 已经发给服务端的位置
+    int m_fwd_end;                  // 已确认属于当前请求的数据的结束位置
+    int m_read_idx;                 // 已经读入的字节数
+    Chttphead m_head;
+    Chttpbody m_body;
+    SESSION_STATE m_state;
+    bool m_keep_alive;
+    bool m_is_head;                 // HEAD请求的应答没有消息体
+    bool m_eof;                     // 客户端已经关闭写方向
+    bool m_stalled;                 // 缓冲区满时停止了读取
+    bool m_proxy_expect;            // 连接开头还有待解析的PROXY协议头部
+    int m_upstream;
+    Cbackend* m_backend;
+
+    char m_cache_key[Crespcache::MAX_KEY];  // 应答可以缓存时的键，长度为0表示不缓存
+    int m_cache_key_len;
+    char* m_reply;                  // 缓存命中时的完整应答
+    int m_reply_len;
+    int m_reply_idx;                // 已经发给客户端的字节数
+
+    // 改写后的请求头部，以分段的形式直接引用缓冲区中的数据
+    struct iovec m_iov[MAX_IOV];
+    int m_iov_cnt;
+    int m_iov_idx;
+
+    Ctimer m_idle_timer;            // 空闲超时，客户端或为其服务的服务端连接上每有一次读写就推迟
+};
+
+// 上游服务器组的连接池
+class Cconnpool
+{
+public:
+    Cconnpool() : m_conn_cnt(0), m_max_conns(0), m_next(0) {}
+
+public:
+    std::list<Cbackend*> m_idle;    // 空闲连接
+    std::list<Csession*> m_waiting; // 等待空闲连接的会话
+    int m_conn_cnt;                 // 已经建立(包括正在建立)的连接数
+    int m_max_conns;
+    int m_next;                     // 下一个新建连接的服务端，轮流选择
+};
+
+class Chttpmgr
+{
+public:
+    Chttpmgr(int epollfd, const Chttpcfg& cfg);
+    ~Chttpmgr();
+
+public:
+    Csession* pick_conn(int cltfd);
+    int get_used_conn_cnt();
+    int get_idle_conn_cnt();
+    void recycle_conns();
+    void drain();
+    RET_CODE process(int fd, OP_TYPE type);
+    void flush_events();
+    bool has_ready();
+    int process_ready();
+    void set_io_budget(int budget) { m_io_budget = budget; }
+    void set_idle_timeout(int ms) { m_idle_timeout = ms; }
+    int expire_timers(long long now);
+    int next_timeout();
+    void print_stats(const char* name, int idx);
+
+private:
+    static const int IO_BUDGET = 16384;
+
+private:
+    static void on_idle_timeout(void* owner, void* data);
+    static void on_connect_timeout(void* owner, void* data);
+    void touch(Csession* session);
+    RET_CODE on_clt_read(Csession* session);
+    RET_CODE on_clt_write(Csession* session);
+    RET_CODE on_srv_read(Cbackend* backend);
+    RET_CODE on_srv_write(Cbackend* backend);
+    RET_CODE advance(Csession* session);
+    RET_CODE start_request(Csession* session);
+    RET_CODE forward_request(Csession* session);
+    RET_CODE forward_response(Cbackend* backend);
+    RET_CODE parse_response(Cbackend* backend);
+    RET_CODE backend_failed(Cbackend* backend);
+    int route(Csession* session);
+    void build_head(Csession* session);
+    void attach(Csession* session, Cbackend* backend);
+    Cbackend* acquire_backend(Csession* session);
+    Cbackend* connect_backend(int upstream);
+    void release_backend(Cbackend* backend);
+    void close_backend(Cbackend* backend);
+    void close_session(Csession* session);
+    RET_CODE reply_error(Csession* session, int status);
+    bool cache_lookup(Csession* session);
+    RET_CODE send_reply(Csession* session);
+    void cache_begin(Cbackend* backend, const char* msg);
+    void cache_end(Cbackend* backend);
+    RET_CODE read_fd(Cfdstate* state, char* buf, int& read_idx, int size);
+    void add_fd(Cfdstate* state, int ev);
+    void set_interest(Cfdstate* state, int ev);
+    void mark_ready(Cfdstate* state);
+
+private:
+    int m_epollfd;
+    Chttpcfg m_cfg;
+    vector<Cconnpool> m_pools;
+    map<int, Cfdstate*> m_fds;                  // 描述符到会话或服务端连接的映射
+    vector<Csession*> m_free_sessions;          // 可重用的会话对象，避免每个连接都分配缓冲区
+    vector<Cbackend*> m_free_backends;
+    int m_session_cnt;
+    bool m_draining;
+    vector<int> m_changes;
+    std::list<int> m_ready;
+    int m_io_budget;
+    long long m_epoll_ctl_cnt;
+    long long m_request_cnt;                    // 转发的请求数
+    long long m_connect_cnt;                    // 新建的服务端连接数
+    long long m_cache_hit_cnt;                  // 直接用缓存应答的请求数
+    Ctimer_queue* m_timers;                     // 会话的空闲超时和服务端连接的connect超时
+    int m_idle_timeout;                         // 会话空闲超时(毫秒)，不大于0表示不超时
+    long long m_now;                            // 本轮事件循环的时间(单调时钟毫秒)
+    long long m_timeout_cnt;                    // 因空闲超时关闭的会话数
+    long long m_connect_timeout_cnt;            // connect超时的服务端连接数
+};
+
+#endif
@@ -0,0 +1,504 @@
+/*********************************************************************************
+ * File Name: httpparser.cpp
+ * Description: HTTP/1.x消息头部增量解析与消息体定界
+ * History: 
+ *********************************************************************************/
+
+#include "httpparser.h"
+#include "httpscan.h"
+
+// 分块编码的扫描状态
+enum CHUNK_STATE
+{
+    CHUNK_SIZE = 0,         // 块大小
+    CHUNK_EXT,              // 块扩展，直到行尾
+    CHUNK_DATA,             // 块数据
+    CHUNK_DATA_CR,          // 块数据之后的CR
+    CHUNK_DATA_LF,          // 块数据之后的LF
+    CHUNK_TRAILER           // 最后一个块之后的尾部字段，遇到空行结束
+};
+
+static const int MAX_CHUNK_DIGITS = 15;     // 块大小最多的十六进制位数，防止溢出
+
+// 在[begin, end)中查找字符c，找不到返回end
+static int find_char(const char* buf, int begin, int end, char c)
+{
+    return scan_char(buf, begin, end, c);
+}
+
+// 跳过空格和制表符
+static int skip_ows(const char* buf, int begin, int end)
+{
+    while ((begin < end) && ((buf[begin] == ' ') || (buf[begin] == '\t')))
+    {
+        begin++;
+    }
+
+    return begin;
+}
+
+// 逗号分隔的列表中是否包含token(不区分大小写)
+static bool has_token(const char* buf, int begin, int end, const char* token)
+{
+    int len = strlen(token);
+    while (begin < end)
+    {
+        int comma = find_char(buf, begin, end, ',');
+        int b = skip_ows(buf, begin, comma);
+        int e = comma;
+        while ((e > b) && ((buf[e - 1] == ' ') || (buf[e - 1] == '\t')))
+        {
+            e--;
+        }
+
+        if (((e - b) == len) && (strncasecmp(buf + b, token, len) == 0))
+        {
+            return true;
+        }
+
+        begin = comma + 1;
+    }
+
+    return false;
+}
+
+// 逗号分隔的列表中最后一项是否为token
+static bool last_token(const char* buf, int begin, int end, const char* token)
+{
+    int b = begin;
+    for (int i = end - 1; i >= begin; i--)
+    {
+        if (buf[i] == ',')
+        {
+            b = i + 1;
+            break;
+        }
+    }
+
+    return has_token(buf, b, end, token);
+}
+
+Chttphead::Chttphead()
+{
+    reset();
+}
+
+void Chttphead::reset()
+{
+    m_checked = 0;
+    m_line = 0;
+    m_first = true;
+    m_blank = 0;
+    m_head_len = 0;
+    m_method.m_off = m_method.m_len = 0;
+    m_target.m_off = m_target.m_len = 0;
+    m_version.m_off = m_version.m_len = 0;
+    m_minor = 0;
+    m_status = 0;
+    m_header_cnt = 0;
+    m_host = -1;
+    m_content_length = -1;
+    m_has_te = false;
+    m_chunked = false;
+    m_conn_close = false;
+    m_conn_keep_alive = false;
+}
+
+// 字段是否等于str(不区分大小写)
+bool Chttphead::span_equal(const char* buf, const Cspan& span, const char* str) const
+{
+    return ((int)strlen(str) == span.m_len) && (strncasecmp(buf + span.m_off, str, span.m_len) == 0);
+}
+
+/**************************************************************
+ * 函数名称：Chttphead::parse
+ * 函数功能：解析buf中前len个字节的HTTP消息头部。可以随数据到达反复调用，
+ *          每次从上次停下的位置继续，buf的内容在两次调用之间不能移动
+ * 输入参数：buf        消息起始位置
+ *           len        已经到达的字节数
+ *           is_request 解析请求还是应答
+ * 输出参数：无
+ * 返 回 值：PARSE_DONE表示头部完整，m_head_len为头部长度
+ **************************************************************/
+PARSE_CODE Chttphead::parse(const char* buf, int len, bool is_request)
+{
+    while (m_checked < len)
+    {
+        int lf = find_char(buf, m_checked, len, '\n');
+        if (lf == len)
+        {
+            m_checked = len;
+            return PARSE_AGAIN;
+        }
+
+        int begin = m_line;
+        int end = lf;
+        if ((end > begin) && (buf[end - 1] == '\r'))
+        {
+            end--;
+        }
+
+        m_checked = lf + 1;
+        m_line = lf + 1;
+
+        PARSE_CODE code = PARSE_AGAIN;
+        if (m_first)
+        {
+            // 起始行之前的空行忽略
+            if (end == begin)
+            {
+                continue;
+            }
+
+            code = is_request ? parse_request_line(buf, begin, end) : parse_status_line(buf, begin, end);
+            m_first = false;
+        }
+        else if (end == begin)
+        {
+            m_blank = begin;
+            m_head_len = lf + 1;
+            return finish();
+        }
+        else
+        {
+            code = parse_header(buf, begin, end, lf + 1);
+        }
+
+        if (code == PARSE_ERROR)
+        {
+            return PARSE_ERROR;
+        }
+    }
+
+    return PARSE_AGAIN;
+}
+
+// 解析请求行：方法 目标URL HTTP/1.x
+PARSE_CODE Chttphead::parse_request_line(const char * buf, int begin, int end)
+{
+    int sp1 = find_char(buf, begin, end, ' ');
+    if ((sp1 == begin) || (sp1 == end))
+    {
+        return PARSE_ERROR;
+    }
+
+    int sp2 = find_char(buf, sp1 + 1, end, ' ');
+    if ((sp2 == sp1 + 1) || (sp2 == end))
+    {
+        return PARSE_ERROR;
+    }
+
+    m_method.m_off = begin;
+    m_method.m_len = sp1 - begin;
+    m_target.m_off = sp1 + 1;
+    m_target.m_len = sp2 - sp1 - 1;
+    return parse_version(buf, sp2 + 1, end);
+}
+
+// 解析状态行：HTTP/1.x 状态码 原因短语
+PARSE_CODE Chttphead::parse_status_line(const char * buf, int begin, int end)
+{
+    int sp = find_char(buf, begin, end, ' ');
+    if ((parse_version(buf, begin, sp) != PARSE_DONE) || ((end - sp) < 4))
+    {
+        return PARSE_ERROR;
+    }
+
+    m_status = 0;
+    for (int i = sp + 1; i < sp + 4; i++)
+    {
+        if ((buf[i] < '0') || (buf[i] > '9'))
+        {
+            return PARSE_ERROR;
+        }
+
+        m_status = m_status * 10 + (buf[i] - '0');
+    }
+
+    return (((sp + 4) == end) || (buf[sp + 4] == ' ')) ? PARSE_DONE : PARSE_ERROR;
+}
+
+// 只支持HTTP/1.0和HTTP/1.1
+PARSE_CODE Chttphead::parse_version(const char * buf, int begin, int end)
+{
+    if (((end - begin) != 8) || (strncmp(buf + begin, "HTTP/1.", 7) != 0))
+    {
+        return PARSE_ERROR;
+    }
+
+    char minor = buf[begin + 7];
+    if ((minor != '0') && (minor != '1'))
+    {
+        return PARSE_ERROR;
+    }
+
+    m_version.m_off = begin;
+    m_version.m_len = 8;
+    m_minor = minor - '0';
+    return PARSE_DONE;
+}
+
+// 解析一个头部字段，只记录位置；与转发相关的几个字段同时提取出来
+PARSE_CODE Chttphead::parse_header(const char * buf, int begin, int end, int next)
+{
+    // 不支持折叠的多行头部
+    if ((buf[begin] == ' ') || (buf[begin] == '\t'))
+    {
+        return PARSE_ERROR;
+    }
+
+    // 字段名中不能有空白，一次扫描同时找到冒号并检查字段名
+    int colon = scan_any(buf, begin, end, ": \t", 3);
+    if ((colon == begin) || (colon == end) || (buf[colon] != ':') || (m_header_cnt >= MAX_HEADERS))
+    {
+        return PARSE_ERROR;
+    }
+
+    int vb = skip_ows(buf, colon + 1, end);
+    int ve = end;
+    while ((ve > vb) && ((buf[ve - 1] == ' ') || (buf[ve - 1] == '\t')))
+    {
+        ve--;
+    }
+
+    Cheader& header = m_headers[m_header_cnt];
+    header.m_name.m_off = begin;
+    header.m_name.m_len = colon - begin;
+    header.m_value.m_off = vb;
+    header.m_value.m_len = ve - vb;
+    header.m_end = next;
+
+    if (span_equal(buf, header.m_name, "Host"))
+    {
+        m_host = m_header_cnt;
+    }
+    else if (span_equal(buf, header.m_name, "Content-Length"))
+    {
+        if (vb == ve)
+        {
+            return PARSE_ERROR;
+        }
+
+        long long length = 0;
+        for (int i = vb; i < ve; i++)
+        {
+            if ((buf[i] < '0') || (buf[i] > '9') || (length > (1LL << 50)))
+            {
+                return PARSE_ERROR;
+            }
+
+            length = length * 10 + (buf[i] - '0');
+        }
+
+        // 多个不一致的Content-Length可能被用来夹带请求
+        if ((m_content_length >= 0) && (m_content_length != length))
+        {
+            return PARSE_ERROR;
+        }
+
+        m_content_length = length;
+    }
+    else if (span_equal(buf, header.m_name, "Transfer-Encoding"))
+    {
+        m_has_te = true;
+        m_chunked = last_token(buf, vb, ve, "chunked");
+    }
+    else if (span_equal(buf, header.m_name, "Connection"))
+    {
+        m_conn_close = m_conn_close || has_token(buf, vb, ve, "close");
+        m_conn_keep_alive = m_conn_keep_alive || has_token(buf, vb, ve, "keep-alive");
+    }
+
+    m_header_cnt++;
+    return PARSE_AGAIN;
+}
+
+// 头部结束时检查消息体定界方式是否明确
+PARSE_CODE Chttphead::finish()
+{
+    if (m_has_te && (m_content_length >= 0))
+    {
+        return PARSE_ERROR;
+    }
+
+    return PARSE_DONE;
+}
+
+bool http_keep_alive(const Chttphead& head)
+{
+    if (head.m_minor == 0)
+    {
+        return head.m_conn_keep_alive && !head.m_conn_close;
+    }
+
+    return !head.m_conn_close;
+}
+
+Chttpbody::Chttpbody()
+{
+    init(BODY_NONE, 0);
+}
+
+void Chttpbody::init(BODY_TYPE type, long long length)
+{
+    m_type = type;
+    m_left = (type == BODY_LENGTH) ? length : 0;
+    m_state = CHUNK_SIZE;
+    m_digits = 0;
+    m_line_len = 0;
+    m_done = (type == BODY_NONE) || ((type == BODY_LENGTH) && (length == 0));
+}
+
+/**************************************************************
+ * 函数名称：Chttpbody::consume
+ * 函数功能：扫描新到达的数据，确定其中有多少字节属于当前消息体
+ * 输入参数：data   新到达的数据
+ *           len    数据长度
+ * 输出参数：无
+ * 返 回 值：属于消息体的字节数，之后的数据属于下一个消息；-1表示分块编码格式错误
+ **************************************************************/
+int Chttpbody::consume(const char * data, int len)
+{
+    if (m_done)
+    {
+        return 0;
+    }
+
+    if (m_type == BODY_UNTIL_CLOSE)
+    {
+        return len;
+    }
+
+    if (m_type == BODY_LENGTH)
+    {
+        int n = (m_left < len) ? (int)m_left : len;
+        m_left -= n;
+        m_done = (m_left == 0);
+        return n;
+    }
+
+    int i = 0;
+    while ((i < len) && !m_done)
+    {
+        if (m_state == CHUNK_DATA)
+        {
+            int n = (m_left < (len - i)) ? (int)m_left : (len - i);
+            m_left -= n;
+            i += n;
+            if (m_left == 0)
+            {
+                m_state = CHUNK_DATA_CR;
+            }
+
+            continue;
+        }
+
+        char c = data[i++];
+        switch (m_state)
+        {
+            case CHUNK_SIZE:
+            {
+                int v = -1;
+                if ((c >= '0') && (c <= '9'))
+                {
+                    v = c - '0';
+                }
+                else if ((c >= 'a') && (c <= 'f'))
+                {
+                    v = c - 'a' + 10;
+                }
+                else if ((c >= 'A') && (c <= 'F'))
+                {
+                    v = c - 'A' + 10;
+                }
+
+                if (v >= 0)
+                {
+                    if (++m_digits > MAX_CHUNK_DIGITS)
+                    {
+                        return -1;
+                    }
+
+                    m_left = m_left * 16 + v;
+                    break;
+                }
+
+                if (m_digits == 0)
+                {
+                    return -1;
+                }
+
+                if (c != '\n')
+                {
+                    m_state = CHUNK_EXT;
+                    break;
+                }
+            }
+            // 块大小行结束
+            // fall through
+            case CHUNK_EXT:
+            {
+                if (c != '\n')
+                {
+                    break;
+                }
+
+                m_digits = 0;
+                m_state = (m_left > 0) ? CHUNK_DATA : CHUNK_TRAILER;
+                m_line_len = 0;
+                break;
+            }
+
+            case CHUNK_DATA_CR:
+            {
+                if (c == '\n')
+                {
+                    m_state = CHUNK_SIZE;
+                }
+                else if (c == '\r')
+                {
+                    m_state = CHUNK_DATA_LF;
+                }
+                else
+                {
+                    return -1;
+                }
+
+                break;
+            }
+
+            case CHUNK_DATA_LF:
+            {
+                if (c != '\n')
+                {
+                    return -1;
+                }
+
+                m_state = CHUNK_SIZE;
+                break;
+            }
+
+            case CHUNK_TRAILER:
+            {
+                if (c == '\n')
+                {
+                    m_done = (m_line_len == 0);
+                    m_line_len = 0;
+                }
+                else if (c != '\r')
+                {
+                    m_line_len++;
+                }
+
+                break;
+            }
+
+            default:
+            {
+                return -1;
+            }
+        }
+    }
+
+    return i;
+}
@@ -0,0 +1,105 @@
+#ifndef __HTTPPARSER_H_
+#define __HTTPPARSER_H_
+
+#include "global.h"
+
+// 解析结果
+enum PARSE_CODE
+{
+    PARSE_AGAIN = 0,        // 数据不完整，需要继续读取
+    PARSE_DONE,             // 解析完成
+    PARSE_ERROR             // 语法错误
+};
+
+// 消息体的定界方式
+enum BODY_TYPE
+{
+    BODY_NONE = 0,          // 没有消息体
+    BODY_LENGTH,            // 由Content-Length给出长度
+    BODY_CHUNKED,           // 分块传输编码
+    BODY_UNTIL_CLOSE        // 直到连接关闭(只用于应答)
+};
+
+// 缓冲区中的一段数据，用相对于消息起始位置的偏移表示，解析时不拷贝数据
+struct Cspan
+{
+    int m_off;
+    int m_len;
+};
+
+struct Cheader
+{
+    Cspan m_name;
+    Cspan m_value;
+    int m_end;              // 本行结束(换行符之后)的位置
+};
+
+// HTTP消息头部解析器，请求和应答共用。增量解析：每次调用只扫描新到达的数据，
+// 已完成的行不会重复扫描；所有字段都以偏移的形式指向调用者的缓冲区
+class Chttphead
+{
+public:
+    static const int MAX_HEADERS = 64;
+
+public:
+    Chttphead();
+
+public:
+    void reset();
+    PARSE_CODE parse(const char* buf, int len, bool is_request);
+    bool span_equal(const char* buf, const Cspan& span, const char* str) const;
+
+private:
+    PARSE_CODE parse_request_line(const char* buf, int begin, int end);
+    PARSE_CODE parse_status_line(const char* buf, int begin, int end);
+    PARSE_CODE parse_version(const char* buf, int begin, int end);
+    PARSE_CODE parse_header(const char* buf, int begin, int end, int next);
+    PARSE_CODE finish();
+
+public:
+    int m_checked;                  // 已经扫描过的字节数
+    int m_line;                     // 当前行的起始位置
+    bool m_first;                   // 是否还在等待起始行(请求行或状态行)
+    int m_blank;                    // 头部结束空行的起始位置
+    int m_head_len;                 // 头部的总长度(包括结束空行)
+
+    Cspan m_method;                 // 请求行：方法、目标URL、版本号
+    Cspan m_target;
+    Cspan m_version;
+    int m_minor;                    // HTTP/1.x中的x
+    int m_status;                   // 状态行中的状态码
+
+    Cheader m_headers[MAX_HEADERS];
+    int m_header_cnt;
+    int m_host;                     // Host头部在m_headers中的下标，没有时为-1
+    long long m_content_length;     // 没有Content-Length时为-1
+    bool m_has_te;                  // 是否有Transfer-Encoding头部
+    bool m_chunked;                 // 最后一个传输编码是否为chunked
+    bool m_conn_close;              // Connection头部包含close
+    bool m_conn_keep_alive;         // Connection头部包含keep-alive
+};
+
+// 消息体定界：跟踪消息体还剩多少字节，分块编码时逐字节扫描块大小行，数据块整体跳过
+class Chttpbody
+{
+public:
+    Chttpbody();
+
+public:
+    void init(BODY_TYPE type, long long length);
+    int consume(const char* data, int len);
+    bool done() const { return m_done; }
+
+public:
+    BODY_TYPE m_type;
+    long long m_left;               // 当前数据块(或整个消息体)还剩的字节数
+    int m_state;                    // 分块编码的扫描状态
+    int m_digits;                   // 块大小行中已读到的十六进制位数
+    int m_line_len;                 // 尾部字段当前行的长度
+    bool m_done;
+};
+
+// HTTP/1.x消息是否保持连接
+bool http_keep_alive(const Chttphead& head);
+
+#endif
@@ -0,0 +1,209 @@
+/*********************************************************************************
+ * File Name: httpscan.cpp
+ * Description: HTTP解析用的字符扫描，SSE4.2/AVX2向量实现和标量实现，运行时选择
+ * History: 
+ *********************************************************************************/
+
+#include <string.h>
+#include "httpscan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+typedef int (*scan_char_fn)(const char* buf, int begin, int end, char c);
+typedef int (*scan_any_fn)(const char* buf, int begin, int end, const char* set, int set_len);
+
+// 当前使用的实现
+struct Cscanops
+{
+    SCAN_IMPL m_impl;
+    scan_char_fn m_char;
+    scan_any_fn m_any;
+};
+
+// 标量实现：单个字符用libc的memchr
+static int scalar_char(const char* buf, int begin, int end, char c)
+{
+    const char* p = (const char*)memchr(buf + begin, c, end - begin);
+    return p ? (int)(p - buf) : end;
+}
+
+static int scalar_any(const char* buf, int begin, int end, const char* set, int set_len)
+{
+    for (int i = begin; i < end; i++)
+    {
+        for (int j = 0; j < set_len; j++)
+        {
+            if (buf[i] == set[j])
+            {
+                return i;
+            }
+        }
+    }
+
+    return end;
+}
+
+#ifdef SCAN_X86
+// 向量实现只处理完整的块，不足一块的尾部逐字节比较，避免读越过end所在的内存页
+__attribute__((target("sse4.2")))
+static int sse42_char(const char* buf, int begin, int end, char c)
+{
+    __m128i needle = _mm_set1_epi8(c);
+    int i = begin;
+    for (; i + 16 <= end; i += 16)
+    {
+        __m128i data = _mm_loadu_si128((const __m128i*)(buf + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(data, needle));
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return scalar_any(buf, i, end, &c, 1);
+}
+
+// 用PCMPESTRI一条指令比较16个字节与整个字符集合
+__attribute__((target("sse4.2")))
+static int sse42_any(const char* buf, int begin, int end, const char* set, int set_len)
+{
+    char chars[16];
+    memset(chars, 0, sizeof(chars));
+    memcpy(chars, set, set_len);
+    __m128i needles = _mm_loadu_si128((const __m128i*)chars);
+
+    int i = begin;
+    for (; i + 16 <= end; i += 16)
+    {
+        __m128i data = _mm_loadu_si128((const __m128i*)(buf + i));
+        int idx = _mm_cmpestri(needles, set_len, data, 16,
+                               _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (idx < 16)
+        {
+            return i + idx;
+        }
+    }
+
+    return scalar_any(buf, i, end, set, set_len);
+}
+
+__attribute__((target("avx2")))
+static int avx2_char(const char* buf, int begin, int end, char c)
+{
+    __m256i needle = _mm256_set1_epi8(c);
+    int i = begin;
+    for (; i + 32 <= end; i += 32)
+    {
+        __m256i data = _mm256_loadu_si256((const __m256i*)(buf + i));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(data, needle));
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return sse42_char(buf, i, end, c);
+}
+
+// 集合中的每个字符各比较一次，结果按位或
+__attribute__((target("avx2")))
+static int avx2_any(const char* buf, int begin, int end, const char* set, int set_len)
+{
+    __m256i needles[4];
+    for (int j = 0; j < set_len; j++)
+    {
+        needles[j] = _mm256_set1_epi8(set[j]);
+    }
+
+    int i = begin;
+    for (; i + 32 <= end; i += 32)
+    {
+        __m256i data = _mm256_loadu_si256((const __m256i*)(buf + i));
+        __m256i hit = _mm256_cmpeq_epi8(data, needles[0]);
+        for (int j = 1; j < set_len; j++)
+        {
+            hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(data, needles[j]));
+        }
+
+        unsigned int mask = _mm256_movemask_epi8(hit);
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return sse42_any(buf, i, end, set, set_len);
+}
+#endif
+
+static Cscanops g_ops = {SCAN_SCALAR, scalar_char, scalar_any};
+
+// 启动时选择CPU支持的最快实现
+static bool g_selected = scan_select(SCAN_AVX2) || scan_select(SCAN_SSE42);
+
+int scan_char(const char* buf, int begin, int end, char c)
+{
+    return g_ops.m_char(buf, begin, end, c);
+}
+
+int scan_any(const char* buf, int begin, int end, const char* set, int set_len)
+{
+    return g_ops.m_any(buf, begin, end, set, set_len);
+}
+
+SCAN_IMPL scan_impl()
+{
+    return g_ops.m_impl;
+}
+
+bool scan_select(SCAN_IMPL impl)
+{
+    Cscanops ops = {SCAN_SCALAR, scalar_char, scalar_any};
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if ((impl == SCAN_AVX2) && __builtin_cpu_supports("avx2"))
+    {
+        ops.m_impl = SCAN_AVX2;
+        ops.m_char = avx2_char;
+        ops.m_any = avx2_any;
+    }
+    else if ((impl == SCAN_SSE42) && __builtin_cpu_supports("sse4.2"))
+    {
+        ops.m_impl = SCAN_SSE42;
+        ops.m_char = sse42_char;
+        ops.m_any = sse42_any;
+    }
+#endif
+
+    if (ops.m_impl != impl)
+    {
+        return false;
+    }
+
+    g_ops = ops;
+    return true;
+}
+
+const char* scan_impl_name(SCAN_IMPL impl)
+{
+    switch (impl)
+    {
+        case SCAN_AVX2:
+        {
+            return "avx2";
+        }
+
+        case SCAN_SSE42:
+        {
+            return "sse4.2";
+        }
+
+        default:
+        {
+            return "scalar";
+        }
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef __HTTPSCAN_H_
+#define __HTTPSCAN_H_
+
+// HTTP解析用的字符扫描：一次比较16(SSE4.2)或32(AVX2)个字节，查找行尾和分隔符。
+// 启动时按CPU支持的指令集选择实现，不支持时使用逐字节的标量实现
+enum SCAN_IMPL
+{
+    SCAN_SCALAR = 0,
+    SCAN_SSE42,
+    SCAN_AVX2
+};
+
+// 在buf的[begin, end)中查找第一个等于c的字符，找不到返回end
+int scan_char(const char* buf, int begin, int end, char c);
+
+// 在buf的[begin, end)中查找第一个属于集合set的字符，找不到返回end。set最多4个字符
+int scan_any(const char* buf, int begin, int end, const char* set, int set_len);
+
+// 当前使用的实现
+SCAN_IMPL scan_impl();
+
+// 切换实现(供基准测试对比)，CPU不支持该指令集时返回false
+bool scan_select(SCAN_IMPL impl);
+
+const char* scan_impl_name(SCAN_IMPL impl);
+
+#endif
@@ -7,26 +7,305 @@
  *********************************************************************************/
 
 #include "processpool.h"
+#include "threadpool.h"
 #include "conn.h"
 #include "mgr.h"
+#include "httpmgr.h"
 
 static const char* version = "1.0";
+static const int DEFAULT_CONNS = 8;         // 默认每个事件循环到每个服务端的连接数
+
+// 命令行选项
+struct Coptions
+{
+    Coptions() : drain_timeout(-1), bind_cpu(false), bind_mem(false), min_workers(0), max_workers(0), threads(0), io_budget(-1),
+                 conns(0), idle_timeout(0), use_tsc(false) {}
+
+    int drain_timeout;
+    bool bind_cpu;
+    bool bind_mem;
+    int min_workers;
+    int max_workers;
+    int threads;
+    int io_budget;
+    int conns;
+    int idle_timeout;
+    bool use_tsc;
+};
+
+// 解析ip:port，端口不合法或者地址过长时返回false
+static bool parse_addr(const char* spec, char* ip, int ip_size, int& port)
+{
+    const char* colon = strrchr(spec, ':');
+    if (!colon || ((colon - spec) >= ip_size))
+    {
+        return false;
+    }
+
+    memcpy(ip, spec, colon - spec);
+    ip[colon - spec] = '\0';
+    port = atoi(colon + 1);
+    struct in_addr tmp;
+    return (port > 0) && (port <= 65535) && (inet_pton(AF_INET, ip, &tmp) == 1);
+}
+
+static void usage(const char* prog)
+{
+    printf("usage: %s [-d drain_timeout] [-a] [-m] [-n min_workers] [-N max_workers] [-t threads] [-b io_budget] [-i idle_ms] [-T connect_ms] [-r] [-l ip:port] [-s ip:port]... [-c conns] [-H route]... [-C cache_mb] [-p 1|2] [-P] [-h]\n", prog);
+    printf("  -d  seconds to drain connections after SIGTERM/SIGINT (default 30)\n");
+    printf("  -a  pin each worker process to its own cpu\n");
+    printf("  -m  with -a, allocate worker memory on the cpu's local numa node\n");
+    printf("  -n  minimum number of worker processes when scaling (default: one per logical server)\n");
+    printf("  -N  maximum number of worker processes; scale with load when greater than -n (at most 16)\n");
+    printf("  -t  run this many event loop threads in one process instead of worker processes\n");
+    printf("  -b  bytes read from one socket per event before serving other sockets, 0 = unlimited (default 16384)\n");
+    printf("  -i  close client sessions with no traffic for this many milliseconds, 0 = never (default 0)\n");
+    printf("  -T  with -H, fail upstream connects not established within this many milliseconds, 0 = kernel default (default 0)\n");
+    printf("  -r  read the event loop clock from the cpu's invariant TSC, calibrated at startup, instead of clock_gettime\n");
+    printf("  -l  listen address (default 127.0.0.1:1234)\n");
+    printf("  -s  server of the tcp relay, may be repeated, one logical server each (default 127.0.0.1:1234)\n");
+    printf("  -c  connections per server per event loop: opened in advance by the tcp relay, the limit with -H (default 8)\n");
+    printf("  -H  run as an HTTP proxy; route [host]/prefix=ip:port[,ip:port...], may be repeated\n");
+    printf("  -C  with -H, cache responses with Cache-Control max-age in this many MB of memory shared by all workers\n");
+    printf("  -p  send a PROXY protocol header of this version (1 or 2) with the first client bytes to the server; tcp mode only\n");
+    printf("  -P  expect a PROXY protocol header (v1 or v2) at the start of each client connection\n");
+}
+
+// 按选项创建线程池或进程池并运行，C/H/M分别为会话、逻辑服务器配置和管理对象的类型
+template< typename C, typename H, typename M >
+static int run_pool(int listenfd, vector<H>& logical_srv, Coptions& opts)
+{
+    // 多线程模式：一个进程内每个线程运行一个事件循环
+    if (opts.threads > 0)
+    {
+        CThreadpool<C, H, M>* pool = CThreadpool<C, H, M>::create(listenfd, opts.threads);
+        if (pool)
+        {
+            if (opts.drain_timeout >= 0)
+            {
+                pool->set_drain_timeout(opts.drain_timeout);
+            }
+
+            pool->set_cpu_affinity(opts.bind_cpu, opts.bind_mem);
+            pool->set_io_budget(opts.io_budget);
+            pool->set_idle_timeout(opts.idle_timeout);
+            pool->run(logical_srv);
+            delete pool;
+        }
+
+        return 0;
+    }
+
+    if (opts.min_workers <= 0)
+    {
+        opts.min_workers = logical_srv.size();
+    }
+
+    if (opts.max_workers < opts.min_workers)
+    {
+        opts.max_workers = opts.min_workers;
+    }
+
+    if (opts.max_workers > 16)
+    {
+        printf("at most 16 worker processes are supported\n");
+        return 1;
+    }
+
+    CProcesspool<C, H, M>* pool = CProcesspool<C, H, M>::create(listenfd, opts.min_workers);
+    if (pool)
+    {
+        if (opts.drain_timeout >= 0)
+        {
+            pool->set_drain_timeout(opts.drain_timeout);
+        }
+
+        pool->set_cpu_affinity(opts.bind_cpu, opts.bind_mem);
+        pool->set_scaling(opts.min_workers, opts.max_workers);
+        pool->set_io_budget(opts.io_budget);
+        pool->set_idle_timeout(opts.idle_timeout);
+
+        pool->run(logical_srv);
+        delete pool;
+    }
+
+    return 0;
+}
 
 int main(int argc, char * argv [ ])
 {
+    Coptions opts;
+    Chttpcfg http_cfg;
+    int cache_mb = 0;
+    int proxy_send = PROXY_NONE;
+    bool proxy_accept = false;
+    int connect_timeout = 0;
+    char listen_ip[INET_ADDRSTRLEN] = "127.0.0.1";
+    int listen_port = 1234;
     vector<Chost> logical_srv;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "d:amn:N:t:b:i:T:rl:s:c:H:C:p:Ph")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd':
+            {
+                opts.drain_timeout = atoi(optarg);
+                break;
+            }
 
-    Chost tmp;
-    strcpy(tmp.m_hostname, "127.0.0.1");
-    tmp.m_port = 1234;
+            case 'a':
+            {
+                opts.bind_cpu = true;
+                break;
+            }
 
-    logical_srv.push_back(tmp);
+            case 'm':
+            {
+                opts.bind_mem = true;
+                break;
+            }
+
+            case 'n':
+            {
+                opts.min_workers = atoi(optarg);
+                break;
+            }
+
+            case 'N':
+            {
+                opts.max_workers = atoi(optarg);
+                break;
+            }
+
+            case 't':
+            {
+                opts.threads = atoi(optarg);
+                break;
+            }
+
+            case 'b':
+            {
+                opts.io_budget = atoi(optarg);
+                break;
+            }
+
+            case 'i':
+            {
+                opts.idle_timeout = atoi(optarg);
+                break;
+            }
+
+            case 'T':
+            {
+                connect_timeout = atoi(optarg);
+                break;
+            }
+
+            case 'r':
+            {
+                opts.use_tsc = true;
+                break;
+            }
+
+            case 'l':
+            {
+                if (!parse_addr(optarg, listen_ip, sizeof(listen_ip), listen_port))
+                {
+                    printf("bad listen address: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+
+            case 's':
+            {
+                Chost host;
+                if (!parse_addr(optarg, host.m_hostname, sizeof(host.m_hostname), host.m_port))
+                {
+                    printf("bad server address: %s\n", optarg);
+                    return 1;
+                }
+
+                logical_srv.push_back(host);
+                break;
+            }
+
+            case 'c':
+            {
+                opts.conns = atoi(optarg);
+                if (opts.conns <= 0)
+                {
+                    printf("bad connection count: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+
+            case 'H':
+            {
+                if (!http_cfg.add_route(optarg))
+                {
+                    printf("bad route: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+
+            case 'C':
+            {
+                cache_mb = atoi(optarg);
+                break;
+            }
+
+            case 'p':
+            {
+                proxy_send = atoi(optarg);
+                if ((proxy_send != PROXY_V1) && (proxy_send != PROXY_V2))
+                {
+                    printf("bad PROXY protocol version: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+
+            case 'P':
+            {
+                proxy_accept = true;
+                break;
+            }
+
+            case 'h':
+            default:
+            {
+                usage(basename(argv[0]));
+                return (opt == 'h') ? 0 : 1;
+            }
+        }
+    }
+
+    // 七层代理的服务端连接由多个客户端轮流复用，连接开头的PROXY协议头部无法描述每个请求的客户端
+    if (!http_cfg.m_routes.empty() && (proxy_send != PROXY_NONE))
+    {
+        printf("-p is not supported with -H, upstream connections are shared by clients\n");
+        return 1;
+    }
+
+    // 时钟来源在创建工作进程和线程之前确定，它们直接使用标定的结果
+    if (Cclock::init(opts.use_tsc))
+    {
+        printf("event loop clock: tsc at %.3f GHz\n", Cclock::tsc_ghz());
+    }
+    else if (opts.use_tsc)
+    {
+        printf("event loop clock: tsc is not invariant on this cpu, using clock_gettime\n");
+    }
 
     struct sockaddr_in serv_addr;
     bzero(&serv_addr, sizeof(serv_addr));
     serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-    serv_addr.sin_port = htons(1234);
+    inet_pton(AF_INET, listen_ip, &serv_addr.sin_addr);
+    serv_addr.sin_port = htons(listen_port);
 
     int listenfd = socket(AF_INET, SOCK_STREAM, 0);
     assert(listenfd >= 0);
@@ -34,17 +313,56 @@ int main(int argc, char * argv [ ])
     int ret = bind(listenfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr));
     assert(ret != -1);
 
-    ret = listen(listenfd, 5);
+    // 连接风暴时积压的连接由工作进程成批接受，队列太短会丢弃SYN，客户端要等重传超时
+    ret = listen(listenfd, SOMAXCONN);
     assert(ret != -1);
 
-    CProcesspool<Conn, Chost, Cmgr>* pool = CProcesspool<Conn, Chost, Cmgr>::create(listenfd, logical_srv.size());
-    if (pool)
+    // 七层HTTP代理模式：所有工作进程共享同一份路由配置
+    if (!http_cfg.m_routes.empty())
     {
-        pool->run(logical_srv);
-        delete pool;
+        http_cfg.m_proxy_accept = proxy_accept;
+        http_cfg.m_connect_timeout = connect_timeout;
+        for (size_t i = 0; (opts.conns > 0) && (i < http_cfg.m_upstreams.size()); i++)
+        {
+            for (size_t j = 0; j < http_cfg.m_upstreams[i].m_servers.size(); j++)
+            {
+                http_cfg.m_upstreams[i].m_servers[j].m_conncnt = opts.conns;
+            }
+        }
+
+        // 应答缓存必须在创建进程池之前建立，工作进程继承同一块共享内存
+        if (cache_mb > 0)
+        {
+            http_cfg.m_cache = Crespcache::create(cache_mb * 1024LL * 1024);
+            if (!http_cfg.m_cache)
+            {
+                printf("create response cache of %d MB failed\n", cache_mb);
+                return 1;
+            }
+        }
+
+        vector<Chttpcfg> cfgs(1, http_cfg);
+        ret = run_pool<Csession, Chttpcfg, Chttpmgr>(listenfd, cfgs, opts);
+        close(listenfd);
+        return ret;
     }
 
+    if (logical_srv.empty())
+    {
+        Chost tmp;
+        strcpy(tmp.m_hostname, "127.0.0.1");
+        tmp.m_port = 1234;
+        logical_srv.push_back(tmp);
+    }
+
+    for (size_t i = 0; i < logical_srv.size(); i++)
+    {
+        logical_srv[i].m_conncnt = (opts.conns > 0) ? opts.conns : DEFAULT_CONNS;
+        logical_srv[i].m_proxy_send = (PROXY_VERSION)proxy_send;
+        logical_srv[i].m_proxy_accept = proxy_accept;
+    }
+
+    ret = run_pool<Conn, Chost, Cmgr>(listenfd, logical_srv, opts);
     close(listenfd);
-    return 0;
+    return ret;
 }
-
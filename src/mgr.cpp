@@ -8,11 +8,13 @@
 
 #include "mgr.h"
 
-int Cmgr::m_epollfd = -1;
-
-Cmgr::Cmgr(int epollfd, const Chost & srv) : m_logic_srv(srv)
+Cmgr::Cmgr(int epollfd, const Chost & srv)
+    : m_epollfd(epollfd), m_retry_at(0), m_logic_srv(srv), m_draining(false), m_io_budget(IO_BUDGET), m_epoll_ctl_cnt(0),
+      m_request_cnt(0), m_idle_timeout(0), m_now(0), m_timeout_cnt(0)
 {
-    m_epollfd = epollfd;
+    // 时间轮从事件循环第一次调用expire_timers时开始转动，在此之前没有定时器
+    m_timers = Ctimer_queue::create(TIMER_WHEEL, 0);
+
     int ret = 0;
 
     struct sockaddr_in addr;
@@ -22,36 +24,68 @@ Cmgr::Cmgr(int epollfd, const Chost & srv) : m_logic_srv(srv)
     addr.sin_port = htons(srv.m_port);
     printf("logical srv host info: (%s, %d)", srv.m_hostname, srv.m_port);
 
+    // 启动时建立失败的连接同样放入m_freed，之后由recycle_conns重试
     for (int i = 0; i < srv.m_conncnt; i++)
     {
-        sleep(1);
+        Conn* tmp = NULL;
+        try
+        {
+            tmp = new Conn;
+        }
+        catch (...)
+        {
+            continue;
+        }
+
         int sockfd = conn2srv(addr);
+        tmp->init_srv(sockfd, addr);
         if (sockfd < 0)
         {
             printf("build connection %d failed\n", i);
+            m_freed.push_back(tmp);
         }
         else 
         {
             printf("build connection %d to server success\n", i);
-            Conn* tmp = NULL;
-            try
-            {
-                tmp = new Conn;
-            }
-            catch (...)
-            {
-                close(sockfd);
-                continue;
-            }
-            tmp->init_srv(sockfd, addr);
             m_conns.insert(pair<int, Conn*>(sockfd, tmp));
         }
     }
 }
 
+// 关闭所有服务端连接和仍在进行的会话，释放连接对象
 Cmgr::~Cmgr()
 {
+    for (map<int, Conn*>::iterator iter = m_conns.begin(); iter != m_conns.end(); iter++)
+    {
+        close(iter->first);
+        delete iter->second;
+    }
 
+    // 每个会话在m_used中占两项，只在客户端描述符一项上释放
+    for (map<int, Conn*>::iterator iter = m_used.begin(); iter != m_used.end(); iter++)
+    {
+        Conn* connection = iter->second;
+        if (connection && (connection->m_cltfd == iter->first))
+        {
+            close(connection->m_cltfd);
+            close(connection->m_srvfd);
+            delete connection;
+        }
+    }
+
+    for (map<int, Conn*>::iterator iter = m_connecting.begin(); iter != m_connecting.end(); iter++)
+    {
+        close(iter->first);
+        delete iter->second;
+    }
+
+    // 等待重建的连接没有打开的描述符
+    for (size_t i = 0; i < m_freed.size(); i++)
+    {
+        delete m_freed[i];
+    }
+
+    delete m_timers;
 }
 
 int Cmgr::conn2srv(const sockaddr_in & addr)
@@ -68,6 +102,9 @@ int Cmgr::conn2srv(const sockaddr_in & addr)
         return -1;
     }
 
+    // 启动时阻塞地建立连接，之后设置为非阻塞。连接只服务一个会话，会话结束时随之关闭，
+    // 由reconnect非阻塞地重建
+    setnonblocking(sockfd);
     return sockfd;
 }
 
@@ -76,8 +113,21 @@ int Cmgr::get_used_conn_cnt()
     return m_used.size();
 }
 
+// 空闲的服务端连接数(包括正在重建和等待重建的连接)
+int Cmgr::get_idle_conn_cnt()
+{
+    return m_conns.size() + m_connecting.size() + m_freed.size();
+}
+
 Conn* Cmgr::pick_conn(int cltfd)
 {
+    // 空闲连接用完时先确认正在重建的连接，本机上的连接通常在connect返回后立即建立
+    for (map<int, Conn*>::iterator iter = m_connecting.begin(); m_conns.empty() && (iter != m_connecting.end());)
+    {
+        Conn* pending = (iter++)->second;
+        finish_connect(pending);
+    }
+
     if (m_conns.empty())
     {
         printf("not enough srv connection to server\n");
@@ -94,10 +144,17 @@ Conn* Cmgr::pick_conn(int cltfd)
     }
 
     m_conns.erase(iter);
+    tmp->m_proxy_send = m_logic_srv.m_proxy_send;
+    tmp->m_proxy_expect = m_logic_srv.m_proxy_accept;
     m_used.insert(pair<int, Conn*>(cltfd, tmp));
     m_used.insert(pair<int, Conn*>(srvfd, tmp));
     add_read_fd(m_epollfd, srvfd);
     add_read_fd(m_epollfd, cltfd);
+    m_epoll_ctl_cnt += 2;
+    tmp->m_clt_events = tmp->m_clt_want = EPOLLIN;
+    tmp->m_srv_events = tmp->m_srv_want = EPOLLIN;
+    tmp->m_idle_timer.init(on_idle_timeout, this, tmp);
+    touch(tmp);
 
     printf("bind client sock %d with server sock %d\n", cltfd, srvfd);
     return tmp;
@@ -107,50 +164,484 @@ void Cmgr::free_conn(Conn * connection)
 {
     int cltfd = connection->m_cltfd;
     int srvfd = connection->m_srvfd;
-    closefd(m_epollfd, cltfd);
-    closefd(m_epollfd, srvfd);
+    // 描述符只在本进程中打开，关闭时内核会自动将其从事件表中删除，无需再调用epoll_ctl
+    close(cltfd);
+    close(srvfd);
+    m_timers->cancel(&connection->m_idle_timer);
     m_used.erase(cltfd);
     m_used.erase(srvfd);
     connection->reset();
-    m_freed.insert(pair<int, Conn*>(srvfd, connection));
+
+    // 排空阶段进程即将退出，不再重建到服务端的连接
+    if (m_draining)
+    {
+        m_freed.push_back(connection);
+        return;
+    }
+
+    reconnect(connection);
+}
+
+/**************************************************************
+ * 函数名称：Cmgr::reconnect
+ * 函数功能：重建服务端连接。发起非阻塞连接，立即建立时直接放回
+ *          空闲连接池；正在进行时注册EPOLLOUT，由finish_connect确认
+ *          结果，并用连接的定时器限制等待的时间；立即失败时放入
+ *          m_freed，RETRY_INTERVAL之后由recycle_conns重试
+ * 输入参数：connection     已经关闭服务端描述符的连接对象
+ * 输出参数：无
+ * 返 回 值：无
+ **************************************************************/
+void Cmgr::reconnect(Conn * connection)
+{
+    int sockfd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int ret = -1;
+    if (sockfd >= 0)
+    {
+        ret = connect(sockfd, (struct sockaddr*)&connection->m_srv_addr, sizeof(connection->m_srv_addr));
+    }
+
+    if ((ret != 0) && ((sockfd < 0) || (errno != EINPROGRESS)))
+    {
+        printf("reconnect to server failed\n");
+        if (sockfd >= 0)
+        {
+            close(sockfd);
+        }
+
+        connection->init_srv(-1, connection->m_srv_addr);
+        m_freed.push_back(connection);
+        m_retry_at = m_now + RETRY_INTERVAL;
+        return;
+    }
+
+    connection->init_srv(sockfd, connection->m_srv_addr);
+    if (ret == 0)
+    {
+        m_conns.insert(pair<int, Conn*>(sockfd, connection));
+        return;
+    }
+
+    add_write_fd(m_epollfd, sockfd);
+    m_epoll_ctl_cnt++;
+    connection->m_idle_timer.init(on_connect_timeout, this, connection);
+    m_timers->add(&connection->m_idle_timer, m_now + CONNECT_TIMEOUT);
+    m_connecting.insert(pair<int, Conn*>(sockfd, connection));
+}
+
+// 重建中的连接可写：连接建立后从内核事件表中删除，放回空闲连接池，由pick_conn重新注册。
+// 描述符号可能被刚关闭的描述符的残留事件命中，连接仍在进行时不做处理
+void Cmgr::finish_connect(Conn * connection)
+{
+    int sockfd = connection->m_srvfd;
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if ((getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) || (error != 0))
+    {
+        printf("reconnect to server failed: %s\n", strerror(error));
+        connect_failed(connection);
+        return;
+    }
+
+    struct sockaddr_in peer;
+    socklen_t peer_len = sizeof(peer);
+    if (getpeername(sockfd, (struct sockaddr*)&peer, &peer_len) < 0)
+    {
+        return;
+    }
+
+    m_timers->cancel(&connection->m_idle_timer);
+    m_connecting.erase(sockfd);
+    closefd(m_epollfd, sockfd);
+    m_epoll_ctl_cnt++;
+    m_conns.insert(pair<int, Conn*>(sockfd, connection));
+}
+
+// 重建失败或者超时：关闭描述符，连接放入m_freed等待重试
+void Cmgr::connect_failed(Conn * connection)
+{
+    int sockfd = connection->m_srvfd;
+    m_timers->cancel(&connection->m_idle_timer);
+    m_connecting.erase(sockfd);
+    removefd(m_epollfd, sockfd);
+    m_epoll_ctl_cnt++;
+    connection->init_srv(-1, connection->m_srv_addr);
+    m_freed.push_back(connection);
+    m_retry_at = m_now + RETRY_INTERVAL;
 }
 
+void Cmgr::on_connect_timeout(void* owner, void* data)
+{
+    printf("reconnect to server timeout\n");
+    static_cast<Cmgr*>(owner)->connect_failed(static_cast<Conn*>(data));
+}
+
+// 重试m_freed中的连接：距上次失败不足RETRY_INTERVAL时不重试，后端不可用时不会在
+// 每轮事件循环中都发起连接
 void Cmgr::recycle_conns()
 {
-    if (m_freed.empty())
+    // 排空阶段进程即将退出，不再重建到服务端的连接
+    if (m_freed.empty() || m_draining || (m_now < m_retry_at))
     {
         return;
     }
 
-    for (map<int, Conn*>::iterator iter = m_freed.begin(); iter != m_freed.end(); iter++)
+    vector<Conn*> freed;
+    freed.swap(m_freed);
+    for (size_t i = 0; i < freed.size(); i++)
+    {
+        reconnect(freed[i]);
+    }
+}
+
+/**************************************************************
+ * 函数名称：Cmgr::drain
+ * 函数功能：进入排空状态。不再重建服务端连接，已经没有待转发数据的
+ *          会话立即对服务端半关闭，其余会话在数据转发完毕后再半关闭，
+ *          由服务端发完剩余应答后关闭连接，从而使会话自然结束
+ * 输入参数：无
+ * 输出参数：无
+ * 返 回 值：无
+ **************************************************************/
+void Cmgr::drain()
+{
+    m_draining = true;
+    for (map<int, Conn*>::iterator iter = m_used.begin(); iter != m_used.end(); iter++)
+    {
+        Conn* connection = iter->second;
+        if (connection && (connection->m_cltfd == iter->first))
+        {
+            half_close(connection);
+        }
+    }
+}
+
+// 客户端缓冲区中的数据已全部发往服务端时，关闭到服务端的写方向
+void Cmgr::half_close(Conn * connection)
+{
+    if (!m_draining || connection->m_srv_half_closed)
+    {
+        return;
+    }
+
+    if (connection->m_clt_read_idx > connection->m_clt_write_idx)
+    {
+        return;
+    }
+
+    shutdown(connection->m_srvfd, SHUT_WR);
+    connection->m_srv_half_closed = true;
+}
+
+// 记录描述符fd期望注册的事件(语义同modfd，总是包含EPOLLIN)，在flush_events中统一提交
+void Cmgr::set_interest(Conn * connection, int fd, int ev)
+{
+    if (fd == connection->m_cltfd)
+    {
+        connection->m_clt_want = ev | EPOLLIN;
+    }
+    else 
+    {
+        connection->m_srv_want = ev | EPOLLIN;
+    }
+
+    m_changes.push_back(fd);
+}
+
+/**************************************************************
+ * 函数名称：Cmgr::flush_events
+ * 函数功能：每轮事件循环结束时调用，把本轮记录的事件变化提交到内核事件表。
+ *          只有期望的事件与已注册的事件不同时才真正调用epoll_ctl。因缓冲区满
+ *          而中断的读取不依赖重新注册EPOLLIN来触发，而是放入就绪队列继续读取
+ * 输入参数：无
+ * 输出参数：无
+ * 返 回 值：无
+ **************************************************************/
+void Cmgr::flush_events()
+{
+    for (size_t i = 0; i < m_changes.size(); i++)
+    {
+        int fd = m_changes[i];
+        map<int, Conn*>::iterator iter = m_used.find(fd);
+        if ((iter == m_used.end()) || !iter->second)
+        {
+            continue;
+        }
+
+        Conn* connection = iter->second;
+        bool is_clt = (fd == connection->m_cltfd);
+        int& events = is_clt ? connection->m_clt_events : connection->m_srv_events;
+        int want = is_clt ? connection->m_clt_want : connection->m_srv_want;
+
+        if (want != events)
+        {
+            modfd(m_epollfd, fd, want);
+            m_epoll_ctl_cnt++;
+            events = want;
+        }
+    }
+
+    m_changes.clear();
+}
+
+// 将描述符fd放入就绪队列，在之后的事件循环中继续读取
+void Cmgr::mark_ready(Conn * connection, int fd)
+{
+    bool& ready = (fd == connection->m_cltfd) ? connection->m_clt_ready : connection->m_srv_ready;
+    if (!ready)
     {
-        sleep(1);
-        int srvfd = iter->first;
-        Conn* tmp = iter->second;
-        srvfd = conn2srv(tmp->m_srv_addr);
-        if (srvfd < 0)
+        ready = true;
+        m_ready.push_back(fd);
+    }
+}
+
+bool Cmgr::has_ready()
+{
+    return !m_ready.empty();
+}
+
+/**************************************************************
+ * 函数名称：Cmgr::process_ready
+ * 函数功能：为就绪队列中的描述符各读取一个预算的数据。只处理本轮开始时已在
+ *          队列中的描述符，仍未读完的重新排到队尾，使大流量连接与其他连接
+ *          按轮次公平地分享事件循环
+ * 输入参数：无
+ * 输出参数：无
+ * 返 回 值：本轮中关闭的会话数
+ **************************************************************/
+int Cmgr::process_ready()
+{
+    int closed = 0;
+    size_t count = m_ready.size();
+    for (size_t i = 0; i < count; i++)
+    {
+        int fd = m_ready.front();
+        m_ready.pop_front();
+
+        map<int, Conn*>::iterator iter = m_used.find(fd);
+        if ((iter == m_used.end()) || !iter->second)
+        {
+            continue;
+        }
+
+        Conn* connection = iter->second;
+        if (fd == connection->m_cltfd)
         {
-            printf("fix connection failed\n");
+            connection->m_clt_ready = false;
         }
         else 
         {
-            printf("fix connection success\n");
-            tmp->init_srv(srvfd, tmp->m_srv_addr);
-            m_conns.insert(pair<int, Conn*>(srvfd, tmp));
+            connection->m_srv_ready = false;
+        }
+
+        if (process(fd, READ) == CLOSED)
+        {
+            closed++;
         }
     }
 
-    m_freed.clear();
+    return closed;
+}
+
+// 会话上有读写时推迟空闲超时
+void Cmgr::touch(Conn * connection)
+{
+    if (m_idle_timeout > 0)
+    {
+        m_timers->add(&connection->m_idle_timer, m_now + m_idle_timeout);
+    }
+}
+
+// 空闲超时的回调：结束会话
+void Cmgr::on_idle_timeout(void* owner, void* data)
+{
+    Cmgr* mgr = static_cast<Cmgr*>(owner);
+    mgr->m_timeout_cnt++;
+    mgr->free_conn(static_cast<Conn*>(data));
+}
+
+// 每轮事件循环开始时调用：记录本轮的时间，关闭空闲超时的会话，返回关闭的会话数
+// 推进定时器，并按RETRY_INTERVAL重试重建失败的连接，连接持续到来、事件循环不空闲时也能重试
+int Cmgr::expire_timers(long long now)
+{
+    m_now = now;
+    int cnt = m_timers->expire(now);
+    recycle_conns();
+    return cnt;
+}
+
+// 距离下一个会话空闲超时的毫秒数，事件循环据此缩短epoll_wait的等待时间。没有定时器时返回-1
+int Cmgr::next_timeout()
+{
+    long long next = m_timers->next_expire();
+    if (next < 0)
+    {
+        return -1;
+    }
+
+    return (next > m_now) ? (int)(next - m_now) : 0;
+}
+
+// 打印事件表操作的统计信息
+void Cmgr::print_stats(const char* name, int idx)
+{
+    double per_request = (m_request_cnt > 0) ? ((double)m_epoll_ctl_cnt / m_request_cnt) : 0.0;
+    printf("%s %d stats: %lld requests, %lld epoll_ctl, %.2f epoll_ctl per request, %lld idle timeouts\n",
+           name, idx, m_request_cnt, m_epoll_ctl_cnt, per_request, m_timeout_cnt);
+}
+
+/**************************************************************
+ * 函数名称：Cmgr::relay_clt
+ * 函数功能：读取客户端数据后立即转发给服务端，不再等待服务端的EPOLLOUT
+ *          事件。只有服务端暂时写不进去时才注册EPOLLOUT；缓冲区读满且已
+ *          全部转发时在读预算内继续读取，预算用完则放入就绪队列
+ * 输入参数：connection 会话
+ * 输出参数：无
+ * 返 回 值：CLOSED表示会话应当结束，其余表示会话继续
+ **************************************************************/
+RET_CODE Cmgr::relay_clt(Conn * connection)
+{
+    int cltfd = connection->m_cltfd;
+    int srvfd = connection->m_srvfd;
+    int budget = m_io_budget;
+    while (true)
+    {
+        int read_idx = connection->m_clt_read_idx;
+        RET_CODE res = connection->read_clt(budget);
+        if ((res == IOERR) || (res == CLOSED))
+        {
+            return CLOSED;
+        }
+        else if (res == NOTHING)
+        {
+            return NOTHING;
+        }
+
+        m_request_cnt++;
+        if (connection->m_clt_pending)
+        {
+            mark_ready(connection, cltfd);
+        }
+
+        // 客户端连接开头的PROXY协议头部不转发，头部不能超过缓冲区
+        if (connection->m_proxy_expect)
+        {
+            int n = connection->strip_proxy();
+            if ((n < 0) || ((n == 0) && (res == BUFFER_FULL)))
+            {
+                return CLOSED;
+            }
+            else if (n == 0)
+            {
+                return OK;
+            }
+        }
+
+        int bytes_read = connection->m_clt_read_idx - read_idx;
+        RET_CODE wres = connection->write_srv();
+        if (wres == TRY_AGAIN)
+        {
+            // 服务端写缓冲区满，等待EPOLLOUT；客户端缓冲区也满时暂停读取
+            connection->m_clt_stalled = (res == BUFFER_FULL);
+            set_interest(connection, srvfd, EPOLLOUT);
+            return OK;
+        }
+        else if (wres != BUFFER_EMPTY)
+        {
+            connection->m_srv_closed = true;
+            return CLOSED;
+        }
+
+        half_close(connection);
+        if (res != BUFFER_FULL)
+        {
+            return OK;
+        }
+
+        if (budget > 0)
+        {
+            budget -= bytes_read;
+            if (budget <= 0)
+            {
+                mark_ready(connection, cltfd);
+                return OK;
+            }
+        }
+    }
+}
+
+// 读取服务端应答后立即转发给客户端，处理方式同relay_clt。服务端关闭时把已读到的应答发完再结束会话
+RET_CODE Cmgr::relay_srv(Conn * connection)
+{
+    int cltfd = connection->m_cltfd;
+    int srvfd = connection->m_srvfd;
+    int budget = m_io_budget;
+    while (true)
+    {
+        int read_idx = connection->m_srv_read_idx;
+        RET_CODE res = connection->read_srv(budget);
+        if ((res == IOERR) || (res == CLOSED))
+        {
+            connection->m_srv_closed = true;
+        }
+        else if (res == NOTHING)
+        {
+            return NOTHING;
+        }
+        else if (connection->m_srv_pending)
+        {
+            mark_ready(connection, srvfd);
+        }
+
+        int bytes_read = connection->m_srv_read_idx - read_idx;
+        RET_CODE wres = connection->write_clt();
+        if (wres == TRY_AGAIN)
+        {
+            connection->m_srv_stalled = (res == BUFFER_FULL);
+            set_interest(connection, cltfd, EPOLLOUT);
+            return OK;
+        }
+        else if ((wres != BUFFER_EMPTY) || connection->m_srv_closed)
+        {
+            return CLOSED;
+        }
+
+        if (res != BUFFER_FULL)
+        {
+            return OK;
+        }
+
+        if (budget > 0)
+        {
+            budget -= bytes_read;
+            if (budget <= 0)
+            {
+                mark_ready(connection, srvfd);
+                return OK;
+            }
+        }
+    }
 }
 
 RET_CODE Cmgr::process(int fd, OP_TYPE type)
 {
-    Conn* connection = m_used[fd];
-    if (!connection)
+    map<int, Conn*>::iterator pending = m_connecting.find(fd);
+    if (pending != m_connecting.end())
+    {
+        finish_connect(pending->second);
+        return OK;
+    }
+
+    // 不能使用m_used[fd]，否则会为已经释放的描述符插入空表项，导致连接计数失真
+    map<int, Conn*>::iterator iter = m_used.find(fd);
+    if ((iter == m_used.end()) || !iter->second)
     {
         return NOTHING;
     }
 
+    Conn* connection = iter->second;
+    touch(connection);
+
     if (connection->m_cltfd == fd)
     {
         int srvfd = connection->m_srvfd;
@@ -158,35 +649,7 @@ RET_CODE Cmgr::process(int fd, OP_TYPE type)
         {
             case READ:
             {
-                RET_CODE res = connection->read_clt();
-                switch (res)
-                {
-                    case OK:
-                    {
-                        printf("content read from client: %s", connection->m_clt_buf);
-                        break;
-                    }
-
-                    case BUFFER_FULL:
-                    {
-                        modfd(m_epollfd, srvfd, EPOLLOUT);
-                        break;
-                    }
-
-                    case IOERR:
-                    case CLOSED:
-                    {
-                        free_conn(connection);
-                        break;
-                    }
-
-                    default:
-                    {
-                        break;
-                    }
-                }
-
-                if (connection->m_srv_closed)
+                if ((relay_clt(connection) == CLOSED) || connection->m_srv_closed)
                 {
                     free_conn(connection);
                     return CLOSED;
@@ -202,14 +665,18 @@ RET_CODE Cmgr::process(int fd, OP_TYPE type)
                 {
                     case TRY_AGAIN:
                     {
-                        modfd(m_epollfd, fd, EPOLLOUT);
+                        set_interest(connection, fd, EPOLLOUT);
                         break;
                     }
 
                     case BUFFER_EMPTY:
                     {
-                        modfd(m_epollfd, srvfd, EPOLLOUT);
-                        modfd(m_epollfd, fd, EPOLLIN);
+                        set_interest(connection, fd, EPOLLIN);
+                        if (connection->m_srv_stalled)
+                        {
+                            connection->m_srv_stalled = false;
+                            mark_ready(connection, srvfd);
+                        }
                         break;
                     }
 
@@ -217,7 +684,7 @@ RET_CODE Cmgr::process(int fd, OP_TYPE type)
                     case CLOSED:
                     {
                         free_conn(connection);
-                        break;
+                        return CLOSED;
                     }
 
                     default:
@@ -226,7 +693,8 @@ RET_CODE Cmgr::process(int fd, OP_TYPE type)
                     }
                 }
 
-                if (connection->m_srv_closed)
+                // 服务端已经关闭时，等发给客户端的应答写完再结束会话
+                if (connection->m_srv_closed && (res != TRY_AGAIN))
                 {
                     free_conn(connection);
                     return CLOSED;
@@ -249,33 +717,10 @@ RET_CODE Cmgr::process(int fd, OP_TYPE type)
         {
             case READ:
             {
-                RET_CODE res = connection->read_srv();
-                switch (res)
+                if (relay_srv(connection) == CLOSED)
                 {
-                    case OK:
-                    {
-                        printf("content read from server: %s\n", connection->m_srv_buf);
-                        break;
-                    }
-
-                    case BUFFER_FULL:
-                    {
-                        modfd(m_epollfd, cltfd, EPOLLOUT);
-                        break;
-                    }
-
-                    case IOERR:
-                    case CLOSED:
-                    {
-                        modfd(m_epollfd, cltfd, EPOLLOUT);
-                        connection->m_srv_closed = true;
-                        break;
-                    }
-
-                    default:
-                    {
-                        break;
-                    }
+                    free_conn(connection);
+                    return CLOSED;
                 }
 
                 break;
@@ -287,21 +732,26 @@ RET_CODE Cmgr::process(int fd, OP_TYPE type)
                 {
                     case TRY_AGAIN:
                     {
-                        modfd(m_epollfd, fd, EPOLLOUT);
+                        set_interest(connection, fd, EPOLLOUT);
                         break;
                     }
 
                     case BUFFER_EMPTY:
                     {
-                        modfd(m_epollfd, cltfd, EPOLLIN);
-                        modfd(m_epollfd, fd, EPOLLIN);
+                        set_interest(connection, fd, EPOLLIN);
+                        if (connection->m_clt_stalled)
+                        {
+                            connection->m_clt_stalled = false;
+                            mark_ready(connection, cltfd);
+                        }
+                        half_close(connection);
                         break;
                     }
 
                     case IOERR:
                     case CLOSED:
                     {
-                        modfd(m_epollfd, cltfd, EPOLLOUT);
+                        set_interest(connection, cltfd, EPOLLOUT);
                         connection->m_srv_closed = true;
                         break;
                     }
@@ -329,7 +779,3 @@ RET_CODE Cmgr::process(int fd, OP_TYPE type)
 
     return OK;
 }
-
-
-
-
@@ -4,6 +4,7 @@
 #include "global.h"
 #include "conn.h"
 #include "fdwrapper.h"
+#include "timer.h"
 
 class Chost
 {
@@ -11,6 +12,8 @@ public:
     char m_hostname[1024];          // IP地址
     int m_port;                     // 端口号
     int m_conncnt;                  // 连接数量
+    PROXY_VERSION m_proxy_send;     // 向服务端发送的PROXY协议头部版本
+    bool m_proxy_accept;            // 客户端连接开头带有PROXY协议头部(位于另一个负载均衡器之后)
 };
 
 class Cmgr
@@ -24,15 +27,55 @@ public:
     Conn* pick_conn(int cltfd);
     void free_conn(Conn* connection);
     int get_used_conn_cnt();
+    int get_idle_conn_cnt();
     void recycle_conns();
+    void drain();
     RET_CODE process(int fd, OP_TYPE type);
+    void flush_events();
+    bool has_ready();
+    int process_ready();
+    void set_io_budget(int budget) { m_io_budget = budget; }
+    void set_idle_timeout(int ms) { m_idle_timeout = ms; }
+    int expire_timers(long long now);
+    int next_timeout();
+    void print_stats(const char* name, int idx);
 
 private:
-    static int m_epollfd;
+    static const int IO_BUDGET = 16384;     // 默认的读预算(字节)
+    static const int CONNECT_TIMEOUT = 3000;    // 重建服务端连接的超时(毫秒)
+    static const int RETRY_INTERVAL = 1000;     // 重建失败后再次重试的间隔(毫秒)
+
+private:
+    static void on_idle_timeout(void* owner, void* data);
+    static void on_connect_timeout(void* owner, void* data);
+    void reconnect(Conn* connection);
+    void finish_connect(Conn* connection);
+    void connect_failed(Conn* connection);
+    RET_CODE relay_clt(Conn* connection);
+    RET_CODE relay_srv(Conn* connection);
+    void half_close(Conn* connection);
+    void set_interest(Conn* connection, int fd, int ev);
+    void mark_ready(Conn* connection, int fd);
+    void touch(Conn* connection);
+
+private:
+    int m_epollfd;                  // 所属事件循环的内核事件表，每个事件循环拥有独立的管理对象
     map<int, Conn*> m_conns;
     map<int, Conn*> m_used;
-    map<int, Conn*> m_freed;
+    map<int, Conn*> m_connecting;   // 正在非阻塞重建的服务端连接，可写时确认结果
+    vector<Conn*> m_freed;          // 等待重建的服务端连接：排空阶段释放的，或者重建失败等待重试的
+    long long m_retry_at;           // 下一次重试m_freed中连接的时间
     Chost m_logic_srv;
+    bool m_draining;                // 是否处于排空状态
+    vector<int> m_changes;          // 本轮事件循环中事件发生变化的描述符，由flush_events统一提交
+    std::list<int> m_ready;         // 仍有数据待读的描述符，每轮事件循环轮流为其读取一个预算的数据
+    int m_io_budget;                // 每次读事件最多读取的字节数，不大于0表示不限制
+    long long m_epoll_ctl_cnt;      // 调用epoll_ctl的次数
+    long long m_request_cnt;        // 转发的客户端请求数(读到并转发一批客户端数据计为一次)
+    Ctimer_queue* m_timers;         // 会话的空闲超时，使用时间轮：每次读写都要推迟，添加和调整都是O(1)
+    int m_idle_timeout;             // 会话空闲超时(毫秒)，不大于0表示不超时
+    long long m_now;                // 本轮事件循环的时间(单调时钟毫秒)，由expire_timers更新
+    long long m_timeout_cnt;        // 因空闲超时关闭的会话数
 };
 
 #endif
@@ -1,19 +1,26 @@
 #ifndef __PROCESSPOOL_H_
 #define __PROCESSPOOL_H_
 
-#include "global.h"
-#include "fdwrapper.h"
+#include "worker.h"
 
 // 子进程类
 class CProcess
 {
 public:
-    CProcess() : m_pid(-1){}
+    CProcess() : m_busy_ratio(0), m_pid(-1), m_draining(false), m_start_time(0), m_respawn_at(0), m_backoff(0), m_crash_cnt(0),
+                 m_loop_util(0), m_conn_util(0){}
 
 public:
-    int m_busy_ratio;       // 子进程的繁忙程度(即负荷)
+    int m_busy_ratio;       // 子进程的繁忙程度(即负荷)。排空阶段表示剩余的连接数
     pid_t m_pid;            // 目标子进程PID
     int m_pipefd[2];        // 父子进程之间通信的管道
+    bool m_draining;        // 子进程是否处于排空状态
+    time_t m_start_time;    // 子进程的启动时间(单调时钟秒，下同)
+    time_t m_respawn_at;    // 子进程异常退出后计划重新拉起的时间，0表示无需重启
+    int m_backoff;          // 当前的重启退避时间(秒)
+    int m_crash_cnt;        // 连续异常退出的次数，子进程稳定运行后清零
+    int m_loop_util;        // 最近上报的事件循环利用率
+    int m_conn_util;        // 最近上报的连接利用率
 };
 
 // 进程池类
@@ -40,11 +47,23 @@ public:
     }
 
     void run(const vector<H>& arg);
+    void set_drain_timeout(int seconds) { m_drain_timeout = seconds; }
+    void set_cpu_affinity(bool bind_cpu, bool bind_mem) { m_bind_cpu = bind_cpu; m_bind_mem = bind_mem; }
+    void set_scaling(int min_process, int max_process);
+    void set_io_budget(int budget) { m_io_budget = budget; }
+    void set_idle_timeout(int ms) { m_idle_timeout = ms; }
 
 private:
-    void notify_parent_busy_ratio(int pipefd, M* manager);
+    static bool on_child_signals(void* owner, CWorker<C, H, M>* worker);
     int get_most_free_srv();
     void setup_sig_pipe();
+    void drain_parent();
+    void setup_affinity();
+    pid_t fork_child(int idx);
+    void on_child_exit(int idx, int stat);
+    bool start_child(int idx);
+    bool respawn_children();
+    bool scale_workers();
     void run_parent();
     void run_child(const vector<H>& arg);
 
@@ -52,11 +71,33 @@ private:
     static const int MAX_PROCESS_NUMBER = 16;       // 进程池允许的最大子进程数量
     static const int USER_PER_PROCESS = 65536;      // 每个子进程最多处理的客户端数量
     static const int MAX_EVENT_NUMBER = 10000;      // epoll最多监听的事件个数
-    int m_process_number;                           // 进程池中的进程总数
+    static const int DRAIN_TIMEOUT = 30;            // 默认排空时限(秒)
+    static const int DRAIN_GRACE = 5;               // 父进程在排空时限之外额外等待的时间(秒)
+    static const int RESPAWN_BACKOFF_MIN = 1;       // 子进程重启的初始退避时间(秒)
+    static const int RESPAWN_BACKOFF_MAX = 32;      // 子进程重启的最大退避时间(秒)
+    static const int STABLE_TIME = 60;              // 子进程运行超过该时间(秒)后视为稳定，清空异常退出计数
+    static const int CRASH_LOOP_LIMIT = 5;          // 连续异常退出达到该次数即视为崩溃循环
+    static const int QUARANTINE_TIME = 300;         // 崩溃循环的子进程被隔离的时间(秒)
+    static const int SCALE_INTERVAL = 5;            // 父进程评估是否伸缩的间隔(秒)
+    static const int SCALE_COOLDOWN = 30;           // 一次伸缩之后至少等待的时间(秒)
+    static const int SCALE_UP_LOAD = 75;            // 平均负荷高于该值时增加子进程
+    static const int SCALE_DOWN_LOAD = 25;          // 平均负荷低于该值时减少子进程
+    int m_process_number;                           // 进程池中已使用的槽位数
+    int m_min_process;                              // 动态伸缩时子进程数量的下限
+    int m_max_process;                              // 动态伸缩时子进程数量的上限
+    time_t m_next_scale;                            // 下一次评估伸缩的时间
     int m_idx;                                      // 子进程在进程池中的编号
     int m_epollfd;                                  // 内核事件表描述符
     int m_listenfd;                                 // 监听描述符
     int m_stop;                                     // 子进程通过m_stop决定是否停止
+    bool m_draining;                                // 是否处于排空状态
+    int m_drain_timeout;                            // 排空时限(秒)，超时后强制退出
+    time_t m_drain_deadline;                        // 排空截止时间
+    bool m_bind_cpu;                                // 是否将子进程绑定到固定的CPU
+    bool m_bind_mem;                                // 是否让子进程优先使用本地NUMA节点的内存
+    int m_cpu;                                      // 子进程绑定的CPU，未绑定为-1
+    int m_io_budget;                                // 每次读事件的读预算(字节)，小于0表示使用管理对象的默认值
+    int m_idle_timeout;                             // 会话空闲超时(毫秒)，不大于0表示不超时
     CProcess* m_sub_process;                        // 进程池
     static CProcesspool<C, H, M>* m_instance;       // 进程池静态实例
 };
@@ -64,7 +105,6 @@ private:
 template<typename C, typename H, typename M>
 CProcesspool<C, H, M>* CProcesspool<C, H, M>::m_instance = NULL;
 
-static int EPOLL_WAIT_TIME = 500;               // epoll_wait函数的超时值
 static int sig_pipdfd[2];                       // 传输信号的管道：用于统一事件源
 
 // 信号sig的信号处理函数
@@ -100,46 +140,95 @@ static void addsig(int sig, void(*handler)(int), bool restart = true)
  **************************************************************/ 
 template<typename C, typename H, typename M>
 CProcesspool<C, H, M>::CProcesspool(int listenfd, int process_number)
-    : m_listenfd(listenfd), m_process_number(process_number), m_idx(-1), m_stop(false)
+    : m_process_number(process_number), m_min_process(process_number), m_max_process(process_number), m_next_scale(0),
+      m_idx(-1), m_listenfd(listenfd), m_stop(false), m_draining(false), m_drain_timeout(DRAIN_TIMEOUT), m_drain_deadline(0),
+      m_bind_cpu(false), m_bind_mem(false), m_cpu(-1), m_io_budget(-1), m_idle_timeout(0)
 {
     assert((process_number > 0) && (process_number <= MAX_PROCESS_NUMBER));
 
-    m_sub_process = new CProcess[process_number];
+    // 子进程循环接受连接直到EAGAIN，监听描述符必须是非阻塞的(fork出的进程共享该标志)
+    setnonblocking(m_listenfd);
+
+    // 按最大数量分配槽位，动态伸缩时新的子进程使用空闲槽位
+    m_sub_process = new CProcess[MAX_PROCESS_NUMBER];
     assert(m_sub_process);
 
     // 创建process_number个子进程，并创建它们与父进程之间的管道
     for (int i = 0; i < process_number; i++)
     {
-        int ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_sub_process[i].m_pipefd);
-        assert(ret == 0);
-
-        m_sub_process[i].m_pid = fork();
-        assert(m_sub_process[i].m_pid >= 0);
+        pid_t pid = fork_child(i);
+        assert(pid >= 0);
 
-        if (m_sub_process[i].m_pid > 0)
+        if (pid == 0)
         {
-            close(m_sub_process[i].m_pipefd[1]);
-            m_sub_process[i].m_busy_ratio = 0;
-            continue;
+            break;
         }
-        else 
+    }
+}
+
+/**************************************************************
+ * 函数名称：CProcesspool<C, H, M>::fork_child
+ * 函数功能：创建第idx个子进程及其与父进程之间的管道，并初始化其在进程池中的槽位
+ * 输入参数：int idx                子进程在进程池中的编号
+ * 输出参数：无
+ * 返 回 值：父进程中返回子进程PID，子进程中返回0，失败返回-1
+ **************************************************************/
+template<typename C, typename H, typename M>
+pid_t CProcesspool<C, H, M>::fork_child(int idx)
+{
+    CProcess& child = m_sub_process[idx];
+    if (socketpair(PF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, child.m_pipefd) != 0)
+    {
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(child.m_pipefd[0]);
+        close(child.m_pipefd[1]);
+        return -1;
+    }
+
+    if (pid > 0)
+    {
+        close(child.m_pipefd[1]);
+        child.m_pid = pid;
+        child.m_busy_ratio = 0;
+        child.m_draining = false;
+        child.m_start_time = Cclock::now_sec();
+        child.m_respawn_at = 0;
+        return pid;
+    }
+
+    // 子进程只保留自己的管道，关闭从父进程继承的其他子进程的管道
+    close(child.m_pipefd[0]);
+    for (int i = 0; i < m_process_number; i++)
+    {
+        if ((i != idx) && (m_sub_process[i].m_pid != -1))
         {
             close(m_sub_process[i].m_pipefd[0]);
-            m_idx = i;
-            break;
         }
     }
+
+    m_idx = idx;
+    return 0;
 }
 
-// 选取负荷最小的线程
+// 选取负荷最小的线程(跳过已经退出或者正在排空的子进程)，没有可用子进程时返回-1
 template<typename C, typename H, typename M>
 int CProcesspool<C, H, M>::get_most_free_srv()
 {
-    int ratio = m_sub_process[0].m_busy_ratio;
-    int idx = 0;
+    int ratio = 0;
+    int idx = -1;
     for (int i = 0; i < m_process_number; i++)
     {
-        if (m_sub_process[i].m_busy_ratio < ratio)
+        if ((m_sub_process[i].m_pid == -1) || m_sub_process[i].m_draining)
+        {
+            continue;
+        }
+
+        if ((idx == -1) || (m_sub_process[i].m_busy_ratio < ratio))
         {
             idx = i;
             ratio = m_sub_process[i].m_busy_ratio;
@@ -149,22 +238,18 @@ int CProcesspool<C, H, M>::get_most_free_srv()
     return idx;
 }
 
-// 统一事件源
+// 统一事件源。父进程把信号管道注册到内核事件表；子进程在每轮事件循环中读取它，
+// 阻塞在epoll_wait上时到来的信号会使epoll_wait返回EINTR
 template<typename C, typename H, typename M>
 void CProcesspool<C, H, M>::setup_sig_pipe()
 {
-    m_epollfd = epoll_create(5);
-    assert(m_epollfd != -1);
-
-    int ret = socketpair(PF_UNIX, SOCK_STREAM, 0, sig_pipdfd);
+    int ret = socketpair(PF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sig_pipdfd);
     assert(ret != -1);
 
-    setnonblocking(sig_pipdfd[1]);
-    add_read_fd(m_epollfd, sig_pipdfd[0]);
-
     addsig(SIGCHLD, sig_handler);
     addsig(SIGTERM, sig_handler);
     addsig(SIGINT, sig_handler);
+    addsig(SIGUSR1, sig_handler);
     addsig(SIGPIPE, SIG_IGN);
 }
 
@@ -172,20 +257,245 @@ void CProcesspool<C, H, M>::setup_sig_pipe()
 template<typename C, typename H, typename M>
 void CProcesspool<C, H, M>::run(const vector<H>&arg)
 {
-    if (m_idx != -1)
+    if (m_idx == -1)
+    {
+        run_parent();
+
+        // 父进程重新拉起的子进程从run_parent返回，继续运行子进程的逻辑
+        if (m_idx == -1)
+        {
+            return ;
+        }
+    }
+
+    run_child(arg);
+}
+
+/**************************************************************
+ * 函数名称：CProcesspool<C, H, M>::on_child_exit
+ * 函数功能：记录第idx个子进程的退出。非排空阶段的退出视为崩溃，按指数退避
+ *          安排重启；连续崩溃达到CRASH_LOOP_LIMIT次的子进程被隔离一段时间，
+ *          使某条连接路径上的缺陷只会短暂地占用一个槽位
+ * 输入参数：int idx                子进程在进程池中的编号
+ *          int stat               waitpid返回的退出状态
+ * 输出参数：无
+ * 返 回 值：无
+ **************************************************************/
+template<typename C, typename H, typename M>
+void CProcesspool<C, H, M>::on_child_exit(int idx, int stat)
+{
+    CProcess& child = m_sub_process[idx];
+    removefd(m_epollfd, child.m_pipefd[0]);
+    child.m_pid = -1;
+
+    if (child.m_draining || m_draining)
+    {
+        printf("child %d join, drained with %d conns left\n", idx, child.m_busy_ratio);
+        return;
+    }
+
+    if (WIFSIGNALED(stat))
+    {
+        printf("child %d killed by signal %d\n", idx, WTERMSIG(stat));
+    }
+    else 
+    {
+        printf("child %d exit with status %d\n", idx, WEXITSTATUS(stat));
+    }
+
+    time_t now = Cclock::now_sec();
+    if (now - child.m_start_time >= STABLE_TIME)
+    {
+        child.m_crash_cnt = 0;
+        child.m_backoff = 0;
+    }
+
+    child.m_crash_cnt++;
+    if (child.m_crash_cnt >= CRASH_LOOP_LIMIT)
+    {
+        printf("child %d crashed %d times in a row, quarantine it for %ds\n", idx, child.m_crash_cnt, QUARANTINE_TIME);
+        child.m_respawn_at = now + QUARANTINE_TIME;
+        child.m_backoff = RESPAWN_BACKOFF_MAX;
+        return;
+    }
+
+    if (child.m_backoff == 0)
+    {
+        child.m_backoff = RESPAWN_BACKOFF_MIN;
+    }
+    else if (child.m_backoff < RESPAWN_BACKOFF_MAX)
+    {
+        child.m_backoff *= 2;
+    }
+
+    printf("respawn child %d in %ds\n", idx, child.m_backoff);
+    child.m_respawn_at = now + child.m_backoff;
+}
+
+/**************************************************************
+ * 函数名称：CProcesspool<C, H, M>::start_child
+ * 函数功能：在父进程运行期间创建第idx个子进程(重启或者扩容)，并为其重建管道和槽位
+ * 输入参数：int idx                子进程在进程池中的编号
+ * 输出参数：无
+ * 返 回 值：在新创建的子进程中返回true，父进程中返回false
+ **************************************************************/
+template<typename C, typename H, typename M>
+bool CProcesspool<C, H, M>::start_child(int idx)
+{
+    CProcess& child = m_sub_process[idx];
+    pid_t pid = fork_child(idx);
+    if (pid < 0)
+    {
+        printf("start child %d failed, errno is %d\n", idx, errno);
+        child.m_respawn_at = Cclock::now_sec() + RESPAWN_BACKOFF_MIN;
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        // 新的子进程不需要父进程的内核事件表和信号管道，run_child会重新创建
+        close(m_epollfd);
+        close(sig_pipdfd[0]);
+        close(sig_pipdfd[1]);
+        m_stop = false;
+        return true;
+    }
+
+    printf("child %d started as pid %d\n", idx, pid);
+    add_read_fd(m_epollfd, child.m_pipefd[0]);
+    return false;
+}
+
+// 重新拉起到期的异常退出的子进程。在新创建的子进程中返回true
+template<typename C, typename H, typename M>
+bool CProcesspool<C, H, M>::respawn_children()
+{
+    if (m_draining)
     {
-        run_child(arg);
-        return ;
+        return false;
+    }
+
+    time_t now = Cclock::now_sec();
+    for (int i = 0; i < m_process_number; i++)
+    {
+        CProcess& child = m_sub_process[i];
+        if ((child.m_pid != -1) || (child.m_respawn_at == 0) || (now < child.m_respawn_at))
+        {
+            continue;
+        }
+
+        if (start_child(i))
+        {
+            return true;
+        }
     }
 
-    run_parent();
+    return false;
+}
+
+// 设置子进程数量的伸缩范围，max_process大于min_process时启用动态伸缩
+template<typename C, typename H, typename M>
+void CProcesspool<C, H, M>::set_scaling(int min_process, int max_process)
+{
+    assert((min_process > 0) && (min_process <= max_process) && (max_process <= MAX_PROCESS_NUMBER));
+    m_min_process = min_process;
+    m_max_process = max_process;
+}
+
+/**************************************************************
+ * 函数名称：CProcesspool<C, H, M>::scale_workers
+ * 函数功能：根据子进程上报的负载动态伸缩子进程数量。每个子进程的负荷取事件
+ *          循环利用率和连接利用率中的较大者，平均负荷高于SCALE_UP_LOAD时
+ *          增加一个子进程，低于SCALE_DOWN_LOAD时让连接最少的子进程排空退出。
+ *          每次伸缩后等待SCALE_COOLDOWN秒，避免负载抖动时反复伸缩
+ * 输入参数：无
+ * 输出参数：无
+ * 返 回 值：在新创建的子进程中返回true，父进程中返回false
+ **************************************************************/
+template<typename C, typename H, typename M>
+bool CProcesspool<C, H, M>::scale_workers()
+{
+    time_t now = Cclock::now_sec();
+    if (m_draining || (m_max_process <= m_min_process) || (now < m_next_scale))
+    {
+        return false;
+    }
+
+    m_next_scale = now + SCALE_INTERVAL;
+
+    int active = 0;
+    int total_load = 0;
+    int victim = -1;
+    int free_slot = -1;
+    for (int i = 0; i < MAX_PROCESS_NUMBER; i++)
+    {
+        CProcess& child = m_sub_process[i];
+        if (child.m_pid == -1)
+        {
+            // 等待重启的槽位仍然属于在役的子进程
+            if ((child.m_respawn_at == 0) && (free_slot == -1))
+            {
+                free_slot = i;
+            }
+
+            continue;
+        }
+
+        if (child.m_draining)
+        {
+            continue;
+        }
+
+        active++;
+        // 连接池为空时只看事件循环利用率，后端不可用不应该触发扩容
+        int conn_util = (child.m_conn_util == CONN_UTIL_NONE) ? 0 : child.m_conn_util;
+        total_load += (child.m_loop_util > conn_util) ? child.m_loop_util : conn_util;
+        if ((victim == -1) || (child.m_busy_ratio < m_sub_process[victim].m_busy_ratio))
+        {
+            victim = i;
+        }
+    }
+
+    if (active == 0)
+    {
+        return false;
+    }
+
+    int avg_load = total_load / active;
+    if ((avg_load >= SCALE_UP_LOAD) && (active < m_max_process) && (free_slot != -1))
+    {
+        printf("average load %d%% over %d children, scale up\n", avg_load, active);
+        m_next_scale = now + SCALE_COOLDOWN;
+        if (free_slot >= m_process_number)
+        {
+            m_process_number = free_slot + 1;
+        }
+
+        m_sub_process[free_slot].m_crash_cnt = 0;
+        m_sub_process[free_slot].m_backoff = 0;
+        return start_child(free_slot);
+    }
+
+    if ((avg_load <= SCALE_DOWN_LOAD) && (active > m_min_process))
+    {
+        printf("average load %d%% over %d children, retire child %d\n", avg_load, active, victim);
+        m_next_scale = now + SCALE_COOLDOWN;
+        m_sub_process[victim].m_draining = true;
+        kill(m_sub_process[victim].m_pid, SIGTERM);
+    }
+
+    return false;
 }
 
 // 运行父进程
 template<typename C, typename H, typename M>
 void CProcesspool<C, H, M>::run_parent()
 {
+    m_epollfd = epoll_create(5);
+    assert(m_epollfd != -1);
+
     setup_sig_pipe();
+    add_read_fd(m_epollfd, sig_pipdfd[0]);
 
     for (int i = 0; i < m_process_number; i++)
     {
@@ -196,7 +506,7 @@ void CProcesspool<C, H, M>::run_parent()
 
     struct epoll_event events[MAX_EVENT_NUMBER];
     int sub_process_counter = 0;
-    int new_conn = 1;
+    int new_conn = CWorker<C, H, M>::CMD_NEW_CONN;
     int number = 0;
     int ret = -1;
 
@@ -209,6 +519,28 @@ void CProcesspool<C, H, M>::run_parent()
             break;
         }
 
+        Cclock::update();
+
+        // 排空超时：强制杀死仍未退出的子进程
+        if (m_draining && (Cclock::now_sec() >= m_drain_deadline))
+        {
+            for (int i = 0; i < m_process_number; i++)
+            {
+                if (m_sub_process[i].m_pid != -1)
+                {
+                    printf("child %d drain timeout with %d conns left, kill it\n", i, m_sub_process[i].m_busy_ratio);
+                    kill(m_sub_process[i].m_pid, SIGKILL);
+                }
+            }
+
+            m_drain_deadline = Cclock::now_sec() + DRAIN_GRACE;
+        }
+
+        if (respawn_children() || scale_workers())
+        {
+            return;
+        }
+
         for (int i = 0; i < number; i++)
         {
             int sockfd = events[i].data.fd;
@@ -216,6 +548,11 @@ void CProcesspool<C, H, M>::run_parent()
             {
                 // 新连接到来：选择负荷最小的线程来处理新到连接
                 int idx = get_most_free_srv();
+                if (idx < 0)
+                {
+                    continue;
+                }
+
                 send(m_sub_process[idx].m_pipefd[0], (char*)&new_conn, sizeof(new_conn), 0);
             }
             // 处理父进程接收到的信号
@@ -239,24 +576,22 @@ void CProcesspool<C, H, M>::run_parent()
                             {
                                 pid_t pid;
                                 int stat;
-                                while ((pid == waitpid(-1, &stat, WNOHANG)) > 0)
+                                while ((pid = waitpid(-1, &stat, WNOHANG)) > 0)
                                 {
                                     for (int i = 0; i < m_process_number; i++)
                                     {
                                         if (m_sub_process[i].m_pid == pid)
                                         {
-                                            printf("child %d join\n", i);
-                                            close(m_sub_process[i].m_pipefd[0]);
-                                            m_sub_process[i].m_pid = -1;;
+                                            on_child_exit(i, stat);
                                         }
                                     }
                                 }
 
-                                // 判断是否所有子进程退出
+                                // 判断是否所有子进程退出且不再需要重启
                                 m_stop = true;
                                 for (int i = 0; i < m_process_number; i++)
                                 {
-                                    if (m_sub_process[i].m_pid  != -1)
+                                    if ((m_sub_process[i].m_pid  != -1) || (!m_draining && (m_sub_process[i].m_respawn_at != 0)))
                                     {
                                         m_stop = false;
                                     }
@@ -268,14 +603,18 @@ void CProcesspool<C, H, M>::run_parent()
                             case SIGTERM:
                             case SIGINT:
                             {
-                                // 父进程接收到终止信号，则杀死所有子进程
-                                printf("kill all the child now\n");
+                                drain_parent();
+                                break;
+                            }
+
+                            // 让所有子进程打印统计信息
+                            case SIGUSR1:
+                            {
                                 for (int i = 0; i < m_process_number; i++)
                                 {
-                                    int pid = m_sub_process[i].m_pid;
-                                    if (pid != -1)
+                                    if (m_sub_process[i].m_pid != -1)
                                     {
-                                        kill(pid, SIGTERM);
+                                        kill(m_sub_process[i].m_pid, SIGUSR1);
                                     }
                                 }
 
@@ -292,9 +631,15 @@ void CProcesspool<C, H, M>::run_parent()
             }
             else if (events[i].events & EPOLLIN)
             {
-                int busy_ratio = 0;
-                ret = recv(sockfd, (char*)&busy_ratio, sizeof(busy_ratio), 0);
-                if (((ret < 0) && (errno != EAGAIN)) || ret == 0)
+                // 子进程可能连续上报多次，只保留最新的值
+                CLoad load;
+                bool got = false;
+                while ((ret = recv(sockfd, (char*)&load, sizeof(load), 0)) == sizeof(load))
+                {
+                    got = true;
+                }
+
+                if (!got)
                 {
                     continue;
                 }
@@ -303,7 +648,14 @@ void CProcesspool<C, H, M>::run_parent()
                 {
                     if (sockfd == m_sub_process[i].m_pipefd[0])
                     {
-                        m_sub_process[i].m_busy_ratio = busy_ratio;
+                        if (m_sub_process[i].m_draining && (m_sub_process[i].m_busy_ratio != load.m_conns))
+                        {
+                            printf("child %d draining, %d conns left\n", i, load.m_conns);
+                        }
+
+                        m_sub_process[i].m_busy_ratio = load.m_conns;
+                        m_sub_process[i].m_loop_util = load.m_loop_util;
+                        m_sub_process[i].m_conn_util = load.m_conn_util;
                         break;
                     }
                 }
@@ -315,172 +667,151 @@ void CProcesspool<C, H, M>::run_parent()
 
     for (int i = 0; i < m_process_number; i++)
     {
-        closefd(m_epollfd, m_sub_process[i].m_pipefd[0]);
+        if (m_sub_process[i].m_pid != -1)
+        {
+            closefd(m_epollfd, m_sub_process[i].m_pipefd[0]);
+        }
     }
 
     close(m_epollfd);
 }
 
-// 运行子进程
+/**************************************************************
+ * 函数名称：CProcesspool<C, H, M>::drain_parent
+ * 函数功能：父进程进入排空状态。停止分发新连接，通知所有子进程排空，
+ *          子进程超过排空时限仍未退出时由父进程强制杀死。
+ *          排空过程中再次收到终止信号则立即杀死所有子进程
+ * 输入参数：无
+ * 输出参数：无
+ * 返 回 值：无
+ **************************************************************/
 template<typename C, typename H, typename M>
-void CProcesspool<C, H, M>::run_child(const vector<H>&arg)
+void CProcesspool<C, H, M>::drain_parent()
 {
-    setup_sig_pipe();
-
-    int pipefd_read = m_sub_process[m_idx].m_pipefd[1];
-    add_read_fd(m_epollfd, pipefd_read);
+    int sig = SIGTERM;
+    if (m_draining)
+    {
+        printf("kill all the child now\n");
+        sig = SIGKILL;
+    }
+    else 
+    {
+        printf("drain all the child now, timeout %ds\n", m_drain_timeout);
+        m_draining = true;
+        m_drain_deadline = Cclock::now_sec() + m_drain_timeout + DRAIN_GRACE;
+        closefd(m_epollfd, m_listenfd);
+    }
 
-    struct epoll_event events[MAX_EVENT_NUMBER];
+    for (int i = 0; i < m_process_number; i++)
+    {
+        int pid = m_sub_process[i].m_pid;
+        if (pid != -1)
+        {
+            m_sub_process[i].m_draining = true;
+            kill(pid, sig);
+        }
+    }
+}
 
-    M* manager = new M(m_epollfd, arg[m_idx]);
-    assert(manager);
+/**************************************************************
+ * 函数名称：CProcesspool<C, H, M>::setup_affinity
+ * 函数功能：将子进程绑定到第m_idx个CPU，并让其内存优先分配在该CPU所在的
+ *          NUMA节点上。必须在创建管理对象之前调用，这样连接缓冲区才会
+ *          分配在本地节点
+ * 输入参数：无
+ * 输出参数：无
+ * 返 回 值：无
+ **************************************************************/
+template<typename C, typename H, typename M>
+void CProcesspool<C, H, M>::setup_affinity()
+{
+    if (!m_bind_cpu)
+    {
+        return;
+    }
 
-    int number = 0;
-    int ret = -1;
+    m_cpu = bind_cpu(m_idx);
+    if (m_cpu < 0)
+    {
+        printf("child %d bind cpu failed, errno is %d\n", m_idx, errno);
+        return;
+    }
 
-    while (!m_stop)
+    if (m_bind_mem && !bind_local_mem(m_cpu))
     {
-        number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, EPOLL_WAIT_TIME);
-        if ((number < 0) && (errno != EINTR))
-        {
-            printf("epoll failed\n");
-            break;
-        }
+        printf("child %d bind memory to node %d failed, errno is %d\n", m_idx, cpu_node(m_cpu), errno);
+    }
 
-        if (number == 0)
-        {
-            manager->recycle_conns();
-            continue;
-        }
+    printf("child %d bound to cpu %d, node %d\n", m_idx, m_cpu, cpu_node(m_cpu));
+}
 
-        for (int i = 0; i < number; i++)
-        {
-            int sockfd = events[i].data.fd;
-            if ((sockfd == pipefd_read) && (events[i].events & EPOLLIN))
-            {
-                int client;
-                ret = recv(sockfd, (char*)&client, sizeof(client), 0);
-                if (((ret < 0) && (errno != EAGAIN)) || ret == 0)
-                {
-                    continue;
-                }
-                else 
-                {
-                    struct sockaddr_in clnt_addr;
-                    socklen_t clnt_addr_len = sizeof(clnt_addr);
-                    int connfd = accept(m_listenfd, (struct sockaddr*)&clnt_addr, &clnt_addr_len);
-                    if (connfd < 0)
-                    {
-                        printf("errno is %d\n", errno);
-                        continue;
-                    }
+// 运行子进程：事件循环由CWorker运行，子进程只负责信号
+template<typename C, typename H, typename M>
+void CProcesspool<C, H, M>::run_child(const vector<H>&arg)
+{
+    setup_sig_pipe();
+    setup_affinity();
 
-                    add_read_fd(m_epollfd, connfd);
+    int pipefd = m_sub_process[m_idx].m_pipefd[1];
+    CWorker<C, H, M> worker("child", m_idx, pipefd, m_listenfd);
+    worker.set_drain_timeout(m_drain_timeout);
+    worker.set_io_budget(m_io_budget);
+    worker.set_idle_timeout(m_idle_timeout);
+    worker.set_cpu(m_cpu);
 
-                    C* conn = manager->pick_conn(connfd);
-                    if (!conn)
-                    {
-                        closefd(m_epollfd, connfd);
-                        continue;
-                    }
+    // 动态扩容时子进程数量可能多于逻辑服务器数量，按编号轮流分配
+    worker.run(arg[m_idx % arg.size()], on_child_signals, this);
 
-                    conn->init_clt(connfd, clnt_addr);
-                    notify_parent_busy_ratio(pipefd_read, manager);
-                }
-            }
-            else if ((sockfd == sig_pipdfd[0]) && (events[i].events & EPOLLIN))
+    close(pipefd);
+    close(sig_pipdfd[0]);
+    close(sig_pipdfd[1]);
+}
+
+// 处理子进程收到的信号：终止信号使子进程进入排空状态，重复的终止信号被忽略(终端Ctrl+C会同时
+// 发给父子进程)，强制退出由父进程的SIGKILL完成；SIGUSR1打印统计信息
+template<typename C, typename H, typename M>
+bool CProcesspool<C, H, M>::on_child_signals(void* owner, CWorker<C, H, M>* worker)
+{
+    CProcesspool<C, H, M>* pool = static_cast<CProcesspool<C, H, M>*>(owner);
+    char signals[1024];
+    int ret = recv(sig_pipdfd[0], signals, sizeof(signals), 0);
+    for (int i = 0; i < ret; i++)
+    {
+        switch (signals[i])
+        {
+            case SIGCHLD:
             {
-                int sig;
-                char signals[1024];
-                ret = recv(sig_pipdfd[0], signals, sizeof(signals), 0);
-                if (ret <= 0)
+                pid_t pid;
+                int stat;
+                while ((pid = waitpid(-1, &stat, WNOHANG)) > 0)
                 {
                     continue;
                 }
-                else 
-                {
-                    for (int i = 0; i < ret; i++)
-                    {
-                        switch (signals[i])
-                        {
-                            case SIGCHLD:
-                            {
-                                pid_t pid;
-                                int stat;
-                                while ((pid = waitpid(-1, &stat, WNOHANG)) > 0)
-                                {
-                                    continue;
-                                }
 
-                                break;
-                            }
-
-                            case SIGTERM:
-                            case SIGINT:
-                            {
-                                m_stop = true;
-                                break;
-                            }
-                            
-                            default:
-                            {
-                                break;
-                            }
-                        }
-                    }
-                }
+                break;
             }
-            else if (events[i].events & EPOLLIN)
-            {
-                RET_CODE result = manager->process(sockfd, READ);
-                switch (result)
-                {
-                    case CLOSED:
-                    {
-                        notify_parent_busy_ratio(pipefd_read, manager);
-                        break;
-                    }
 
-                    default:
-                    {
-                        break;
-                    }
-                }
-            }
-            else if (events[i].events & EPOLLOUT)
+            case SIGTERM:
+            case SIGINT:
             {
-                RET_CODE result = manager->process(sockfd, WRITE);
-                switch (result)
-                {
-                    case CLOSED:
-                    {
-                        notify_parent_busy_ratio(pipefd_read, manager);
-                        break;
-                    }
+                worker->drain();
+                break;
+            }
 
-                    default:
-                    {
-                        break;
-                    }
-                }
+            case SIGUSR1:
+            {
+                worker->get_manager()->print_stats("child", pool->m_idx);
+                break;
             }
-            else 
+
+            default:
             {
-                continue;
+                break;
             }
         }
     }
 
-    close(pipefd_read);
-    close(m_epollfd);
-}
-
-// 报告父进程繁忙程度
-template<typename C, typename H, typename M>
-void CProcesspool<C, H, M>::notify_parent_busy_ratio(int pipefd, M* manager)
-{
-    int msg = manager->get_used_conn_cnt();
-    send(pipefd, (char*)&msg, 1, 0);
+    return false;
 }
 
 #endif
@@ -0,0 +1,177 @@
+/*********************************************************************************
+ * File Name: proxyproto.cpp
+ * Description: PROXY协议v1/v2头部的生成与解析
+ * History: 
+ *********************************************************************************/
+
+#include "proxyproto.h"
+
+// v2头部的签名
+static const char V2_SIG[12] = {'\r', '\n', '\r', '\n', '\0', '\r', '\n', 'Q', 'U', 'I', 'T', '\n'};
+static const char V1_SIG[6] = {'P', 'R', 'O', 'X', 'Y', ' '};
+
+static const int V2_HDR_LEN = 16;           // 签名、版本和命令、地址族、地址长度
+static const int V2_CMD_LOCAL = 0x20;
+static const int V2_CMD_PROXY = 0x21;
+static const int V2_TCP4 = 0x11;
+static const int V2_TCP4_LEN = 12;          // 源地址、目的地址、源端口、目的端口
+
+/**************************************************************
+ * 函数名称：proxy_build
+ * 函数功能：生成PROXY协议头部。v1为"PROXY TCP4 源地址 目的地址
+ *          源端口 目的端口\r\n"，v2为16字节的固定部分加上12字节的
+ *          IPv4地址，地址和端口都是网络字节序
+ * 输入参数：version    PROXY_V1或PROXY_V2
+ *           src        原始客户端地址
+ *           dst        客户端连接的目的地址
+ * 输出参数：buf        头部，至少PROXY_HDR_MAX字节
+ * 返 回 值：头部长度
+ **************************************************************/
+int proxy_build(PROXY_VERSION version, const sockaddr_in& src, const sockaddr_in& dst, char* buf)
+{
+    if (version == PROXY_V1)
+    {
+        char src_ip[INET_ADDRSTRLEN];
+        char dst_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &src.sin_addr, src_ip, sizeof(src_ip));
+        inet_ntop(AF_INET, &dst.sin_addr, dst_ip, sizeof(dst_ip));
+        return snprintf(buf, PROXY_HDR_MAX, "PROXY TCP4 %s %s %d %d\r\n",
+                        src_ip, dst_ip, ntohs(src.sin_port), ntohs(dst.sin_port));
+    }
+
+    memcpy(buf, V2_SIG, sizeof(V2_SIG));
+    buf[12] = V2_CMD_PROXY;
+    buf[13] = V2_TCP4;
+    buf[14] = 0;
+    buf[15] = V2_TCP4_LEN;
+    memcpy(buf + 16, &src.sin_addr, 4);
+    memcpy(buf + 20, &dst.sin_addr, 4);
+    memcpy(buf + 24, &src.sin_port, 2);
+    memcpy(buf + 26, &dst.sin_port, 2);
+    return V2_HDR_LEN + V2_TCP4_LEN;
+}
+
+// 解析v1头部：TCP4时取出地址，TCP6和UNKNOWN只跳过
+static int parse_v1(const char* buf, int len, sockaddr_in& src, sockaddr_in& dst, bool& has_addr)
+{
+    const char* end = (const char*)memchr(buf, '\n', (len < PROXY_V1_MAX) ? len : PROXY_V1_MAX);
+    if (!end)
+    {
+        return (len < PROXY_V1_MAX) ? 0 : -1;
+    }
+
+    if ((end == buf) || (end[-1] != '\r'))
+    {
+        return -1;
+    }
+
+    char line[PROXY_V1_MAX + 1];
+    int line_len = end - 1 - buf;
+    memcpy(line, buf, line_len);
+    line[line_len] = '\0';
+
+    has_addr = false;
+    if (strncmp(line + sizeof(V1_SIG), "TCP4 ", 5) == 0)
+    {
+        char src_ip[INET_ADDRSTRLEN];
+        char dst_ip[INET_ADDRSTRLEN];
+        int src_port = 0;
+        int dst_port = 0;
+        if ((sscanf(line + sizeof(V1_SIG) + 5, "%15s %15s %d %d", src_ip, dst_ip, &src_port, &dst_port) != 4)
+            || (inet_pton(AF_INET, src_ip, &src.sin_addr) != 1) || (inet_pton(AF_INET, dst_ip, &dst.sin_addr) != 1)
+            || (src_port <= 0) || (src_port > 65535) || (dst_port <= 0) || (dst_port > 65535))
+        {
+            return -1;
+        }
+
+        src.sin_family = dst.sin_family = AF_INET;
+        src.sin_port = htons(src_port);
+        dst.sin_port = htons(dst_port);
+        has_addr = true;
+    }
+    else if ((strncmp(line + sizeof(V1_SIG), "TCP6 ", 5) != 0) && (strncmp(line + sizeof(V1_SIG), "UNKNOWN", 7) != 0))
+    {
+        return -1;
+    }
+
+    return end + 1 - buf;
+}
+
+// 解析v2头部：只有PROXY命令的TCP/IPv4地址被取出，其余地址族和TLV扩展直接跳过
+static int parse_v2(const char* buf, int len, sockaddr_in& src, sockaddr_in& dst, bool& has_addr)
+{
+    if (len < V2_HDR_LEN)
+    {
+        return 0;
+    }
+
+    unsigned char cmd = buf[12];
+    unsigned char fam = buf[13];
+    int addr_len = ((unsigned char)buf[14] << 8) | (unsigned char)buf[15];
+    if ((cmd != V2_CMD_LOCAL) && (cmd != V2_CMD_PROXY))
+    {
+        return -1;
+    }
+
+    if (len < V2_HDR_LEN + addr_len)
+    {
+        return 0;
+    }
+
+    has_addr = false;
+    if ((cmd == V2_CMD_PROXY) && (fam == V2_TCP4))
+    {
+        if (addr_len < V2_TCP4_LEN)
+        {
+            return -1;
+        }
+
+        src.sin_family = dst.sin_family = AF_INET;
+        memcpy(&src.sin_addr, buf + 16, 4);
+        memcpy(&dst.sin_addr, buf + 20, 4);
+        memcpy(&src.sin_port, buf + 24, 2);
+        memcpy(&dst.sin_port, buf + 26, 2);
+        has_addr = true;
+    }
+
+    return V2_HDR_LEN + addr_len;
+}
+
+/**************************************************************
+ * 函数名称：proxy_parse
+ * 函数功能：解析连接开头的PROXY协议头部，按签名区分v1和v2。
+ *          签名还没有收全时只比较已经到达的部分
+ * 输入参数：buf        连接上最先收到的数据
+ *           len        数据长度
+ * 输出参数：src        原始客户端地址
+ *           dst        原始连接的目的地址
+ *           has_addr   头部是否携带了IPv4地址
+ * 返 回 值：头部长度，数据不完整返回0，不是PROXY协议头部或格式错误返回-1
+ **************************************************************/
+int proxy_parse(const char* buf, int len, sockaddr_in& src, sockaddr_in& dst, bool& has_addr)
+{
+    has_addr = false;
+    if (len <= 0)
+    {
+        return 0;
+    }
+
+    if (buf[0] == V1_SIG[0])
+    {
+        int n = (len < (int)sizeof(V1_SIG)) ? len : (int)sizeof(V1_SIG);
+        if (memcmp(buf, V1_SIG, n) != 0)
+        {
+            return -1;
+        }
+
+        return (len < (int)sizeof(V1_SIG)) ? 0 : parse_v1(buf, len, src, dst, has_addr);
+    }
+
+    int n = (len < (int)sizeof(V2_SIG)) ? len : (int)sizeof(V2_SIG);
+    if (memcmp(buf, V2_SIG, n) != 0)
+    {
+        return -1;
+    }
+
+    return parse_v2(buf, len, src, dst, has_addr);
+}
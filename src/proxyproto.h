@@ -0,0 +1,27 @@
+#ifndef __PROXYPROTO_H_
+#define __PROXYPROTO_H_
+
+// PROXY协议(HAProxy定义)：在连接开头附带原始客户端的地址。v1是一行文本，
+// v2是二进制格式。springsnail可以在转发给服务端的数据前加上该头部，
+// 也可以在位于另一个四层负载均衡器之后时解析客户端连接上的该头部
+#include "global.h"
+
+enum PROXY_VERSION
+{
+    PROXY_NONE = 0,
+    PROXY_V1 = 1,
+    PROXY_V2 = 2
+};
+
+static const int PROXY_V1_MAX = 107;        // v1头部的最大长度(包括\r\n)
+static const int PROXY_HDR_MAX = 108;       // 本地生成的头部的最大长度
+
+// 生成描述src到dst连接的头部，返回头部长度
+int proxy_build(PROXY_VERSION version, const sockaddr_in& src, const sockaddr_in& dst, char* buf);
+
+// 解析连接开头的头部(自动识别v1和v2)。has_addr为false表示头部没有携带IPv4地址
+// (LOCAL命令、UNKNOWN或其他地址族)，此时应使用连接本身的地址。
+// 返回头部长度，数据不完整返回0，格式错误返回-1
+int proxy_parse(const char* buf, int len, sockaddr_in& src, sockaddr_in& dst, bool& has_addr);
+
+#endif
@@ -0,0 +1,357 @@
+/*********************************************************************************
+ * File Name: respcache.cpp
+ * Description: 七层代理的共享内存应答缓存
+ * History: 
+ *********************************************************************************/
+
+#include <new>
+#include "respcache.h"
+#include "clock.h"
+
+// 记录按8字节对齐
+static int align_len(int len)
+{
+    return (len + 7) & ~7;
+}
+
+/**************************************************************
+ * 函数名称：Crespcache::create
+ * 函数功能：创建共享内存中的缓存，必须在创建进程池之前调用，
+ *          fork出的工作进程继承同一块映射。映射在进程退出时释放
+ * 输入参数：size   共享内存的总字节数，包括索引和数据区
+ * 输出参数：无
+ * 返 回 值：内存太小或者映射失败时返回NULL
+ **************************************************************/
+Crespcache* Crespcache::create(long long size)
+{
+    int slot_cnt = 1024;
+    while ((long long)slot_cnt * 1024 < size)
+    {
+        slot_cnt *= 2;
+    }
+
+    long long slot_off = (sizeof(Crespcache) + 63) & ~63LL;
+    long long data_off = slot_off + slot_cnt * sizeof(Cslot);
+    if (size < data_off + 64 * 1024)
+    {
+        return NULL;
+    }
+
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    Crespcache* cache = (Crespcache*)mem;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    int ret = pthread_mutex_init(&cache->m_mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (ret != 0)
+    {
+        munmap(mem, size);
+        return NULL;
+    }
+
+    cache->m_slot_off = slot_off;
+    cache->m_slot_cnt = slot_cnt;
+    cache->m_data_off = data_off;
+    cache->m_data_size = (size - data_off) & ~7LL;
+    cache->m_max_object = (cache->m_data_size / 4 < MAX_OBJECT) ? (int)(cache->m_data_size / 4) : MAX_OBJECT;
+    memset(&cache->m_stats, 0, sizeof(cache->m_stats));
+    cache->clear();
+    return cache;
+}
+
+// 读取事件循环本轮缓存的时间，查找和插入时不再读时钟
+long long Crespcache::now_ms()
+{
+    return Cclock::now_ms();
+}
+
+// FNV-1a
+unsigned long long Crespcache::hash(const char* key, int key_len)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    for (int i = 0; i < key_len; i++)
+    {
+        h = (h ^ (unsigned char)key[i]) * 1099511628211ULL;
+    }
+
+    return h;
+}
+
+void Crespcache::lock()
+{
+    if (pthread_mutex_lock(&m_mutex) == EOWNERDEAD)
+    {
+        // 持有锁的进程在修改缓存的过程中退出了，索引和数据区可能不一致，整个清空
+        clear();
+        pthread_mutex_consistent(&m_mutex);
+    }
+}
+
+void Crespcache::clear()
+{
+    Cslot* table = slots();
+    for (int i = 0; i < m_slot_cnt; i++)
+    {
+        table[i].m_off = -1;
+    }
+
+    m_head = m_tail = m_used = 0;
+    m_end = m_data_size;
+    m_stats.m_entries = 0;
+}
+
+// 在索引中查找键，返回索引项下标，没有时返回-1
+int Crespcache::find(unsigned long long h, const char* key, int key_len)
+{
+    Cslot* table = slots();
+    int mask = m_slot_cnt - 1;
+    for (int i = h & mask, n = 0; n < m_slot_cnt; i = (i + 1) & mask, n++)
+    {
+        if (table[i].m_off < 0)
+        {
+            return -1;
+        }
+
+        Crecord* rec = record(table[i].m_off);
+        if ((table[i].m_hash == h) && (rec->m_key_len == key_len) && (memcmp(rec + 1, key, key_len) == 0))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// 删除索引项，把探测序列上的后继项前移填补空位，保证查找时遇到空闲项即可停止
+void Crespcache::remove_slot(int idx)
+{
+    Cslot* table = slots();
+    int mask = m_slot_cnt - 1;
+    record(table[idx].m_off)->m_slot = -1;
+    table[idx].m_off = -1;
+    m_stats.m_entries--;
+
+    for (int j = (idx + 1) & mask; table[j].m_off >= 0; j = (j + 1) & mask)
+    {
+        // 后继项的初始位置在(idx, j]之间时不能前移
+        int home = table[j].m_hash & mask;
+        bool stay = (idx <= j) ? ((idx < home) && (home <= j)) : ((idx < home) || (home <= j));
+        if (stay)
+        {
+            continue;
+        }
+
+        table[idx] = table[j];
+        record(table[idx].m_off)->m_slot = idx;
+        table[j].m_off = -1;
+        idx = j;
+    }
+}
+
+// 淘汰数据区中最早的记录
+void Crespcache::evict_tail()
+{
+    Crecord* rec = record(m_tail);
+    if (rec->m_slot >= 0)
+    {
+        remove_slot(rec->m_slot);
+        m_stats.m_evictions++;
+    }
+
+    m_tail += rec->m_len;
+    m_used -= rec->m_len;
+    if (m_used == 0)
+    {
+        m_head = m_tail = 0;
+        m_end = m_data_size;
+    }
+    else if (m_tail == m_end)
+    {
+        m_tail = 0;
+        m_end = m_data_size;
+    }
+}
+
+/**************************************************************
+ * 函数名称：Crespcache::alloc
+ * 函数功能：在数据区头部分配一段连续空间。末尾放不下时回绕到开头，
+ *          与尾部的记录重叠时从尾部淘汰，直到空间足够
+ * 输入参数：len    记录长度
+ * 输出参数：无
+ * 返 回 值：记录在数据区中的偏移
+ **************************************************************/
+long long Crespcache::alloc(int len)
+{
+    while (true)
+    {
+        bool wrapped = (m_used > 0) && (m_head <= m_tail);
+        if (!wrapped)
+        {
+            if (m_data_size - m_head >= len)
+            {
+                break;
+            }
+
+            if (m_tail == 0)
+            {
+                evict_tail();
+            }
+            else
+            {
+                m_end = m_head;
+                m_head = 0;
+            }
+        }
+        else if (m_tail - m_head >= len)
+        {
+            break;
+        }
+        else
+        {
+            evict_tail();
+        }
+    }
+
+    long long off = m_head;
+    m_head += len;
+    m_used += len;
+    return off;
+}
+
+/**************************************************************
+ * 函数名称：Crespcache::lookup
+ * 函数功能：查找键对应的应答，命中时拷贝出完整的应答：保存的头部，
+ *          加上Age和Connection头部、结束空行以及消息体。过期的应答删除
+ * 输入参数：key        方法、主机和路径组成的键
+ *           key_len    键的长度
+ *           conn       Connection头部的值
+ * 输出参数：len        应答的长度
+ * 返 回 值：用new[]分配的应答，调用者负责释放；未命中时返回NULL
+ **************************************************************/
+char* Crespcache::lookup(const char* key, int key_len, const char* conn, int& len)
+{
+    unsigned long long h = hash(key, key_len);
+    long long now = now_ms();
+
+    lock();
+    int idx = find(h, key, key_len);
+    if (idx < 0)
+    {
+        m_stats.m_misses++;
+        unlock();
+        return NULL;
+    }
+
+    Crecord* rec = record(slots()[idx].m_off);
+    if (now >= rec->m_expires_ms)
+    {
+        remove_slot(idx);
+        m_stats.m_expired++;
+        m_stats.m_misses++;
+        unlock();
+        return NULL;
+    }
+
+    char line[128];
+    int age = rec->m_age + (now - rec->m_stored_ms) / 1000;
+    int extra = snprintf(line, sizeof(line), "Age: %d\r\nConnection: %s\r\n\r\n", age, conn);
+    char* data = new (std::nothrow) char[rec->m_head_len + extra + rec->m_body_len];
+    if (!data)
+    {
+        unlock();
+        return NULL;
+    }
+
+    const char* src = (const char*)(rec + 1) + rec->m_key_len;
+    memcpy(data, src, rec->m_head_len);
+    memcpy(data + rec->m_head_len, line, extra);
+    memcpy(data + rec->m_head_len + extra, src + rec->m_head_len, rec->m_body_len);
+    len = rec->m_head_len + extra + rec->m_body_len;
+    m_stats.m_hits++;
+    unlock();
+    return data;
+}
+
+/**************************************************************
+ * 函数名称：Crespcache::store
+ * 函数功能：保存应答，替换同一个键的旧应答。索引过满或者数据区
+ *          空间不足时从尾部淘汰最早的记录
+ * 输入参数：key        方法、主机和路径组成的键
+ *           key_len    键的长度
+ *           head       去掉逐跳头部之后的应答头部，不含结束空行
+ *           head_len   头部长度
+ *           body       消息体
+ *           body_len   消息体长度
+ *           ttl        有效秒数
+ *           age        服务端给出的Age
+ * 输出参数：无
+ * 返 回 值：无
+ **************************************************************/
+void Crespcache::store(const char* key, int key_len, const char* head, int head_len, const char* body, int body_len,
+                       int ttl, int age)
+{
+    if ((ttl <= 0) || (key_len > MAX_KEY) || (head_len + body_len > m_max_object))
+    {
+        return;
+    }
+
+    unsigned long long h = hash(key, key_len);
+    int len = align_len(sizeof(Crecord) + key_len + head_len + body_len);
+    long long now = now_ms();
+
+    lock();
+    int idx = find(h, key, key_len);
+    if (idx >= 0)
+    {
+        remove_slot(idx);
+    }
+
+    while (m_stats.m_entries >= m_slot_cnt / 4 * 3)
+    {
+        evict_tail();
+    }
+
+    long long off = alloc(len);
+    Crecord* rec = record(off);
+    rec->m_len = len;
+    rec->m_key_len = key_len;
+    rec->m_head_len = head_len;
+    rec->m_body_len = body_len;
+    rec->m_age = age;
+    rec->m_stored_ms = now;
+    rec->m_expires_ms = now + ttl * 1000LL;
+    char* dst = (char*)(rec + 1);
+    memcpy(dst, key, key_len);
+    memcpy(dst + key_len, head, head_len);
+    memcpy(dst + key_len + head_len, body, body_len);
+
+    Cslot* table = slots();
+    int mask = m_slot_cnt - 1;
+    idx = h & mask;
+    while (table[idx].m_off >= 0)
+    {
+        idx = (idx + 1) & mask;
+    }
+
+    table[idx].m_hash = h;
+    table[idx].m_off = off;
+    rec->m_slot = idx;
+    m_stats.m_entries++;
+    m_stats.m_stores++;
+    unlock();
+}
+
+void Crespcache::get_stats(Ccachestats& stats)
+{
+    lock();
+    stats = m_stats;
+    stats.m_used = m_used;
+    unlock();
+}
@@ -0,0 +1,89 @@
+#ifndef __RESPCACHE_H_
+#define __RESPCACHE_H_
+
+// 七层代理的应答缓存：可以缓存的应答(Cache-Control: max-age)按"方法 主机 路径"保存在
+// 进程启动时创建的共享内存中，fork出的工作进程和同一进程中的工作线程共用一份缓存。
+// 数据区是一个环形日志，新应答追加在头部，空间不足时从尾部按写入顺序淘汰；
+// 索引是线性探测的哈希表，删除时向前移动后继项，不留墓碑
+#include "global.h"
+
+// 缓存统计，所有工作进程共享
+struct Ccachestats
+{
+    long long m_hits;
+    long long m_misses;
+    long long m_stores;
+    long long m_evictions;          // 因为空间不足被淘汰的应答数
+    long long m_expired;            // 查找时发现已经过期而删除的应答数
+    long long m_used;               // 数据区中已经使用的字节数
+    int m_entries;
+};
+
+class Crespcache
+{
+public:
+    static const int MAX_KEY = 1024;                // 键的最大长度
+    static const int MAX_OBJECT = 1024 * 1024;      // 单个应答(头部加消息体)的最大长度
+
+public:
+    static Crespcache* create(long long size);
+
+public:
+    int max_object() const { return m_max_object; }
+    char* lookup(const char* key, int key_len, const char* conn, int& len);
+    void store(const char* key, int key_len, const char* head, int head_len, const char* body, int body_len,
+               int ttl, int age);
+    void get_stats(Ccachestats& stats);
+
+private:
+    // 索引项
+    struct Cslot
+    {
+        unsigned long long m_hash;
+        long long m_off;            // 记录在数据区中的偏移，-1表示空闲
+    };
+
+    // 数据区中的记录，后面依次是键、头部(不含结束空行)和消息体
+    struct Crecord
+    {
+        int m_len;                  // 记录的总长度(按8字节对齐)
+        int m_slot;                 // 索引项下标，-1表示已经删除或者是环尾的填充
+        int m_key_len;
+        int m_head_len;
+        int m_body_len;
+        int m_age;                  // 存入时应答已有的Age
+        long long m_stored_ms;
+        long long m_expires_ms;
+    };
+
+private:
+    Crespcache() {}                 // 只能在共享内存中由create初始化
+
+private:
+    static long long now_ms();
+    static unsigned long long hash(const char* key, int key_len);
+    void lock();
+    void unlock() { pthread_mutex_unlock(&m_mutex); }
+    void clear();
+    Cslot* slots() { return (Cslot*)((char*)this + m_slot_off); }
+    Crecord* record(long long off) { return (Crecord*)((char*)this + m_data_off + off); }
+    int find(unsigned long long h, const char* key, int key_len);
+    void remove_slot(int idx);
+    void evict_tail();
+    long long alloc(int len);
+
+private:
+    pthread_mutex_t m_mutex;        // 进程间共享，持有者崩溃时由下一个加锁者清空缓存
+    long long m_slot_off;           // 索引相对于本对象的偏移
+    int m_slot_cnt;                 // 索引项数，2的幂
+    long long m_data_off;           // 数据区相对于本对象的偏移
+    long long m_data_size;
+    long long m_head;               // 下一条记录写入的位置
+    long long m_tail;               // 最早的记录的位置
+    long long m_end;                // 写入位置回绕后，数据区末尾有效数据的结束位置
+    long long m_used;               // 从m_tail到m_head已经使用的字节数
+    int m_max_object;
+    Ccachestats m_stats;
+};
+
+#endif
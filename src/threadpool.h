@@ -0,0 +1,411 @@
+#ifndef __THREADPOOL_H_
+#define __THREADPOOL_H_
+
+// 线程池：每个工作线程拥有独立的epoll事件循环和管理对象(服务端连接池)，
+// 逻辑服务器配置等只读数据在线程间共享，数据路径上不需要加锁
+#include "processpool.h"
+
+// 工作线程类
+class CThread
+{
+public:
+    CThread() : m_busy_ratio(0), m_alive(false), m_draining(false){}
+
+public:
+    pthread_t m_tid;        // 线程ID
+    int m_pipefd[2];        // 主线程与工作线程之间通信的管道，[0]由主线程使用，[1]由工作线程使用
+    int m_busy_ratio;       // 工作线程的繁忙程度(即负荷)，只由主线程读写
+    bool m_alive;           // 工作线程是否仍在运行
+    bool m_draining;        // 工作线程是否处于排空状态
+};
+
+// 线程池类
+template <typename C, typename H, typename M>
+class CThreadpool
+{
+private:
+    CThreadpool(int listenfd, int thread_number = 8);
+
+public:
+    static CThreadpool<C, H, M>* create(int listenfd, int thread_number = 8)
+    {
+        if (!m_instance)
+        {
+            m_instance = new CThreadpool<C, H, M>(listenfd, thread_number);
+        }
+
+        return m_instance;
+    }
+
+    ~CThreadpool()
+    {
+        for (int i = 0; i < m_thread_number; i++)
+        {
+            close(m_threads[i].m_pipefd[0]);
+        }
+
+        delete [] m_threads;
+        m_instance = NULL;
+    }
+
+    void run(const vector<H>& arg);
+    void set_drain_timeout(int seconds) { m_drain_timeout = seconds; }
+    void set_cpu_affinity(bool bind_cpu, bool bind_mem) { m_bind_cpu = bind_cpu; m_bind_mem = bind_mem; }
+    void set_io_budget(int budget) { m_io_budget = budget; }
+    void set_idle_timeout(int ms) { m_idle_timeout = ms; }
+
+private:
+    static void* worker(void* arg);
+    int get_most_free_thread();
+    void drain_main();
+    void run_main();
+    void stop_threads();
+    void run_worker(int idx);
+
+private:
+    static const int MAX_THREAD_NUMBER = 64;        // 线程池允许的最大工作线程数量
+    static const int MAX_EVENT_NUMBER = 10000;      // epoll最多监听的事件个数
+    static const int DRAIN_TIMEOUT = 30;            // 默认排空时限(秒)
+    static const int DRAIN_GRACE = 5;               // 主线程在排空时限之外额外等待的时间(秒)
+    int m_thread_number;                            // 线程池中的线程总数
+    int m_epollfd;                                  // 主线程的内核事件表描述符
+    int m_listenfd;                                 // 监听描述符
+    bool m_stop;                                    // 主线程通过m_stop决定是否停止
+    bool m_draining;                                // 主线程是否处于排空状态
+    int m_drain_timeout;                            // 排空时限(秒)，超时后强制退出
+    time_t m_drain_deadline;                        // 主线程的排空截止时间
+    bool m_bind_cpu;                                // 是否将工作线程绑定到固定的CPU
+    bool m_bind_mem;                                // 是否让工作线程优先使用本地NUMA节点的内存
+    int m_io_budget;                                // 每次读事件的读预算(字节)，小于0表示使用管理对象的默认值
+    int m_idle_timeout;                             // 会话空闲超时(毫秒)，不大于0表示不超时
+    const vector<H>* m_arg;                         // 逻辑服务器配置，所有工作线程只读共享
+    CThread* m_threads;                             // 工作线程组
+    static CThreadpool<C, H, M>* m_instance;        // 线程池静态实例
+};
+
+template<typename C, typename H, typename M>
+CThreadpool<C, H, M>* CThreadpool<C, H, M>::m_instance = NULL;
+
+/**************************************************************
+ * 函数名称：CThreadpool<C, H, M>::CThreadpool
+ * 函数功能：线程池构造函数。只创建主线程与工作线程之间的管道，
+ *          工作线程在run中创建
+ * 输入参数：int listenfd           监听描述符
+ *          int thread_number      要创建的工作线程的数量
+ * 输出参数：无
+ * 返 回 值：无
+ **************************************************************/
+template<typename C, typename H, typename M>
+CThreadpool<C, H, M>::CThreadpool(int listenfd, int thread_number)
+    : m_thread_number(thread_number), m_listenfd(listenfd), m_stop(false), m_draining(false),
+      m_drain_timeout(DRAIN_TIMEOUT), m_drain_deadline(0), m_bind_cpu(false), m_bind_mem(false), m_io_budget(-1), m_idle_timeout(0),
+      m_arg(NULL)
+{
+    assert((thread_number > 0) && (thread_number <= MAX_THREAD_NUMBER));
+
+    m_threads = new CThread[thread_number];
+    assert(m_threads);
+
+    // 工作线程循环接受连接直到EAGAIN，监听描述符必须是非阻塞的
+    setnonblocking(m_listenfd);
+
+    for (int i = 0; i < thread_number; i++)
+    {
+        int ret = socketpair(PF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, m_threads[i].m_pipefd);
+        assert(ret == 0);
+    }
+}
+
+// 工作线程入口函数，arg为线程编号
+template<typename C, typename H, typename M>
+void* CThreadpool<C, H, M>::worker(void* arg)
+{
+    m_instance->run_worker((int)(long)arg);
+    return NULL;
+}
+
+// 选取负荷最小的工作线程(跳过已经退出或者正在排空的线程)，没有可用线程时返回-1
+template<typename C, typename H, typename M>
+int CThreadpool<C, H, M>::get_most_free_thread()
+{
+    int ratio = 0;
+    int idx = -1;
+    for (int i = 0; i < m_thread_number; i++)
+    {
+        if (!m_threads[i].m_alive || m_threads[i].m_draining)
+        {
+            continue;
+        }
+
+        if ((idx == -1) || (m_threads[i].m_busy_ratio < ratio))
+        {
+            idx = i;
+            ratio = m_threads[i].m_busy_ratio;
+        }
+    }
+
+    return idx;
+}
+
+/**************************************************************
+ * 函数名称：CThreadpool<C, H, M>::run
+ * 函数功能：运行线程池。信号只由主线程处理：创建工作线程前屏蔽所有信号，
+ *          使工作线程继承屏蔽字，再在主线程中恢复。返回前所有工作线程
+ *          都已经退出，调用者可以销毁线程池
+ * 输入参数：const vector<H>& arg    逻辑服务器配置
+ * 输出参数：无
+ * 返 回 值：无
+ **************************************************************/
+template<typename C, typename H, typename M>
+void CThreadpool<C, H, M>::run(const vector<H>& arg)
+{
+    m_arg = &arg;
+
+    sigset_t all;
+    sigset_t old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    for (int i = 0; i < m_thread_number; i++)
+    {
+        if (pthread_create(&m_threads[i].m_tid, NULL, worker, (void*)(long)i) != 0)
+        {
+            printf("create thread %d failed\n", i);
+            close(m_threads[i].m_pipefd[1]);
+            continue;
+        }
+
+        m_threads[i].m_alive = true;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    run_main();
+    stop_threads();
+}
+
+// 主线程因为排空超时、再次收到终止信号或者出错而退出时，工作线程可能仍在运行：
+// 通知它们立即退出并等待它们结束
+template<typename C, typename H, typename M>
+void CThreadpool<C, H, M>::stop_threads()
+{
+    int cmd = CWorker<C, H, M>::CMD_STOP;
+    for (int i = 0; i < m_thread_number; i++)
+    {
+        if (m_threads[i].m_alive)
+        {
+            send(m_threads[i].m_pipefd[0], (char*)&cmd, sizeof(cmd), 0);
+        }
+    }
+
+    for (int i = 0; i < m_thread_number; i++)
+    {
+        if (m_threads[i].m_alive)
+        {
+            printf("thread %d join\n", i);
+            pthread_join(m_threads[i].m_tid, NULL);
+            m_threads[i].m_alive = false;
+        }
+    }
+}
+
+// 主线程进入排空状态，再次收到终止信号时立即退出
+template<typename C, typename H, typename M>
+void CThreadpool<C, H, M>::drain_main()
+{
+    if (m_draining)
+    {
+        printf("stop all the threads now\n");
+        m_stop = true;
+        return;
+    }
+
+    printf("drain all the threads now, timeout %ds\n", m_drain_timeout);
+    m_draining = true;
+    m_drain_deadline = Cclock::now_sec() + m_drain_timeout + DRAIN_GRACE;
+    closefd(m_epollfd, m_listenfd);
+
+    int cmd = CWorker<C, H, M>::CMD_DRAIN;
+    for (int i = 0; i < m_thread_number; i++)
+    {
+        if (m_threads[i].m_alive)
+        {
+            m_threads[i].m_draining = true;
+            send(m_threads[i].m_pipefd[0], (char*)&cmd, sizeof(cmd), 0);
+        }
+    }
+}
+
+// 运行主线程：分发新连接、处理信号、收集工作线程的负载
+template<typename C, typename H, typename M>
+void CThreadpool<C, H, M>::run_main()
+{
+    m_epollfd = epoll_create(5);
+    assert(m_epollfd != -1);
+
+    int ret = socketpair(PF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sig_pipdfd);
+    assert(ret != -1);
+
+    add_read_fd(m_epollfd, sig_pipdfd[0]);
+
+    addsig(SIGTERM, sig_handler);
+    addsig(SIGINT, sig_handler);
+    addsig(SIGPIPE, SIG_IGN);
+
+    for (int i = 0; i < m_thread_number; i++)
+    {
+        if (m_threads[i].m_alive)
+        {
+            add_read_fd(m_epollfd, m_threads[i].m_pipefd[0]);
+        }
+    }
+
+    add_read_fd(m_epollfd, m_listenfd);
+
+    struct epoll_event events[MAX_EVENT_NUMBER];
+    int new_conn = CWorker<C, H, M>::CMD_NEW_CONN;
+    int number = 0;
+
+    while (!m_stop)
+    {
+        number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, EPOLL_WAIT_TIME);
+        if ((number < 0) && (errno != EINTR))
+        {
+            printf("epoll failed\n");
+            break;
+        }
+
+        Cclock::update();
+
+        if (m_draining && (Cclock::now_sec() >= m_drain_deadline))
+        {
+            printf("drain timeout, stop all the threads now\n");
+            break;
+        }
+
+        for (int i = 0; i < number; i++)
+        {
+            int sockfd = events[i].data.fd;
+            if (sockfd == m_listenfd)
+            {
+                int idx = get_most_free_thread();
+                if (idx < 0)
+                {
+                    continue;
+                }
+
+                send(m_threads[idx].m_pipefd[0], (char*)&new_conn, sizeof(new_conn), 0);
+            }
+            else if ((sockfd == sig_pipdfd[0]) && (events[i].events & EPOLLIN))
+            {
+                char signals[1024];
+                ret = recv(sig_pipdfd[0], signals, sizeof(signals), 0);
+                for (int j = 0; j < ret; j++)
+                {
+                    if ((signals[j] == SIGTERM) || (signals[j] == SIGINT))
+                    {
+                        drain_main();
+                    }
+                }
+            }
+            else if (events[i].events & EPOLLIN)
+            {
+                int idx = -1;
+                for (int j = 0; j < m_thread_number; j++)
+                {
+                    if (sockfd == m_threads[j].m_pipefd[0])
+                    {
+                        idx = j;
+                        break;
+                    }
+                }
+
+                if (idx < 0)
+                {
+                    continue;
+                }
+
+                // 工作线程退出时关闭自己一端的管道，主线程读到0字节
+                CLoad load;
+                bool closed = false;
+                while (true)
+                {
+                    ret = recv(sockfd, (char*)&load, sizeof(load), 0);
+                    if (ret == sizeof(load))
+                    {
+                        if (m_threads[idx].m_draining && (m_threads[idx].m_busy_ratio != load.m_conns))
+                        {
+                            printf("thread %d draining, %d conns left\n", idx, load.m_conns);
+                        }
+
+                        m_threads[idx].m_busy_ratio = load.m_conns;
+                        continue;
+                    }
+
+                    closed = (ret == 0) || ((ret < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK));
+                    break;
+                }
+
+                if (closed)
+                {
+                    printf("thread %d join\n", idx);
+                    pthread_join(m_threads[idx].m_tid, NULL);
+
+                    // 管道描述符由析构函数关闭，这里只从内核事件表中删除
+                    closefd(m_epollfd, sockfd);
+                    m_threads[idx].m_alive = false;
+
+                    m_stop = true;
+                    for (int j = 0; j < m_thread_number; j++)
+                    {
+                        if (m_threads[j].m_alive)
+                        {
+                            m_stop = false;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    close(sig_pipdfd[0]);
+    close(sig_pipdfd[1]);
+    close(m_epollfd);
+}
+
+/**************************************************************
+ * 函数名称：CThreadpool<C, H, M>::run_worker
+ * 函数功能：运行第idx个工作线程。事件循环由CWorker运行，与子进程相同，
+ *          只是不处理信号，排空和退出通知来自主线程
+ * 输入参数：int idx                工作线程编号
+ * 输出参数：无
+ * 返 回 值：无
+ **************************************************************/
+template<typename C, typename H, typename M>
+void CThreadpool<C, H, M>::run_worker(int idx)
+{
+    int cpu = -1;
+    if (m_bind_cpu)
+    {
+        cpu = bind_cpu(idx);
+        if ((cpu >= 0) && m_bind_mem)
+        {
+            bind_local_mem(cpu);
+        }
+
+        printf("thread %d bound to cpu %d\n", idx, cpu);
+    }
+
+    int pipefd = m_threads[idx].m_pipefd[1];
+    CWorker<C, H, M> worker("thread", idx, pipefd, m_listenfd);
+    worker.set_drain_timeout(m_drain_timeout);
+    worker.set_io_budget(m_io_budget);
+    worker.set_idle_timeout(m_idle_timeout);
+    worker.set_cpu(cpu);
+    worker.run((*m_arg)[idx % m_arg->size()], NULL, NULL);
+
+    // 关闭管道使主线程读到0字节，得知工作线程退出
+    close(pipefd);
+}
+
+#endif
+
@@ -0,0 +1,333 @@
+/*********************************************************************************
+ * File Name: timer.cpp
+ * Description: 定时器容器：四叉堆和分层时间轮
+ * History:
+ *********************************************************************************/
+
+#include "timer.h"
+
+Ctimer_queue* Ctimer_queue::create(TIMER_TYPE type, long long now)
+{
+    if (type == TIMER_WHEEL)
+    {
+        return new Ctimer_wheel(now);
+    }
+
+    return new Ctimer_heap;
+}
+
+void Ctimer_heap::add(Ctimer * timer, long long expire)
+{
+    if (timer->pending())
+    {
+        adjust(timer, expire);
+        return;
+    }
+
+    timer->m_expire = expire;
+    timer->m_index = m_heap.size();
+    m_heap.push_back(timer);
+    m_size = m_heap.size();
+    sift_up(timer->m_index);
+}
+
+// 用最后一个元素填补被删除的位置，再根据它与原位置的大小关系上移或下移
+void Ctimer_heap::cancel(Ctimer * timer)
+{
+    if (!timer->pending())
+    {
+        return;
+    }
+
+    int idx = timer->m_index;
+    Ctimer* last = m_heap.back();
+    m_heap.pop_back();
+    m_size = m_heap.size();
+    timer->m_index = -1;
+    if (last == timer)
+    {
+        return;
+    }
+
+    m_heap[idx] = last;
+    last->m_index = idx;
+    if ((idx > 0) && (last->m_expire < m_heap[(idx - 1) / ARITY]->m_expire))
+    {
+        sift_up(idx);
+    }
+    else
+    {
+        sift_down(idx);
+    }
+}
+
+void Ctimer_heap::adjust(Ctimer * timer, long long expire)
+{
+    if (!timer->pending())
+    {
+        add(timer, expire);
+        return;
+    }
+
+    long long old = timer->m_expire;
+    timer->m_expire = expire;
+    if (expire < old)
+    {
+        sift_up(timer->m_index);
+    }
+    else if (expire > old)
+    {
+        sift_down(timer->m_index);
+    }
+}
+
+int Ctimer_heap::expire(long long now)
+{
+    int cnt = 0;
+    while (!m_heap.empty() && (m_heap[0]->m_expire <= now))
+    {
+        Ctimer* timer = m_heap[0];
+        cancel(timer);
+        timer->m_func(timer->m_owner, timer->m_data);
+        cnt++;
+    }
+
+    return cnt;
+}
+
+long long Ctimer_heap::next_expire()
+{
+    return m_heap.empty() ? -1 : m_heap[0]->m_expire;
+}
+
+// 上移：父结点依次下移填补空位，最后把定时器放入空位
+void Ctimer_heap::sift_up(int idx)
+{
+    Ctimer* timer = m_heap[idx];
+    while (idx > 0)
+    {
+        int parent = (idx - 1) / ARITY;
+        if (m_heap[parent]->m_expire <= timer->m_expire)
+        {
+            break;
+        }
+
+        m_heap[idx] = m_heap[parent];
+        m_heap[idx]->m_index = idx;
+        idx = parent;
+    }
+
+    m_heap[idx] = timer;
+    timer->m_index = idx;
+}
+
+// 下移：每层从四个子结点中选出最早到期的一个上移
+void Ctimer_heap::sift_down(int idx)
+{
+    Ctimer* timer = m_heap[idx];
+    int size = m_heap.size();
+    while (true)
+    {
+        int first = idx * ARITY + 1;
+        if (first >= size)
+        {
+            break;
+        }
+
+        int last = (first + ARITY < size) ? (first + ARITY) : size;
+        int child = first;
+        for (int i = first + 1; i < last; i++)
+        {
+            if (m_heap[i]->m_expire < m_heap[child]->m_expire)
+            {
+                child = i;
+            }
+        }
+
+        if (m_heap[child]->m_expire >= timer->m_expire)
+        {
+            break;
+        }
+
+        m_heap[idx] = m_heap[child];
+        m_heap[idx]->m_index = idx;
+        idx = child;
+    }
+
+    m_heap[idx] = timer;
+    timer->m_index = idx;
+}
+
+Ctimer_wheel::Ctimer_wheel(long long now) : m_now(now)
+{
+    memset(m_slots, 0, sizeof(m_slots));
+}
+
+/**************************************************************
+ * 函数名称：Ctimer_wheel::link
+ * 函数功能：按到期时间与当前时间的距离把定时器放入对应层的槽中。
+ *          第level层放距离小于256^(level+1)的定时器，槽号取到期时间
+ *          的第level个8位。已经过期的定时器放入当前槽，超出最高层
+ *          范围的放入最高层最远的槽，转到时再重新分配
+ * 输入参数：timer      定时器
+ * 输出参数：无
+ * 返 回 值：无
+ **************************************************************/
+void Ctimer_wheel::link(Ctimer * timer)
+{
+    long long expire = (timer->m_expire < m_now) ? m_now : timer->m_expire;
+    long long delta = expire - m_now;
+    long long range = 1LL << (SLOT_BITS * LEVELS);
+    if (delta >= range)
+    {
+        expire = m_now + range - 1;
+        delta = range - 1;
+    }
+
+    int level = 0;
+    while ((level < LEVELS - 1) && (delta >= (1LL << (SLOT_BITS * (level + 1)))))
+    {
+        level++;
+    }
+
+    int slot = (expire >> (SLOT_BITS * level)) & (SLOTS - 1);
+    Ctimer** head = &m_slots[level][slot];
+    timer->m_next = *head;
+    if (*head)
+    {
+        (*head)->m_pprev = &timer->m_next;
+    }
+
+    *head = timer;
+    timer->m_pprev = head;
+    timer->m_index = level * SLOTS + slot;
+}
+
+void Ctimer_wheel::unlink(Ctimer * timer)
+{
+    *timer->m_pprev = timer->m_next;
+    if (timer->m_next)
+    {
+        timer->m_next->m_pprev = timer->m_pprev;
+    }
+
+    timer->m_next = NULL;
+    timer->m_pprev = NULL;
+    timer->m_index = -1;
+}
+
+void Ctimer_wheel::add(Ctimer * timer, long long expire)
+{
+    if (timer->pending())
+    {
+        adjust(timer, expire);
+        return;
+    }
+
+    timer->m_expire = expire;
+    link(timer);
+    m_size++;
+}
+
+void Ctimer_wheel::cancel(Ctimer * timer)
+{
+    if (timer->pending())
+    {
+        unlink(timer);
+        m_size--;
+    }
+}
+
+void Ctimer_wheel::adjust(Ctimer * timer, long long expire)
+{
+    if (!timer->pending())
+    {
+        add(timer, expire);
+        return;
+    }
+
+    unlink(timer);
+    timer->m_expire = expire;
+    link(timer);
+}
+
+// 最低层转完一圈：把上层当前槽中的定时器重新分配到下层，上层也转完一圈时继续向上
+void Ctimer_wheel::cascade()
+{
+    for (int level = 1; level < LEVELS; level++)
+    {
+        int slot = (m_now >> (SLOT_BITS * level)) & (SLOTS - 1);
+        Ctimer* timer = m_slots[level][slot];
+        m_slots[level][slot] = NULL;
+        while (timer)
+        {
+            Ctimer* next = timer->m_next;
+            link(timer);
+            timer = next;
+        }
+
+        if (slot != 0)
+        {
+            break;
+        }
+    }
+}
+
+/**************************************************************
+ * 函数名称：Ctimer_wheel::expire
+ * 函数功能：逐个时间单位推进时间轮直到now，执行经过的槽中的定时器。
+ *          时间轮为空时直接跳到now，不再逐个推进
+ * 输入参数：now        当前时间
+ * 输出参数：无
+ * 返 回 值：执行的定时器个数
+ **************************************************************/
+int Ctimer_wheel::expire(long long now)
+{
+    int cnt = 0;
+    while ((m_size > 0) && (m_now <= now))
+    {
+        if ((m_now & (SLOTS - 1)) == 0)
+        {
+            cascade();
+        }
+
+        Ctimer** head = &m_slots[0][m_now & (SLOTS - 1)];
+        while (*head)
+        {
+            Ctimer* timer = *head;
+            unlink(timer);
+            m_size--;
+            timer->m_func(timer->m_owner, timer->m_data);
+            cnt++;
+        }
+
+        m_now++;
+    }
+
+    if ((m_size == 0) && (m_now <= now))
+    {
+        m_now = now + 1;
+    }
+
+    return cnt;
+}
+
+// 在最低层查找下一个非空的槽，遇到需要从上层重新分配的位置时返回该位置
+long long Ctimer_wheel::next_expire()
+{
+    if (m_size == 0)
+    {
+        return -1;
+    }
+
+    long long when = m_now;
+    while (true)
+    {
+        if (((when & (SLOTS - 1)) == 0) || m_slots[0][when & (SLOTS - 1)])
+        {
+            return when;
+        }
+
+        when++;
+    }
+}
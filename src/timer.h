@@ -0,0 +1,124 @@
+#ifndef __TIMER_H_
+#define __TIMER_H_
+
+// 定时器容器的公共接口。定时器由使用者嵌入到自己的会话对象中，容器只保存指针，
+// 添加、取消和重新调度都不分配内存。到期时间是绝对时间，单位由使用者决定
+// (负载均衡器使用单调时钟的毫秒数)。两种实现可以互相替换：四叉堆的添加和调整
+// 为O(log n)，能给出精确的最早到期时间；分层时间轮的各项操作都是O(1)，适合
+// 大量连接频繁刷新空闲超时的场景
+#include <vector>
+#include "global.h"
+
+typedef void (*TIMER_FUNC)(void* owner, void* data);
+
+class Ctimer
+{
+public:
+    Ctimer() : m_expire(0), m_index(-1), m_next(NULL), m_pprev(NULL), m_func(NULL), m_owner(NULL), m_data(NULL) {}
+
+public:
+    // 设置回调函数：到期时调用func(owner, data)，owner通常是管理对象，data是会话
+    void init(TIMER_FUNC func, void* owner, void* data)
+    {
+        m_func = func;
+        m_owner = owner;
+        m_data = data;
+    }
+
+    bool pending() const { return m_index >= 0; }
+
+public:
+    long long m_expire;             // 到期时间
+    int m_index;                    // 在容器中的位置：堆中的下标或时间轮的槽号，-1表示不在容器中
+    Ctimer* m_next;                 // 时间轮同一个槽中的下一个定时器
+    Ctimer** m_pprev;               // 指向前一个定时器的m_next或者槽头，删除时无需区分是否为头结点
+    TIMER_FUNC m_func;
+    void* m_owner;
+    void* m_data;
+};
+
+enum TIMER_TYPE
+{
+    TIMER_HEAP = 0,
+    TIMER_WHEEL
+};
+
+class Ctimer_queue
+{
+public:
+    Ctimer_queue() : m_size(0) {}
+    virtual ~Ctimer_queue() {}
+
+public:
+    // 创建定时器容器，now为当前时间，时间轮从这里开始转动
+    static Ctimer_queue* create(TIMER_TYPE type, long long now);
+
+public:
+    // 添加定时器，已在容器中时等同于adjust
+    virtual void add(Ctimer* timer, long long expire) = 0;
+    // 取消定时器，不在容器中时什么也不做
+    virtual void cancel(Ctimer* timer) = 0;
+    // 修改到期时间，可以提前也可以推迟
+    virtual void adjust(Ctimer* timer, long long expire) = 0;
+    // 取出并执行到期时间不晚于now的定时器，返回执行的个数。回调中可以添加或取消定时器
+    virtual int expire(long long now) = 0;
+    // 最早到期时间的下界，在此之前调用expire不会有定时器到期。没有定时器时返回-1
+    virtual long long next_expire() = 0;
+
+    int size() const { return m_size; }
+
+protected:
+    int m_size;
+};
+
+// 四叉堆：比二叉堆层数少一半，一个结点的子结点在数组中相邻
+class Ctimer_heap : public Ctimer_queue
+{
+public:
+    void add(Ctimer* timer, long long expire);
+    void cancel(Ctimer* timer);
+    void adjust(Ctimer* timer, long long expire);
+    int expire(long long now);
+    long long next_expire();
+
+private:
+    static const int ARITY = 4;
+
+private:
+    void sift_up(int idx);
+    void sift_down(int idx);
+
+private:
+    std::vector<Ctimer*> m_heap;
+};
+
+// 分层时间轮：四层，每层256个槽，最低层一个槽为一个时间单位，每层的一个槽覆盖下一层的一整圈。
+// 定时器按与当前时间的距离放入对应的层，最低层转完一圈时把上层当前槽中的定时器重新分配到下层
+class Ctimer_wheel : public Ctimer_queue
+{
+public:
+    Ctimer_wheel(long long now);
+
+public:
+    void add(Ctimer* timer, long long expire);
+    void cancel(Ctimer* timer);
+    void adjust(Ctimer* timer, long long expire);
+    int expire(long long now);
+    long long next_expire();
+
+private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 8;
+    static const int SLOTS = 1 << SLOT_BITS;
+
+private:
+    void link(Ctimer* timer);
+    void unlink(Ctimer* timer);
+    void cascade();
+
+private:
+    Ctimer* m_slots[LEVELS][SLOTS];
+    long long m_now;                // 下一个待处理的时间单位，之前的定时器都已经到期
+};
+
+#endif
@@ -0,0 +1,362 @@
+#ifndef __WORKER_H_
+#define __WORKER_H_
+
+// 工作者事件循环：进程池的子进程和线程池的工作线程共用。每个事件循环拥有独立的内核事件表和
+// 管理对象，通过管道接收调度方(父进程或主线程)的命令，并定期上报负载。两种池只在如何启动
+// 和监管事件循环上不同
+#include "global.h"
+#include "fdwrapper.h"
+#include "affinity.h"
+#include "clock.h"
+
+// 工作者向调度方上报的负载信息
+struct CLoad
+{
+    int m_conns;            // 正在使用的连接数
+    int m_loop_util;        // 事件循环利用率(百分比)：非阻塞在epoll_wait上的时间占比
+    int m_conn_util;        // 连接利用率(百分比)：正在使用的服务端连接占全部服务端连接的比例，
+                            // 连接池为空(后端不可用或者连接全部失败)时为CONN_UTIL_NONE
+};
+
+static const int CONN_UTIL_NONE = -1;           // 没有服务端连接，连接利用率无意义
+
+static int EPOLL_WAIT_TIME = 500;               // epoll_wait函数的超时值
+
+// 工作者类
+template <typename C, typename H, typename M>
+class CWorker
+{
+public:
+    // 每轮事件循环调用一次，处理事件循环之外的控制事件(如子进程收到的信号)，返回true时退出事件循环
+    typedef bool (*STOP_FUNC)(void* owner, CWorker<C, H, M>* worker);
+
+    static const int CMD_NEW_CONN = 1;              // 调度方通知工作者：有新连接到来
+    static const int CMD_DRAIN = -1;                // 调度方通知工作者：进入排空状态
+    static const int CMD_STOP = -2;                 // 调度方通知工作者：立即退出
+
+public:
+    CWorker(const char* name, int idx, int pipefd, int listenfd)
+        : m_name(name), m_idx(idx), m_pipefd(pipefd), m_listenfd(listenfd), m_epollfd(-1), m_manager(NULL),
+          m_stop(false), m_draining(false), m_drain_timeout(0), m_drain_deadline(0), m_drain_left(-1), m_io_budget(-1),
+          m_idle_timeout(0), m_cpu(-1), m_local_conns(0), m_remote_conns(0), m_loop_util(0), m_accept_pending(false){}
+
+    void set_drain_timeout(int seconds) { m_drain_timeout = seconds; }
+    void set_io_budget(int budget) { m_io_budget = budget; }
+    void set_idle_timeout(int ms) { m_idle_timeout = ms; }
+    void set_cpu(int cpu) { m_cpu = cpu; }
+    M* get_manager() { return m_manager; }
+
+    void run(const H& srv, STOP_FUNC stop, void* owner);
+    void drain();
+
+private:
+    void loop(STOP_FUNC stop, void* owner);
+    void process_cmds();
+    bool accept_conns();
+    void notify_busy_ratio();
+
+private:
+    static const int MAX_EVENT_NUMBER = 10000;      // epoll最多监听的事件个数
+    static const int ACCEPT_BATCH = 64;             // 每轮事件循环最多接受的连接数
+    static const int LOAD_REPORT_INTERVAL = 1000;   // 上报负载的间隔(毫秒)
+    const char* m_name;                             // 工作者的名称("child"或者"thread")，用于日志
+    int m_idx;                                      // 工作者编号
+    int m_pipefd;                                   // 与调度方通信的管道
+    int m_listenfd;                                 // 监听描述符
+    int m_epollfd;                                  // 内核事件表描述符
+    M* m_manager;                                   // 管理对象
+    bool m_stop;                                    // 是否退出事件循环
+    bool m_draining;                                // 是否处于排空状态
+    int m_drain_timeout;                            // 排空时限(秒)，超时后强制退出
+    time_t m_drain_deadline;                        // 排空截止时间
+    int m_drain_left;                               // 最近一次上报的排空剩余连接数
+    int m_io_budget;                                // 每次读事件的读预算(字节)，小于0表示使用管理对象的默认值
+    int m_idle_timeout;                             // 会话空闲超时(毫秒)，不大于0表示不超时
+    int m_cpu;                                      // 工作者绑定的CPU，未绑定为-1
+    int m_local_conns;                              // 数据包由本工作者所在CPU处理的连接数
+    int m_remote_conns;                             // 数据包由其他CPU处理的连接数
+    int m_loop_util;                                // 最近一个统计周期的事件循环利用率
+    bool m_accept_pending;                          // 监听队列中可能还有本轮没有接受完的连接
+};
+
+/**************************************************************
+ * 函数名称：CWorker<C, H, M>::run
+ * 函数功能：运行工作者。创建内核事件表和管理对象，运行事件循环直到
+ *          收到退出命令、排空结束或者stop返回true，然后打印统计信息
+ *          并销毁管理对象。管道由调用者关闭
+ * 输入参数：const H& srv           逻辑服务器配置
+ *          STOP_FUNC stop         每轮事件循环调用的回调，可以为NULL
+ *          void* owner            回调的第一个参数
+ * 输出参数：无
+ * 返 回 值：无
+ **************************************************************/
+template<typename C, typename H, typename M>
+void CWorker<C, H, M>::run(const H& srv, STOP_FUNC stop, void* owner)
+{
+    m_epollfd = epoll_create(5);
+    assert(m_epollfd != -1);
+
+    add_read_fd(m_epollfd, m_pipefd);
+
+    m_manager = new M(m_epollfd, srv);
+    assert(m_manager);
+    if (m_io_budget >= 0)
+    {
+        m_manager->set_io_budget(m_io_budget);
+    }
+
+    m_manager->set_idle_timeout(m_idle_timeout);
+    m_manager->expire_timers(Cclock::update());
+
+    loop(stop, owner);
+
+    m_manager->print_stats(m_name, m_idx);
+    if (m_cpu >= 0)
+    {
+        printf("%s %d on cpu %d: %d conns local, %d conns remote\n", m_name, m_idx, m_cpu, m_local_conns, m_remote_conns);
+    }
+
+    delete m_manager;
+    m_manager = NULL;
+    close(m_epollfd);
+}
+
+// 进入排空状态：不再接受新连接，已有会话结束或者超过排空时限后退出。重复的排空请求被忽略
+template<typename C, typename H, typename M>
+void CWorker<C, H, M>::drain()
+{
+    if (m_draining)
+    {
+        return;
+    }
+
+    m_draining = true;
+    m_drain_deadline = Cclock::now_sec() + m_drain_timeout;
+    m_manager->drain();
+}
+
+// 事件循环
+template<typename C, typename H, typename M>
+void CWorker<C, H, M>::loop(STOP_FUNC stop, void* owner)
+{
+    struct epoll_event* events = new epoll_event[MAX_EVENT_NUMBER];
+    long long window_start = Cclock::now_ms();
+    long long idle_ms = 0;
+
+    while (!m_stop)
+    {
+        // 就绪队列中还有待读的连接或者还有待接受的连接时不能阻塞，否则最多等到下一个会话空闲超时。
+        // 每轮只在等待前后读时钟，处理事件时定时器和统计都读取缓存的时间
+        long long wait_start = Cclock::update();
+        bool busy = m_manager->has_ready() || m_accept_pending;
+        int timeout = busy ? 0 : m_manager->next_timeout();
+        timeout = ((timeout < 0) || (timeout > EPOLL_WAIT_TIME)) ? EPOLL_WAIT_TIME : timeout;
+        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, timeout);
+        if ((number < 0) && (errno != EINTR))
+        {
+            printf("epoll failed\n");
+            break;
+        }
+
+        // 统计事件循环利用率，并定期向调度方上报负载
+        long long now = Cclock::update();
+        idle_ms += now - wait_start;
+        if (now - window_start >= LOAD_REPORT_INTERVAL)
+        {
+            m_loop_util = (int)(100 - idle_ms * 100 / (now - window_start));
+            window_start = now;
+            idle_ms = 0;
+            notify_busy_ratio();
+        }
+
+        if (stop && stop(owner, this))
+        {
+            break;
+        }
+
+        if (m_manager->expire_timers(now) > 0)
+        {
+            notify_busy_ratio();
+        }
+
+        // 排空阶段：所有会话结束或者超过排空时限后退出，并向调度方报告排空进度
+        if (m_draining)
+        {
+            int left = m_manager->get_used_conn_cnt();
+            if (left != m_drain_left)
+            {
+                notify_busy_ratio();
+                m_drain_left = left;
+            }
+
+            if ((left == 0) || (Cclock::now_sec() >= m_drain_deadline))
+            {
+                printf("%s %d drained, %d conns left\n", m_name, m_idx, left);
+                break;
+            }
+        }
+
+        if ((number == 0) && !busy)
+        {
+            m_manager->recycle_conns();
+            continue;
+        }
+
+        for (int i = 0; i < number; i++)
+        {
+            int sockfd = events[i].data.fd;
+            if (sockfd == m_pipefd)
+            {
+                if (events[i].events & EPOLLIN)
+                {
+                    process_cmds();
+                }
+            }
+            else
+            {
+                // 边沿触发下可读和可写可能在同一个事件中报告，两者都要处理，否则丢失的边沿不会再次出现
+                RET_CODE result = OK;
+                if (events[i].events & EPOLLIN)
+                {
+                    result = m_manager->process(sockfd, READ);
+                }
+
+                if ((result != CLOSED) && (events[i].events & EPOLLOUT))
+                {
+                    result = m_manager->process(sockfd, WRITE);
+                }
+
+                if (result == CLOSED)
+                {
+                    notify_busy_ratio();
+                }
+            }
+        }
+
+        // 为上一轮预算用完的连接继续读取数据
+        if (m_manager->process_ready() > 0)
+        {
+            notify_busy_ratio();
+        }
+
+        if (m_accept_pending && !m_stop)
+        {
+            m_accept_pending = !m_draining && accept_conns();
+        }
+
+        m_manager->flush_events();
+    }
+
+    delete [] events;
+}
+
+// 边沿触发：一次读完调度方积压的所有命令。调度方的监听描述符也是边沿触发的，
+// 一次新连接通知可能对应多个连接，连接统一由accept_conns接受到监听队列为空
+template<typename C, typename H, typename M>
+void CWorker<C, H, M>::process_cmds()
+{
+    int cmd = 0;
+    while (recv(m_pipefd, (char*)&cmd, sizeof(cmd), 0) == sizeof(cmd))
+    {
+        if (cmd == CMD_STOP)
+        {
+            m_stop = true;
+            return;
+        }
+
+        if (cmd == CMD_DRAIN)
+        {
+            drain();
+            continue;
+        }
+
+        // 排空阶段不再接受新连接，留给其他工作者处理
+        m_accept_pending = !m_draining;
+    }
+}
+
+/**************************************************************
+ * 函数名称：CWorker<C, H, M>::accept_conns
+ * 函数功能：接受监听队列中的连接，每轮事件循环最多ACCEPT_BATCH个，
+ *          避免连接风暴时已有会话长时间得不到处理。accept4直接返回
+ *          非阻塞的描述符，整批连接只向调度方报告一次负载
+ * 输入参数：无
+ * 输出参数：无
+ * 返 回 值：本批用完时返回true，表示监听队列中可能还有连接
+ **************************************************************/
+template<typename C, typename H, typename M>
+bool CWorker<C, H, M>::accept_conns()
+{
+    bool more = true;
+    int accepted = 0;
+    for (int n = 0; n < ACCEPT_BATCH; n++)
+    {
+        struct sockaddr_in clnt_addr;
+        socklen_t clnt_addr_len = sizeof(clnt_addr);
+        int connfd = accept4(m_listenfd, (struct sockaddr*)&clnt_addr, &clnt_addr_len, SOCK_NONBLOCK);
+        if (connfd < 0)
+        {
+            if ((errno == EINTR) || (errno == ECONNABORTED))
+            {
+                continue;
+            }
+
+            // 队列为空(EAGAIN)，或者描述符耗尽等错误，等待调度方的下一次通知
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+            {
+                printf("errno is %d\n", errno);
+            }
+
+            more = false;
+            break;
+        }
+
+        // 统计连接的数据包是否由本工作者绑定的CPU处理
+        if (m_cpu >= 0)
+        {
+            if (incoming_cpu(connfd) == m_cpu)
+            {
+                m_local_conns++;
+            }
+            else
+            {
+                m_remote_conns++;
+            }
+        }
+
+        // 客户端描述符由pick_conn注册到内核事件表
+        C* conn = m_manager->pick_conn(connfd);
+        if (!conn)
+        {
+            close(connfd);
+            continue;
+        }
+
+        conn->init_clt(connfd, clnt_addr);
+        accepted++;
+    }
+
+    if (accepted > 0)
+    {
+        notify_busy_ratio();
+    }
+
+    return more;
+}
+
+// 向调度方报告繁忙程度
+template<typename C, typename H, typename M>
+void CWorker<C, H, M>::notify_busy_ratio()
+{
+    CLoad msg;
+    msg.m_conns = m_manager->get_used_conn_cnt();
+    msg.m_loop_util = m_loop_util;
+
+    // 每个会话在m_used中占两项(客户端和服务端描述符)
+    int sessions = msg.m_conns / 2;
+    int total = sessions + m_manager->get_idle_conn_cnt();
+    msg.m_conn_util = (total > 0) ? (sessions * 100 / total) : CONN_UTIL_NONE;
+    send(m_pipefd, (char*)&msg, sizeof(msg), 0);
+}
+
+#endif